@@ -0,0 +1,111 @@
+#ifndef __LITEWS_HOST_MINIZ_H__
+#define __LITEWS_HOST_MINIZ_H__ 1
+
+// 'tinfl' as litews_deflate.c uses it from the ESP32 ROM, over zlib raw inflate,
+// for hosts without the miniz library, see host/CMakeLists.txt
+
+#include <string.h>
+#include <stdint.h>
+#include <zlib.h>
+
+typedef unsigned char mz_uint8;
+typedef uint32_t mz_uint32;
+
+enum 
+{
+    TINFL_FLAG_PARSE_ZLIB_HEADER = 1,
+    TINFL_FLAG_HAS_MORE_INPUT = 2,
+    TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF = 4,
+    TINFL_FLAG_COMPUTE_ADLER32 = 8
+};
+
+typedef enum 
+{
+    TINFL_STATUS_BAD_PARAM = -3,
+    TINFL_STATUS_ADLER32_MISMATCH = -2,
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2
+} tinfl_status;
+
+// zlib allocates its state and 32 KB window from 'arena', the decompressor is freed
+// by litews_free like the ROM one, without a call back into this file
+#define LITEWS_HOST_TINFL_ARENA (48 * 1024)
+
+typedef struct tinfl_decompressor_tag 
+{
+    mz_uint32 m_state; // 0 - zlib starts over with the next call
+    z_stream z;
+    size_t arena_used;
+    unsigned char arena[LITEWS_HOST_TINFL_ARENA];
+} tinfl_decompressor;
+
+#define tinfl_init(r) do { (r)->m_state = 0; } while (0)
+
+static voidpf litews_host_tinfl_alloc(voidpf opaque, uInt items, uInt size) 
+{
+    tinfl_decompressor * r = (tinfl_decompressor *)opaque;
+    const size_t len = ((size_t)items * size + 15) & ~(size_t)15;
+
+    if (len > LITEWS_HOST_TINFL_ARENA - r->arena_used) 
+    {
+        return Z_NULL;
+    }
+    r->arena_used += len;
+    return r->arena + r->arena_used - len;
+}
+
+static void litews_host_tinfl_free(voidpf opaque, voidpf address) 
+{
+    (void)opaque;
+    (void)address; // the arena goes with the decompressor
+}
+
+static tinfl_status tinfl_decompress(tinfl_decompressor * r, const mz_uint8 * in, size_t * in_size,
+                                     mz_uint8 * out_start, mz_uint8 * out_next, size_t * out_size, const mz_uint32 flags) 
+{
+    const size_t window = (size_t)(out_next - out_start) + *out_size;
+    int ret = Z_OK;
+
+    (void)flags; // raw deflate into a circular window, as litews_deflate.c asks for
+    if ((window & (window - 1)) || out_next < out_start) 
+    {
+        *in_size = 0;
+        *out_size = 0;
+        return TINFL_STATUS_BAD_PARAM;
+    }
+    if (r->m_state == 0) 
+    {
+        memset(&r->z, 0, sizeof(r->z));
+        r->arena_used = 0;
+        r->z.zalloc = litews_host_tinfl_alloc;
+        r->z.zfree = litews_host_tinfl_free;
+        r->z.opaque = r;
+        if (inflateInit2(&r->z, -15) != Z_OK) 
+        {
+            return TINFL_STATUS_FAILED;
+        }
+        r->m_state = 1;
+    }
+
+    r->z.next_in = (unsigned char *)in;
+    r->z.avail_in = (uInt)*in_size;
+    r->z.next_out = out_next;
+    r->z.avail_out = (uInt)*out_size;
+    ret = inflate(&r->z, Z_SYNC_FLUSH);
+    *in_size -= r->z.avail_in;
+    *out_size -= r->z.avail_out;
+
+    if (ret == Z_STREAM_END) 
+    {
+        return TINFL_STATUS_DONE;
+    }
+    if (ret != Z_OK && ret != Z_BUF_ERROR) 
+    {
+        return TINFL_STATUS_FAILED;
+    }
+    return (r->z.avail_out == 0) ? TINFL_STATUS_HAS_MORE_OUTPUT : TINFL_STATUS_NEEDS_MORE_INPUT;
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef __LITEWS_LOOPBACK_H__
+#define __LITEWS_LOOPBACK_H__ 1
+
+#include <stdio.h>
+
+// websocket server on 127.0.0.1 for host tests and benchmarks, a thread per connection,
+// pings are answered, close frames too, anything else is counted and handed to 'on_frame'.
+// permessage-deflate is zlib's, messages are inflated before 'on_frame' and echoed texts compressed
+
+#define LITEWS_LOOPBACK_OPCODES 16
+#define LITEWS_LOOPBACK_MAX_CONNS 64 // connections over the lifetime of a server
+
+typedef struct _litews_loopback_struct * litews_loopback;
+
+// a received frame, 'payload' is unmasked and inflated, called on the thread of connection 'conn' (0, 1, ... by accept order)
+typedef void (*litews_loopback_on_frame)(void * user, const int conn, const int opcode, const int is_finished,
+                                         const unsigned char * payload, const size_t len);
+
+typedef struct _litews_loopback_config_struct
+{
+    int use_tls; // TLS 1.2 with litews_loopback_ca_pem as the CA, needs LITEWS_HOST_TLS
+    int echo_text; // data frames come back unmasked with the same opcode and FIN
+    int echo_binary;
+    size_t read_size; // bytes per recv, 0 - 16 KB
+    unsigned int read_delay_us; // pause after every recv, a slow reader
+    int rcvbuf; // SO_RCVBUF of accepted sockets, 0 - system default
+    unsigned int drop_min_ms; // a flaky server closes every link after a random time
+    unsigned int drop_max_ms; // between these two, 0 - links are kept
+    size_t stream_bytes; // payload pushed to each client right after the upgrade, frame 'n' filled with byte 'n'
+                         // (binary) or letter 'a' + n % 26 (text), counted across messages
+    size_t stream_frame; // payload per pushed frame, 0 - 4096
+    size_t stream_message; // payload per pushed message, 0 - all of 'stream_bytes' in one
+    int stream_text; // every second pushed message is a text, the first one is binary
+    unsigned int pong_delay_ms; // pings are answered this late, a slow link
+    int pong_copies; // extra copies of every pong, stale once the first one arrived
+    unsigned int unsolicited_pong_ms; // a pong no ping asked for this often, 0 - never
+    unsigned int pings_answered_ms; // a link stops answering pings this long after its upgrade, 0 - never
+    int deflate_window_bits; // permessage-deflate accepted when offered, 8..15 caps both windows, 0 - declined
+    litews_loopback_on_frame on_frame;
+    void * user;
+} litews_loopback_config;
+
+typedef struct _litews_loopback_stats_struct
+{
+    unsigned int connections; // upgrades answered
+    unsigned int handshakes_full; // TLS handshakes with a certificate exchange
+    unsigned int handshakes_resumed; // TLS handshakes that resumed a cached session or a ticket
+    unsigned int drops; // links the flaky server closed
+    unsigned long long wire_in; // bytes read from the sockets, TLS records and the upgrade included
+    unsigned long long wire_out;
+    unsigned int reads; // recv calls that returned bytes
+    unsigned int records_in; // TLS records read, 0 over TCP
+    unsigned int pongs_out; // copies and unsolicited ones included
+    unsigned int frames_in[LITEWS_LOOPBACK_OPCODES];
+    unsigned long long payload_in[LITEWS_LOOPBACK_OPCODES]; // as on the wire, compressed or not
+    unsigned int messages_deflated_in; // data messages that came with RSV1
+    unsigned long long inflated_in; // their payload after inflating
+} litews_loopback_stats;
+
+// listens on a port picked by the system, NULL on failure
+litews_loopback litews_loopback_start(const litews_loopback_config * config);
+
+int litews_loopback_port(litews_loopback lb);
+
+void litews_loopback_get_stats(litews_loopback lb, litews_loopback_stats * stats);
+
+// close every link, wait for the threads and free 'lb'
+void litews_loopback_stop(litews_loopback lb);
+
+#ifdef LITEWS_HOST_TLS
+// CA of the server certificate, for litews_socket_set_server_cert, the certificate names 127.0.0.1
+extern const char * litews_loopback_ca_pem;
+#endif
+
+#endif
@@ -0,0 +1,145 @@
+// control frames and priority texts behind a saturated uplink: seconds of paced binary stay queued
+// while keep-alive pings and priority texts go out, their tail latency is measured
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "litewebsocket.h"
+#include "litews_loopback.h"
+#include "litews_test.h"
+
+#define CHUNK_BYTES 2048 // 64 ms of 16 kHz 16 bit PCM
+#define PACE_BYTES_PER_SEC (64 * 1024)
+#define QUEUE_BYTES (256 * 1024) // 4 s at the paced rate
+#define PRIORITY_TEXTS 20
+#define PRIORITY_GAP_MS 100
+
+typedef struct _control_state_struct
+{
+    volatile int connected;
+    volatile int disconnected;
+    volatile int texts; // priority texts at the server
+    unsigned long long latency_us[PRIORITY_TEXTS];
+} _control_state;
+
+static void on_connected(litews_socket s)
+{
+    ((_control_state *)litews_socket_get_user_object(s))->connected = 1;
+}
+
+static void on_disconnected(litews_socket s)
+{
+    ((_control_state *)litews_socket_get_user_object(s))->disconnected = 1;
+}
+
+// each text carries the time it was handed to litews_socket_send_text_priority
+static void on_frame(void * user, const int conn, const int opcode, const int is_finished,
+                     const unsigned char * payload, const size_t len)
+{
+    _control_state * st = (_control_state *)user;
+    const unsigned long long now_us = litews_test_now_us();
+    unsigned long long sent_us = 0;
+    char text[64];
+
+    if (opcode != 0x1 || len >= sizeof(text) || st->texts >= PRIORITY_TEXTS)
+    {
+        return;
+    }
+    memcpy(text, payload, len);
+    text[len] = '\0';
+    if (sscanf(text, "priority %llu", &sent_us) == 1)
+    {
+        st->latency_us[st->texts] = now_us > sent_us ? now_us - sent_us : 0;
+        st->texts++;
+    }
+}
+
+// queue chunks until the budget is spent
+static int fill_queue(litews_socket s, const unsigned char * chunk)
+{
+    int queued = 0;
+
+    while (litews_socket_send_binary(s, chunk, CHUNK_BYTES, litews_frame_one) == litews_true)
+    {
+        queued++;
+    }
+    return queued;
+}
+
+static int compare_us(const void * a, const void * b)
+{
+    const unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+int main(void)
+{
+    litews_loopback_config config;
+    litews_socket_stats stats;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+    _control_state st;
+    unsigned char chunk[CHUNK_BYTES];
+    char text[64];
+    int i = 0, chunks = 0;
+
+    memset(&config, 0, sizeof(config));
+    memset(&st, 0, sizeof(st));
+    memset(chunk, 0x11, sizeof(chunk));
+    config.on_frame = on_frame;
+    config.user = &st;
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL);
+    if (!lb)
+    {
+        return LITEWS_TEST_RESULT();
+    }
+
+    s = litews_socket_create();
+    litews_socket_set_url(s, "ws", "127.0.0.1", litews_loopback_port(lb), "/");
+    litews_socket_set_transport(s, litews_transport_tcp());
+    litews_socket_set_user_object(s, &st);
+    litews_socket_set_on_connected(s, on_connected);
+    litews_socket_set_on_disconnected(s, on_disconnected);
+    // the server sends nothing, so the socket pings every 100 ms
+    litews_socket_set_keepalive(s, 100, 1000, 3);
+    litews_socket_set_send_queue_limit(s, QUEUE_BYTES);
+    litews_socket_set_send_pacing(s, PACE_BYTES_PER_SEC, CHUNK_BYTES);
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+    LITEWS_TEST_CHECK(litews_test_wait(&st.connected, 1, 5000));
+
+    chunks = fill_queue(s, chunk);
+    for (i = 0; i < PRIORITY_TEXTS; i++)
+    {
+        usleep(PRIORITY_GAP_MS * 1000);
+        chunks += fill_queue(s, chunk);
+        snprintf(text, sizeof(text), "priority %llu", litews_test_now_us());
+        LITEWS_TEST_CHECK(litews_socket_send_text_priority(s, text) == litews_true);
+    }
+    LITEWS_TEST_CHECK(litews_test_wait(&st.texts, PRIORITY_TEXTS, 2000));
+
+    litews_socket_get_stats(s, &stats);
+    qsort(st.latency_us, (size_t)st.texts, sizeof(st.latency_us[0]), compare_us);
+    printf("%d chunks queued, %u bytes still queued, binary queueing delay max %u ms avg %u ms\n",
+           chunks, stats.send_queue_bytes, stats.send_delay_max_ms, stats.send_delay_avg_ms);
+    printf("pings %u, pongs %u, rtt min %u ms max %u ms avg %u ms\n",
+           stats.pings_sent, stats.pongs_matched, stats.rtt_min_ms, stats.rtt_max_ms, stats.rtt_avg_ms);
+    if (st.texts > 0)
+    {
+        printf("priority text to server: median %llu us, p90 %llu us, max %llu us\n",
+               st.latency_us[st.texts / 2], st.latency_us[st.texts * 9 / 10], st.latency_us[st.texts - 1]);
+    }
+
+    // the uplink really was saturated
+    LITEWS_TEST_CHECK(stats.send_queue_bytes > QUEUE_BYTES / 2);
+    LITEWS_TEST_CHECK(stats.send_delay_max_ms >= 1000);
+    // pongs were not stuck behind it, nor were priority texts, neither behind the pacer nor behind Nagle
+    LITEWS_TEST_CHECK(stats.pongs_matched >= 5);
+    LITEWS_TEST_CHECK(stats.rtt_max_ms < 20);
+    LITEWS_TEST_CHECK(st.texts == PRIORITY_TEXTS && st.latency_us[st.texts - 1] < 20000);
+
+    litews_socket_disconnect_and_release(s);
+    LITEWS_TEST_CHECK(litews_test_wait(&st.disconnected, 1, 5000));
+    litews_loopback_stop(lb);
+    return LITEWS_TEST_RESULT();
+}
@@ -0,0 +1,160 @@
+// JSON-like texts echoed with permessage-deflate off and on: wire bytes per payload byte up (at the
+// server) and down (at the client) for a few windows, with and without context takeover
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "litewebsocket.h"
+#include "litews_loopback.h"
+#include "litews_test.h"
+
+#define TEXTS 500
+#define TEXT_MAX 1200
+
+typedef struct _bench_deflate_state_struct
+{
+    volatile int connected;
+    volatile int disconnected;
+    volatile int texts; // echoes at the client
+    int errors;
+    unsigned int seed; // regenerates the texts the echoes are compared with
+} _bench_deflate_state;
+
+// an event of the kind the device sends and gets, ids and numbers change, the keys don't
+static size_t make_event(char * buf, const size_t size, unsigned int * seed)
+{
+    static const char * k_names[] = {"Recognize", "Play", "Pause", "SetVolume", "ExpectSpeech", "Synthesize"};
+    static const char * k_spaces[] = {"SpeechRecognizer", "AudioPlayer", "Speaker", "System"};
+    int len = 0;
+    int pad = (int)(rand_r(seed) % (TEXT_MAX / 2));
+
+    len = snprintf(buf, size,
+                   "{\"header\":{\"namespace\":\"%s\",\"name\":\"%s\",\"messageId\":\"%08x-%04x-%04x\","
+                   "\"dialogRequestId\":\"%08x\"},\"payload\":{\"seq\":%u,\"volume\":%u,\"muted\":%s,"
+                   "\"token\":\"%08x%08x\",\"text\":\"%.*s\"}}",
+                   k_spaces[rand_r(seed) % 4], k_names[rand_r(seed) % 6],
+                   (unsigned int)rand_r(seed), (unsigned int)rand_r(seed) & 0xffff, (unsigned int)rand_r(seed) & 0xffff,
+                   (unsigned int)rand_r(seed), (unsigned int)rand_r(seed) % 10000, (unsigned int)rand_r(seed) % 101,
+                   (rand_r(seed) & 1) ? "true" : "false", (unsigned int)rand_r(seed), (unsigned int)rand_r(seed),
+                   pad, "what is the weather like tomorrow in hangzhou, play some music by the band you played "
+                        "yesterday, set an alarm for seven in the morning, turn the volume down a little, "
+                        "what is the weather like tomorrow in beijing, play the next song, stop the music, "
+                        "remind me to call mom at eight in the evening, how long is the drive to the airport, "
+                        "tell me a joke, what time is it now, play some relaxing music for sleeping please, "
+                        "what is the weather like tomorrow in shanghai, turn the volume up, pause, resume");
+    return (len > 0 && (size_t)len < size) ? (size_t)len : 0;
+}
+
+static void on_connected(litews_socket s)
+{
+    ((_bench_deflate_state *)litews_socket_get_user_object(s))->connected = 1;
+}
+
+static void on_disconnected(litews_socket s)
+{
+    ((_bench_deflate_state *)litews_socket_get_user_object(s))->disconnected = 1;
+}
+
+static void on_text(litews_socket s, const char * text, const unsigned int length)
+{
+    _bench_deflate_state * st = (_bench_deflate_state *)litews_socket_get_user_object(s);
+    char expected[TEXT_MAX + 512];
+    const size_t len = make_event(expected, sizeof(expected), &st->seed);
+
+    if (len != length || memcmp(expected, text, len) != 0)
+    {
+        st->errors++;
+    }
+    st->texts++;
+}
+
+static void run_texts(const int window_bits, const litews_bool no_context_takeover)
+{
+    litews_loopback_config config;
+    litews_loopback_stats server;
+    litews_socket_stats stats;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+    _bench_deflate_state st;
+    char text[TEXT_MAX + 512];
+    char label[32] = "off";
+    unsigned long long payload = 0, wire_in = 0, stream_in = 0, start_us = 0, cpu_us = 0;
+    unsigned int seed = 1;
+    int i = 0;
+
+    memset(&config, 0, sizeof(config));
+    memset(&st, 0, sizeof(st));
+    st.seed = seed;
+    config.echo_text = 1;
+    config.deflate_window_bits = window_bits ? 15 : 0;
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL);
+    if (!lb)
+    {
+        return;
+    }
+
+    s = litews_socket_create();
+    litews_socket_set_url(s, "ws", "127.0.0.1", litews_loopback_port(lb), "/");
+    litews_socket_set_transport(s, litews_transport_tcp());
+    litews_socket_set_user_object(s, &st);
+    litews_socket_set_on_connected(s, on_connected);
+    litews_socket_set_on_disconnected(s, on_disconnected);
+    litews_socket_set_on_received_text(s, on_text);
+    litews_socket_set_deflate(s, window_bits, no_context_takeover);
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+    LITEWS_TEST_CHECK(litews_test_wait(&st.connected, 1, 5000));
+    // the upgrade isn't counted
+    litews_loopback_get_stats(lb, &server);
+    litews_socket_get_stats(s, &stats);
+    wire_in = server.wire_in;
+    stream_in = stats.stream_bytes_in;
+
+    start_us = litews_test_now_us();
+    cpu_us = litews_test_cpu_us();
+    for (i = 0; i < TEXTS; i++)
+    {
+        payload += make_event(text, sizeof(text), &seed);
+        LITEWS_TEST_CHECK(litews_socket_send_text(s, text) == litews_true);
+    }
+    LITEWS_TEST_CHECK(litews_test_wait(&st.texts, TEXTS, 30000));
+    cpu_us = litews_test_cpu_us() - cpu_us;
+
+    litews_loopback_get_stats(lb, &server);
+    litews_socket_get_stats(s, &stats);
+    if (window_bits)
+    {
+        snprintf(label, sizeof(label), "window %d%s", window_bits, no_context_takeover ? " no takeover" : "");
+    }
+    printf("deflate %-21s: %d texts of %llu bytes avg, %.3f wire bytes per payload byte up, %.3f down, "
+           "%llu us CPU per text with the server's in %llu ms\n",
+           label,
+           TEXTS, payload / TEXTS,
+           (double)(server.wire_in - wire_in) / (double)payload, (double)(stats.stream_bytes_in - stream_in) / (double)payload,
+           cpu_us / TEXTS, (litews_test_now_us() - start_us) / 1000);
+    LITEWS_TEST_CHECK(st.errors == 0);
+    if (window_bits)
+    {
+        LITEWS_TEST_CHECK(server.messages_deflated_in > TEXTS / 2);
+        LITEWS_TEST_CHECK(server.wire_in - wire_in < payload);
+    }
+    else
+    {
+        LITEWS_TEST_CHECK(server.messages_deflated_in == 0 && server.wire_in - wire_in > payload);
+    }
+
+    litews_socket_disconnect_and_release(s);
+    LITEWS_TEST_CHECK(litews_test_wait(&st.disconnected, 1, 5000));
+    litews_loopback_stop(lb);
+}
+
+int main(void)
+{
+    run_texts(0, litews_false);
+    run_texts(9, litews_false);
+    run_texts(11, litews_false);
+    run_texts(15, litews_false);
+    run_texts(11, litews_true);
+    run_texts(15, litews_true);
+    return LITEWS_TEST_RESULT();
+}
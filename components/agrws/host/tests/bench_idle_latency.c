@@ -0,0 +1,162 @@
+// work thread wakeups per second on an idle link, and latency from litews_socket_send_text to the server
+
+#include <string.h>
+#include <stdlib.h>
+#include <dirent.h>
+
+#include "litewebsocket.h"
+#include "litews_loopback.h"
+#include "litews_test.h"
+
+#define IDLE_MS 2000
+#define SENDS 200
+#define SEND_GAP_US 5000 // the work thread is back asleep before each send
+
+typedef struct _idle_state_struct
+{
+    volatile int connected;
+    volatile int disconnected;
+    volatile int received; // texts at the server
+    volatile unsigned long long received_us;
+} _idle_state;
+
+static void on_connected(litews_socket s)
+{
+    ((_idle_state *)litews_socket_get_user_object(s))->connected = 1;
+}
+
+static void on_disconnected(litews_socket s)
+{
+    ((_idle_state *)litews_socket_get_user_object(s))->disconnected = 1;
+}
+
+static void on_frame(void * user, const int conn, const int opcode, const int is_finished,
+                     const unsigned char * payload, const size_t len)
+{
+    _idle_state * st = (_idle_state *)user;
+
+    if (opcode == 0x1)
+    {
+        st->received_us = litews_test_now_us();
+        st->received++;
+    }
+}
+
+// context switches of the threads named 'name', each time a thread blocks and wakes counts once
+static unsigned long long thread_switches(const char * name)
+{
+    DIR * dir = opendir("/proc/self/task");
+    struct dirent * entry = NULL;
+    char path[300], line[128];
+    unsigned long long total = 0, value = 0;
+    FILE * f = NULL;
+
+    while (dir && (entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/proc/self/task/%s/comm", entry->d_name);
+        if (!(f = fopen(path, "r")))
+        {
+            continue;
+        }
+        line[0] = '\0';
+        fgets(line, sizeof(line), f);
+        fclose(f);
+        if (strncmp(line, name, strlen(name)) != 0)
+        {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/proc/self/task/%s/status", entry->d_name);
+        if (!(f = fopen(path, "r")))
+        {
+            continue;
+        }
+        while (fgets(line, sizeof(line), f))
+        {
+            if (sscanf(line, "voluntary_ctxt_switches: %llu", &value) == 1 ||
+                sscanf(line, "nonvoluntary_ctxt_switches: %llu", &value) == 1)
+            {
+                total += value;
+            }
+        }
+        fclose(f);
+    }
+    if (dir)
+    {
+        closedir(dir);
+    }
+    return total;
+}
+
+static int compare_us(const void * a, const void * b)
+{
+    const unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+int main(void)
+{
+    litews_loopback_config config;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+    _idle_state st;
+    unsigned long long latency_us[SENDS];
+    unsigned long long switches = 0, cpu_us = 0, sent_us = 0;
+    char text[32];
+    double wakeups = 0;
+    int i = 0;
+
+    memset(&config, 0, sizeof(config));
+    memset(&st, 0, sizeof(st));
+    config.on_frame = on_frame;
+    config.user = &st;
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL);
+    if (!lb)
+    {
+        return LITEWS_TEST_RESULT();
+    }
+
+    s = litews_socket_create();
+    litews_socket_set_url(s, "ws", "127.0.0.1", litews_loopback_port(lb), "/");
+    litews_socket_set_transport(s, litews_transport_tcp());
+    litews_socket_set_user_object(s, &st);
+    litews_socket_set_on_connected(s, on_connected);
+    litews_socket_set_on_disconnected(s, on_disconnected);
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+    LITEWS_TEST_CHECK(litews_test_wait(&st.connected, 1, 5000));
+    usleep(100000);
+
+    // idle: nothing to send, nothing received, keep-alive 20 s away
+    switches = thread_switches("ws_thread");
+    cpu_us = litews_test_cpu_us();
+    usleep(IDLE_MS * 1000);
+    switches = thread_switches("ws_thread") - switches;
+    cpu_us = litews_test_cpu_us() - cpu_us;
+    wakeups = (double)switches * 1000.0 / IDLE_MS;
+    printf("idle: %.1f work thread wakeups/s, %.2f%% CPU of the process with the server\n",
+           wakeups, (double)cpu_us * 100.0 / (IDLE_MS * 1000.0));
+    LITEWS_TEST_CHECK(wakeups < 5.0); // was 100/s with the 10 ms sleep
+
+    for (i = 0; i < SENDS; i++)
+    {
+        snprintf(text, sizeof(text), "ping %d", i);
+        sent_us = litews_test_now_us();
+        LITEWS_TEST_CHECK(litews_socket_send_text(s, text) == litews_true);
+        LITEWS_TEST_CHECK(litews_test_wait(&st.received, i + 1, 1000));
+        latency_us[i] = st.received_us > sent_us ? st.received_us - sent_us : 0;
+        usleep(SEND_GAP_US);
+    }
+    qsort(latency_us, SENDS, sizeof(latency_us[0]), compare_us);
+    printf("send to server: median %llu us, p99 %llu us, max %llu us\n",
+           latency_us[SENDS / 2], latency_us[SENDS * 99 / 100], latency_us[SENDS - 1]);
+    LITEWS_TEST_CHECK(latency_us[SENDS / 2] < 2000); // the sleeping loop added 5 ms on average
+
+    litews_socket_disconnect_and_release(s);
+    LITEWS_TEST_CHECK(litews_test_wait(&st.disconnected, 1, 5000));
+    litews_loopback_stop(lb);
+    return LITEWS_TEST_RESULT();
+}
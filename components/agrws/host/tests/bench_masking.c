@@ -0,0 +1,103 @@
+// masking kernel: same bytes as the byte loop for every alignment, offset and tail, and MB/s against it
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "litews_frame.h"
+#include "litews_test.h"
+
+#define BENCH_US 200000 // per size and kernel
+
+// the loop litews_frame_fill_with_send_bin_data and litews_frame_create_with_recv_data had
+static void __attribute__((noinline)) mask_bytewise(unsigned char * data, const size_t len, const unsigned char mask[4], const size_t offset)
+{
+    size_t index = 0;
+
+    for (index = 0; index < len; index++)
+    {
+        data[index] ^= mask[(offset + index) & 0x3];
+    }
+}
+
+static void check_kernel(void)
+{
+    const unsigned char mask[4] = { 0x12, 0x9a, 0x5c, 0xe7 };
+    unsigned char expected[96];
+    unsigned char actual[96 + 8];
+    size_t align = 0, offset = 0, len = 0, i = 0;
+    int errors = 0;
+
+    for (align = 0; align < 8; align++)
+    {
+        for (offset = 0; offset < 8; offset++)
+        {
+            for (len = 0; len <= 80; len++)
+            {
+                for (i = 0; i < len; i++)
+                {
+                    expected[i] = (unsigned char)(i * 31 + len);
+                }
+                memset(actual, 0xa5, sizeof(actual));
+                memcpy(actual + align, expected, len);
+                mask_bytewise(expected, len, mask, offset);
+                litews_frame_mask_data(actual + align, len, mask, offset);
+                if (memcmp(actual + align, expected, len) != 0 || (align > 0 && actual[align - 1] != 0xa5) ||
+                    actual[align + len] != 0xa5)
+                {
+                    errors++;
+                }
+            }
+        }
+    }
+    LITEWS_TEST_CHECK(errors == 0);
+}
+
+typedef void (*mask_kernel)(unsigned char * data, const size_t len, const unsigned char mask[4], const size_t offset);
+
+static double run_kernel(mask_kernel kernel, unsigned char * data, const size_t len)
+{
+    const unsigned char mask[4] = { 0x37, 0xfa, 0x21, 0x3d };
+    unsigned long long bytes = 0, elapsed_us = 0;
+    const unsigned long long start_us = litews_test_now_us();
+    int i = 0;
+
+    do
+    {
+        for (i = 0; i < 64; i++)
+        {
+            kernel(data, len, mask, (size_t)i);
+        }
+        bytes += 64ULL * len;
+        elapsed_us = litews_test_now_us() - start_us;
+    } while (elapsed_us < BENCH_US);
+    return (double)bytes / (double)elapsed_us;
+}
+
+int main(void)
+{
+    // 64 ms of 16 kHz 16 bit PCM is 2 KB, the rest brackets it
+    static const size_t sizes[] = { 64, 640, 2048, 16384, 65536 };
+    unsigned char * data = (unsigned char *)malloc(65536 + 1);
+    double bytewise = 0, kernel = 0;
+    size_t i = 0;
+
+    check_kernel();
+    LITEWS_TEST_CHECK(data != NULL);
+    if (!data)
+    {
+        return LITEWS_TEST_RESULT();
+    }
+    memset(data, 0x5a, 65536 + 1);
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        // one byte in, as a payload behind a frame header usually is
+        bytewise = run_kernel(mask_bytewise, data + 1, sizes[i]);
+        kernel = run_kernel(litews_frame_mask_data, data + 1, sizes[i]);
+        printf("%6zu bytes: byte loop %8.1f MB/s, litews_frame_mask_data %8.1f MB/s, x%.1f\n",
+               sizes[i], bytewise, kernel, bytewise > 0 ? kernel / bytewise : 0.0);
+        LITEWS_TEST_CHECK(sizes[i] < 640 || kernel > bytewise); // words pay off from a few of them on
+    }
+    free(data);
+    return LITEWS_TEST_RESULT();
+}
@@ -0,0 +1,163 @@
+// N sockets echoing binary through one loopback server at once: every socket gets back exactly its own
+// stream, aggregate throughput is reported
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "litewebsocket.h"
+#include "litews_loopback.h"
+#include "litews_test.h"
+
+#define SOCKETS 8
+#define FRAME_BYTES (16 * 1024)
+#define FRAMES 256 // 4 MB per socket
+
+typedef struct _parallel_state_struct
+{
+    int id;
+    volatile int connected;
+    volatile int disconnected;
+    volatile int done;
+    unsigned long long received;
+    int errors;
+} _parallel_state;
+
+// differs per socket, so bytes of another stream show
+static unsigned char pattern(const int id, const unsigned long long offset)
+{
+    return (unsigned char)(offset * 7 + (offset >> 8) + (unsigned long long)id * 101);
+}
+
+static void on_connected(litews_socket s)
+{
+    ((_parallel_state *)litews_socket_get_user_object(s))->connected = 1;
+}
+
+static void on_disconnected(litews_socket s)
+{
+    ((_parallel_state *)litews_socket_get_user_object(s))->disconnected = 1;
+}
+
+static void on_bin(litews_socket s, const void * data, const unsigned int length, int flag)
+{
+    _parallel_state * st = (_parallel_state *)litews_socket_get_user_object(s);
+    const unsigned char * bytes = (const unsigned char *)data;
+    unsigned int i = 0;
+
+    for (i = 0; i < length; i++)
+    {
+        if (bytes[i] != pattern(st->id, st->received + i))
+        {
+            st->errors++;
+            break;
+        }
+    }
+    st->received += length;
+    if (st->received == (unsigned long long)FRAMES * FRAME_BYTES)
+    {
+        st->done = 1;
+    }
+}
+
+int main(void)
+{
+    litews_loopback_config config;
+    litews_loopback_stats server;
+    litews_loopback lb = NULL;
+    litews_socket sockets[SOCKETS];
+    _parallel_state states[SOCKETS];
+    int sent[SOCKETS];
+    unsigned char * payload = (unsigned char *)malloc(FRAME_BYTES);
+    unsigned long long start_us = 0, elapsed_us = 0, offset = 0;
+    litews_bool queued = litews_false;
+    int i = 0, j = 0, pending = 0;
+
+    memset(&config, 0, sizeof(config));
+    memset(states, 0, sizeof(states));
+    memset(sent, 0, sizeof(sent));
+    config.echo_binary = 1;
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL && payload != NULL);
+    if (!lb || !payload)
+    {
+        free(payload);
+        return LITEWS_TEST_RESULT();
+    }
+
+    for (i = 0; i < SOCKETS; i++)
+    {
+        states[i].id = i;
+        sockets[i] = litews_socket_create();
+        litews_socket_set_url(sockets[i], "ws", "127.0.0.1", litews_loopback_port(lb), "/");
+        litews_socket_set_transport(sockets[i], litews_transport_tcp());
+        litews_socket_set_user_object(sockets[i], &states[i]);
+        litews_socket_set_on_connected(sockets[i], on_connected);
+        litews_socket_set_on_disconnected(sockets[i], on_disconnected);
+        litews_socket_set_on_received_bin(sockets[i], on_bin);
+        LITEWS_TEST_CHECK(litews_socket_connect(sockets[i]));
+    }
+    for (i = 0; i < SOCKETS; i++)
+    {
+        LITEWS_TEST_CHECK(litews_test_wait(&states[i].connected, 1, 5000));
+    }
+
+    // round robin over the sockets, one with a full queue is offered its frame again next round
+    start_us = litews_test_now_us();
+    do
+    {
+        pending = 0;
+        for (i = 0; i < SOCKETS; i++)
+        {
+            if (sent[i] == FRAMES)
+            {
+                continue;
+            }
+            offset = (unsigned long long)sent[i] * FRAME_BYTES;
+            for (j = 0; j < FRAME_BYTES; j++)
+            {
+                payload[j] = pattern(i, offset + (unsigned long long)j);
+            }
+            queued = litews_socket_send_binary(sockets[i], payload, FRAME_BYTES,
+                         sent[i] == 0 ? litews_frame_start : (sent[i] == FRAMES - 1 ? litews_frame_end : litews_frame_continue));
+            LITEWS_TEST_CHECK(queued != litews_false);
+            if (queued == litews_true)
+            {
+                sent[i]++;
+            }
+            pending += (sent[i] < FRAMES);
+        }
+        if (pending)
+        {
+            usleep(100);
+        }
+    } while (pending);
+
+    for (i = 0; i < SOCKETS; i++)
+    {
+        LITEWS_TEST_CHECK(litews_test_wait(&states[i].done, 1, 60000));
+    }
+    elapsed_us = litews_test_now_us() - start_us;
+
+    litews_loopback_get_stats(lb, &server);
+    printf("%d sockets, %d MB echoed each, %.1f MB/s up and down together\n",
+           SOCKETS, FRAMES * FRAME_BYTES / (1024 * 1024),
+           elapsed_us ? 2.0 * SOCKETS * FRAMES * FRAME_BYTES / (double)elapsed_us : 0.0);
+    LITEWS_TEST_CHECK(server.connections == SOCKETS);
+    for (i = 0; i < SOCKETS; i++)
+    {
+        LITEWS_TEST_CHECK(states[i].errors == 0);
+        LITEWS_TEST_CHECK(states[i].received == (unsigned long long)FRAMES * FRAME_BYTES);
+    }
+
+    for (i = 0; i < SOCKETS; i++)
+    {
+        litews_socket_disconnect_and_release(sockets[i]);
+    }
+    for (i = 0; i < SOCKETS; i++)
+    {
+        LITEWS_TEST_CHECK(litews_test_wait(&states[i].disconnected, 1, 5000));
+    }
+    litews_loopback_stop(lb);
+    free(payload);
+    return LITEWS_TEST_RESULT();
+}
@@ -0,0 +1,321 @@
+// the in-memory transport: binary messages echoed by a peer answering with litews_socket_pipe_put right
+// from the write callback, i.e. while the socket is still in its send path, and by a peer answering from
+// a thread of its own; the TCP loopback server for comparison. Echoes are checked byte for byte.
+
+#define _GNU_SOURCE // memmem
+
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "litewebsocket.h"
+#include "litews_loopback.h"
+#include "litews_test.h"
+
+#define STREAM_BYTES (16 * 1024 * 1024)
+
+typedef enum _pipe_mode_enum
+{
+    pipe_mode_tcp = 0, // loopback server
+    pipe_mode_inline, // the peer answers from the write callback
+    pipe_mode_thread // the peer answers from its own thread
+} _pipe_mode;
+
+typedef struct _pipe_state_struct
+{
+    volatile int connected;
+    volatile int disconnected;
+    volatile int messages; // echoes at the client
+    size_t message_bytes;
+    size_t received;
+    int errors;
+    // the peer, what the socket wrote and wasn't answered yet
+    unsigned char * in;
+    size_t in_len;
+    size_t in_cap;
+    int is_upgraded;
+    unsigned int reentrant_puts; // answers put before the socket's write returned
+    volatile int in_write;
+    // the thread of a threaded peer and what it was handed
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    unsigned char * queued;
+    size_t queued_len;
+    size_t queued_cap;
+    int is_stopping;
+    litews_socket socket;
+} _pipe_state;
+
+static void append(unsigned char ** buf, size_t * len, size_t * cap, const void * data, const size_t size)
+{
+    if (*len + size > *cap)
+    {
+        *cap = (*cap ? *cap : 4096);
+        while (*cap < *len + size)
+        {
+            *cap *= 2;
+        }
+        *buf = (unsigned char *)realloc(*buf, *cap);
+    }
+    memcpy(*buf + *len, data, size);
+    *len += size;
+}
+
+static void peer_put(litews_socket s, _pipe_state * st, const void * data, const size_t len)
+{
+    if (st->in_write)
+    {
+        st->reentrant_puts++;
+    }
+    litews_socket_pipe_put(s, data, (unsigned int)len);
+}
+
+// answers the upgrade and echoes every complete frame unmasked, pings as pongs
+static void peer_answer(litews_socket s, _pipe_state * st)
+{
+    static const char * k_response = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                                     "Sec-WebSocket-Accept: pipe\r\n\r\n";
+    unsigned char * p = st->in;
+    unsigned char * end = st->in + st->in_len;
+    unsigned char header[10];
+    unsigned long long payload = 0;
+    size_t header_len = 0, i = 0;
+
+    if (!st->is_upgraded)
+    {
+        const unsigned char * blank = (const unsigned char *)memmem(p, st->in_len, "\r\n\r\n", 4);
+        if (!blank)
+        {
+            return;
+        }
+        peer_put(s, st, k_response, strlen(k_response));
+        st->is_upgraded = 1;
+        p = (unsigned char *)blank + 4;
+    }
+    while (end - p >= 6)
+    {
+        payload = p[1] & 0x7f;
+        header_len = 2;
+        if (payload == 126)
+        {
+            payload = ((unsigned long long)p[2] << 8) | p[3];
+            header_len = 4;
+        }
+        else if (payload == 127)
+        {
+            payload = 0;
+            for (i = 0; i < 8 && (size_t)(end - p) >= 10; i++)
+            {
+                payload = (payload << 8) | p[2 + i];
+            }
+            header_len = 10;
+        }
+        if ((unsigned long long)(end - p) < header_len + 4 + payload)
+        {
+            break;
+        }
+        for (i = 0; i < payload; i++)
+        {
+            p[header_len + 4 + i] ^= p[header_len + (i & 3)];
+        }
+        memcpy(header, p, header_len);
+        header[0] = ((p[0] & 0x0f) == 0x9) ? (unsigned char)((p[0] & 0xf0) | 0xa) : p[0];
+        header[1] = p[1] & 0x7f;
+        // header and payload in one put, the unmasked payload is moved up against its header
+        memmove(p + 4, header, header_len);
+        peer_put(s, st, p + 4, header_len + (size_t)payload);
+        p += header_len + 4 + payload;
+    }
+    st->in_len = (size_t)(end - p);
+    memmove(st->in, p, st->in_len);
+}
+
+static void on_written(litews_socket s, const void * data, const unsigned int length)
+{
+    _pipe_state * st = (_pipe_state *)litews_socket_get_user_object(s);
+
+    if (st->thread)
+    {
+        pthread_mutex_lock(&st->mutex);
+        append(&st->queued, &st->queued_len, &st->queued_cap, data, length);
+        pthread_cond_signal(&st->cond);
+        pthread_mutex_unlock(&st->mutex);
+        return;
+    }
+    append(&st->in, &st->in_len, &st->in_cap, data, length);
+    st->in_write = 1;
+    peer_answer(s, st);
+    st->in_write = 0;
+}
+
+static void * peer_thread(void * arg)
+{
+    _pipe_state * st = (_pipe_state *)arg;
+
+    pthread_mutex_lock(&st->mutex);
+    while (!st->is_stopping)
+    {
+        if (st->queued_len == 0)
+        {
+            pthread_cond_wait(&st->cond, &st->mutex);
+            continue;
+        }
+        append(&st->in, &st->in_len, &st->in_cap, st->queued, st->queued_len);
+        st->queued_len = 0;
+        pthread_mutex_unlock(&st->mutex);
+        peer_answer(st->socket, st);
+        pthread_mutex_lock(&st->mutex);
+    }
+    pthread_mutex_unlock(&st->mutex);
+    return NULL;
+}
+
+static void on_connected(litews_socket s)
+{
+    ((_pipe_state *)litews_socket_get_user_object(s))->connected = 1;
+}
+
+static void on_disconnected(litews_socket s)
+{
+    ((_pipe_state *)litews_socket_get_user_object(s))->disconnected = 1;
+}
+
+static unsigned char pattern(const size_t message, const size_t offset)
+{
+    return (unsigned char)(message * 131 + offset);
+}
+
+static void on_bin(litews_socket s, const void * data, const unsigned int length, int flag)
+{
+    _pipe_state * st = (_pipe_state *)litews_socket_get_user_object(s);
+    const unsigned char * bytes = (const unsigned char *)data;
+    unsigned int i = 0;
+
+    for (i = 0; i < length; i++)
+    {
+        const size_t at = st->received + i;
+        if (bytes[i] != pattern(at / st->message_bytes, at % st->message_bytes))
+        {
+            st->errors++;
+            break;
+        }
+    }
+    // slices are flagged start and continue, frame ends aren't told apart
+    st->received += length;
+    st->messages = (int)(st->received / st->message_bytes);
+}
+
+static void run_echo(const _pipe_mode mode, const size_t message_bytes)
+{
+    static const char * k_labels[] = {"tcp loopback", "pipe, inline peer", "pipe, peer thread"};
+    litews_loopback_config config;
+    litews_socket_stats stats;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+    _pipe_state * st = (_pipe_state *)calloc(1, sizeof(_pipe_state));
+    unsigned char * message = (unsigned char *)malloc(message_bytes);
+    const int messages = (int)(STREAM_BYTES / message_bytes);
+    unsigned long long start_us = 0, elapsed_us = 0, cpu_us = 0;
+    litews_bool queued = litews_false;
+    size_t j = 0;
+    int i = 0;
+
+    LITEWS_TEST_CHECK(st != NULL && message != NULL);
+    if (!st || !message)
+    {
+        free(st);
+        free(message);
+        return;
+    }
+    st->message_bytes = message_bytes;
+    s = litews_socket_create();
+    st->socket = s;
+    litews_socket_set_url(s, "ws", "127.0.0.1", 80, "/");
+    if (mode == pipe_mode_tcp)
+    {
+        memset(&config, 0, sizeof(config));
+        config.echo_binary = 1;
+        lb = litews_loopback_start(&config);
+        LITEWS_TEST_CHECK(lb != NULL);
+        litews_socket_set_url(s, "ws", "127.0.0.1", lb ? litews_loopback_port(lb) : 80, "/");
+        litews_socket_set_transport(s, litews_transport_tcp());
+    }
+    else
+    {
+        litews_socket_set_transport(s, litews_transport_pipe());
+        litews_socket_set_pipe_peer(s, on_written);
+        if (mode == pipe_mode_thread)
+        {
+            pthread_mutex_init(&st->mutex, NULL);
+            pthread_cond_init(&st->cond, NULL);
+            pthread_create(&st->thread, NULL, peer_thread, st);
+        }
+    }
+    litews_socket_set_user_object(s, st);
+    litews_socket_set_on_connected(s, on_connected);
+    litews_socket_set_on_disconnected(s, on_disconnected);
+    litews_socket_set_on_received_bin(s, on_bin);
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+    LITEWS_TEST_CHECK(litews_test_wait(&st->connected, 1, 5000));
+
+    start_us = litews_test_now_us();
+    cpu_us = litews_test_cpu_us();
+    for (i = 0; i < messages && st->connected; i++)
+    {
+        for (j = 0; j < message_bytes; j++)
+        {
+            message[j] = pattern((size_t)i, j);
+        }
+        while ((queued = litews_socket_send_binary(s, message, (int)message_bytes, litews_frame_one)) == litews_would_block)
+        {
+            usleep(50);
+        }
+        LITEWS_TEST_CHECK(queued == litews_true);
+    }
+    LITEWS_TEST_CHECK(litews_test_wait(&st->messages, messages, 60000));
+    elapsed_us = litews_test_now_us() - start_us;
+    cpu_us = litews_test_cpu_us() - cpu_us;
+    litews_socket_get_stats(s, &stats);
+
+    printf("%-18s %5zu byte messages: %.1f MB/s echoed, %.2f us CPU per message, %u writes, %u re-entrant puts, "
+           "%d errors\n",
+           k_labels[mode], message_bytes, (double)STREAM_BYTES / (double)elapsed_us, (double)cpu_us / messages,
+           stats.stream_writes, st->reentrant_puts, st->errors);
+    LITEWS_TEST_CHECK(st->messages == messages && st->received == (size_t)messages * message_bytes);
+    LITEWS_TEST_CHECK(st->errors == 0);
+    // the inline peer answered every write before it returned
+    LITEWS_TEST_CHECK(mode != pipe_mode_inline || st->reentrant_puts >= (unsigned int)messages);
+
+    litews_socket_disconnect_and_release(s);
+    LITEWS_TEST_CHECK(litews_test_wait(&st->disconnected, 1, 5000));
+    if (lb)
+    {
+        litews_loopback_stop(lb);
+    }
+    if (st->thread)
+    {
+        pthread_mutex_lock(&st->mutex);
+        st->is_stopping = 1;
+        pthread_cond_signal(&st->cond);
+        pthread_mutex_unlock(&st->mutex);
+        pthread_join(st->thread, NULL);
+        pthread_cond_destroy(&st->cond);
+        pthread_mutex_destroy(&st->mutex);
+    }
+    free(st->in);
+    free(st->queued);
+    free(st);
+    free(message);
+}
+
+int main(void)
+{
+    run_echo(pipe_mode_tcp, 640);
+    run_echo(pipe_mode_inline, 640);
+    run_echo(pipe_mode_thread, 640);
+    run_echo(pipe_mode_tcp, 4096);
+    run_echo(pipe_mode_inline, 4096);
+    run_echo(pipe_mode_thread, 4096);
+    return LITEWS_TEST_RESULT();
+}
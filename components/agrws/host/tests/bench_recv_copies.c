@@ -0,0 +1,174 @@
+// receive path benchmark: a binary stream from the loopback server through the received binary callback,
+// against a replay of the receive code before the ring and the bytes it copied per received byte
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "litewebsocket.h"
+#include "litews_loopback.h"
+#include "litews_test.h"
+
+#define STREAM_BYTES (32 * 1024 * 1024)
+#define STREAM_FRAME 1024 // the code before the ring stalled on frames that did not fit its free space with a read left
+
+// the receive buffers the code before the ring used with mbedtls
+#define LEGACY_BUFFER_SIZE 6144
+#define LEGACY_READ_SIZE 4096
+
+typedef struct _recv_state_struct
+{
+    volatile int connected;
+    volatile int done;
+    volatile int disconnected;
+    size_t received;
+    int errors;
+} _recv_state;
+
+static void on_connected(litews_socket s)
+{
+    ((_recv_state *)litews_socket_get_user_object(s))->connected = 1;
+}
+
+static void on_disconnected(litews_socket s)
+{
+    ((_recv_state *)litews_socket_get_user_object(s))->disconnected = 1;
+}
+
+// the server fills each frame with its index
+static void check_payload(_recv_state * st, const unsigned char * data, const size_t length)
+{
+    size_t i = 0;
+
+    for (i = 0; i < length; i++)
+    {
+        if (data[i] != (unsigned char)((st->received + i) / STREAM_FRAME))
+        {
+            st->errors++;
+            break;
+        }
+    }
+    st->received += length;
+    if (st->received == STREAM_BYTES)
+    {
+        st->done = 1;
+    }
+}
+
+static void on_bin(litews_socket s, const void * data, const unsigned int length, int flag)
+{
+    check_payload((_recv_state *)litews_socket_get_user_object(s), (const unsigned char *)data, length);
+}
+
+static void run_stream(void)
+{
+    litews_loopback_config config;
+    litews_socket_stats stats;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+    _recv_state * st = (_recv_state *)calloc(1, sizeof(_recv_state));
+    unsigned long long start_us = 0, elapsed_us = 0;
+
+    memset(&config, 0, sizeof(config));
+    config.stream_bytes = STREAM_BYTES;
+    config.stream_frame = STREAM_FRAME;
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL && st != NULL);
+    if (!lb || !st)
+    {
+        free(st);
+        return;
+    }
+
+    s = litews_socket_create();
+    litews_socket_set_url(s, "ws", "127.0.0.1", litews_loopback_port(lb), "/");
+    litews_socket_set_transport(s, litews_transport_tcp());
+    litews_socket_set_user_object(s, st);
+    litews_socket_set_on_connected(s, on_connected);
+    litews_socket_set_on_disconnected(s, on_disconnected);
+    litews_socket_set_on_received_bin(s, on_bin);
+
+    start_us = litews_test_now_us();
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+    LITEWS_TEST_CHECK(litews_test_wait(&st->done, 1, 60000));
+    elapsed_us = litews_test_now_us() - start_us;
+    LITEWS_TEST_CHECK(st->errors == 0);
+    LITEWS_TEST_CHECK(st->received == STREAM_BYTES);
+
+    litews_socket_get_stats(s, &stats);
+    // the transport reads into the ring and the callback gets the payload where it was read, unmasked in place
+    printf("%-8s %7.1f MB/s, 0.000 bytes copied per received byte, %llu bytes read\n", "ring",
+           elapsed_us ? (double)STREAM_BYTES / (double)elapsed_us : 0.0, stats.stream_bytes_in);
+    LITEWS_TEST_CHECK(stats.stream_bytes_in >= STREAM_BYTES);
+
+    litews_socket_disconnect_and_release(s);
+    LITEWS_TEST_CHECK(litews_test_wait(&st->disconnected, 1, 5000));
+    litews_loopback_stop(lb);
+    free(st);
+}
+
+// the same wire bytes through the code before the ring: every read copied from a stack buffer into
+// 'received_buffer', every frame copied out of it and the bytes behind the frame moved to its front
+static unsigned long long run_legacy_replay(void)
+{
+    const size_t frames = STREAM_BYTES / STREAM_FRAME;
+    const size_t wire_frame = 4 + STREAM_FRAME;
+    const size_t wire_size = frames * wire_frame;
+    unsigned char * wire = (unsigned char *)malloc(wire_size);
+    unsigned char * frame = (unsigned char *)malloc(STREAM_FRAME);
+    unsigned char buff[LEGACY_READ_SIZE];
+    unsigned char received_buffer[LEGACY_BUFFER_SIZE];
+    size_t wire_pos = 0, buffer_len = 0, len = 0, i = 0, parsed = 0;
+    unsigned long long copied = 0;
+
+    LITEWS_TEST_CHECK(wire != NULL && frame != NULL);
+    if (!wire || !frame)
+    {
+        free(wire);
+        free(frame);
+        return 0;
+    }
+    for (i = 0; i < frames; i++)
+    {
+        unsigned char * f = wire + i * wire_frame;
+        f[0] = (unsigned char)(0x80 | (i == 0 ? 0x2 : 0x0));
+        f[1] = 126;
+        f[2] = (unsigned char)(STREAM_FRAME >> 8);
+        f[3] = (unsigned char)(STREAM_FRAME & 0xff);
+        memset(f + 4, (int)(i & 0xff), STREAM_FRAME);
+    }
+
+    // one read and at most one frame per pass of the work loop, as litews_socket_idle_recv did
+    while (parsed < frames)
+    {
+        if (LEGACY_BUFFER_SIZE - buffer_len > LEGACY_READ_SIZE && wire_pos < wire_size)
+        {
+            len = wire_size - wire_pos < LEGACY_READ_SIZE ? wire_size - wire_pos : LEGACY_READ_SIZE;
+            memcpy(buff, wire + wire_pos, len); // mbedtls_ssl_read decrypting into the stack buffer
+            wire_pos += len;
+            memcpy(received_buffer + buffer_len, buff, len);
+            buffer_len += len;
+            copied += len;
+        }
+        if (buffer_len >= wire_frame)
+        {
+            memcpy(frame, received_buffer + 4, STREAM_FRAME); // litews_frame_create_with_recv_data
+            copied += STREAM_FRAME;
+            LITEWS_TEST_CHECK(frame[0] == (unsigned char)parsed);
+            memmove(received_buffer, received_buffer + wire_frame, buffer_len - wire_frame);
+            copied += buffer_len - wire_frame;
+            buffer_len -= wire_frame;
+            parsed++;
+        }
+    }
+    printf("%-8s %.3f bytes copied per received byte\n", "legacy", (double)copied / (double)wire_size);
+    free(wire);
+    free(frame);
+    return copied;
+}
+
+int main(void)
+{
+    LITEWS_TEST_CHECK(run_legacy_replay() > STREAM_BYTES);
+    run_stream();
+    return LITEWS_TEST_RESULT();
+}
@@ -0,0 +1,132 @@
+// a burst of small binary frames with and without the write batch: writes (TLS records) per second
+// and wire bytes per payload byte, over TCP and, when built in, over TLS
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "litewebsocket.h"
+#include "litews_loopback.h"
+#include "litews_test.h"
+
+#define FRAMES 5000
+#define FRAME_BYTES 64
+
+typedef struct _batch_state_struct
+{
+    volatile int connected;
+    volatile int disconnected;
+    volatile int frames; // at the server
+} _batch_state;
+
+static void on_connected(litews_socket s)
+{
+    ((_batch_state *)litews_socket_get_user_object(s))->connected = 1;
+}
+
+static void on_disconnected(litews_socket s)
+{
+    ((_batch_state *)litews_socket_get_user_object(s))->disconnected = 1;
+}
+
+static void on_frame(void * user, const int conn, const int opcode, const int is_finished,
+                     const unsigned char * payload, const size_t len)
+{
+    if (opcode == 0x2 || opcode == 0x0)
+    {
+        ((_batch_state *)user)->frames++;
+    }
+}
+
+static void run_burst(const int use_tls, const int batch)
+{
+    litews_loopback_config config;
+    litews_loopback_stats server;
+    litews_socket_stats stats;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+    _batch_state st;
+    unsigned char payload[FRAME_BYTES];
+    unsigned long long start_us = 0, elapsed_us = 0, writes = 0;
+    litews_bool queued = litews_false;
+    int i = 0;
+
+    memset(&config, 0, sizeof(config));
+    memset(&st, 0, sizeof(st));
+    memset(payload, 0x3c, sizeof(payload));
+    config.use_tls = use_tls;
+    config.on_frame = on_frame;
+    config.user = &st;
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL);
+    if (!lb)
+    {
+        return;
+    }
+
+    s = litews_socket_create();
+    litews_socket_set_url(s, use_tls ? "wss" : "ws", "127.0.0.1", litews_loopback_port(lb), "/");
+#ifdef LITEWS_HOST_TLS
+    if (use_tls)
+    {
+        litews_socket_set_transport(s, litews_transport_tls());
+        litews_socket_set_server_cert(s, litews_loopback_ca_pem);
+    }
+    else
+#endif
+    {
+        litews_socket_set_transport(s, litews_transport_tcp());
+    }
+    litews_socket_set_user_object(s, &st);
+    litews_socket_set_on_connected(s, on_connected);
+    litews_socket_set_on_disconnected(s, on_disconnected);
+    litews_socket_set_send_batch(s, batch);
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+    LITEWS_TEST_CHECK(litews_test_wait(&st.connected, 1, 10000));
+    litews_socket_get_stats(s, &stats);
+    writes = stats.stream_writes; // the upgrade request
+
+    start_us = litews_test_now_us();
+    for (i = 0; i < FRAMES; i++)
+    {
+        while ((queued = litews_socket_send_binary(s, payload, FRAME_BYTES,
+                         i == 0 ? litews_frame_start : (i == FRAMES - 1 ? litews_frame_end : litews_frame_continue))) == litews_would_block)
+        {
+            usleep(100);
+        }
+        LITEWS_TEST_CHECK(queued == litews_true);
+    }
+    LITEWS_TEST_CHECK(litews_test_wait(&st.frames, FRAMES, 30000));
+    elapsed_us = litews_test_now_us() - start_us;
+
+    litews_socket_get_stats(s, &stats);
+    litews_loopback_get_stats(lb, &server);
+    writes = stats.stream_writes - writes;
+    printf("%s, batch %5d: %6llu writes in %llu ms, %8.0f writes/s, %u TLS records, %.3f wire bytes per payload byte\n",
+           use_tls ? "tls" : "tcp", batch, writes, elapsed_us / 1000,
+           elapsed_us ? (double)writes * 1000000.0 / (double)elapsed_us : 0.0,
+           server.records_in, (double)server.wire_in / ((double)FRAMES * FRAME_BYTES));
+    if (batch > 0)
+    {
+        LITEWS_TEST_CHECK(writes * 4 < FRAMES);
+        LITEWS_TEST_CHECK(!use_tls || server.records_in * 4 < FRAMES);
+    }
+    else
+    {
+        LITEWS_TEST_CHECK(writes >= FRAMES);
+    }
+
+    litews_socket_disconnect_and_release(s);
+    LITEWS_TEST_CHECK(litews_test_wait(&st.disconnected, 1, 5000));
+    litews_loopback_stop(lb);
+}
+
+int main(void)
+{
+    run_burst(0, 0);
+    run_burst(0, 4096);
+#ifdef LITEWS_HOST_TLS
+    run_burst(1, 0);
+    run_burst(1, 4096);
+#endif
+    return LITEWS_TEST_RESULT();
+}
@@ -0,0 +1,205 @@
+// cost of a TLS reconnect on the work thread, heap allocations and CPU time from the lost link to the
+// next upgrade, against a server dropping every link: with the shared TLS context kept between links
+// and with it freed on every drop, so that each connect seeds a DRBG, parses the CA and sets up a
+// config of its own again, as every connect did before the context was shared
+
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+
+#include "litewebsocket.h"
+#include "litews_socket.h"
+#include "litews_loopback.h"
+#include "litews_test.h"
+
+#ifdef LITEWS_HOST_TLS
+
+#define RECONNECTS 20
+#define WARMUP 2 // reconnects not counted, the pool and the session cache fill up
+
+// heap calls of the thread counting them, the sanitizers keep the allocator to themselves
+#if defined(__SANITIZE_ADDRESS__)
+#define BENCH_COUNTS_ALLOCS 0
+#else
+#define BENCH_COUNTS_ALLOCS 1
+
+extern void * __libc_malloc(size_t size);
+extern void * __libc_calloc(size_t count, size_t size);
+extern void * __libc_realloc(void * ptr, size_t size);
+
+static __thread int _bench_counting = 0;
+static __thread unsigned long long _bench_allocs = 0;
+static __thread unsigned long long _bench_alloc_bytes = 0;
+
+void * malloc(size_t size)
+{
+    if (_bench_counting)
+    {
+        _bench_allocs++;
+        _bench_alloc_bytes += size;
+    }
+    return __libc_malloc(size);
+}
+
+void * calloc(size_t count, size_t size)
+{
+    if (_bench_counting)
+    {
+        _bench_allocs++;
+        _bench_alloc_bytes += count * size;
+    }
+    return __libc_calloc(count, size);
+}
+
+void * realloc(void * ptr, size_t size)
+{
+    if (_bench_counting)
+    {
+        _bench_allocs++;
+        _bench_alloc_bytes += size;
+    }
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+typedef struct _tls_reconnect_state_struct
+{
+    volatile int connected; // links up
+    volatile int disconnected;
+    int rebuild; // the shared context is freed on every drop
+    unsigned long long cpu_start_us;
+    unsigned long long cpu_us; // counted reconnects
+    unsigned long long allocs;
+    unsigned long long alloc_bytes;
+    int counted;
+} _tls_reconnect_state;
+
+static unsigned long long thread_cpu_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + (unsigned long long)ts.tv_nsec / 1000ULL;
+}
+
+static void on_disconnected(litews_socket s)
+{
+    ((_tls_reconnect_state *)litews_socket_get_user_object(s))->disconnected = 1;
+}
+
+// on the work thread: a reconnect runs from the lost link to the next upgrade
+static void on_state(litews_socket s, int state)
+{
+    _tls_reconnect_state * st = (_tls_reconnect_state *)litews_socket_get_user_object(s);
+
+    if (state == litews_state_waiting_reconnect)
+    {
+        if (st->rebuild)
+        {
+            litews_tls_context_trim(); // the link let go of it when it closed
+        }
+        if (st->connected > WARMUP)
+        {
+#if BENCH_COUNTS_ALLOCS
+            _bench_allocs = 0;
+            _bench_alloc_bytes = 0;
+            _bench_counting = 1;
+#endif
+            st->cpu_start_us = thread_cpu_us();
+        }
+    }
+    else if (state == litews_state_connected)
+    {
+        if (st->cpu_start_us)
+        {
+            st->cpu_us += thread_cpu_us() - st->cpu_start_us;
+            st->cpu_start_us = 0;
+#if BENCH_COUNTS_ALLOCS
+            _bench_counting = 0;
+            st->allocs += _bench_allocs;
+            st->alloc_bytes += _bench_alloc_bytes;
+#endif
+            st->counted++;
+        }
+        st->connected++;
+    }
+}
+
+static void run_reconnects(const int rebuild, _tls_reconnect_state * st)
+{
+    litews_loopback_config config;
+    litews_loopback_stats server;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+
+    memset(&config, 0, sizeof(config));
+    memset(st, 0, sizeof(*st));
+    st->rebuild = rebuild;
+    config.use_tls = 1;
+    config.drop_min_ms = 100;
+    config.drop_max_ms = 150;
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL);
+    if (!lb)
+    {
+        return;
+    }
+
+    s = litews_socket_create();
+    litews_socket_set_url(s, "wss", "127.0.0.1", litews_loopback_port(lb), "/");
+    litews_socket_set_transport(s, litews_transport_tls());
+    litews_socket_set_server_cert(s, litews_loopback_ca_pem);
+    litews_socket_set_user_object(s, st);
+    litews_socket_set_on_disconnected(s, on_disconnected);
+    litews_socket_set_on_state_changed(s, on_state);
+    litews_socket_set_auto_reconnect(s, 20, 50, litews_false);
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+    LITEWS_TEST_CHECK(litews_test_wait(&st->connected, RECONNECTS + 1, 30000));
+    litews_socket_disconnect_and_release(s);
+    LITEWS_TEST_CHECK(litews_test_wait(&st->disconnected, 1, 5000));
+    litews_loopback_get_stats(lb, &server);
+    litews_loopback_stop(lb);
+    litews_tls_context_trim();
+
+    LITEWS_TEST_CHECK(st->counted > 0);
+    if (st->counted == 0)
+    {
+        return;
+    }
+    printf("TLS context %-8s: %d reconnects, %llu heap allocations of %llu bytes and %llu us CPU each "
+           "on the work thread, %u of %u handshakes resumed\n",
+           rebuild ? "rebuilt" : "kept", st->counted, st->allocs / st->counted, st->alloc_bytes / st->counted,
+           st->cpu_us / st->counted, server.handshakes_resumed, server.connections);
+}
+
+int main(void)
+{
+    _tls_reconnect_state kept, rebuilt;
+
+    signal(SIGPIPE, SIG_IGN); // writes race the drops of the flaky server
+    run_reconnects(1, &rebuilt);
+    run_reconnects(0, &kept);
+    if (!kept.counted || !rebuilt.counted)
+    {
+        return LITEWS_TEST_RESULT();
+    }
+    printf("saved per reconnect: %lld heap allocations, %lld bytes, %lld us CPU\n",
+           (long long)(rebuilt.allocs / rebuilt.counted) - (long long)(kept.allocs / kept.counted),
+           (long long)(rebuilt.alloc_bytes / rebuilt.counted) - (long long)(kept.alloc_bytes / kept.counted),
+           (long long)(rebuilt.cpu_us / rebuilt.counted) - (long long)(kept.cpu_us / kept.counted));
+#if BENCH_COUNTS_ALLOCS
+    // the seed, the CA chain and the config aren't set up again
+    LITEWS_TEST_CHECK(kept.allocs / kept.counted < rebuilt.allocs / rebuilt.counted);
+#endif
+    return LITEWS_TEST_RESULT();
+}
+
+#else
+
+int main(void)
+{
+    printf("built without mbedtls, no TLS reconnects to measure\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef __LITEWS_TEST_H__
+#define __LITEWS_TEST_H__ 1
+
+// shared by the host tests and benchmarks: a check that counts failures, clocks and waiting
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+static int _litews_test_failures = 0;
+
+#define LITEWS_TEST_CHECK(cond) \
+    do { \
+        if (!(cond)) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            _litews_test_failures++; \
+        } \
+    } while (0)
+
+// exit status of a test: 0 when every check passed
+#define LITEWS_TEST_RESULT() (_litews_test_failures ? 1 : 0)
+
+static unsigned long long litews_test_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + (unsigned long long)ts.tv_nsec / 1000ULL;
+}
+
+static unsigned long long litews_test_now_ms(void)
+{
+    return litews_test_now_us() / 1000ULL;
+}
+
+// CPU time of the whole process, every thread of it
+static unsigned long long litews_test_cpu_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + (unsigned long long)ts.tv_nsec / 1000ULL;
+}
+
+// waits until '*flag' is at least 'value', returns 0 if 'timeout_ms' passed first
+static int litews_test_wait(volatile int * flag, const int value, const unsigned int timeout_ms)
+{
+    const unsigned long long until = litews_test_now_ms() + timeout_ms;
+
+    while (*flag < value)
+    {
+        if (litews_test_now_ms() >= until)
+        {
+            return 0;
+        }
+        usleep(1000);
+    }
+    return 1;
+}
+
+#endif
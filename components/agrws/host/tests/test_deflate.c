@@ -0,0 +1,453 @@
+// permessage-deflate against zlib: messages compressed here inflate with zlib and the other way around,
+// for every window from 8 to 15 bits, with and without context takeover, then over the loopback server
+// a text that doesn't shrink goes out as is and one that inflates beyond the text limit ends the link
+
+#include <string.h>
+#include <stdlib.h>
+#include <zlib.h>
+
+#include "litewebsocket.h"
+#include "litews_deflate.h"
+#include "litews_memory.h"
+#include "litews_socket.h"
+#include "litews_loopback.h"
+#include "litews_test.h"
+
+#define MESSAGES 30
+
+static const char * k_words[] = {
+    "\"header\":{", "\"namespace\":\"", "SpeechRecognizer", "\"name\":\"", "Recognize", "\"messageId\":\"",
+    "\"payload\":{", "\"text\":\"", "play some music", "what is the weather", "\"volume\":", "\"seq\":",
+    "AudioPlayer", "\"token\":\"", "},", "\",", "true", "false"};
+
+typedef struct _deflate_buf_struct
+{
+    unsigned char * data;
+    size_t len;
+    size_t cap;
+} _deflate_buf;
+
+// JSON-like text of 'len' bytes, the words repeat within and across messages
+static void make_text(char * buf, const size_t len, unsigned int * seed)
+{
+    size_t pos = 0, n = 0;
+    const char * word = NULL;
+    char number[16];
+
+    while (pos < len)
+    {
+        if (rand_r(seed) % 4 == 0)
+        {
+            snprintf(number, sizeof(number), "%u", (unsigned int)rand_r(seed) % 100000);
+            word = number;
+        }
+        else
+        {
+            word = k_words[(unsigned int)rand_r(seed) % (sizeof(k_words) / sizeof(k_words[0]))];
+        }
+        n = strlen(word);
+        n = (n < len - pos) ? n : len - pos;
+        memcpy(buf + pos, word, n);
+        pos += n;
+    }
+    buf[len] = 0;
+}
+
+// random two byte UTF-8 characters, each of their bytes a 9 bit literal of the fixed huffman codes,
+// chance matches don't make up for that, so it doesn't shrink; 'len' is even
+static void make_noise(char * buf, const size_t len, unsigned int * seed)
+{
+    size_t i = 0;
+
+    for (i = 0; i + 1 < len; i += 2)
+    {
+        buf[i] = (char)(0xc2 + rand_r(seed) % 30);
+        buf[i + 1] = (char)(0x90 + rand_r(seed) % 48);
+    }
+    buf[len] = 0;
+}
+
+static litews_bool sink_append(void * user, const unsigned char * data, const size_t len)
+{
+    _deflate_buf * b = (_deflate_buf *)user;
+
+    if (b->len + len > b->cap)
+    {
+        return litews_false;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    return litews_true;
+}
+
+// 'packed' with its stripped tail put back through a zlib raw inflater, 1 when it gives 'text'
+static int zlib_inflate_equals(z_stream * z, const unsigned char * packed, const size_t packed_len,
+                               const char * text, const size_t len, unsigned char * out, const size_t out_cap)
+{
+    static const unsigned char k_tail[4] = {0x00, 0x00, 0xff, 0xff};
+    int ret = Z_OK;
+
+    z->next_out = out;
+    z->avail_out = (uInt)out_cap;
+    z->next_in = (Bytef *)packed;
+    z->avail_in = (uInt)packed_len;
+    ret = inflate(z, Z_SYNC_FLUSH);
+    if (ret != Z_OK && ret != Z_BUF_ERROR)
+    {
+        return 0;
+    }
+    z->next_in = (Bytef *)k_tail;
+    z->avail_in = sizeof(k_tail);
+    ret = inflate(z, Z_SYNC_FLUSH);
+    if (ret != Z_OK && ret != Z_BUF_ERROR)
+    {
+        return 0;
+    }
+    return (out_cap - z->avail_out == len && memcmp(out, text, len) == 0) ? 1 : 0;
+}
+
+// litews compresses, zlib inflates
+static void run_client_window(const int bits, const litews_bool no_context_takeover)
+{
+    const size_t window = (size_t)1 << bits;
+    const size_t rep_len = window / 2 > 1024 ? 1024 : window / 2;
+    const size_t max_len = window * 3 > 4096 ? window * 3 : 4096;
+    unsigned char * out = (unsigned char *)malloc(max_len);
+    char * rep = (char *)malloc(rep_len + 1);
+    char * text = (char *)malloc(max_len + 1);
+    unsigned char * packed = NULL;
+    size_t packed_len = 0, first_len = 0, second_len = 0, len = 0;
+    unsigned int seed = (unsigned int)bits;
+    char offer[128];
+    const char * error = NULL;
+    _litews_deflate * d = NULL;
+    z_stream z;
+    int i = 0, round_trips = 0;
+
+    snprintf(offer, sizeof(offer), "permessage-deflate; client_max_window_bits=%d%s", bits,
+             no_context_takeover ? "; client_no_context_takeover; server_no_context_takeover" : "");
+    d = litews_deflate_create(offer, bits < 9 ? 9 : bits, no_context_takeover, &error);
+    memset(&z, 0, sizeof(z));
+    LITEWS_TEST_CHECK(d != NULL && out && rep && text && inflateInit2(&z, -bits) == Z_OK);
+    if (!d || !out || !rep || !text)
+    {
+        goto done;
+    }
+    make_text(rep, rep_len, &seed);
+
+    // the same message twice: with takeover the second one is little more than a back reference
+    for (i = 0; i < 2; i++)
+    {
+        packed = litews_deflate_message(d, (const unsigned char *)rep, rep_len, &packed_len);
+        LITEWS_TEST_CHECK(packed != NULL);
+        if (!packed)
+        {
+            goto done;
+        }
+        LITEWS_TEST_CHECK(zlib_inflate_equals(&z, packed, packed_len, rep, rep_len, out, max_len));
+        if (no_context_takeover)
+        {
+            inflateReset(&z);
+        }
+        litews_free(packed);
+        if (i == 0)
+        {
+            first_len = packed_len;
+        }
+    }
+    second_len = packed_len;
+    LITEWS_TEST_CHECK(no_context_takeover ? second_len == first_len : second_len * 4 < first_len);
+
+    // a message that doesn't shrink is sent as is, the peer's inflater never sees it
+    make_noise(text, 2000, &seed);
+    packed = litews_deflate_message(d, (const unsigned char *)text, 2000, &packed_len);
+    LITEWS_TEST_CHECK(packed == NULL);
+    litews_free(packed);
+
+    for (i = 0; i < MESSAGES; i++)
+    {
+        len = (i == 0) ? rep_len : 50 + (size_t)rand_r(&seed) % (max_len - 50);
+        if (i == 0)
+        {
+            memcpy(text, rep, rep_len + 1); // still in the window across the uncompressed one
+        }
+        else
+        {
+            make_text(text, len, &seed);
+        }
+        packed = litews_deflate_message(d, (const unsigned char *)text, len, &packed_len);
+        LITEWS_TEST_CHECK(packed != NULL);
+        if (!packed)
+        {
+            continue;
+        }
+        if (i == 0 && !no_context_takeover)
+        {
+            LITEWS_TEST_CHECK(packed_len * 4 < first_len);
+        }
+        LITEWS_TEST_CHECK(zlib_inflate_equals(&z, packed, packed_len, text, len, out, max_len));
+        if (no_context_takeover)
+        {
+            inflateReset(&z);
+        }
+        litews_free(packed);
+        round_trips++;
+    }
+    printf("client window %2d%s: %d round trips, a repeated %u byte text %u then %u bytes\n",
+           bits, no_context_takeover ? " no takeover" : "", round_trips + 2,
+           (unsigned int)rep_len, (unsigned int)first_len, (unsigned int)second_len);
+
+done:
+    inflateEnd(&z);
+    litews_deflate_delete(d);
+    free(out);
+    free(rep);
+    free(text);
+}
+
+// zlib compresses with a sync flush and the tail cut, as a server does, litews inflates it in slices;
+// zlib has no raw 8 bit deflate, for that window litews' own output is fed back
+static void run_server_window(const int bits, const litews_bool no_context_takeover)
+{
+    const size_t window = (size_t)1 << bits;
+    const size_t max_len = window * 4 > 4096 ? window * 4 : 4096;
+    char * text = (char *)malloc(max_len + 1);
+    unsigned char * packed = (unsigned char *)malloc(max_len * 2 + 64);
+    unsigned char * own = NULL;
+    size_t len = 0, packed_len = 0, pos = 0, slice = 0;
+    unsigned int seed = (unsigned int)bits * 31;
+    char responce[128];
+    const char * error = NULL;
+    _litews_deflate * d = NULL;
+    _litews_deflate * d8 = NULL;
+    _deflate_buf got;
+    z_stream z;
+    litews_bool ok = litews_true;
+    int i = 0, round_trips = 0;
+
+    memset(&z, 0, sizeof(z));
+    memset(&got, 0, sizeof(got));
+    got.cap = max_len;
+    got.data = (unsigned char *)malloc(got.cap);
+    snprintf(responce, sizeof(responce), "permessage-deflate; server_max_window_bits=%d%s", bits,
+             no_context_takeover ? "; client_no_context_takeover; server_no_context_takeover" : "");
+    d = litews_deflate_create(responce, 15, no_context_takeover, &error);
+    if (bits < 9)
+    {
+        d8 = litews_deflate_create("permessage-deflate; client_max_window_bits=8", 9, no_context_takeover, &error);
+        LITEWS_TEST_CHECK(d8 != NULL);
+    }
+    else
+    {
+        LITEWS_TEST_CHECK(deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -bits, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+    }
+    LITEWS_TEST_CHECK(d != NULL && text && packed && got.data);
+    if (!d || !text || !packed || !got.data || (bits < 9 && !d8))
+    {
+        goto done;
+    }
+
+    for (i = 0; i < MESSAGES; i++)
+    {
+        len = 50 + (size_t)rand_r(&seed) % (max_len - 50);
+        make_text(text, len, &seed);
+        if (d8)
+        {
+            own = litews_deflate_message(d8, (const unsigned char *)text, len, &packed_len);
+            if (!own)
+            {
+                continue; // sent as is
+            }
+            memcpy(packed, own, packed_len);
+            litews_free(own);
+        }
+        else
+        {
+            z.next_in = (Bytef *)text;
+            z.avail_in = (uInt)len;
+            z.next_out = packed;
+            z.avail_out = (uInt)(max_len * 2 + 64);
+            LITEWS_TEST_CHECK(deflate(&z, Z_SYNC_FLUSH) == Z_OK && z.avail_in == 0);
+            packed_len = max_len * 2 + 64 - z.avail_out - 4; // 00 00 ff ff
+            if (no_context_takeover)
+            {
+                deflateReset(&z);
+            }
+        }
+
+        got.len = 0;
+        ok = litews_true;
+        for (pos = 0; pos < packed_len && ok; pos += slice)
+        {
+            slice = 1 + (pos * 37 + (size_t)i) % 211;
+            slice = (slice < packed_len - pos) ? slice : packed_len - pos;
+            ok = litews_inflate_message(d, packed + pos, slice, pos + slice == packed_len, sink_append, &got);
+        }
+        LITEWS_TEST_CHECK(ok && got.len == len && memcmp(got.data, text, len) == 0);
+        round_trips++;
+    }
+    printf("server window %2d%s: %d messages inflated in slices\n",
+           bits, no_context_takeover ? " no takeover" : "", round_trips);
+    LITEWS_TEST_CHECK(round_trips > MESSAGES / 2);
+
+done:
+    if (bits >= 9)
+    {
+        deflateEnd(&z);
+    }
+    litews_deflate_delete(d);
+    litews_deflate_delete(d8);
+    free(got.data);
+    free(text);
+    free(packed);
+}
+
+// over the loopback server
+
+typedef struct _deflate_state_struct
+{
+    volatile int connected;
+    volatile int disconnected;
+    volatile int texts; // echoes at the client
+    char * last;
+    size_t last_len;
+    unsigned long long inflated_at_server; // of the longest text
+} _deflate_state;
+
+static void on_connected(litews_socket s)
+{
+    ((_deflate_state *)litews_socket_get_user_object(s))->connected = 1;
+}
+
+static void on_disconnected(litews_socket s)
+{
+    ((_deflate_state *)litews_socket_get_user_object(s))->disconnected = 1;
+}
+
+static void on_text(litews_socket s, const char * text, const unsigned int length)
+{
+    _deflate_state * st = (_deflate_state *)litews_socket_get_user_object(s);
+
+    free(st->last);
+    st->last = (char *)malloc(length + 1);
+    if (st->last)
+    {
+        memcpy(st->last, text, length);
+        st->last[length] = 0;
+    }
+    st->last_len = length;
+    st->texts++;
+}
+
+static void on_frame(void * user, const int conn, const int opcode, const int is_finished,
+                     const unsigned char * payload, const size_t len)
+{
+    _deflate_state * st = (_deflate_state *)user;
+
+    if (opcode == 0x1 && len > st->inflated_at_server)
+    {
+        st->inflated_at_server = len;
+    }
+}
+
+static int echoed(_deflate_state * st, litews_socket s, const char * text)
+{
+    const int texts = st->texts;
+
+    LITEWS_TEST_CHECK(litews_socket_send_text(s, text) == litews_true);
+    return litews_test_wait(&st->texts, texts + 1, 5000) && st->last && strcmp(st->last, text) == 0;
+}
+
+static void run_loopback(void)
+{
+    const size_t big_len = LITEWS_MAX_TEXT_MESSAGE_SIZE + LITEWS_MAX_TEXT_MESSAGE_SIZE / 2;
+    litews_loopback_config config;
+    litews_loopback_stats server;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+    _deflate_state st;
+    char * text = (char *)malloc(big_len + 1);
+    unsigned int seed = 7;
+    unsigned int deflated = 0;
+    int i = 0;
+
+    memset(&config, 0, sizeof(config));
+    memset(&st, 0, sizeof(st));
+    config.echo_text = 1;
+    config.deflate_window_bits = 15;
+    config.on_frame = on_frame;
+    config.user = &st;
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL && text != NULL);
+    if (!lb || !text)
+    {
+        free(text);
+        return;
+    }
+
+    s = litews_socket_create();
+    litews_socket_set_url(s, "ws", "127.0.0.1", litews_loopback_port(lb), "/");
+    litews_socket_set_transport(s, litews_transport_tcp());
+    litews_socket_set_user_object(s, &st);
+    litews_socket_set_on_connected(s, on_connected);
+    litews_socket_set_on_disconnected(s, on_disconnected);
+    litews_socket_set_on_received_text(s, on_text);
+    litews_socket_set_deflate(s, 11, litews_false);
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+    LITEWS_TEST_CHECK(litews_test_wait(&st.connected, 1, 5000));
+
+    // context taken over from one message to the next, both ways
+    make_text(text, 600, &seed);
+    for (i = 0; i < 10; i++)
+    {
+        LITEWS_TEST_CHECK(echoed(&st, s, text));
+    }
+    litews_loopback_get_stats(lb, &server);
+    LITEWS_TEST_CHECK(server.messages_deflated_in == 10 && server.inflated_in == 10 * 600);
+    LITEWS_TEST_CHECK(server.payload_in[1] * 4 < server.inflated_in);
+    deflated = server.messages_deflated_in;
+
+    // noise goes out as is, compressed or not the echo comes back intact
+    make_noise(text, 3000, &seed);
+    LITEWS_TEST_CHECK(echoed(&st, s, text));
+    litews_loopback_get_stats(lb, &server);
+    LITEWS_TEST_CHECK(server.messages_deflated_in == deflated && server.frames_in[1] == 11);
+
+    // just below the limit
+    make_text(text, LITEWS_MAX_TEXT_MESSAGE_SIZE - 1024, &seed);
+    LITEWS_TEST_CHECK(echoed(&st, s, text));
+
+    // a few KB on the wire, beyond the limit once inflated: the client ends the link instead of handing it out
+    make_text(text, big_len, &seed);
+    LITEWS_TEST_CHECK(litews_socket_send_text(s, text) == litews_true);
+    LITEWS_TEST_CHECK(litews_test_wait(&st.disconnected, 1, 5000));
+    litews_loopback_get_stats(lb, &server);
+    printf("loopback: %d texts echoed, %llu text bytes inflated at the server from %llu on the wire\n",
+           st.texts, server.inflated_in, server.payload_in[1]);
+    LITEWS_TEST_CHECK(st.inflated_at_server == big_len);
+    LITEWS_TEST_CHECK(st.texts == 12 && st.last_len < big_len);
+
+    // the socket ended on its own and is freed already
+    litews_loopback_stop(lb);
+    free(st.last);
+    free(text);
+}
+
+int main(void)
+{
+    int bits = 0;
+
+    litews_mem_init(); // the pool lock, a socket takes it otherwise
+    for (bits = 8; bits <= 15; bits++)
+    {
+        run_client_window(bits, litews_false);
+        run_server_window(bits, litews_false);
+    }
+    run_client_window(8, litews_true);
+    run_client_window(15, litews_true);
+    run_server_window(9, litews_true);
+    run_server_window(15, litews_true);
+    litews_mem_release();
+    run_loopback();
+    return LITEWS_TEST_RESULT();
+}
@@ -0,0 +1,299 @@
+// the address cache and the connect race: a cached name isn't resolved again until it expires, an
+// expired one is kept when resolving fails; a blackholed address holds the live one back by the
+// stagger only, a refused one not at all, and a socket gets through a name whose first address is blackholed
+//
+// built with its own litews_dns.c, a cache lifetime of LITEWS_DNS_CACHE_TTL_MS and the resolver below
+
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <arpa/inet.h>
+
+#include "litewebsocket.h"
+#include "litews_dns.h"
+#include "litews_memory.h"
+#include "litews_loopback.h"
+#include "litews_test.h"
+
+#define SLACK_MS 60
+#define ATTEMPT_MS 400
+
+static volatile int resolves = 0;
+static volatile int resolve_fails = 0;
+
+// 'live.test' is 127.0.0.1, 'race.test' is the blackholed 127.0.0.2 and then 127.0.0.1, nothing else resolves
+int test_dns_getaddrinfo(const char * host, const char * service, const struct addrinfo * hints, struct addrinfo ** result)
+{
+    struct addrinfo * first = NULL;
+    int ret = 0;
+
+    resolves++;
+    if (resolve_fails)
+    {
+        return EAI_AGAIN;
+    }
+    if (strcmp(host, "live.test") == 0)
+    {
+        return getaddrinfo("127.0.0.1", service, hints, result);
+    }
+    if (strcmp(host, "race.test") != 0)
+    {
+        return EAI_NONAME;
+    }
+    // glibc frees a list node by node, so two lists chain into one
+    ret = getaddrinfo("127.0.0.2", service, hints, &first);
+    if (ret != 0)
+    {
+        return ret;
+    }
+    ret = getaddrinfo("127.0.0.1", service, hints, &first->ai_next);
+    if (ret != 0)
+    {
+        freeaddrinfo(first);
+        return ret;
+    }
+    *result = first;
+    return 0;
+}
+
+static void make_addr(_litews_dns_addr * a, const char * ip, const int port)
+{
+    struct sockaddr_in * in = (struct sockaddr_in *)&a->addr;
+
+    memset(a, 0, sizeof(*a));
+    in->sin_family = AF_INET;
+    in->sin_port = htons((unsigned short)port);
+    inet_pton(AF_INET, ip, &in->sin_addr);
+    a->addr_len = sizeof(*in);
+    a->family = AF_INET;
+}
+
+static int addr_port(const struct sockaddr_storage * addr)
+{
+    return ntohs(((const struct sockaddr_in *)addr)->sin_port);
+}
+
+// a listener on 'ip':'port' (0 - any port), 'backlog' 0 and one connect filling its accept queue
+// make it blackholed, the kernel drops the SYNs of later connects and they hang
+static int listener_open(const char * ip, const int port, const int backlog, int * filler)
+{
+    _litews_dns_addr a;
+    socklen_t len = sizeof(a.addr);
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+
+    make_addr(&a, ip, port);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, (struct sockaddr *)&a.addr, a.addr_len) != 0 || listen(fd, backlog) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    if (filler)
+    {
+        getsockname(fd, (struct sockaddr *)&a.addr, &len);
+        *filler = socket(AF_INET, SOCK_STREAM, 0);
+        connect(*filler, (struct sockaddr *)&a.addr, a.addr_len);
+        usleep(20000);
+    }
+    return fd;
+}
+
+static int listener_port(const int fd)
+{
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+
+    getsockname(fd, (struct sockaddr *)&addr, &len);
+    return addr_port(&addr);
+}
+
+static void run_cache(void)
+{
+    _litews_dns_addr addrs[LITEWS_DNS_MAX_ADDRS];
+    int n = 0;
+
+    resolves = 0;
+    n = litews_dns_resolve("live.test", 80, addrs, LITEWS_DNS_MAX_ADDRS);
+    LITEWS_TEST_CHECK(n == 1 && addr_port(&addrs[0].addr) == 80 && resolves == 1);
+    // fresh, from the cache
+    n = litews_dns_resolve("live.test", 80, addrs, LITEWS_DNS_MAX_ADDRS);
+    LITEWS_TEST_CHECK(n == 1 && resolves == 1);
+    // another port is another entry
+    n = litews_dns_resolve("live.test", 443, addrs, LITEWS_DNS_MAX_ADDRS);
+    LITEWS_TEST_CHECK(n == 1 && addr_port(&addrs[0].addr) == 443 && resolves == 2);
+    // forgotten, resolved again
+    litews_dns_forget("live.test", 80);
+    n = litews_dns_resolve("live.test", 80, addrs, LITEWS_DNS_MAX_ADDRS);
+    LITEWS_TEST_CHECK(n == 1 && resolves == 3);
+
+    // expired, resolved again
+    usleep((LITEWS_DNS_CACHE_TTL_MS + SLACK_MS) * 1000);
+    n = litews_dns_resolve("live.test", 80, addrs, LITEWS_DNS_MAX_ADDRS);
+    LITEWS_TEST_CHECK(n == 1 && resolves == 4);
+    n = litews_dns_resolve("live.test", 80, addrs, LITEWS_DNS_MAX_ADDRS);
+    LITEWS_TEST_CHECK(n == 1 && resolves == 4);
+
+    // expired and the resolver down: the expired addresses, tried again on every call
+    usleep((LITEWS_DNS_CACHE_TTL_MS + SLACK_MS) * 1000);
+    resolve_fails = 1;
+    memset(addrs, 0, sizeof(addrs));
+    n = litews_dns_resolve("live.test", 80, addrs, LITEWS_DNS_MAX_ADDRS);
+    LITEWS_TEST_CHECK(n == 1 && resolves == 5 && addr_port(&addrs[0].addr) == 80 &&
+                      ((struct sockaddr_in *)&addrs[0].addr)->sin_addr.s_addr == htonl(INADDR_LOOPBACK));
+    n = litews_dns_resolve("live.test", 80, addrs, LITEWS_DNS_MAX_ADDRS);
+    LITEWS_TEST_CHECK(n == 1 && resolves == 6);
+    // nothing to fall back on
+    LITEWS_TEST_CHECK(litews_dns_resolve("other.test", 80, addrs, LITEWS_DNS_MAX_ADDRS) == 0);
+    litews_dns_forget("live.test", 80);
+    LITEWS_TEST_CHECK(litews_dns_resolve("live.test", 80, addrs, LITEWS_DNS_MAX_ADDRS) == 0);
+
+    // back up, the name is fresh again
+    resolve_fails = 0;
+    n = litews_dns_resolve("live.test", 80, addrs, LITEWS_DNS_MAX_ADDRS);
+    LITEWS_TEST_CHECK(n == 1 && resolves == 9);
+    n = litews_dns_resolve("live.test", 80, addrs, LITEWS_DNS_MAX_ADDRS);
+    LITEWS_TEST_CHECK(n == 1 && resolves == 9);
+    printf("cache: fresh names from the cache, expired ones resolved again, kept while resolving fails\n");
+}
+
+// races 'count' addresses, checks the winner is 'live_port' (0 - none) and took 'min_ms' .. 'max_ms'
+static void race(const char * label, const _litews_dns_addr * addrs, const int count, const int live_port,
+                 const unsigned int min_ms, const unsigned int max_ms)
+{
+    const unsigned long long start_ms = litews_test_now_ms();
+    const litews_socket_t fd = litews_dns_connect(addrs, count, ATTEMPT_MS);
+    const unsigned long long took_ms = litews_test_now_ms() - start_ms;
+    struct sockaddr_storage peer;
+    socklen_t len = sizeof(peer);
+
+    printf("race %-24s: %s in %llu ms\n", label, (fd != LITEWS_INVALID_SOCKET) ? "connected" : "no address answered", took_ms);
+    LITEWS_TEST_CHECK(took_ms + 5 >= min_ms && took_ms <= max_ms);
+    if (!live_port)
+    {
+        LITEWS_TEST_CHECK(fd == LITEWS_INVALID_SOCKET);
+        return;
+    }
+    LITEWS_TEST_CHECK(fd != LITEWS_INVALID_SOCKET);
+    if (fd == LITEWS_INVALID_SOCKET)
+    {
+        return;
+    }
+    LITEWS_TEST_CHECK(getpeername(fd, (struct sockaddr *)&peer, &len) == 0 && addr_port(&peer) == live_port);
+    // the winner is handed back blocking
+    LITEWS_TEST_CHECK((fcntl(fd, F_GETFL, 0) & O_NONBLOCK) == 0);
+    close(fd);
+}
+
+static void run_race(void)
+{
+    _litews_dns_addr addrs[LITEWS_DNS_MAX_ADDRS];
+    int filler = -1, refused_port = 0;
+    const int live = listener_open("127.0.0.1", 0, 16, NULL);
+    const int blackhole = listener_open("127.0.0.2", 0, 0, &filler);
+    int refused = listener_open("127.0.0.1", 0, 1, NULL);
+
+    LITEWS_TEST_CHECK(live >= 0 && blackhole >= 0 && refused >= 0);
+    if (live < 0 || blackhole < 0 || refused < 0)
+    {
+        return;
+    }
+    refused_port = listener_port(refused);
+    close(refused);
+
+    make_addr(&addrs[0], "127.0.0.2", listener_port(blackhole));
+    make_addr(&addrs[1], "127.0.0.1", listener_port(live));
+    race("blackholed, live", addrs, 2, listener_port(live),
+         LITEWS_CONNECT_STAGGER_MS, LITEWS_CONNECT_STAGGER_MS + SLACK_MS);
+
+    make_addr(&addrs[1], "127.0.0.2", listener_port(blackhole));
+    make_addr(&addrs[2], "127.0.0.1", listener_port(live));
+    race("blackholed twice, live", addrs, 3, listener_port(live),
+         2 * LITEWS_CONNECT_STAGGER_MS, 2 * LITEWS_CONNECT_STAGGER_MS + SLACK_MS);
+
+    make_addr(&addrs[0], "127.0.0.1", refused_port);
+    make_addr(&addrs[1], "127.0.0.1", listener_port(live));
+    race("refused, live", addrs, 2, listener_port(live), 0, SLACK_MS);
+
+    make_addr(&addrs[0], "127.0.0.1", listener_port(live));
+    make_addr(&addrs[1], "127.0.0.2", listener_port(blackhole));
+    race("live, blackholed", addrs, 2, listener_port(live), 0, SLACK_MS);
+
+    // every attempt times out, the last one started a stagger after the first
+    make_addr(&addrs[0], "127.0.0.2", listener_port(blackhole));
+    race("blackholed twice", addrs, 2, 0, ATTEMPT_MS + LITEWS_CONNECT_STAGGER_MS,
+         ATTEMPT_MS + LITEWS_CONNECT_STAGGER_MS + SLACK_MS);
+
+    close(filler);
+    close(blackhole);
+    close(live);
+}
+
+typedef struct _dns_state_struct
+{
+    volatile int connected;
+    volatile int disconnected;
+} _dns_state;
+
+static void on_connected(litews_socket s)
+{
+    ((_dns_state *)litews_socket_get_user_object(s))->connected = 1;
+}
+
+static void on_disconnected(litews_socket s)
+{
+    ((_dns_state *)litews_socket_get_user_object(s))->disconnected = 1;
+}
+
+// the server on 127.0.0.1, its port blackholed on 127.0.0.2, the address the name resolves to first
+static void run_socket(void)
+{
+    litews_loopback_config config;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+    _dns_state st;
+    unsigned long long start_ms = 0, took_ms = 0;
+    int blackhole = -1, filler = -1;
+
+    memset(&config, 0, sizeof(config));
+    memset(&st, 0, sizeof(st));
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL);
+    if (!lb)
+    {
+        return;
+    }
+    blackhole = listener_open("127.0.0.2", litews_loopback_port(lb), 0, &filler);
+    LITEWS_TEST_CHECK(blackhole >= 0);
+
+    s = litews_socket_create();
+    litews_socket_set_url(s, "ws", "race.test", litews_loopback_port(lb), "/");
+    litews_socket_set_transport(s, litews_transport_tcp());
+    litews_socket_set_user_object(s, &st);
+    litews_socket_set_on_connected(s, on_connected);
+    litews_socket_set_on_disconnected(s, on_disconnected);
+    start_ms = litews_test_now_ms();
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+    LITEWS_TEST_CHECK(litews_test_wait(&st.connected, 1, 5000));
+    took_ms = litews_test_now_ms() - start_ms;
+    printf("socket to race.test: connected in %llu ms\n", took_ms);
+    LITEWS_TEST_CHECK(took_ms + 5 >= LITEWS_CONNECT_STAGGER_MS && took_ms < LITEWS_CONNECT_TIMEOUT_MS);
+
+    litews_socket_disconnect_and_release(s);
+    LITEWS_TEST_CHECK(litews_test_wait(&st.disconnected, 1, 5000));
+    litews_loopback_stop(lb);
+    close(filler);
+    close(blackhole);
+}
+
+int main(void)
+{
+    signal(SIGPIPE, SIG_IGN);
+    litews_mem_init();
+    litews_dns_init();
+    run_cache();
+    run_race();
+    run_socket();
+    litews_mem_release();
+    return LITEWS_TEST_RESULT();
+}
@@ -0,0 +1,150 @@
+// keep-alive against a server that stops answering pings: the idle time grows while pings are answered,
+// the link is declared dead within that idle time plus the missed pong timeouts, and the next link
+// never pings later than the idle time the first one died at
+
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#include "litewebsocket.h"
+#include "litews_loopback.h"
+#include "litews_test.h"
+
+#define IDLE_MS 100
+#define PONG_TIMEOUT_MS 200
+#define MAX_MISSED 2
+#define ANSWERED_MS 1500 // per link
+#define LINKS 2
+#define PINGS 64
+#define SLACK_MS 30
+
+typedef struct _keepalive_state_struct
+{
+    volatile int links; // connected
+    volatile int disconnected;
+    volatile int deaths; // declared dead
+    unsigned long long connected_ms[LINKS];
+    unsigned long long dead_ms[LINKS];
+    unsigned long long ping_ms[LINKS][PINGS]; // arrivals at the server
+    int pings[LINKS];
+} _keepalive_state;
+
+static void on_disconnected(litews_socket s)
+{
+    ((_keepalive_state *)litews_socket_get_user_object(s))->disconnected = 1;
+}
+
+static void on_state(litews_socket s, int state)
+{
+    _keepalive_state * st = (_keepalive_state *)litews_socket_get_user_object(s);
+
+    if (state == litews_state_connected && st->links < LINKS)
+    {
+        st->connected_ms[st->links] = litews_test_now_ms();
+        st->links++;
+    }
+    else if (state == litews_state_waiting_reconnect && st->deaths < LINKS)
+    {
+        st->dead_ms[st->deaths] = litews_test_now_ms();
+        st->deaths++;
+    }
+}
+
+static void on_frame(void * user, const int conn, const int opcode, const int is_finished,
+                     const unsigned char * payload, const size_t len)
+{
+    _keepalive_state * st = (_keepalive_state *)user;
+
+    if (opcode == 0x9 && conn < LINKS && st->pings[conn] < PINGS)
+    {
+        st->ping_ms[conn][st->pings[conn]++] = litews_test_now_ms();
+    }
+}
+
+// pings of a link that were answered, those before it went silent
+static int answered(const _keepalive_state * st, const int link)
+{
+    int i = 0;
+
+    while (i < st->pings[link] && st->ping_ms[link][i] + SLACK_MS < st->connected_ms[link] + ANSWERED_MS)
+    {
+        i++;
+    }
+    return i;
+}
+
+int main(void)
+{
+    litews_loopback_config config;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+    _keepalive_state st;
+    unsigned long long first_gap = 0, last_gap = 0, ceiling = 0, gap = 0, gap_max = 0, silent_ms = 0;
+    int n = 0, i = 0;
+
+    signal(SIGPIPE, SIG_IGN);
+    memset(&config, 0, sizeof(config));
+    memset(&st, 0, sizeof(st));
+    config.pings_answered_ms = ANSWERED_MS;
+    config.on_frame = on_frame;
+    config.user = &st;
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL);
+    if (!lb)
+    {
+        return LITEWS_TEST_RESULT();
+    }
+
+    s = litews_socket_create();
+    litews_socket_set_url(s, "ws", "127.0.0.1", litews_loopback_port(lb), "/");
+    litews_socket_set_transport(s, litews_transport_tcp());
+    litews_socket_set_user_object(s, &st);
+    litews_socket_set_on_disconnected(s, on_disconnected);
+    litews_socket_set_on_state_changed(s, on_state);
+    litews_socket_set_keepalive(s, IDLE_MS, PONG_TIMEOUT_MS, MAX_MISSED);
+    litews_socket_set_auto_reconnect(s, 20, 50, litews_false);
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+    LITEWS_TEST_CHECK(litews_test_wait(&st.deaths, LINKS, 10000));
+    litews_socket_disconnect_and_release(s);
+    LITEWS_TEST_CHECK(litews_test_wait(&st.disconnected, 1, 5000));
+    litews_loopback_stop(lb);
+    if (st.deaths < LINKS)
+    {
+        return LITEWS_TEST_RESULT();
+    }
+
+    // answered pings come further apart
+    n = answered(&st, 0);
+    LITEWS_TEST_CHECK(n >= 6 && n < st.pings[0]);
+    if (n < 6 || n >= st.pings[0])
+    {
+        return LITEWS_TEST_RESULT();
+    }
+    first_gap = st.ping_ms[0][1] - st.ping_ms[0][0];
+    last_gap = st.ping_ms[0][n - 1] - st.ping_ms[0][n - 2];
+    // the first unanswered ping went out after the idle time the link dies at
+    ceiling = st.ping_ms[0][n] - st.ping_ms[0][n - 1];
+    silent_ms = st.connected_ms[0] + ANSWERED_MS;
+    printf("link 1: %d pings answered, idle %llu ms at first, %llu ms at last, died at %llu ms idle, "
+           "declared dead %llu ms after the server went silent\n",
+           n, first_gap, last_gap, ceiling, st.dead_ms[0] - silent_ms);
+    LITEWS_TEST_CHECK(first_gap + SLACK_MS >= IDLE_MS && first_gap <= IDLE_MS + SLACK_MS);
+    LITEWS_TEST_CHECK(last_gap > first_gap + IDLE_MS / 4);
+    LITEWS_TEST_CHECK(ceiling + SLACK_MS >= last_gap);
+    // dead within the idle time plus the missed pongs, not before the pongs were missed
+    LITEWS_TEST_CHECK(st.dead_ms[0] <= silent_ms + ceiling + MAX_MISSED * PONG_TIMEOUT_MS + SLACK_MS);
+    LITEWS_TEST_CHECK(st.dead_ms[0] + SLACK_MS >= st.ping_ms[0][n] + MAX_MISSED * PONG_TIMEOUT_MS);
+
+    // the next link stays below the idle time the first one died at
+    n = answered(&st, 1);
+    for (i = 1; i < n; i++)
+    {
+        gap = st.ping_ms[1][i] - st.ping_ms[1][i - 1];
+        gap_max = (gap > gap_max) ? gap : gap_max;
+    }
+    printf("link 2: %d pings answered, idle at most %llu ms\n", n, gap_max);
+    LITEWS_TEST_CHECK(n >= 6);
+    LITEWS_TEST_CHECK(gap_max <= ceiling + SLACK_MS / 3);
+    LITEWS_TEST_CHECK(st.dead_ms[1] <= st.connected_ms[1] + ANSWERED_MS + ceiling + MAX_MISSED * PONG_TIMEOUT_MS + SLACK_MS);
+    return LITEWS_TEST_RESULT();
+}
@@ -0,0 +1,152 @@
+// text and binary echo through the loopback server, over TCP and, when built in, over TLS
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "litewebsocket.h"
+#include "litews_loopback.h"
+#include "litews_test.h"
+
+#define TEXTS 100
+#define BIN_FRAME 1000
+
+typedef struct _echo_state_struct
+{
+    volatile int connected;
+    volatile int disconnected;
+    volatile int texts; // echoes received in order
+    volatile int text_errors;
+    volatile int bin_bytes;
+    volatile int bin_errors;
+} _echo_state;
+
+static void on_connected(litews_socket s)
+{
+    ((_echo_state *)litews_socket_get_user_object(s))->connected = 1;
+}
+
+static void on_disconnected(litews_socket s)
+{
+    ((_echo_state *)litews_socket_get_user_object(s))->disconnected = 1;
+}
+
+static void on_text(litews_socket s, const char * text, const unsigned int length)
+{
+    _echo_state * st = (_echo_state *)litews_socket_get_user_object(s);
+    char expected[32];
+
+    snprintf(expected, sizeof(expected), "text %d", st->texts);
+    if (length != strlen(expected) || memcmp(text, expected, length) != 0)
+    {
+        st->text_errors++;
+    }
+    st->texts++;
+}
+
+static void on_bin(litews_socket s, const void * data, const unsigned int length, int flag)
+{
+    _echo_state * st = (_echo_state *)litews_socket_get_user_object(s);
+    const unsigned char * bytes = (const unsigned char *)data;
+    unsigned int i = 0;
+
+    for (i = 0; i < length; i++)
+    {
+        if (bytes[i] != (unsigned char)((st->bin_bytes + i) * 7))
+        {
+            st->bin_errors++;
+            break;
+        }
+    }
+    st->bin_bytes += (int)length;
+}
+
+static void run_echo(const int use_tls)
+{
+    litews_loopback_config config;
+    litews_loopback_stats server;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+    _echo_state st;
+    unsigned char payload[BIN_FRAME];
+    char text[32];
+    int i = 0;
+
+    memset(&config, 0, sizeof(config));
+    memset(&st, 0, sizeof(st));
+    config.use_tls = use_tls;
+    config.echo_text = 1;
+    config.echo_binary = 1;
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL);
+    if (!lb)
+    {
+        return;
+    }
+
+    s = litews_socket_create();
+    litews_socket_set_url(s, use_tls ? "wss" : "ws", "127.0.0.1", litews_loopback_port(lb), "/");
+#ifdef LITEWS_HOST_TLS
+    if (use_tls)
+    {
+        litews_socket_set_transport(s, litews_transport_tls());
+        litews_socket_set_server_cert(s, litews_loopback_ca_pem);
+    }
+    else
+#endif
+    {
+        litews_socket_set_transport(s, litews_transport_tcp());
+    }
+    litews_socket_set_user_object(s, &st);
+    litews_socket_set_on_connected(s, on_connected);
+    litews_socket_set_on_disconnected(s, on_disconnected);
+    litews_socket_set_on_received_text(s, on_text);
+    litews_socket_set_on_received_bin(s, on_bin);
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+    LITEWS_TEST_CHECK(litews_test_wait(&st.connected, 1, 5000));
+
+    for (i = 0; i < TEXTS; i++)
+    {
+        snprintf(text, sizeof(text), "text %d", i);
+        LITEWS_TEST_CHECK(litews_socket_send_text(s, text) == litews_true);
+    }
+    for (i = 0; i < 3 * BIN_FRAME; i++)
+    {
+        payload[i % BIN_FRAME] = (unsigned char)(i * 7);
+        if (i % BIN_FRAME == BIN_FRAME - 1)
+        {
+            LITEWS_TEST_CHECK(litews_socket_send_binary(s, payload, BIN_FRAME,
+                              i < BIN_FRAME ? litews_frame_start : (i < 2 * BIN_FRAME ? litews_frame_continue : litews_frame_end)) == litews_true);
+        }
+    }
+
+    LITEWS_TEST_CHECK(litews_test_wait(&st.texts, TEXTS, 5000));
+    LITEWS_TEST_CHECK(litews_test_wait(&st.bin_bytes, 3 * BIN_FRAME, 5000));
+    LITEWS_TEST_CHECK(st.text_errors == 0);
+    LITEWS_TEST_CHECK(st.bin_errors == 0);
+
+    litews_socket_disconnect_and_release(s);
+    LITEWS_TEST_CHECK(litews_test_wait(&st.disconnected, 1, 5000));
+
+    litews_loopback_get_stats(lb, &server);
+    LITEWS_TEST_CHECK(server.connections == 1);
+    LITEWS_TEST_CHECK(server.frames_in[1] == TEXTS);
+    LITEWS_TEST_CHECK(server.frames_in[2] == 1 && server.frames_in[0] == 2);
+    LITEWS_TEST_CHECK(server.payload_in[2] + server.payload_in[0] == 3 * BIN_FRAME);
+    if (use_tls)
+    {
+        LITEWS_TEST_CHECK(server.handshakes_full == 1);
+        LITEWS_TEST_CHECK(server.records_in > 0);
+    }
+    printf("%s: %d texts and %d binary bytes echoed, %llu bytes on the wire\n",
+           use_tls ? "tls" : "tcp", st.texts, st.bin_bytes, server.wire_in);
+    litews_loopback_stop(lb);
+}
+
+int main(void)
+{
+    run_echo(0);
+#ifdef LITEWS_HOST_TLS
+    run_echo(1);
+#endif
+    return LITEWS_TEST_RESULT();
+}
@@ -0,0 +1,206 @@
+// the block cache over a long run: texts and audio sized chunks across reconnects of a flaky server,
+// then sockets created, used and released one after the other; once warm the pool misses no more,
+// keeps no more cached bytes and the heap doesn't grow
+
+#include <string.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <signal.h>
+
+#include "litewebsocket.h"
+#include "litews_memory.h"
+#include "litews_loopback.h"
+#include "litews_test.h"
+
+#define RECONNECTS 20
+#define WARMUP 4 // reconnects before the pool counters have to stay flat
+#define SOCKETS 20
+#define HEAP_WARMUP 6 // sockets before the heap has to, the C library sets up per thread arenas until then
+#define CHUNK_BYTES 640 // 20 ms of 16 kHz 16 bit PCM, the biggest pooled class
+#define CACHE_MAX_BYTES ((32 + 64) * 4 * LITEWS_MEM_POOL_DEPTH + 192 * LITEWS_MEM_POOL_DEPTH + 640 * (LITEWS_MEM_POOL_DEPTH / 2))
+
+typedef struct _soak_state_struct
+{
+    volatile int connected;
+    volatile int disconnected;
+    volatile int echoes;
+} _soak_state;
+
+static void on_connected(litews_socket s)
+{
+    ((_soak_state *)litews_socket_get_user_object(s))->connected++;
+}
+
+static void on_disconnected(litews_socket s)
+{
+    ((_soak_state *)litews_socket_get_user_object(s))->disconnected = 1;
+}
+
+static void on_text(litews_socket s, const char * text, const unsigned int length)
+{
+    ((_soak_state *)litews_socket_get_user_object(s))->echoes++;
+}
+
+static void on_bin(litews_socket s, const void * data, const unsigned int length, int flag)
+{
+    ((_soak_state *)litews_socket_get_user_object(s))->echoes++;
+}
+
+static litews_socket connect_socket(litews_loopback lb, _soak_state * st)
+{
+    litews_socket s = litews_socket_create();
+
+    litews_socket_set_url(s, "ws", "127.0.0.1", litews_loopback_port(lb), "/");
+    litews_socket_set_transport(s, litews_transport_tcp());
+    litews_socket_set_user_object(s, st);
+    litews_socket_set_on_connected(s, on_connected);
+    litews_socket_set_on_disconnected(s, on_disconnected);
+    litews_socket_set_on_received_text(s, on_text);
+    litews_socket_set_on_received_bin(s, on_bin);
+    return s;
+}
+
+// a text and a chunk every 5 ms, as the device sends events and recorded audio
+static void send_some(litews_socket s, const int count)
+{
+    unsigned char chunk[CHUNK_BYTES];
+    char text[160];
+    int i = 0;
+
+    memset(chunk, 0x5a, sizeof(chunk));
+    for (i = 0; i < count; i++)
+    {
+        snprintf(text, sizeof(text), "{\"header\":{\"name\":\"Recognize\",\"seq\":%d},\"payload\":{}}", i);
+        litews_socket_send_text(s, text);
+        litews_socket_send_binary(s, chunk, CHUNK_BYTES, litews_frame_one);
+        usleep(5000);
+    }
+}
+
+static void run_reconnects(void)
+{
+    litews_loopback_config config;
+    litews_socket_stats stats;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+    _soak_state st;
+    _litews_mem_stats mem, warm;
+    unsigned int cached_max = 0;
+    int reconnects = 0;
+
+    memset(&config, 0, sizeof(config));
+    memset(&st, 0, sizeof(st));
+    memset(&warm, 0, sizeof(warm));
+    config.echo_text = 1;
+    config.echo_binary = 1;
+    config.drop_min_ms = 150;
+    config.drop_max_ms = 300;
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL);
+    if (!lb)
+    {
+        return;
+    }
+
+    s = connect_socket(lb, &st);
+    litews_socket_set_auto_reconnect(s, 20, 50, litews_false);
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+    LITEWS_TEST_CHECK(litews_test_wait(&st.connected, 1, 5000));
+
+    while (reconnects < RECONNECTS)
+    {
+        send_some(s, 10);
+        litews_socket_get_stats(s, &stats);
+        litews_mem_get_stats(&mem);
+        cached_max = (mem.cached_bytes > cached_max) ? (unsigned int)mem.cached_bytes : cached_max;
+        if ((int)stats.reconnects == reconnects)
+        {
+            continue;
+        }
+        reconnects = (int)stats.reconnects;
+        if (reconnects == WARMUP)
+        {
+            warm = mem;
+        }
+    }
+    litews_mem_get_stats(&mem);
+    printf("%d reconnects, %d echoes: %u hits, %u misses (%u after %d reconnects), %u oversize, "
+           "at most %u bytes cached\n",
+           reconnects, st.echoes, mem.hits, mem.misses, mem.misses - warm.misses, WARMUP, mem.oversize, cached_max);
+    // warm, the pool serves nearly every small allocation, links come and go
+    LITEWS_TEST_CHECK(st.echoes > RECONNECTS * 10);
+    LITEWS_TEST_CHECK(mem.hits - warm.hits > 20 * (mem.misses - warm.misses));
+    LITEWS_TEST_CHECK(cached_max <= CACHE_MAX_BYTES);
+
+    litews_socket_disconnect_and_release(s);
+    LITEWS_TEST_CHECK(litews_test_wait(&st.disconnected, 1, 5000));
+    litews_loopback_stop(lb);
+}
+
+// the last socket gives the cache back, the heap in use is the same after every round; each round
+// has its own server, it keeps its links until stopped
+static void run_sockets(void)
+{
+    litews_loopback_config config;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+    _soak_state st;
+    _litews_mem_stats mem;
+    struct mallinfo2 heap;
+    size_t heap_warm = 0, heap_max = 0;
+    int i = 0, j = 0;
+
+    memset(&config, 0, sizeof(config));
+    config.echo_text = 1;
+    config.echo_binary = 1;
+    for (i = 0; i < SOCKETS; i++)
+    {
+        lb = litews_loopback_start(&config);
+        LITEWS_TEST_CHECK(lb != NULL);
+        if (!lb)
+        {
+            return;
+        }
+        memset(&st, 0, sizeof(st));
+        s = connect_socket(lb, &st);
+        LITEWS_TEST_CHECK(litews_socket_connect(s));
+        LITEWS_TEST_CHECK(litews_test_wait(&st.connected, 1, 5000));
+        send_some(s, 10);
+        LITEWS_TEST_CHECK(litews_test_wait(&st.echoes, 20, 5000));
+        litews_socket_disconnect_and_release(s);
+        LITEWS_TEST_CHECK(litews_test_wait(&st.disconnected, 1, 5000));
+
+        // on_disconnected runs before the work thread frees the socket
+        for (j = 0; j < 1000; j++)
+        {
+            litews_mem_get_stats(&mem);
+            if (mem.cached == 0)
+            {
+                break;
+            }
+            usleep(1000);
+        }
+        LITEWS_TEST_CHECK(mem.cached == 0 && mem.cached_bytes == 0);
+        litews_loopback_stop(lb);
+        usleep(10000); // the work thread is gone
+        heap = mallinfo2();
+        if (i == HEAP_WARMUP)
+        {
+            heap_warm = heap.uordblks;
+        }
+        if (i >= HEAP_WARMUP && heap.uordblks > heap_max)
+        {
+            heap_max = heap.uordblks;
+        }
+    }
+    printf("%d sockets: heap in use %zu bytes after %d, at most %zu after that\n", SOCKETS, heap_warm, HEAP_WARMUP, heap_max);
+    LITEWS_TEST_CHECK(heap_max <= heap_warm + 1024);
+}
+
+int main(void)
+{
+    signal(SIGPIPE, SIG_IGN); // writes race the drops of the flaky server
+    run_reconnects();
+    run_sockets();
+    return LITEWS_TEST_RESULT();
+}
@@ -0,0 +1,117 @@
+// uplink pacing: recorded audio queued at once reaches the server at the paced rate, the queueing delay
+// of the chunks shows in the stats
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "litewebsocket.h"
+#include "litews_loopback.h"
+#include "litews_test.h"
+
+#define RATE 32000 // 16 kHz 16 bit PCM
+#define BURST 3200 // 100 ms
+#define CHUNK_BYTES 1280 // 40 ms
+#define CHUNKS 75 // 3 s
+
+typedef struct _pacing_state_struct
+{
+    volatile int connected;
+    volatile int disconnected;
+    volatile int chunks; // at the server
+    unsigned long long first_us;
+    unsigned long long last_us;
+    unsigned long long bytes;
+} _pacing_state;
+
+static void on_connected(litews_socket s)
+{
+    ((_pacing_state *)litews_socket_get_user_object(s))->connected = 1;
+}
+
+static void on_disconnected(litews_socket s)
+{
+    ((_pacing_state *)litews_socket_get_user_object(s))->disconnected = 1;
+}
+
+static void on_frame(void * user, const int conn, const int opcode, const int is_finished,
+                     const unsigned char * payload, const size_t len)
+{
+    _pacing_state * st = (_pacing_state *)user;
+    const unsigned long long now_us = litews_test_now_us();
+
+    if (opcode != 0x2 && opcode != 0x0)
+    {
+        return;
+    }
+    if (st->chunks == 0)
+    {
+        st->first_us = now_us;
+    }
+    st->last_us = now_us;
+    st->bytes += len;
+    st->chunks++;
+}
+
+int main(void)
+{
+    litews_loopback_config config;
+    litews_socket_stats stats;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+    _pacing_state st;
+    unsigned char chunk[CHUNK_BYTES];
+    double rate = 0;
+    int i = 0;
+
+    memset(&config, 0, sizeof(config));
+    memset(&st, 0, sizeof(st));
+    memset(chunk, 0x42, sizeof(chunk));
+    config.on_frame = on_frame;
+    config.user = &st;
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL);
+    if (!lb)
+    {
+        return LITEWS_TEST_RESULT();
+    }
+
+    s = litews_socket_create();
+    litews_socket_set_url(s, "ws", "127.0.0.1", litews_loopback_port(lb), "/");
+    litews_socket_set_transport(s, litews_transport_tcp());
+    litews_socket_set_user_object(s, &st);
+    litews_socket_set_on_connected(s, on_connected);
+    litews_socket_set_on_disconnected(s, on_disconnected);
+    litews_socket_set_send_queue_limit(s, CHUNKS * CHUNK_BYTES * 2);
+    litews_socket_set_send_pacing(s, RATE, BURST);
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+    LITEWS_TEST_CHECK(litews_test_wait(&st.connected, 1, 5000));
+
+    // a recording read faster than real time, e.g. from a buffer that filled while connecting
+    for (i = 0; i < CHUNKS; i++)
+    {
+        LITEWS_TEST_CHECK(litews_socket_send_binary(s, chunk, CHUNK_BYTES,
+                          i == 0 ? litews_frame_start : (i == CHUNKS - 1 ? litews_frame_end : litews_frame_continue)) == litews_true);
+    }
+    LITEWS_TEST_CHECK(litews_test_wait(&st.chunks, CHUNKS, 10000));
+
+    // the burst goes at once, the rest at the rate
+    if (st.last_us > st.first_us)
+    {
+        rate = (double)(st.bytes - BURST) * 1000000.0 / (double)(st.last_us - st.first_us);
+    }
+    litews_socket_get_stats(s, &stats);
+    printf("%llu bytes over %llu ms at the server: %.0f B/s paced to %d B/s, %u pacer waits, "
+           "queueing delay last %u ms avg %u ms max %u ms\n",
+           st.bytes, (st.last_us - st.first_us) / 1000, rate, RATE, stats.pace_waits,
+           stats.send_delay_last_ms, stats.send_delay_avg_ms, stats.send_delay_max_ms);
+    LITEWS_TEST_CHECK(st.bytes == (unsigned long long)CHUNKS * CHUNK_BYTES);
+    LITEWS_TEST_CHECK(rate > RATE * 0.85 && rate < RATE * 1.15);
+    LITEWS_TEST_CHECK(stats.pace_waits > 0);
+    // the last chunk waited for nearly all of the paced time
+    LITEWS_TEST_CHECK(stats.send_delay_max_ms >= (CHUNKS * CHUNK_BYTES - BURST) * 1000ULL / RATE * 85 / 100);
+
+    litews_socket_disconnect_and_release(s);
+    LITEWS_TEST_CHECK(litews_test_wait(&st.disconnected, 1, 5000));
+    litews_loopback_stop(lb);
+    return LITEWS_TEST_RESULT();
+}
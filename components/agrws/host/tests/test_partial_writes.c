@@ -0,0 +1,132 @@
+// partial and blocked writes: a binary stream to a server that reads slowly through a small receive buffer
+// must arrive whole and in order, with the resumed writes counted
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "litewebsocket.h"
+#include "litews_loopback.h"
+#include "litews_test.h"
+
+#define FRAME_BYTES (64 * 1024)
+#define FRAMES 96
+
+typedef struct _stress_state_struct
+{
+    volatile int connected;
+    volatile int disconnected;
+    volatile int frames; // at the server
+    unsigned long long server_bytes;
+    int errors;
+} _stress_state;
+
+static unsigned char pattern(const unsigned long long offset)
+{
+    // differs for neighbouring bytes and blocks, so a lost or repeated part of a write shows
+    return (unsigned char)(offset ^ (offset >> 8) ^ (offset >> 16));
+}
+
+static void on_connected(litews_socket s)
+{
+    ((_stress_state *)litews_socket_get_user_object(s))->connected = 1;
+}
+
+static void on_disconnected(litews_socket s)
+{
+    ((_stress_state *)litews_socket_get_user_object(s))->disconnected = 1;
+}
+
+static void on_frame(void * user, const int conn, const int opcode, const int is_finished,
+                     const unsigned char * payload, const size_t len)
+{
+    _stress_state * st = (_stress_state *)user;
+    size_t i = 0;
+
+    if (opcode != 0x2 && opcode != 0x0)
+    {
+        return;
+    }
+    for (i = 0; i < len; i++)
+    {
+        if (payload[i] != pattern(st->server_bytes + i))
+        {
+            st->errors++;
+            break;
+        }
+    }
+    st->server_bytes += len;
+    st->frames++;
+}
+
+int main(void)
+{
+    litews_loopback_config config;
+    litews_socket_stats stats;
+    litews_loopback_stats server;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+    _stress_state st;
+    unsigned char * payload = (unsigned char *)malloc(FRAME_BYTES);
+    unsigned long long offset = 0;
+    litews_bool queued = litews_false;
+    int i = 0, j = 0, retries = 0;
+
+    memset(&config, 0, sizeof(config));
+    memset(&st, 0, sizeof(st));
+    config.rcvbuf = 4096;
+    config.read_size = 1024;
+    config.read_delay_us = 200;
+    config.on_frame = on_frame;
+    config.user = &st;
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL && payload != NULL);
+    if (!lb || !payload)
+    {
+        free(payload);
+        return LITEWS_TEST_RESULT();
+    }
+
+    s = litews_socket_create();
+    litews_socket_set_url(s, "ws", "127.0.0.1", litews_loopback_port(lb), "/");
+    litews_socket_set_transport(s, litews_transport_tcp());
+    litews_socket_set_user_object(s, &st);
+    litews_socket_set_on_connected(s, on_connected);
+    litews_socket_set_on_disconnected(s, on_disconnected);
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+    LITEWS_TEST_CHECK(litews_test_wait(&st.connected, 1, 5000));
+
+    for (i = 0; i < FRAMES; i++)
+    {
+        for (j = 0; j < FRAME_BYTES; j++)
+        {
+            payload[j] = pattern(offset + (unsigned long long)j);
+        }
+        // a full queue holds the sender back, the frame is offered again
+        while ((queued = litews_socket_send_binary(s, payload, FRAME_BYTES,
+                         i == 0 ? litews_frame_start : (i == FRAMES - 1 ? litews_frame_end : litews_frame_continue))) == litews_would_block)
+        {
+            retries++;
+            usleep(1000);
+        }
+        LITEWS_TEST_CHECK(queued == litews_true);
+        offset += FRAME_BYTES;
+    }
+
+    LITEWS_TEST_CHECK(litews_test_wait(&st.frames, FRAMES, 60000));
+    LITEWS_TEST_CHECK(st.errors == 0);
+    LITEWS_TEST_CHECK(st.server_bytes == (unsigned long long)FRAMES * FRAME_BYTES);
+
+    litews_socket_get_stats(s, &stats);
+    litews_loopback_get_stats(lb, &server);
+    printf("%u frames of %d bytes: %u partial writes, %u blocked writes, %u server reads, %d queue retries\n",
+           stats.frames_out[2] + stats.frames_out[0], FRAME_BYTES, stats.partial_writes, stats.write_blocks,
+           server.reads, retries);
+    LITEWS_TEST_CHECK(stats.partial_writes + stats.write_blocks > 0);
+    LITEWS_TEST_CHECK(stats.connects == 1);
+
+    litews_socket_disconnect_and_release(s);
+    LITEWS_TEST_CHECK(litews_test_wait(&st.disconnected, 1, 5000));
+    litews_loopback_stop(lb);
+    free(payload);
+    return LITEWS_TEST_RESULT();
+}
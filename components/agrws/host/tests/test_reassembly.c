@@ -0,0 +1,266 @@
+// fragmented text and binary messages through the receive ring: frame sizes around the header length
+// steps, prime ones and ones larger than the ring, so that headers and payload keep crossing its wrap
+// point; then fragmented messages echoed by a server reading in odd sized pieces. Texts come out whole,
+// binary slices in order, byte for byte.
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "litewebsocket.h"
+#include "litews_socket.h"
+#include "litews_loopback.h"
+#include "litews_test.h"
+
+#define MESSAGE_BYTES 20000 // within LITEWS_MAX_TEXT_MESSAGE_SIZE
+#define MESSAGES 40 // binary and text by turns
+#define ECHO_MESSAGES 60
+#define ECHO_FRAME 1021
+#define ECHO_READ_SIZE 1531
+
+typedef struct _reassembly_state_struct
+{
+    volatile int connected;
+    volatile int disconnected;
+    volatile int texts;
+    size_t frame; // of the stream, 0 - echo
+    size_t bin_received;
+    int errors;
+} _reassembly_state;
+
+static void on_connected(litews_socket s)
+{
+    ((_reassembly_state *)litews_socket_get_user_object(s))->connected = 1;
+}
+
+static void on_disconnected(litews_socket s)
+{
+    ((_reassembly_state *)litews_socket_get_user_object(s))->disconnected = 1;
+}
+
+// the server fills every frame with its index, counted across messages
+static size_t stream_frame_index(const _reassembly_state * st, const size_t message, const size_t offset)
+{
+    const size_t frames = (MESSAGE_BYTES + st->frame - 1) / st->frame;
+
+    return message * frames + offset / st->frame;
+}
+
+// texts and binary echoed: a text is its index and letters, binary bytes follow their offset in the stream
+static size_t echo_text_length(const int index)
+{
+    return 1 + ((size_t)index * 7919) % 30000;
+}
+
+static char echo_text_byte(const int index, const size_t offset)
+{
+    return (char)('A' + (index + offset) % 26);
+}
+
+static unsigned char echo_bin_byte(const size_t at)
+{
+    return (unsigned char)(at * 7 + at / 251);
+}
+
+static void on_text(litews_socket s, const char * text, const unsigned int length)
+{
+    _reassembly_state * st = (_reassembly_state *)litews_socket_get_user_object(s);
+    const int index = st->texts;
+    size_t i = 0;
+
+    if (st->frame)
+    {
+        // message 2 * index + 1 of the stream
+        if (length != MESSAGE_BYTES)
+        {
+            st->errors++;
+        }
+        for (i = 0; i < length && i < MESSAGE_BYTES; i++)
+        {
+            if (text[i] != (char)('a' + stream_frame_index(st, (size_t)(2 * index + 1), i) % 26))
+            {
+                st->errors++;
+                break;
+            }
+        }
+    }
+    else
+    {
+        if (length != echo_text_length(index))
+        {
+            st->errors++;
+        }
+        for (i = 0; i < length; i++)
+        {
+            if (text[i] != echo_text_byte(index, i))
+            {
+                st->errors++;
+                break;
+            }
+        }
+    }
+    st->texts++;
+}
+
+static void on_bin(litews_socket s, const void * data, const unsigned int length, int flag)
+{
+    _reassembly_state * st = (_reassembly_state *)litews_socket_get_user_object(s);
+    const unsigned char * bytes = (const unsigned char *)data;
+    size_t at = 0, i = 0;
+
+    for (i = 0; i < length; i++)
+    {
+        at = st->bin_received + i;
+        // message 2 * k of the stream
+        if (st->frame ? bytes[i] != (unsigned char)stream_frame_index(st, 2 * (at / MESSAGE_BYTES), at % MESSAGE_BYTES)
+                      : bytes[i] != echo_bin_byte(at))
+        {
+            st->errors++;
+            break;
+        }
+    }
+    st->bin_received += length;
+}
+
+static litews_socket connect_socket(litews_loopback lb, _reassembly_state * st)
+{
+    litews_socket s = litews_socket_create();
+
+    litews_socket_set_url(s, "ws", "127.0.0.1", litews_loopback_port(lb), "/");
+    litews_socket_set_transport(s, litews_transport_tcp());
+    litews_socket_set_user_object(s, st);
+    litews_socket_set_on_connected(s, on_connected);
+    litews_socket_set_on_disconnected(s, on_disconnected);
+    litews_socket_set_on_received_text(s, on_text);
+    litews_socket_set_on_received_bin(s, on_bin);
+    return s;
+}
+
+static void run_stream(const size_t frame)
+{
+    litews_loopback_config config;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+    _reassembly_state st;
+    const size_t bin_bytes = MESSAGES / 2 * MESSAGE_BYTES;
+    int done = 0;
+
+    memset(&config, 0, sizeof(config));
+    memset(&st, 0, sizeof(st));
+    st.frame = frame;
+    config.stream_bytes = MESSAGES * MESSAGE_BYTES;
+    config.stream_frame = frame;
+    config.stream_message = MESSAGE_BYTES;
+    config.stream_text = 1;
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL);
+    if (!lb)
+    {
+        return;
+    }
+
+    s = connect_socket(lb, &st);
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+    LITEWS_TEST_CHECK(litews_test_wait(&st.connected, 1, 5000));
+    done = litews_test_wait(&st.texts, MESSAGES / 2, 10000);
+    while (done && st.bin_received < bin_bytes && done++ < 5000)
+    {
+        usleep(1000);
+    }
+    printf("stream of %5zu byte frames through a %d byte ring: %d texts, %zu binary bytes, %d errors\n",
+           frame, SSL_REC_BUFFER_SIZE, st.texts, st.bin_received, st.errors);
+    LITEWS_TEST_CHECK(st.texts == MESSAGES / 2 && st.bin_received == bin_bytes);
+    LITEWS_TEST_CHECK(st.errors == 0 && st.disconnected == 0);
+
+    litews_socket_disconnect_and_release(s);
+    LITEWS_TEST_CHECK(litews_test_wait(&st.disconnected, 1, 5000));
+    litews_loopback_stop(lb);
+}
+
+// binary messages sent in ECHO_FRAME pieces and texts of any length, the server reads ECHO_READ_SIZE at a time
+static void run_echo(void)
+{
+    litews_loopback_config config;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+    _reassembly_state st;
+    unsigned char piece[ECHO_FRAME];
+    char * text = (char *)malloc(30001);
+    size_t sent = 0, len = 0, i = 0, j = 0;
+    litews_bool queued = litews_false;
+    int m = 0, texts = 0, flag = 0, done = 0;
+
+    memset(&config, 0, sizeof(config));
+    memset(&st, 0, sizeof(st));
+    config.echo_text = 1;
+    config.echo_binary = 1;
+    config.read_size = ECHO_READ_SIZE;
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL && text != NULL);
+    if (!lb || !text)
+    {
+        free(text);
+        return;
+    }
+
+    s = connect_socket(lb, &st);
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+    LITEWS_TEST_CHECK(litews_test_wait(&st.connected, 1, 5000));
+    for (m = 0; m < ECHO_MESSAGES; m++)
+    {
+        if (m % 2)
+        {
+            len = echo_text_length(texts);
+            for (i = 0; i < len; i++)
+            {
+                text[i] = echo_text_byte(texts, i);
+            }
+            text[len] = 0;
+            LITEWS_TEST_CHECK(litews_socket_send_text(s, text) == litews_true);
+            texts++;
+            continue;
+        }
+        // 3 .. 20 pieces, the last one shorter
+        len = (size_t)(3 + m % 18) * ECHO_FRAME - (size_t)m;
+        for (i = 0; i < len; i += ECHO_FRAME)
+        {
+            const size_t n = (len - i < ECHO_FRAME) ? len - i : ECHO_FRAME;
+            for (j = 0; j < n; j++)
+            {
+                piece[j] = echo_bin_byte(sent + j);
+            }
+            flag = (i == 0) ? litews_frame_start : (i + n == len ? litews_frame_end : litews_frame_continue);
+            while ((queued = litews_socket_send_binary(s, piece, (int)n, flag)) == litews_would_block)
+            {
+                usleep(100);
+            }
+            LITEWS_TEST_CHECK(queued == litews_true);
+            sent += n;
+        }
+    }
+    done = litews_test_wait(&st.texts, texts, 10000);
+    while (done && st.bin_received < sent && done++ < 5000)
+    {
+        usleep(1000);
+    }
+    printf("echo of %d byte pieces read %d bytes at a time: %d texts, %zu binary bytes, %d errors\n",
+           ECHO_FRAME, ECHO_READ_SIZE, st.texts, st.bin_received, st.errors);
+    LITEWS_TEST_CHECK(st.texts == texts && st.bin_received == sent);
+    LITEWS_TEST_CHECK(st.errors == 0 && st.disconnected == 0);
+
+    litews_socket_disconnect_and_release(s);
+    LITEWS_TEST_CHECK(litews_test_wait(&st.disconnected, 1, 5000));
+    litews_loopback_stop(lb);
+    free(text);
+}
+
+int main(void)
+{
+    run_stream(125); // the largest payload with a 2 byte header
+    run_stream(126); // the smallest with a 4 byte one
+    run_stream(1021);
+    run_stream(4093);
+    run_stream(SSL_REC_BUFFER_SIZE + 3);
+    run_stream(MESSAGE_BYTES); // a frame per message, three times the ring
+    run_echo();
+    return LITEWS_TEST_RESULT();
+}
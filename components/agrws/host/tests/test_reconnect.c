@@ -0,0 +1,283 @@
+// auto reconnect against a server that closes every link after a random time: the socket lives on,
+// numbered texts queued across the drops reach the server, and fragmented binary messages cut by a drop
+// with priority texts queued behind them leave no text inside a message on the next link
+
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include "litewebsocket.h"
+#include "litews_loopback.h"
+#include "litews_test.h"
+
+#define TEXTS 1500
+#define TEXT_GAP_US 2000
+#define DROPS 20
+#define MESSAGE_FRAMES 4
+#define FRAGMENT_BYTES 1024
+
+typedef struct _flaky_state_struct
+{
+    volatile int disconnected; // on_disconnected, only when the socket ends
+    volatile int states[4]; // entered, by litews_socket_state_t
+    pthread_mutex_t mutex; // the server calls from the thread of each link
+    unsigned char seen[TEXTS];
+    int unique;
+    int repeated;
+    int conn; // link of the message below
+    int message; // id of the binary message open on it, -1 - none
+    int messages; // finished at the server
+    int priority; // priority texts at the server
+    int interleaved; // data frames out of place within a message
+} _flaky_state;
+
+static void on_connected(litews_socket s)
+{
+}
+
+static void on_disconnected(litews_socket s)
+{
+    ((_flaky_state *)litews_socket_get_user_object(s))->disconnected++;
+}
+
+static void on_state(litews_socket s, int state)
+{
+    _flaky_state * st = (_flaky_state *)litews_socket_get_user_object(s);
+
+    if (state >= 0 && state < 4)
+    {
+        st->states[state]++;
+    }
+}
+
+static void on_frame(void * user, const int conn, const int opcode, const int is_finished,
+                     const unsigned char * payload, const size_t len)
+{
+    _flaky_state * st = (_flaky_state *)user;
+    char text[32];
+    int n = -1;
+
+    if (opcode != 0x1 || len >= sizeof(text))
+    {
+        return;
+    }
+    memcpy(text, payload, len);
+    text[len] = '\0';
+    if (sscanf(text, "n %d", &n) != 1 || n < 0 || n >= TEXTS)
+    {
+        return;
+    }
+    pthread_mutex_lock(&st->mutex);
+    if (st->seen[n])
+    {
+        st->repeated++; // a partly written frame is sent again from its start
+    }
+    else
+    {
+        st->seen[n] = 1;
+        st->unique++;
+    }
+    pthread_mutex_unlock(&st->mutex);
+}
+
+// every fragment carries the id of its message in each byte, a frame of another message or a text
+// while one is open means the lanes got mixed
+static void on_fragment(void * user, const int conn, const int opcode, const int is_finished,
+                        const unsigned char * payload, const size_t len)
+{
+    _flaky_state * st = (_flaky_state *)user;
+
+    pthread_mutex_lock(&st->mutex);
+    if (conn != st->conn)
+    {
+        st->conn = conn; // a message cut by the drop ends with its link
+        st->message = -1;
+    }
+    if (opcode == 0x1)
+    {
+        st->priority++;
+        st->interleaved += (st->message >= 0);
+    }
+    else if (opcode == 0x2 || opcode == 0x0)
+    {
+        if ((opcode == 0x2) != (st->message < 0) || len == 0 ||
+            (opcode == 0x0 && payload[0] != (unsigned char)st->message))
+        {
+            st->interleaved++;
+        }
+        st->message = is_finished ? -1 : (len ? payload[0] : 0);
+        st->messages += is_finished;
+    }
+    pthread_mutex_unlock(&st->mutex);
+}
+
+static void run_texts(void)
+{
+    litews_loopback_config config;
+    litews_loopback_stats server;
+    litews_socket_stats stats;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+    _flaky_state st;
+    char text[32];
+    int i = 0, unique = 0;
+    unsigned long long until_ms = 0;
+
+    memset(&config, 0, sizeof(config));
+    memset(&st, 0, sizeof(st));
+    pthread_mutex_init(&st.mutex, NULL);
+    config.drop_min_ms = 150;
+    config.drop_max_ms = 500;
+    config.on_frame = on_frame;
+    config.user = &st;
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL);
+    if (!lb)
+    {
+        pthread_mutex_destroy(&st.mutex);
+        return;
+    }
+
+    s = litews_socket_create();
+    litews_socket_set_url(s, "ws", "127.0.0.1", litews_loopback_port(lb), "/");
+    litews_socket_set_transport(s, litews_transport_tcp());
+    litews_socket_set_user_object(s, &st);
+    litews_socket_set_on_connected(s, on_connected);
+    litews_socket_set_on_disconnected(s, on_disconnected);
+    litews_socket_set_on_state_changed(s, on_state);
+    litews_socket_set_auto_reconnect(s, 20, 200, litews_true);
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+
+    // the sender doesn't follow the link, texts queued while it is down go out after the next connect
+    for (i = 0; i < TEXTS; i++)
+    {
+        snprintf(text, sizeof(text), "n %d", i);
+        LITEWS_TEST_CHECK(litews_socket_send_text(s, text) == litews_true);
+        usleep(TEXT_GAP_US);
+    }
+
+    // the last queued texts may wait out a drop and a backoff
+    until_ms = litews_test_now_ms() + 5000;
+    do
+    {
+        usleep(10000);
+        pthread_mutex_lock(&st.mutex);
+        unique = st.unique;
+        pthread_mutex_unlock(&st.mutex);
+    } while (unique < TEXTS && litews_test_now_ms() < until_ms);
+
+    litews_socket_get_stats(s, &stats);
+    litews_loopback_get_stats(lb, &server);
+    printf("%d of %d texts arrived, %d twice, %u links, %u dropped, %u reconnects\n",
+           unique, TEXTS, st.repeated, server.connections, server.drops, stats.reconnects);
+    LITEWS_TEST_CHECK(server.drops >= 3);
+    LITEWS_TEST_CHECK(server.connections >= 3);
+    LITEWS_TEST_CHECK(stats.reconnects >= 2);
+    LITEWS_TEST_CHECK(st.states[litews_state_waiting_reconnect] >= 2);
+    LITEWS_TEST_CHECK(st.disconnected == 0);
+    // texts a dropped link had taken but the server not read yet are lost with it
+    LITEWS_TEST_CHECK(unique * 10 >= TEXTS * 9);
+
+    litews_socket_disconnect_and_release(s);
+    LITEWS_TEST_CHECK(litews_test_wait(&st.disconnected, 1, 5000));
+    litews_loopback_stop(lb);
+    pthread_mutex_destroy(&st.mutex);
+}
+
+// a slow reader keeps frames in the batch and the partly written one when the link drops, the start of
+// a message may be among them with its continuations queued behind and priority texts waiting for its end
+static void run_fragments(void)
+{
+    litews_loopback_config config;
+    litews_loopback_stats server;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+    _flaky_state st;
+    unsigned char fragment[FRAGMENT_BYTES];
+    char text[32];
+    litews_bool queued = litews_false;
+    int i = 0, j = 0;
+    unsigned long long until_ms = 0;
+
+    memset(&config, 0, sizeof(config));
+    memset(&st, 0, sizeof(st));
+    pthread_mutex_init(&st.mutex, NULL);
+    st.conn = -1;
+    st.message = -1;
+    config.drop_min_ms = 100;
+    config.drop_max_ms = 300;
+    config.read_size = 512;
+    config.read_delay_us = 20000;
+    config.rcvbuf = 4096;
+    config.on_frame = on_fragment;
+    config.user = &st;
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL);
+    if (!lb)
+    {
+        pthread_mutex_destroy(&st.mutex);
+        return;
+    }
+
+    s = litews_socket_create();
+    litews_socket_set_url(s, "ws", "127.0.0.1", litews_loopback_port(lb), "/");
+    litews_socket_set_transport(s, litews_transport_tcp());
+    litews_socket_set_user_object(s, &st);
+    litews_socket_set_on_connected(s, on_connected);
+    litews_socket_set_on_disconnected(s, on_disconnected);
+    litews_socket_set_on_state_changed(s, on_state);
+    litews_socket_set_auto_reconnect(s, 20, 100, litews_true);
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+
+    // the sender never waits for a link, its queue is always full
+    until_ms = litews_test_now_ms() + 20000;
+    for (i = 0; litews_test_now_ms() < until_ms; i++)
+    {
+        litews_loopback_get_stats(lb, &server);
+        if (server.drops >= DROPS)
+        {
+            break;
+        }
+        memset(fragment, i & 0x7f, sizeof(fragment));
+        for (j = 0; j < MESSAGE_FRAMES; j++)
+        {
+            while ((queued = litews_socket_send_binary(s, fragment, FRAGMENT_BYTES,
+                             j == 0 ? litews_frame_start : (j == MESSAGE_FRAMES - 1 ? litews_frame_end : litews_frame_continue))) == litews_would_block)
+            {
+                usleep(1000);
+            }
+            LITEWS_TEST_CHECK(queued == litews_true);
+            if (j == 0)
+            {
+                snprintf(text, sizeof(text), "p %d", i);
+                LITEWS_TEST_CHECK(litews_socket_send_text_priority(s, text) == litews_true);
+            }
+        }
+    }
+
+    litews_loopback_get_stats(lb, &server);
+    pthread_mutex_lock(&st.mutex);
+    printf("%d of %d messages and %d priority texts arrived, %d frames out of place, %u links, %u dropped\n",
+           st.messages, i, st.priority, st.interleaved, server.connections, server.drops);
+    LITEWS_TEST_CHECK(server.drops >= DROPS);
+    LITEWS_TEST_CHECK(st.interleaved == 0);
+    // what the slow reader hadn't taken when its link dropped is lost, the rest kept flowing
+    LITEWS_TEST_CHECK(st.messages > 0 && st.priority > 0);
+    pthread_mutex_unlock(&st.mutex);
+
+    // the close frame would wait behind megabytes for the slow reader
+    litews_socket_disconnect_and_release(s);
+    litews_loopback_stop(lb);
+    LITEWS_TEST_CHECK(litews_test_wait(&st.disconnected, 1, 5000));
+    pthread_mutex_destroy(&st.mutex);
+}
+
+int main(void)
+{
+    // a write racing the drop of its link must fail rather than end the process
+    signal(SIGPIPE, SIG_IGN);
+    run_texts();
+    run_fragments();
+    return LITEWS_TEST_RESULT();
+}
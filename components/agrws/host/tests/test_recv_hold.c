@@ -0,0 +1,197 @@
+// receive flow control against a streaming server: while the consumer has no room nothing is handed out
+// and the socket isn't read, sends go on; once it opens up the stream arrives whole, short holds along
+// the way don't add up; a consumer that never opens up gets the link closed after LITEWS_RECV_HOLD_MAX_MS
+//
+// built with its own litews_socketpriv.c and a hold limit of LITEWS_RECV_HOLD_MAX_MS
+
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#include "litewebsocket.h"
+#include "litews_socket.h"
+#include "litews_loopback.h"
+#include "litews_test.h"
+
+#define STREAM_BYTES (1024 * 1024)
+#define STREAM_FRAME 4096
+#define HOLD_MS 400 // before the consumer opens up, within LITEWS_RECV_HOLD_MAX_MS
+#define ROOM 1000 // bytes taken per call once open
+#define ROOM_GAP 50 // every this many calls there is no room for a moment
+#define SLACK_MS 200
+
+typedef struct _hold_state_struct
+{
+    volatile int connected;
+    volatile int disconnected;
+    volatile int done;
+    volatile int is_open; // the consumer has room
+    size_t received;
+    int errors;
+    unsigned int calls;
+    unsigned int refused; // calls answered with no room
+} _hold_state;
+
+static void on_connected(litews_socket s)
+{
+    ((_hold_state *)litews_socket_get_user_object(s))->connected = 1;
+}
+
+static void on_disconnected(litews_socket s)
+{
+    ((_hold_state *)litews_socket_get_user_object(s))->disconnected = 1;
+}
+
+static unsigned int on_room(litews_socket s)
+{
+    _hold_state * st = (_hold_state *)litews_socket_get_user_object(s);
+
+    st->calls++;
+    if (!st->is_open || st->calls % ROOM_GAP == 0)
+    {
+        st->refused++;
+        return 0;
+    }
+    return ROOM;
+}
+
+// the server fills each frame with its index
+static void on_bin(litews_socket s, const void * data, const unsigned int length, int flag)
+{
+    _hold_state * st = (_hold_state *)litews_socket_get_user_object(s);
+    const unsigned char * bytes = (const unsigned char *)data;
+    unsigned int i = 0;
+
+    if (!st->is_open || length > ROOM)
+    {
+        st->errors++;
+    }
+    for (i = 0; i < length; i++)
+    {
+        if (bytes[i] != (unsigned char)((st->received + i) / STREAM_FRAME))
+        {
+            st->errors++;
+            break;
+        }
+    }
+    st->received += length;
+    if (st->received == STREAM_BYTES)
+    {
+        st->done = 1;
+    }
+}
+
+static litews_socket connect_socket(litews_loopback lb, _hold_state * st)
+{
+    litews_socket s = litews_socket_create();
+
+    litews_socket_set_url(s, "ws", "127.0.0.1", litews_loopback_port(lb), "/");
+    litews_socket_set_transport(s, litews_transport_tcp());
+    litews_socket_set_user_object(s, st);
+    litews_socket_set_on_connected(s, on_connected);
+    litews_socket_set_on_disconnected(s, on_disconnected);
+    litews_socket_set_on_received_bin(s, on_bin);
+    litews_socket_set_recv_flow_control(s, on_room);
+    return s;
+}
+
+static void run_hold(void)
+{
+    litews_loopback_config config;
+    litews_loopback_stats server;
+    litews_socket_stats held, later;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+    _hold_state st;
+    unsigned long long start_ms = 0;
+    unsigned int texts_in = 0;
+
+    memset(&config, 0, sizeof(config));
+    memset(&st, 0, sizeof(st));
+    config.stream_bytes = STREAM_BYTES;
+    config.stream_frame = STREAM_FRAME;
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL);
+    if (!lb)
+    {
+        return;
+    }
+
+    s = connect_socket(lb, &st);
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+    LITEWS_TEST_CHECK(litews_test_wait(&st.connected, 1, 5000));
+
+    // held: nothing handed out, the socket not read once its ring is full, texts still go out
+    usleep(HOLD_MS / 2 * 1000);
+    litews_loopback_get_stats(lb, &server);
+    texts_in = server.frames_in[1];
+    litews_socket_get_stats(s, &held);
+    LITEWS_TEST_CHECK(litews_socket_send_text(s, "{\"header\":{\"name\":\"Recognize\"}}") == litews_true);
+    usleep(HOLD_MS / 2 * 1000);
+    litews_socket_get_stats(s, &later);
+    litews_loopback_get_stats(lb, &server);
+    LITEWS_TEST_CHECK(st.received == 0);
+    LITEWS_TEST_CHECK(held.recv_held >= 1);
+    LITEWS_TEST_CHECK(later.stream_bytes_in == held.stream_bytes_in && later.stream_bytes_in < STREAM_BYTES);
+    LITEWS_TEST_CHECK(server.frames_in[1] == texts_in + 1);
+
+    // open, the whole stream in order, the short holds reset the limit each time
+    start_ms = litews_test_now_ms();
+    st.is_open = 1;
+    litews_socket_recv_resume(s);
+    LITEWS_TEST_CHECK(litews_test_wait(&st.done, 1, 20000));
+    litews_socket_get_stats(s, &later);
+    printf("held %d ms with %llu bytes read, then %zu bytes in %llu ms, %u holds, %u of %u room calls refused, "
+           "%d errors\n",
+           HOLD_MS, held.stream_bytes_in, st.received, litews_test_now_ms() - start_ms, later.recv_held,
+           st.refused, st.calls, st.errors);
+    LITEWS_TEST_CHECK(st.received == STREAM_BYTES && st.errors == 0);
+    LITEWS_TEST_CHECK(later.recv_held > 1 && later.recv_held <= st.refused);
+    LITEWS_TEST_CHECK(st.disconnected == 0);
+
+    litews_socket_disconnect_and_release(s);
+    LITEWS_TEST_CHECK(litews_test_wait(&st.disconnected, 1, 5000));
+    litews_loopback_stop(lb);
+}
+
+// the consumer never has room, the link is closed after the hold limit; the socket ended on an error
+// and released itself
+static void run_stall(void)
+{
+    litews_loopback_config config;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+    _hold_state st;
+    unsigned long long start_ms = 0, took_ms = 0;
+
+    memset(&config, 0, sizeof(config));
+    memset(&st, 0, sizeof(st));
+    config.stream_bytes = STREAM_BYTES;
+    config.stream_frame = STREAM_FRAME;
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL);
+    if (!lb)
+    {
+        return;
+    }
+
+    s = connect_socket(lb, &st);
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+    LITEWS_TEST_CHECK(litews_test_wait(&st.connected, 1, 5000));
+    start_ms = litews_test_now_ms();
+    LITEWS_TEST_CHECK(litews_test_wait(&st.disconnected, 1, LITEWS_RECV_HOLD_MAX_MS + 5000));
+    took_ms = litews_test_now_ms() - start_ms;
+    printf("stalled consumer: link closed %llu ms after connecting, limit %d ms, %u room calls\n",
+           took_ms, LITEWS_RECV_HOLD_MAX_MS, st.calls);
+    LITEWS_TEST_CHECK(took_ms + 20 >= LITEWS_RECV_HOLD_MAX_MS && took_ms <= LITEWS_RECV_HOLD_MAX_MS + SLACK_MS);
+    LITEWS_TEST_CHECK(st.received == 0);
+    litews_loopback_stop(lb);
+}
+
+int main(void)
+{
+    signal(SIGPIPE, SIG_IGN); // the server may still be streaming when the link is closed
+    run_hold();
+    run_stall();
+    return LITEWS_TEST_RESULT();
+}
@@ -0,0 +1,117 @@
+// keep-alive round trips: pongs of a slow server land in the right histogram bucket, copies of a pong
+// and pongs no ping asked for are counted apart and leave the round trip stats alone
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "litewebsocket.h"
+#include "litews_loopback.h"
+#include "litews_test.h"
+
+#define PONG_DELAY_MS 60 // bucket 2, 50..100 ms
+#define RUN_MS 2000
+
+typedef struct _rtt_state_struct
+{
+    volatile int connected;
+    volatile int disconnected;
+} _rtt_state;
+
+static void on_connected(litews_socket s)
+{
+    ((_rtt_state *)litews_socket_get_user_object(s))->connected = 1;
+}
+
+static void on_disconnected(litews_socket s)
+{
+    ((_rtt_state *)litews_socket_get_user_object(s))->disconnected = 1;
+}
+
+static void run_pings(const unsigned int pong_delay_ms, const int pong_copies, const unsigned int unsolicited_pong_ms)
+{
+    litews_loopback_config config;
+    litews_loopback_stats server;
+    litews_socket_stats stats;
+    litews_loopback lb = NULL;
+    litews_socket s = NULL;
+    _rtt_state st;
+    unsigned int counted = 0;
+    int i = 0;
+
+    memset(&config, 0, sizeof(config));
+    memset(&st, 0, sizeof(st));
+    config.pong_delay_ms = pong_delay_ms;
+    config.pong_copies = pong_copies;
+    config.unsolicited_pong_ms = unsolicited_pong_ms;
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL);
+    if (!lb)
+    {
+        return;
+    }
+
+    s = litews_socket_create();
+    litews_socket_set_url(s, "ws", "127.0.0.1", litews_loopback_port(lb), "/");
+    litews_socket_set_transport(s, litews_transport_tcp());
+    litews_socket_set_user_object(s, &st);
+    litews_socket_set_on_connected(s, on_connected);
+    litews_socket_set_on_disconnected(s, on_disconnected);
+    litews_socket_set_keepalive(s, 100, 1000, 3);
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+    LITEWS_TEST_CHECK(litews_test_wait(&st.connected, 1, 5000));
+    usleep(RUN_MS * 1000);
+
+    litews_socket_get_stats(s, &stats);
+    litews_loopback_get_stats(lb, &server);
+    printf("pong delay %u ms, %d copies, unsolicited every %u ms: %u pings, %u pongs matched, %u unmatched of %u, "
+           "rtt min %u avg %u max %u ms, buckets",
+           pong_delay_ms, pong_copies, unsolicited_pong_ms, stats.pings_sent, stats.pongs_matched,
+           stats.pongs_unmatched, server.pongs_out, stats.rtt_min_ms, stats.rtt_avg_ms, stats.rtt_max_ms);
+    for (i = 0; i < LITEWS_RTT_BUCKETS; i++)
+    {
+        printf(" %u", stats.rtt_histogram[i]);
+        counted += stats.rtt_histogram[i];
+    }
+    printf("\n");
+
+    // every matched pong is in the histogram, nothing else is
+    LITEWS_TEST_CHECK(stats.pongs_matched >= 5);
+    LITEWS_TEST_CHECK(counted == stats.pongs_matched);
+    // a ping is matched once at most, its copies are not
+    LITEWS_TEST_CHECK(stats.pongs_matched <= stats.pings_sent && stats.pings_sent <= stats.pongs_matched + 1);
+    // all pongs are accounted for, one may still be on the way
+    LITEWS_TEST_CHECK(stats.pongs_matched + stats.pongs_unmatched <= server.pongs_out &&
+                      stats.pongs_matched + stats.pongs_unmatched + 1 + pong_copies >= server.pongs_out);
+    LITEWS_TEST_CHECK(stats.rtt_min_ms <= stats.rtt_avg_ms && stats.rtt_avg_ms <= stats.rtt_max_ms);
+    if (pong_delay_ms)
+    {
+        LITEWS_TEST_CHECK(stats.rtt_min_ms >= pong_delay_ms);
+        LITEWS_TEST_CHECK(stats.rtt_histogram[2] == stats.pongs_matched);
+    }
+    else
+    {
+        LITEWS_TEST_CHECK(stats.rtt_histogram[0] == stats.pongs_matched);
+    }
+    if (pong_copies || unsolicited_pong_ms)
+    {
+        LITEWS_TEST_CHECK(stats.pongs_unmatched >= stats.pongs_matched * (unsigned int)pong_copies);
+        LITEWS_TEST_CHECK(!unsolicited_pong_ms || stats.pongs_unmatched >= RUN_MS / unsolicited_pong_ms / 2);
+    }
+    else
+    {
+        LITEWS_TEST_CHECK(stats.pongs_unmatched == 0);
+    }
+
+    litews_socket_disconnect_and_release(s);
+    LITEWS_TEST_CHECK(litews_test_wait(&st.disconnected, 1, 5000));
+    litews_loopback_stop(lb);
+}
+
+int main(void)
+{
+    run_pings(0, 0, 0);
+    run_pings(PONG_DELAY_MS, 0, 0);
+    run_pings(0, 1, 0);
+    run_pings(PONG_DELAY_MS, 2, 150);
+    return LITEWS_TEST_RESULT();
+}
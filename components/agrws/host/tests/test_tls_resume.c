@@ -0,0 +1,89 @@
+// TLS session resumption: the second connect to the loopback server resumes the session of the first one
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "litewebsocket.h"
+#include "litews_loopback.h"
+#include "litews_test.h"
+
+#ifdef LITEWS_HOST_TLS
+
+typedef struct _resume_state_struct
+{
+    volatile int connected;
+    volatile int disconnected;
+} _resume_state;
+
+static void on_connected(litews_socket s)
+{
+    ((_resume_state *)litews_socket_get_user_object(s))->connected = 1;
+}
+
+static void on_disconnected(litews_socket s)
+{
+    ((_resume_state *)litews_socket_get_user_object(s))->disconnected = 1;
+}
+
+// a fresh socket per connect, as after a lost link: only the session kept by litews_tls carries over
+static unsigned long long connect_once(litews_loopback lb)
+{
+    litews_socket s = litews_socket_create();
+    _resume_state st;
+    unsigned long long start_us = 0, elapsed_us = 0;
+
+    memset(&st, 0, sizeof(st));
+    litews_socket_set_url(s, "wss", "127.0.0.1", litews_loopback_port(lb), "/");
+    litews_socket_set_transport(s, litews_transport_tls());
+    litews_socket_set_server_cert(s, litews_loopback_ca_pem);
+    litews_socket_set_user_object(s, &st);
+    litews_socket_set_on_connected(s, on_connected);
+    litews_socket_set_on_disconnected(s, on_disconnected);
+
+    start_us = litews_test_now_us();
+    LITEWS_TEST_CHECK(litews_socket_connect(s));
+    LITEWS_TEST_CHECK(litews_test_wait(&st.connected, 1, 10000));
+    elapsed_us = litews_test_now_us() - start_us;
+
+    litews_socket_disconnect_and_release(s);
+    LITEWS_TEST_CHECK(litews_test_wait(&st.disconnected, 1, 5000));
+    return elapsed_us;
+}
+
+int main(void)
+{
+    litews_loopback_config config;
+    litews_loopback_stats server;
+    litews_loopback lb = NULL;
+    unsigned long long full_us = 0, resumed_us = 0;
+
+    memset(&config, 0, sizeof(config));
+    config.use_tls = 1;
+    lb = litews_loopback_start(&config);
+    LITEWS_TEST_CHECK(lb != NULL);
+    if (!lb)
+    {
+        return LITEWS_TEST_RESULT();
+    }
+
+    full_us = connect_once(lb);
+    resumed_us = connect_once(lb);
+    litews_loopback_get_stats(lb, &server);
+    printf("full handshake connect %llu us, resumed %llu us\n", full_us, resumed_us);
+    LITEWS_TEST_CHECK(server.connections == 2);
+    LITEWS_TEST_CHECK(server.handshakes_full == 1);
+    LITEWS_TEST_CHECK(server.handshakes_resumed == 1);
+
+    litews_loopback_stop(lb);
+    return LITEWS_TEST_RESULT();
+}
+
+#else
+
+int main(void)
+{
+    printf("built without mbedtls, nothing to resume\n");
+    return 0;
+}
+
+#endif
@@ -18,6 +18,14 @@ typedef enum _litews_frame_status
 	litews_frame_one, //singal frame
 } litews_frame_status_t;
 
+typedef enum _litews_socket_state
+{
+	litews_state_disconnected=0, //not started, released or ended
+	litews_state_connecting, //resolving, TCP, TLS and websocket handshakes
+	litews_state_connected, //handshake done, frames flow
+	litews_state_waiting_reconnect, //link lost, next attempt after the backoff delay
+} litews_socket_state_t;
+
 
 // extern
 #if defined(__cplusplus) || defined(_cplusplus)
@@ -90,6 +98,7 @@ typedef enum _litews_error_code
 typedef unsigned char litews_bool;
 #define litews_true 1
 #define litews_false 0
+#define litews_would_block 2 // send queue is over its byte budget, nothing was queued, retry later
 
 
 /**
@@ -104,6 +113,51 @@ typedef void* litews_handle;
 typedef struct litews_socket_struct * litews_socket;
 
 
+#define LITEWS_STATS_OPCODES 16 // frame counters are indexed by opcode: 0 continuation, 1 text, 2 binary, 8 close, 9 ping, 10 pong
+#define LITEWS_RTT_BUCKETS 8 // ping round trips up to 20, 50, 100, 200, 500, 1000, 2000 ms and longer
+
+/**
+ @brief Link metrics of a socket, see litews_socket_get_stats.
+ @detailed Counters run from litews_socket_create across reconnects. Bytes are the websocket stream,
+ i.e. inside TLS and after permessage-deflate compressed.
+ */
+typedef struct litews_socket_stats_struct
+{
+	unsigned int frames_in[LITEWS_STATS_OPCODES];
+	unsigned int frames_out[LITEWS_STATS_OPCODES];
+	unsigned long long bytes_in[LITEWS_STATS_OPCODES]; // payload bytes
+	unsigned long long bytes_out[LITEWS_STATS_OPCODES];
+	unsigned long long stream_bytes_in; // everything read, frame headers and handshake included
+	unsigned long long stream_bytes_out;
+	unsigned int stream_writes; // transport writes that took bytes, each one a TLS record at least
+	unsigned int recv_held; // reads put off as the consumer had no room
+
+	unsigned int send_queue_frames; // queued now
+	unsigned int send_queue_bytes;
+	unsigned int send_queue_peak_frames;
+	unsigned int send_queue_peak_bytes;
+	unsigned int partial_writes; // writes that took only a part of the offered bytes
+	unsigned int write_blocks; // writes that would block
+	unsigned int pace_waits; // binary frames held back by the pacer, see litews_socket_set_send_pacing
+	unsigned int send_delay_last_ms; // binary frame from being queued to its last byte written
+	unsigned int send_delay_max_ms;
+	unsigned int send_delay_avg_ms;
+	unsigned int send_delay_histogram[LITEWS_RTT_BUCKETS]; // bounds of 'rtt_histogram'
+
+	unsigned int connects; // successful handshakes
+	unsigned int reconnects; // lost links that were reconnected, see litews_socket_set_auto_reconnect
+
+	unsigned int pings_sent; // own pings written to the link
+	unsigned int pongs_matched; // pongs answering one of them
+	unsigned int pongs_unmatched; // late, unsolicited or unknown pongs
+	unsigned int rtt_last_ms;
+	unsigned int rtt_min_ms;
+	unsigned int rtt_max_ms;
+	unsigned int rtt_avg_ms;
+	unsigned int rtt_histogram[LITEWS_RTT_BUCKETS];
+} litews_socket_stats;
+
+
 /**
  @brief Error object handle.
  */
@@ -154,6 +208,37 @@ typedef void (*litews_on_socket_recvd_text)(litews_socket socket, const char * t
 typedef void (*litews_on_socket_recvd_bin)(litews_socket socket, const void * data, const unsigned int length, int flag);
 
 
+/**
+ @brief Callback type asking the consumer of received binary payload for room, see litews_socket_set_recv_flow_control.
+ @param socket Socket object.
+ @return Payload bytes the consumer takes now without blocking, 0 - none.
+ */
+typedef unsigned int (*litews_on_socket_bin_room)(litews_socket socket);
+
+
+/**
+ @brief Byte stream a socket speaks the websocket protocol over, see litews_socket_set_transport.
+ */
+typedef struct litews_transport_struct litews_transport;
+
+
+/**
+ @brief Callback type getting what a socket writes into its in-memory pipe, see litews_socket_set_pipe_peer.
+ @param socket Socket object.
+ @param data Bytes as they would go on the wire: the upgrade request, then masked frames.
+ @param length Number of bytes.
+ */
+typedef void (*litews_on_pipe_written)(litews_socket socket, const void * data, const unsigned int length);
+
+
+/**
+ @brief Callback type on socket connection state change.
+ @param socket Socket object.
+ @param state New state, define in litews_socket_state_t.
+ */
+typedef void (*litews_on_socket_state)(litews_socket socket, int state);
+
+
 // socket
 
 /**
@@ -303,6 +388,60 @@ LITEWS_API(void) litews_socket_disconnect_and_release(litews_socket socket);
 LITEWS_API(litews_bool) litews_socket_is_connected(litews_socket socket);
 
 
+/**
+ @brief Tune the keep-alive of the socket.
+ @detailed The work thread pings when nothing was received for the idle time and treats the link as dead
+ when 'max_missed' pings in a row get no byte back within 'pong_timeout_ms'. The idle time then shrinks,
+ as the NAT on the way probably forgot the link sooner, and grows again while pings are answered,
+ never back up to a time a link died at. Defaults: 20 s, 3 s, 2.
+ @param socket Socket object.
+ @param idle_ms First idle time before a ping, 0 - no keep-alive.
+ @param pong_timeout_ms Wait for an answer, 0 - default.
+ @param max_missed Missed pings before the link is closed, 0 - default.
+ */
+LITEWS_API(void) litews_socket_set_keepalive(litews_socket socket, int idle_ms, int pong_timeout_ms, int max_missed);
+
+
+/**
+ @brief Copy the link metrics of the socket.
+ @detailed Thread safe getter, the counters are not reset.
+ @param socket Socket object.
+ @param stats Filled with the current values.
+ @return litews_true - filled, litews_false - no socket or stats.
+ */
+LITEWS_API(litews_bool) litews_socket_get_stats(litews_socket socket, litews_socket_stats * stats);
+
+
+/**
+ @brief Keep the socket alive across lost links.
+ @detailed When the link drops or a connect fails, the socket waits and connects again instead of ending.
+ The wait starts at 'min_delay_ms' and doubles per failed attempt up to 'max_delay_ms', a random part of it
+ spreads devices that lost the link together. on_disconnected is called only when the socket ends,
+ follow the link with litews_socket_set_on_state_changed. Call before litews_socket_connect.
+ @param socket Socket object.
+ @param min_delay_ms First delay, 0 - don't reconnect (default).
+ @param max_delay_ms Longest delay.
+ @param keep_queue litews_true - frames queued while the link was down are sent after reconnect,
+ a partly written frame is sent again from its start, the rest of a binary message begun on the lost link
+ is dropped. litews_false - they are dropped.
+ */
+LITEWS_API(void) litews_socket_set_auto_reconnect(litews_socket socket, int min_delay_ms, int max_delay_ms, litews_bool keep_queue);
+
+
+/**
+ @brief Offer permessage-deflate (RFC 7692) in the handshake.
+ @detailed Text messages are compressed when the server accepts the extension and they get smaller,
+ binary messages are always sent as is. Received messages are inflated before they are handed out.
+ Each direction needs about 2^window_bits bytes, plus 11 KB inflater state and a 4 KB match finder.
+ Call before litews_socket_connect.
+ @param socket Socket object.
+ @param window_bits LZ77 window of both directions, 9..15, 0 - don't offer (default).
+ @param no_context_takeover litews_true - every message is compressed on its own, saves the kept window
+ of sent data but compresses small messages worse.
+ */
+LITEWS_API(void) litews_socket_set_deflate(litews_socket socket, int window_bits, litews_bool no_context_takeover);
+
+
 /**
  @brief Send text to connect socket.
  @detailed Thread safe method.
@@ -313,6 +452,18 @@ LITEWS_API(litews_bool) litews_socket_is_connected(litews_socket socket);
 LITEWS_API(litews_bool) litews_socket_send_text(litews_socket socket, const char * text);
 
 
+/**
+ @brief Send text ahead of queued text and binary frames.
+ @detailed Thread safe method. The text goes out before everything queued with litews_socket_send_text
+ and litews_socket_send_binary, but never into the middle of a fragmented message: it waits until the
+ frame ending that message is queued for writing. Ping, pong and close frames still go first.
+ @param socket Socket object.
+ @param text Text string for sending.
+ @return litews_true - socket and text exists and placed to send queue, otherwice litews_false.
+ */
+LITEWS_API(litews_bool) litews_socket_send_text_priority(litews_socket socket, const char * text);
+
+
 /**
  @brief Send text to connect socket.
  @detailed Thread safe method.
@@ -320,11 +471,80 @@ LITEWS_API(litews_bool) litews_socket_send_text(litews_socket socket, const char
  @param data Binary for sending.
  @param data_size Binary data size
  @param flag , for opcode control , define in litews_frame_status_t
- @return litews_true - socket and text exists and placed to send queue, otherwice litews_false.
+ @return litews_true - socket and text exists and placed to send queue, litews_would_block - send queue is full,
+ otherwice litews_false.
  */
 LITEWS_API(litews_bool) litews_socket_send_binary(litews_socket socket, const unsigned char * data , int data_size , int flag);
 
 
+/**
+ @brief Set byte budget of the send queue.
+ @detailed Thread safe method. Binary sends return litews_would_block while queued frames hold more than
+ 'max_bytes', text and control frames are always queued. Default is LITEWS_SEND_QUEUE_MAX_BYTES.
+ @param socket Socket object.
+ @param max_bytes Budget in bytes.
+ */
+LITEWS_API(void) litews_socket_set_send_queue_limit(litews_socket socket, int max_bytes);
+
+
+/**
+ @brief Set size of the write batch.
+ @detailed Thread safe method. The work thread copies queued frames into one buffer of up to 'max_bytes',
+ capped by the TLS max fragment length, and writes them as one TLS record. Larger frames are written alone.
+ Default is LITEWS_SEND_BATCH_SIZE.
+ @param socket Socket object.
+ @param max_bytes Batch size in bytes, 0 - every frame is written by itself.
+ */
+LITEWS_API(void) litews_socket_set_send_batch(litews_socket socket, int max_bytes);
+
+
+/**
+ @brief Pace binary payload to a byte rate, e.g. recorded audio over a weak Wi-Fi link.
+ @detailed Thread safe method. A token bucket lets 'burst_bytes' of binary payload go at once and then
+ 'bytes_per_sec' on average. The rest waits in the send queue, whose budget then holds the sender back,
+ rather than piling up in lwIP and on the access point where nothing can be done about it. Control and
+ text frames are not paced. A rate a little above the real-time rate of the stream lets the queue drain
+ after a stall. The queueing delay of binary frames shows in litews_socket_get_stats.
+ @param socket Socket object.
+ @param bytes_per_sec Average payload rate, 0 - binary frames are not paced (default).
+ @param burst_bytes Payload that may go ahead of the rate.
+ */
+LITEWS_API(void) litews_socket_set_send_pacing(litews_socket socket, int bytes_per_sec, int burst_bytes);
+
+
+/**
+ @brief Borrow a send buffer from the socket pool.
+ @detailed Thread safe method. Fill the buffer and pass it to litews_socket_send_binary_buffer, or give it back
+ with litews_socket_free_send_buffer. No memory is allocated while sending a borrowed buffer.
+ @param socket Socket object.
+ @param capacity Receives the usable size of the buffer, can be null.
+ @return Buffer, or null when all pooled buffers are still queued.
+ */
+LITEWS_API(unsigned char *) litews_socket_alloc_send_buffer(litews_socket socket, int * capacity);
+
+
+/**
+ @brief Send binary data placed in a borrowed buffer.
+ @detailed Thread safe method. The buffer is masked in place and the frame header is written in front of it,
+ the buffer returns to the pool after it was sent. Don't touch the buffer once litews_true is returned,
+ on litews_false it stays borrowed.
+ @param socket Socket object.
+ @param buffer Buffer from litews_socket_alloc_send_buffer.
+ @param data_size Binary data size, not more than the buffer capacity.
+ @param flag , for opcode control , define in litews_frame_status_t
+ @return litews_true - placed to send queue, litews_would_block - send queue is full, otherwice litews_false.
+ */
+LITEWS_API(litews_bool) litews_socket_send_binary_buffer(litews_socket socket, unsigned char * buffer, int data_size, int flag);
+
+
+/**
+ @brief Give back an unused borrowed buffer.
+ @param socket Socket object.
+ @param buffer Buffer from litews_socket_alloc_send_buffer.
+ */
+LITEWS_API(void) litews_socket_free_send_buffer(litews_socket socket, unsigned char * buffer);
+
+
 /**
  @brief Set socket user defined object pointer for identificating socket object.
  @param socket Socket object.
@@ -353,6 +573,88 @@ LITEWS_API(void) litews_socket_set_on_received_text(litews_socket socket, litews
 LITEWS_API(void) litews_socket_set_on_received_bin(litews_socket socket, litews_on_socket_recvd_bin callback);
 
 
+/**
+ @brief Hand binary payload to the received binary callback only as far as its consumer has room.
+ @detailed Before each slice the work thread asks 'room' how many bytes the callback takes without
+ blocking and passes no more than that. With no room it stops reading the socket, so TCP holds the
+ server back, while sending goes on; the consumer is asked again after LITEWS_RECV_RETRY_MS
+ or on litews_socket_recv_resume. Control and text frames queued ahead of the payload are still handled,
+ those behind it wait too. Held time doesn't count as received for keep-alive, which doesn't ping then,
+ as the pong couldn't be read. A consumer without room for LITEWS_RECV_HOLD_MAX_MS (30 s) has stalled:
+ the link is closed with an error and reconnected if that is on.
+ Compressed payload is counted as received, its inflated slices may be larger.
+ 'room' runs on the work thread with the socket locked, it must be quick and not call back into the socket.
+ @param socket Socket object.
+ @param room Room of the consumer, null - no flow control.
+ */
+LITEWS_API(void) litews_socket_set_recv_flow_control(litews_socket socket, litews_on_socket_bin_room room);
+
+
+/**
+ @brief Tell a socket held back by a full consumer that room is free again.
+ @detailed Wakes the work thread at once in place of the next retry, may be called from any thread.
+ @param socket Socket object.
+ */
+LITEWS_API(void) litews_socket_recv_resume(litews_socket socket);
+
+
+LITEWS_API(void) litews_socket_set_on_state_changed(litews_socket socket, litews_on_socket_state callback);
+
+
+/**
+ @brief Plain TCP transport.
+ */
+LITEWS_API(const litews_transport *) litews_transport_tcp(void);
+
+
+/**
+ @brief TLS transport of the library built in.
+ @return Transport or NULL if built without TLS.
+ */
+LITEWS_API(const litews_transport *) litews_transport_tls(void);
+
+
+/**
+ @brief In-memory transport, the bytes go to a callback instead of the network, see litews_socket_set_pipe_peer.
+ @detailed Runs framing, queueing and reassembly without name lookup, TCP or TLS, e.g. to benchmark
+ or fuzz them on a host. Host, port and scheme are only put into the upgrade request.
+ */
+LITEWS_API(const litews_transport *) litews_transport_pipe(void);
+
+
+/**
+ @brief Set the transport the socket connects over, reconnects included.
+ @detailed Must be set before litews_socket_connect, later calls are ignored.
+ By default TLS is used if built in, plain TCP otherwise, the URL scheme doesn't choose.
+ @param socket Socket object.
+ @param transport Transport, NULL - the default one.
+ */
+LITEWS_API(void) litews_socket_set_transport(litews_socket socket, const litews_transport * transport);
+
+
+/**
+ @brief Set the other end of the in-memory transport.
+ @detailed 'peer' gets everything the socket writes, on its work thread and synchronously: the socket
+ goes on when it returns. The peer answers with litews_socket_pipe_put, right from the callback or later
+ from any thread. Connecting over the pipe fails without a peer.
+ @param socket Socket object.
+ @param peer Callback getting the written bytes.
+ */
+LITEWS_API(void) litews_socket_set_pipe_peer(litews_socket socket, litews_on_pipe_written peer);
+
+
+/**
+ @brief Queue bytes for the socket to read from its in-memory transport and wake its work thread.
+ @detailed May be called from any thread, the bytes are copied. Bytes of a previous connection are dropped
+ on connect.
+ @param socket Socket object.
+ @param data Bytes as a server would send them: the upgrade responce, then unmasked frames.
+ @param length Number of bytes.
+ @return litews_false while the pipe isn't connected.
+ */
+LITEWS_API(litews_bool) litews_socket_pipe_put(litews_socket socket, const void * data, const unsigned int length);
+
+
 /**
  @return 0 - if error is empty or no error, otherwice error code.
  */
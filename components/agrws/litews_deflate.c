@@ -0,0 +1,565 @@
+
+
+#include "litewebsocket.h"
+#include "litews_deflate.h"
+#include "litews_memory.h"
+#include "litews_string.h"
+#include "litews_log.h"
+
+#include <ctype.h>
+#if defined(AG_OS_POSIX)
+#include "miniz.h"      // same 'tinfl' as the ROM, from the miniz library
+#else
+#include "rom/miniz.h"
+#endif
+
+struct _litews_deflate_struct
+{
+    int server_window_bits; // limit of the peer's distances, size of 'inflate_window'
+    int client_window_bits; // limit of our distances
+    litews_bool server_no_context_takeover;
+    litews_bool client_no_context_takeover;
+
+    tinfl_decompressor * inflater;
+    unsigned char * inflate_window; // circular output of 'tinfl', holds the dictionary of the peer
+    size_t inflate_pos;
+    litews_bool inflate_in_message; // a compressed message is being received
+    litews_bool inflate_restart; // stream has to start over with the next message
+
+    unsigned int * hash_head; // position + 1 of the latest 3 bytes with this hash, 0 - none
+    unsigned short * hash_prev; // distance to the previous position with the same hash, by position in the window
+    unsigned char * history; // tail of the sent messages, only with context takeover
+    size_t history_len;
+};
+
+typedef struct _litews_bit_writer_struct
+{
+    unsigned char * out;
+    size_t len; // counted past 'cap' too, then the result is thrown away
+    size_t cap;
+    unsigned int bits;
+    int bits_count;
+} _litews_bit_writer;
+
+static const unsigned char k_litews_deflate_tail[4] = { 0x00, 0x00, 0xff, 0xff }; // stripped by the sender
+
+static const unsigned short k_litews_deflate_len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const unsigned char k_litews_deflate_len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const unsigned short k_litews_deflate_dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+    4097, 6145, 8193, 12289, 16385, 24577 };
+static const unsigned char k_litews_deflate_dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+#define LITEWS_DEFLATE_MIN_MATCH 3
+#define LITEWS_DEFLATE_MAX_MATCH 258
+
+// --- negotiation ---
+
+static litews_bool litews_deflate_token_is(const char * token, const size_t len, const char * name)
+{
+    size_t i = 0;
+    if (strlen(name) != len)
+    {
+        return litews_false;
+    }
+    for (i = 0; i < len; i++)
+    {
+        if (tolower((unsigned char)token[i]) != name[i])
+        {
+            return litews_false;
+        }
+    }
+    return litews_true;
+}
+
+static const char * litews_deflate_skip_spaces(const char * str)
+{
+    while (*str == ' ' || *str == '\t')
+    {
+        str++;
+    }
+    return str;
+}
+
+// token up to '=', ';', ',' or the end
+static const char * litews_deflate_read_token(const char * str, size_t * len)
+{
+    const char * start = litews_deflate_skip_spaces(str);
+    const char * end = start;
+    while (*end && *end != '=' && *end != ';' && *end != ',' && *end != ' ' && *end != '\t')
+    {
+        end++;
+    }
+    *len = (size_t)(end - start);
+    return start;
+}
+
+size_t litews_deflate_write_offer(char * buff, const size_t buff_size, const int window_bits, const litews_bool no_context_takeover)
+{
+    int len = litews_sprintf(buff, buff_size,
+                       "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits=%d; server_max_window_bits=%d%s\r\n",
+                       window_bits, window_bits,
+                       no_context_takeover ? "; client_no_context_takeover; server_no_context_takeover" : "");
+    return (len > 0 && (size_t)len < buff_size) ? (size_t)len : 0;
+}
+
+static litews_bool litews_deflate_parse_responce(_litews_deflate * d, const char * str, const int window_bits, const char ** error)
+{
+    const char * token = NULL;
+    size_t len = 0;
+    int bits = 0;
+    char * end = NULL;
+
+    token = litews_deflate_read_token(str, &len);
+    if (!litews_deflate_token_is(token, len, "permessage-deflate"))
+    {
+        *error = "Unexpected websocket extension";
+        return litews_false;
+    }
+    str = litews_deflate_skip_spaces(token + len);
+
+    while (*str == ';')
+    {
+        token = litews_deflate_read_token(str + 1, &len);
+        str = litews_deflate_skip_spaces(token + len);
+        bits = -1;
+        if (*str == '=')
+        {
+            str = litews_deflate_skip_spaces(str + 1);
+            if (*str == '"')
+            {
+                str++;
+            }
+            bits = (int)strtol(str, &end, 10);
+            if (end == str)
+            {
+                *error = "Bad permessage-deflate parameter";
+                return litews_false;
+            }
+            str = (*end == '"') ? end + 1 : end;
+            str = litews_deflate_skip_spaces(str);
+        }
+
+        if (litews_deflate_token_is(token, len, "server_no_context_takeover"))
+        {
+            d->server_no_context_takeover = litews_true;
+        }
+        else if (litews_deflate_token_is(token, len, "client_no_context_takeover"))
+        {
+            d->client_no_context_takeover = litews_true;
+        }
+        else if (litews_deflate_token_is(token, len, "server_max_window_bits") && bits >= 8 && bits <= window_bits)
+        {
+            d->server_window_bits = bits;
+        }
+        else if (litews_deflate_token_is(token, len, "client_max_window_bits") && bits >= 8 && bits <= 15)
+        {
+            if (bits < d->client_window_bits)
+            {
+                d->client_window_bits = bits;
+            }
+        }
+        else
+        {
+            *error = "Bad permessage-deflate parameter";
+            return litews_false;
+        }
+    }
+
+    if (*str != '\0' && *str != '\r' && *str != '\n')
+    {
+        *error = "Unexpected websocket extension"; // a second one or garbage, only permessage-deflate is offered
+        return litews_false;
+    }
+    return litews_true;
+}
+
+_litews_deflate * litews_deflate_create(const char * responce, const int window_bits, const litews_bool no_context_takeover, const char ** error)
+{
+    _litews_deflate * d = (_litews_deflate *)litews_malloc_zero(sizeof(_litews_deflate));
+    size_t window_size = 0;
+
+    if (!d)
+    {
+        *error = "No memory for permessage-deflate";
+        return NULL;
+    }
+    d->server_window_bits = LITEWS_DEFLATE_MAX_WINDOW_BITS; // the server may leave its limit out
+    d->client_window_bits = window_bits;
+    d->server_no_context_takeover = no_context_takeover;
+    d->client_no_context_takeover = no_context_takeover;
+    d->inflate_restart = litews_true;
+
+    if (!litews_deflate_parse_responce(d, responce, window_bits, error))
+    {
+        litews_deflate_delete(d);
+        return NULL;
+    }
+
+    window_size = (size_t)1 << d->client_window_bits;
+    d->inflater = (tinfl_decompressor *)litews_malloc(sizeof(tinfl_decompressor));
+    d->inflate_window = (unsigned char *)litews_malloc((size_t)1 << d->server_window_bits);
+    d->hash_head = (unsigned int *)litews_malloc(sizeof(unsigned int) << LITEWS_DEFLATE_HASH_BITS);
+    d->hash_prev = (unsigned short *)litews_malloc(sizeof(unsigned short) * window_size);
+    if (!d->client_no_context_takeover)
+    {
+        d->history = (unsigned char *)litews_malloc(window_size);
+    }
+    if (!d->inflater || !d->inflate_window || !d->hash_head || !d->hash_prev ||
+        (!d->client_no_context_takeover && !d->history))
+    {
+        *error = "No memory for permessage-deflate";
+        litews_deflate_delete(d);
+        return NULL;
+    }
+
+    LOGD_LITEWS("permessage-deflate: server window %d%s, client window %d%s",
+                d->server_window_bits, d->server_no_context_takeover ? " no takeover" : "",
+                d->client_window_bits, d->client_no_context_takeover ? " no takeover" : "");
+    return d;
+}
+
+void litews_deflate_delete(_litews_deflate * d)
+{
+    if (d)
+    {
+        litews_free(d->inflater);
+        litews_free(d->inflate_window);
+        litews_free(d->hash_head);
+        litews_free(d->hash_prev);
+        litews_free(d->history);
+        litews_free(d);
+    }
+}
+
+void litews_deflate_delete_clean(_litews_deflate ** d)
+{
+    if (d)
+    {
+        litews_deflate_delete(*d);
+        *d = NULL;
+    }
+}
+
+// --- inflate ---
+
+static litews_bool litews_inflate_feed(_litews_deflate * d, const unsigned char * data, size_t len,
+                                       litews_inflate_sink sink, void * user)
+{
+    const size_t window_mask = ((size_t)1 << d->server_window_bits) - 1;
+    size_t in_len = 0, out_len = 0;
+    tinfl_status status = TINFL_STATUS_NEEDS_MORE_INPUT;
+
+    do
+    {
+        // the window is a power of 2, so 'tinfl' wraps around it and keeps the dictionary there
+        in_len = len;
+        out_len = window_mask + 1 - d->inflate_pos;
+        status = tinfl_decompress(d->inflater, data, &in_len, d->inflate_window, d->inflate_window + d->inflate_pos,
+                                  &out_len, TINFL_FLAG_HAS_MORE_INPUT);
+        data += in_len;
+        len -= in_len;
+        if (out_len > 0)
+        {
+            if (!sink(user, d->inflate_window + d->inflate_pos, out_len))
+            {
+                return litews_false;
+            }
+            d->inflate_pos = (d->inflate_pos + out_len) & window_mask;
+        }
+        if (status < TINFL_STATUS_DONE)
+        {
+            return litews_false;
+        }
+        if (status == TINFL_STATUS_DONE)
+        {
+            d->inflate_restart = litews_true; // final block, the rest of the message is ignored
+            return litews_true;
+        }
+    } while (status == TINFL_STATUS_HAS_MORE_OUTPUT || (len > 0 && (in_len > 0 || out_len > 0)));
+
+    return litews_true;
+}
+
+litews_bool litews_inflate_message(_litews_deflate * d, const unsigned char * data, const size_t len, const litews_bool is_last,
+                                   litews_inflate_sink sink, void * user)
+{
+    litews_bool ret = litews_true;
+
+    if (!d->inflate_in_message)
+    {
+        if (d->inflate_restart || d->server_no_context_takeover)
+        {
+            tinfl_init(d->inflater);
+            d->inflate_pos = 0;
+            d->inflate_restart = litews_false;
+        }
+        d->inflate_in_message = litews_true;
+    }
+
+    if (len > 0 && !d->inflate_restart)
+    {
+        ret = litews_inflate_feed(d, data, len, sink, user);
+    }
+    if (ret && is_last && !d->inflate_restart)
+    {
+        ret = litews_inflate_feed(d, k_litews_deflate_tail, sizeof(k_litews_deflate_tail), sink, user);
+    }
+    if (!ret)
+    {
+        d->inflate_restart = litews_true; // connection is failed by the caller anyway
+    }
+    if (is_last)
+    {
+        d->inflate_in_message = litews_false;
+    }
+    return ret;
+}
+
+// --- deflate ---
+
+static void litews_bits_put(_litews_bit_writer * w, const unsigned int value, const int count)
+{
+    w->bits |= value << w->bits_count;
+    w->bits_count += count;
+    while (w->bits_count >= 8)
+    {
+        if (w->len < w->cap)
+        {
+            w->out[w->len] = (unsigned char)(w->bits & 0xff);
+        }
+        w->len++;
+        w->bits >>= 8;
+        w->bits_count -= 8;
+    }
+}
+
+// huffman codes go out starting with their most significant bit
+static void litews_bits_put_code(_litews_bit_writer * w, unsigned int code, int count)
+{
+    unsigned int reversed = 0;
+    int i = 0;
+    for (i = 0; i < count; i++)
+    {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+    litews_bits_put(w, reversed, count);
+}
+
+// fixed literal/length code of RFC 1951 3.2.6
+static void litews_deflate_put_symbol(_litews_bit_writer * w, const unsigned int symbol)
+{
+    if (symbol < 144)
+    {
+        litews_bits_put_code(w, 0x30 + symbol, 8);
+    }
+    else if (symbol < 256)
+    {
+        litews_bits_put_code(w, 0x190 + symbol - 144, 9);
+    }
+    else if (symbol < 280)
+    {
+        litews_bits_put_code(w, symbol - 256, 7);
+    }
+    else
+    {
+        litews_bits_put_code(w, 0xc0 + symbol - 280, 8);
+    }
+}
+
+static void litews_deflate_put_match(_litews_bit_writer * w, const unsigned int len, const unsigned int dist)
+{
+    int i = 28;
+    while (k_litews_deflate_len_base[i] > len)
+    {
+        i--;
+    }
+    litews_deflate_put_symbol(w, 257 + i);
+    if (k_litews_deflate_len_extra[i])
+    {
+        litews_bits_put(w, len - k_litews_deflate_len_base[i], k_litews_deflate_len_extra[i]);
+    }
+
+    i = 29;
+    while (k_litews_deflate_dist_base[i] > dist)
+    {
+        i--;
+    }
+    litews_bits_put_code(w, (unsigned int)i, 5);
+    if (k_litews_deflate_dist_extra[i])
+    {
+        litews_bits_put(w, dist - k_litews_deflate_dist_base[i], k_litews_deflate_dist_extra[i]);
+    }
+}
+
+static unsigned int litews_deflate_hash(const unsigned char * p)
+{
+    const unsigned int v = ((unsigned int)p[0] << 16) | ((unsigned int)p[1] << 8) | p[2];
+    return (v * 2654435761u) >> (32 - LITEWS_DEFLATE_HASH_BITS);
+}
+
+static void litews_deflate_insert(_litews_deflate * d, const unsigned char * buf, const size_t pos)
+{
+    const size_t window_size = (size_t)1 << d->client_window_bits;
+    const unsigned int h = litews_deflate_hash(buf + pos);
+    const size_t last = d->hash_head[h];
+    size_t dist = 0;
+
+    if (last)
+    {
+        dist = pos - (last - 1);
+    }
+    d->hash_prev[pos & (window_size - 1)] = (dist < window_size) ? (unsigned short)dist : 0;
+    d->hash_head[h] = (unsigned int)pos + 1;
+}
+
+// longest earlier match of 'pos' within the window, 'dist' is set when it's worth a length/distance pair
+static size_t litews_deflate_find_match(_litews_deflate * d, const unsigned char * buf, const size_t pos, const size_t end,
+                                        size_t * dist)
+{
+    const size_t window_size = (size_t)1 << d->client_window_bits;
+    const size_t max_len = (end - pos < LITEWS_DEFLATE_MAX_MATCH) ? end - pos : LITEWS_DEFLATE_MAX_MATCH;
+    size_t cand = d->hash_head[litews_deflate_hash(buf + pos)];
+    size_t best = 0, len = 0, step = 0;
+    int depth = LITEWS_DEFLATE_CHAIN_DEPTH;
+
+    while (cand && depth-- > 0)
+    {
+        cand--;
+        // a distance of the whole window would make the inflater copy a byte onto itself
+        if (pos - cand >= window_size)
+        {
+            break;
+        }
+        if (buf[cand + best] == buf[pos + best])
+        {
+            len = 0;
+            while (len < max_len && buf[cand + len] == buf[pos + len])
+            {
+                len++;
+            }
+            if (len > best)
+            {
+                best = len;
+                *dist = pos - cand;
+                if (len == max_len)
+                {
+                    break;
+                }
+            }
+        }
+        step = d->hash_prev[cand & (window_size - 1)];
+        if (!step || step > cand)
+        {
+            break;
+        }
+        cand = cand - step + 1;
+    }
+    return (best >= LITEWS_DEFLATE_MIN_MATCH) ? best : 0;
+}
+
+unsigned char * litews_deflate_message(_litews_deflate * d, const unsigned char * data, const size_t len, size_t * out_len)
+{
+    const size_t window_size = (size_t)1 << d->client_window_bits;
+    const unsigned char * buf = data;
+    unsigned char * joined = NULL;
+    size_t start = 0, end = 0, pos = 0, match = 0, dist = 0, i = 0, keep = 0;
+    _litews_bit_writer w;
+
+    if (len < LITEWS_DEFLATE_MIN_MATCH)
+    {
+        return NULL;
+    }
+
+    // the previous messages are the dictionary of this one
+    if (d->history_len > 0)
+    {
+        joined = (unsigned char *)litews_malloc(d->history_len + len);
+        if (!joined)
+        {
+            return NULL;
+        }
+        AG_OS_MEMCPY(joined, d->history, d->history_len);
+        AG_OS_MEMCPY(joined + d->history_len, data, len);
+        buf = joined;
+        start = d->history_len;
+    }
+    end = start + len;
+
+    AG_OS_MEMSET(&w, 0, sizeof(w));
+    w.cap = len - 1; // it has to get smaller to be worth it
+    w.out = (unsigned char *)litews_malloc(w.cap);
+    if (!w.out)
+    {
+        litews_free(joined);
+        return NULL;
+    }
+
+    AG_OS_MEMSET(d->hash_head, 0, sizeof(unsigned int) << LITEWS_DEFLATE_HASH_BITS);
+    for (pos = 0; pos < start && pos + LITEWS_DEFLATE_MIN_MATCH <= end; pos++)
+    {
+        litews_deflate_insert(d, buf, pos);
+    }
+
+    litews_bits_put(&w, 0, 1); // BFINAL 0, the stream goes on with the next message
+    litews_bits_put(&w, 1, 2); // BTYPE 01, fixed huffman codes
+
+    pos = start;
+    while (pos < end && w.len <= w.cap)
+    {
+        match = 0;
+        if (pos + LITEWS_DEFLATE_MIN_MATCH <= end)
+        {
+            match = litews_deflate_find_match(d, buf, pos, end, &dist);
+        }
+        if (match)
+        {
+            litews_deflate_put_match(&w, (unsigned int)match, (unsigned int)dist);
+            for (i = 0; i < match; i++, pos++)
+            {
+                if (pos + LITEWS_DEFLATE_MIN_MATCH <= end)
+                {
+                    litews_deflate_insert(d, buf, pos);
+                }
+            }
+        }
+        else
+        {
+            litews_deflate_put_symbol(&w, buf[pos]);
+            if (pos + LITEWS_DEFLATE_MIN_MATCH <= end)
+            {
+                litews_deflate_insert(d, buf, pos);
+            }
+            pos++;
+        }
+    }
+
+    litews_deflate_put_symbol(&w, 256); // end of block
+    litews_bits_put(&w, 0, 3); // empty stored block aligns to a byte, its 00 00 ff ff is left out
+    if (w.bits_count > 0)
+    {
+        litews_bits_put(&w, 0, 8 - w.bits_count);
+    }
+
+    if (w.len > w.cap)
+    {
+        // sent as is, so the peer's dictionary doesn't see it either
+        litews_free(w.out);
+        litews_free(joined);
+        return NULL;
+    }
+
+    if (d->history)
+    {
+        keep = (end < window_size) ? end : window_size;
+        AG_OS_MEMCPY(d->history, buf + end - keep, keep);
+        d->history_len = keep;
+    }
+    litews_free(joined);
+    *out_len = w.len;
+    return w.out;
+}
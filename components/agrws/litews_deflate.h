@@ -0,0 +1,41 @@
+
+#ifndef __LITEWS_DEFLATE_H__
+#define __LITEWS_DEFLATE_H__ 1
+
+#include "litewebsocket.h"
+
+// permessage-deflate (RFC 7692), inflate is the ROM miniz 'tinfl', deflate is a small LZ77 with fixed huffman codes
+
+#define LITEWS_DEFLATE_MIN_WINDOW_BITS   9
+#define LITEWS_DEFLATE_MAX_WINDOW_BITS   15
+#ifndef LITEWS_DEFLATE_HASH_BITS
+#define LITEWS_DEFLATE_HASH_BITS         10     //match finder heads, 4 bytes each
+#endif
+#ifndef LITEWS_DEFLATE_CHAIN_DEPTH
+#define LITEWS_DEFLATE_CHAIN_DEPTH       8      //candidates tried per position
+#endif
+
+typedef struct _litews_deflate_struct _litews_deflate;
+
+// inflated bytes of the current message, litews_false stops inflating
+typedef litews_bool (*litews_inflate_sink)(void * user, const unsigned char * data, const size_t len);
+
+// "Sec-WebSocket-Extensions" offer for 'window_bits' (LITEWS_DEFLATE_MIN_WINDOW_BITS..MAX), returns written length
+size_t litews_deflate_write_offer(char * buff, const size_t buff_size, const int window_bits, const litews_bool no_context_takeover);
+
+// state for the extension accepted by 'responce' (value of "Sec-WebSocket-Extensions"),
+// null with 'error' set when the server answered something that was not offered
+_litews_deflate * litews_deflate_create(const char * responce, const int window_bits, const litews_bool no_context_takeover, const char ** error);
+
+void litews_deflate_delete(_litews_deflate * d);
+
+void litews_deflate_delete_clean(_litews_deflate ** d);
+
+// next payload slice of a compressed message, 'is_last' once its final frame is complete
+litews_bool litews_inflate_message(_litews_deflate * d, const unsigned char * data, const size_t len, const litews_bool is_last,
+                                   litews_inflate_sink sink, void * user);
+
+// compressed payload of a whole message or null when it doesn't get smaller, free with 'litews_free'
+unsigned char * litews_deflate_message(_litews_deflate * d, const unsigned char * data, const size_t len, size_t * out_len);
+
+#endif
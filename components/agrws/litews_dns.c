@@ -0,0 +1,324 @@
+
+#include "litewebsocket.h"
+#include "litews_dns.h"
+#include "litews_memory.h"
+#include "litews_string.h"
+#include "litews_log.h"
+
+#include <errno.h>
+
+#ifdef LITEWS_DNS_GETADDRINFO
+// a resolver standing in for getaddrinfo, the host test fails names with it on demand
+int LITEWS_DNS_GETADDRINFO(const char * host, const char * service, const struct addrinfo * hints, struct addrinfo ** result);
+#else
+#define LITEWS_DNS_GETADDRINFO getaddrinfo
+#endif
+
+typedef struct _litews_dns_entry_struct 
+{
+    char * host; // null - free slot
+    int port;
+    unsigned int resolved_ms;
+    int count;
+    _litews_dns_addr addrs[LITEWS_DNS_MAX_ADDRS];
+} _litews_dns_entry;
+
+static _litews_dns_entry _litews_dns_cache[LITEWS_DNS_CACHE_SIZE];
+static AG_MUTEX_T _litews_dns_mutex = NULL;
+
+void litews_dns_init(void) 
+{
+    if (!_litews_dns_mutex) 
+    {
+        ag_os_task_mutex_init(&_litews_dns_mutex);
+    }
+}
+
+static void litews_dns_lock(void) 
+{
+    ag_os_task_mutex_lock(&_litews_dns_mutex);
+}
+
+static void litews_dns_unlock(void) 
+{
+    ag_os_task_mutex_unlock(&_litews_dns_mutex);
+}
+
+static _litews_dns_entry * litews_dns_find(const char * host, const int port) 
+{
+    int i = 0;
+    for (i = 0; i < LITEWS_DNS_CACHE_SIZE; i++) 
+    {
+        _litews_dns_entry * e = &_litews_dns_cache[i];
+        if (e->host && e->port == port && strcmp(e->host, host) == 0) 
+        {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static int litews_dns_copy(const _litews_dns_entry * e, _litews_dns_addr * addrs, const int max_addrs) 
+{
+    const int count = e->count < max_addrs ? e->count : max_addrs;
+    AG_OS_MEMCPY(addrs, e->addrs, count * sizeof(_litews_dns_addr));
+    return count;
+}
+
+static void litews_dns_store(const char * host, const int port, const _litews_dns_addr * addrs, const int count) 
+{
+    _litews_dns_entry * e = litews_dns_find(host, port);
+    int i = 0;
+
+    if (!e) 
+    {
+        // a free slot or the oldest one
+        e = &_litews_dns_cache[0];
+        for (i = 0; i < LITEWS_DNS_CACHE_SIZE && e->host; i++) 
+        {
+            _litews_dns_entry * c = &_litews_dns_cache[i];
+            if (!c->host || 
+                litews_get_time_ms() - c->resolved_ms > litews_get_time_ms() - e->resolved_ms) 
+            {
+                e = c;
+            }
+        }
+        litews_string_delete_clean(&e->host);
+        e->host = litews_string_copy(host);
+        if (!e->host) 
+        {
+            return;
+        }
+    }
+    e->port = port;
+    e->resolved_ms = litews_get_time_ms();
+    e->count = count;
+    AG_OS_MEMCPY(e->addrs, addrs, count * sizeof(_litews_dns_addr));
+}
+
+int litews_dns_resolve(const char * host, const int port, _litews_dns_addr * addrs, const int max_addrs) 
+{
+    struct addrinfo hints;
+    struct addrinfo * result = NULL;
+    struct addrinfo * p = NULL;
+    _litews_dns_entry * e = NULL;
+    char portstr[16];
+    int count = 0, stale = 0;
+
+    if (!host || max_addrs <= 0) 
+    {
+        return 0;
+    }
+
+    litews_dns_lock();
+    e = litews_dns_find(host, port);
+    if (e) 
+    {
+        // an expired entry is still the best guess should the name not resolve now
+        count = litews_dns_copy(e, addrs, max_addrs);
+        if (litews_get_time_ms() - e->resolved_ms >= LITEWS_DNS_CACHE_TTL_MS) 
+        {
+            stale = count;
+            count = 0;
+        }
+    }
+    litews_dns_unlock();
+    if (count > 0) 
+    {
+        return count;
+    }
+
+    AG_OS_MEMSET(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    litews_sprintf(portstr, 16, "%i", port);
+    if (LITEWS_DNS_GETADDRINFO(host, portstr, &hints, &result) != 0 || !result) 
+    {
+        if (stale > 0) 
+        {
+            LOGE_LITEWS("resolving %s failed, using the expired addresses", host);
+            return stale; // 'addrs' untouched since the copy
+        }
+        LOGE_LITEWS("resolving %s failed", host);
+        return 0;
+    }
+    for (p = result; p && count < max_addrs && count < LITEWS_DNS_MAX_ADDRS; p = p->ai_next) 
+    {
+        if (p->ai_addrlen > sizeof(addrs[count].addr)) 
+        {
+            continue;
+        }
+        AG_OS_MEMSET(&addrs[count], 0, sizeof(_litews_dns_addr));
+        AG_OS_MEMCPY(&addrs[count].addr, p->ai_addr, p->ai_addrlen);
+        addrs[count].addr_len = p->ai_addrlen;
+        addrs[count].family = p->ai_family;
+        count++;
+    }
+    freeaddrinfo(result);
+
+    if (count > 0) 
+    {
+        litews_dns_lock();
+        litews_dns_store(host, port, addrs, count);
+        litews_dns_unlock();
+    }
+    return count;
+}
+
+void litews_dns_forget(const char * host, const int port) 
+{
+    _litews_dns_entry * e = NULL;
+
+    if (!host) 
+    {
+        return;
+    }
+    litews_dns_lock();
+    e = litews_dns_find(host, port);
+    if (e) 
+    {
+        litews_string_delete_clean(&e->host);
+        e->count = 0;
+    }
+    litews_dns_unlock();
+}
+
+static void litews_dns_set_blocking(litews_socket_t fd, const litews_bool blocking) 
+{
+    const int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+}
+
+litews_socket_t litews_dns_connect(const _litews_dns_addr * addrs, const int count, const unsigned int attempt_timeout_ms) 
+{
+    litews_socket_t fds[LITEWS_DNS_MAX_ADDRS];
+    unsigned int started_ms[LITEWS_DNS_MAX_ADDRS];
+    litews_socket_t winner = LITEWS_INVALID_SOCKET;
+    unsigned int last_start_ms = 0;
+    int total = count < LITEWS_DNS_MAX_ADDRS ? count : LITEWS_DNS_MAX_ADDRS;
+    int next = 0, active = 0, i = 0;
+
+    for (i = 0; i < LITEWS_DNS_MAX_ADDRS; i++) 
+    {
+        fds[i] = LITEWS_INVALID_SOCKET;
+    }
+
+    while (winner == LITEWS_INVALID_SOCKET && (next < total || active > 0)) 
+    {
+        unsigned int now_ms = litews_get_time_ms();
+        unsigned int wait_ms = attempt_timeout_ms;
+        struct timeval tv;
+        fd_set wfds;
+        litews_socket_t max_fd = -1;
+        int ret = 0;
+
+        // start the next address when nothing is in flight or the running ones had their head start
+        if (next < total && (active == 0 || now_ms - last_start_ms >= LITEWS_CONNECT_STAGGER_MS)) 
+        {
+            const _litews_dns_addr * a = &addrs[next];
+            litews_socket_t fd = socket(a->family, SOCK_STREAM, 0);
+
+            if (fd >= 0) 
+            {
+                litews_dns_set_blocking(fd, litews_false);
+                ret = connect(fd, (const struct sockaddr *)&a->addr, a->addr_len);
+                if (ret == 0) 
+                {
+                    winner = fd;
+                    break;
+                }
+                if (errno == EINPROGRESS) 
+                {
+                    fds[next] = fd;
+                    started_ms[next] = now_ms;
+                    active++;
+                }
+                else 
+                {
+                    close(fd);
+                }
+            }
+            last_start_ms = now_ms;
+            next++;
+            continue;
+        }
+
+        FD_ZERO(&wfds);
+        for (i = 0; i < next; i++) 
+        {
+            if (fds[i] == LITEWS_INVALID_SOCKET) 
+            {
+                continue;
+            }
+            if (now_ms - started_ms[i] >= attempt_timeout_ms) 
+            {
+                close(fds[i]);
+                fds[i] = LITEWS_INVALID_SOCKET;
+                active--;
+                continue;
+            }
+            if (attempt_timeout_ms - (now_ms - started_ms[i]) < wait_ms) 
+            {
+                wait_ms = attempt_timeout_ms - (now_ms - started_ms[i]);
+            }
+            FD_SET(fds[i], &wfds);
+            if (fds[i] > max_fd) 
+            {
+                max_fd = fds[i];
+            }
+        }
+        if (active == 0) 
+        {
+            continue; // the next address starts at once
+        }
+        if (next < total && LITEWS_CONNECT_STAGGER_MS - (now_ms - last_start_ms) < wait_ms) 
+        {
+            wait_ms = LITEWS_CONNECT_STAGGER_MS - (now_ms - last_start_ms);
+        }
+
+        tv.tv_sec = wait_ms / 1000;
+        tv.tv_usec = (wait_ms % 1000) * 1000;
+        ret = select(max_fd + 1, NULL, &wfds, NULL, &tv);
+        if (ret <= 0) 
+        {
+            continue;
+        }
+
+        for (i = 0; i < next && winner == LITEWS_INVALID_SOCKET; i++) 
+        {
+            int error = 0;
+            socklen_t len = sizeof(error);
+
+            if (fds[i] == LITEWS_INVALID_SOCKET || !FD_ISSET(fds[i], &wfds)) 
+            {
+                continue;
+            }
+            if (getsockopt(fds[i], SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0) 
+            {
+                winner = fds[i];
+            }
+            else 
+            {
+                close(fds[i]); // refused or unreachable, the next address needs no head start
+                last_start_ms = now_ms - LITEWS_CONNECT_STAGGER_MS;
+            }
+            fds[i] = LITEWS_INVALID_SOCKET;
+            active--;
+        }
+    }
+
+    // the losers of the race
+    for (i = 0; i < next; i++) 
+    {
+        if (fds[i] != LITEWS_INVALID_SOCKET) 
+        {
+            close(fds[i]);
+        }
+    }
+
+    if (winner != LITEWS_INVALID_SOCKET) 
+    {
+        litews_dns_set_blocking(winner, litews_true);
+    }
+    return winner;
+}
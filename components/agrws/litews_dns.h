@@ -0,0 +1,44 @@
+#ifndef __LITEWS_DNS_H__
+#define __LITEWS_DNS_H__ 1
+
+#include "litews_socket.h"
+
+#ifndef LITEWS_DNS_MAX_ADDRS
+#define LITEWS_DNS_MAX_ADDRS             4      //addresses kept and raced per host
+#endif
+#ifndef LITEWS_DNS_CACHE_SIZE
+#define LITEWS_DNS_CACHE_SIZE            4      //hosts remembered
+#endif
+#ifndef LITEWS_DNS_CACHE_TTL_MS
+#define LITEWS_DNS_CACHE_TTL_MS          (10 * 60 * 1000)  //lwIP doesn't hand out the record TTL, so a fixed lifetime
+#endif
+#ifndef LITEWS_CONNECT_TIMEOUT_MS
+#define LITEWS_CONNECT_TIMEOUT_MS        5000   //one address gives up after this
+#endif
+#ifndef LITEWS_CONNECT_STAGGER_MS
+#define LITEWS_CONNECT_STAGGER_MS        250    //head start of an address before the next one is tried as well
+#endif
+
+typedef struct _litews_dns_addr_struct 
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    int family;
+} _litews_dns_addr;
+
+// set up the cache lock, called by litews_socket_create so that work threads of
+// several sockets never race on the first connect
+void litews_dns_init(void);
+
+// addresses of 'host':'port', from the cache while fresh, the expired ones when resolving again fails,
+// returns their count, 0 if the name can't be resolved
+int litews_dns_resolve(const char * host, const int port, _litews_dns_addr * addrs, const int max_addrs);
+
+// drop 'host':'port' from the cache, e.g. when none of its addresses answered
+void litews_dns_forget(const char * host, const int port);
+
+// race non-blocking connects across 'addrs', the next address starts when the previous one failed
+// or had LITEWS_CONNECT_STAGGER_MS, returns the first connected socket (blocking mode) or LITEWS_INVALID_SOCKET
+litews_socket_t litews_dns_connect(const _litews_dns_addr * addrs, const int count, const unsigned int attempt_timeout_ms);
+
+#endif
@@ -0,0 +1,149 @@
+#include "litewebsocket.h"
+#include "litews_event.h"
+#include "litews_log.h"
+
+litews_bool litews_event_open(litews_socket s) 
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    litews_socket_t fd = LITEWS_INVALID_SOCKET;
+
+    if (s->wakeup_socket != LITEWS_INVALID_SOCKET) 
+    {
+        return litews_true;
+    }
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) 
+    {
+        LOGE_LITEWS("wakeup socket failed");
+        return litews_false;
+    }
+
+    AG_OS_MEMSET(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    // connected to itself, so a plain 'send' is a wakeup and a 'recv' drains it
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || 
+        getsockname(fd, (struct sockaddr *)&addr, &addr_len) != 0 || 
+        connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) 
+    {
+        LOGE_LITEWS("wakeup socket setup failed");
+        close(fd);
+        return litews_false;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+
+    s->wakeup_socket = fd;
+    return litews_true;
+}
+
+void litews_event_close(litews_socket s) 
+{
+    if (s->wakeup_socket != LITEWS_INVALID_SOCKET) 
+    {
+        close(s->wakeup_socket);
+        s->wakeup_socket = LITEWS_INVALID_SOCKET;
+    }
+}
+
+void litews_event_wakeup(litews_socket s) 
+{
+    const char c = 0;
+
+    if (s->wakeup_socket != LITEWS_INVALID_SOCKET) 
+    {
+        send(s->wakeup_socket, &c, 1, 0);
+    }
+}
+
+litews_bool litews_event_wait(litews_socket s, const unsigned int timeout_ms) 
+{
+    char drain[16];
+    fd_set read_set;
+    fd_set write_set;
+    struct timeval tv;
+    litews_socket_t max_fd = -1;
+    int ret = 0;
+    // a consumer without room is asked again soon, unless litews_socket_recv_resume wakes the thread earlier
+    const unsigned int wait_ms = (s->recv_held && timeout_ms > LITEWS_RECV_RETRY_MS) ? 
+        LITEWS_RECV_RETRY_MS : timeout_ms;
+
+    // already decrypted or queued work must not wait for the socket, unless a consumer without room holds reading back
+    if (!s->recv_held && litews_socket_pending_bytes(s) > 0) 
+    {
+        return litews_true;
+    }
+    litews_mutex_lock(s->send_mutex);
+    ret = (litews_socket_has_send_frame(s) && s->is_connected && !s->send_pending && s->send_batch_len == 0);
+    litews_mutex_unlock(s->send_mutex);
+    if (ret) 
+    {
+        return litews_true;
+    }
+
+    FD_ZERO(&read_set);
+    FD_ZERO(&write_set);
+    if (s->socket != LITEWS_INVALID_SOCKET) 
+    {
+        if (!s->recv_held) 
+        {
+            FD_SET(s->socket, &read_set);
+        }
+        if (s->send_pending || s->send_batch_len > 0) 
+        {
+            FD_SET(s->socket, &write_set);
+        }
+        max_fd = s->socket;
+    }
+    if (s->wakeup_socket != LITEWS_INVALID_SOCKET) 
+    {
+        FD_SET(s->wakeup_socket, &read_set);
+        if (s->wakeup_socket > max_fd) 
+        {
+            max_fd = s->wakeup_socket;
+        }
+    }
+
+    if (max_fd < 0) 
+    {
+        litews_thread_sleep(wait_ms);
+        return litews_false;
+    }
+
+    tv.tv_sec = wait_ms / 1000;
+    tv.tv_usec = (wait_ms % 1000) * 1000;
+    ret = select(max_fd + 1, &read_set, &write_set, NULL, &tv);
+    if (ret <= 0) 
+    {
+        return litews_false;
+    }
+
+    if (s->wakeup_socket != LITEWS_INVALID_SOCKET && FD_ISSET(s->wakeup_socket, &read_set)) 
+    {
+        while (recv(s->wakeup_socket, drain, sizeof(drain), 0) > 0) 
+        {
+        }
+    }
+    return litews_true;
+}
+
+litews_bool litews_event_wait_writable(litews_socket s, const unsigned int timeout_ms) 
+{
+    fd_set write_set;
+    struct timeval tv;
+
+    if (s->socket == LITEWS_INVALID_SOCKET) 
+    {
+        return litews_false;
+    }
+
+    FD_ZERO(&write_set);
+    FD_SET(s->socket, &write_set);
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    return (select(s->socket + 1, NULL, &write_set, NULL, &tv) > 0) ? litews_true : litews_false;
+}
+
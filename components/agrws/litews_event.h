@@ -0,0 +1,22 @@
+#ifndef __LITEWS_EVENT_H__
+#define __LITEWS_EVENT_H__ 1
+
+#include "litews_socket.h"
+
+// loopback UDP socket used to wake the work thread out of 'select', lwIP has no pipe or eventfd
+litews_bool litews_event_open(litews_socket s);
+
+void litews_event_close(litews_socket s);
+
+// make the next or current 'litews_event_wait' return at once, callable from any thread
+void litews_event_wakeup(litews_socket s);
+
+// block until the transport is readable (or writable while a frame is partially written),
+// a wakeup arrives or 'timeout_ms' passed, returns litews_false on timeout
+litews_bool litews_event_wait(litews_socket s, const unsigned int timeout_ms);
+
+// block until the transport is writable or 'timeout_ms' passed
+litews_bool litews_event_wait_writable(litews_socket s, const unsigned int timeout_ms);
+
+#endif
+
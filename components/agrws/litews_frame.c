@@ -27,6 +27,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 //#include <assert.h>
 #include <time.h>
 
@@ -45,10 +46,8 @@ _litews_frame * litews_frame_create_with_recv_data(const void * data, const size
 		unsigned int header_size = is_masked ? 6 : 2;
 		
 		unsigned int expected_size = 0, mask_pos = 0;
-		size_t index = 0;
 		_litews_frame * frame = NULL;
 		const unsigned char * actual_udata = NULL;
-		unsigned char * unmasked = NULL;
 		
 		switch (payload) 
 		{
@@ -119,12 +118,8 @@ _litews_frame * litews_frame_create_with_recv_data(const void * data, const size
 			actual_udata = udata + header_size;
 			if (is_masked) 
 			{
-				unmasked = (unsigned char *)frame->data;
-				for (index = 0; index < expected_size; index++) 
-				{
-					*unmasked = *actual_udata ^ frame->mask[index & 0x3];
-					unmasked++; actual_udata++;
-				}
+				AG_OS_MEMCPY(frame->data, actual_udata, expected_size);
+				litews_frame_mask_data((unsigned char *)frame->data, expected_size, frame->mask, 0);
 			} 
 			else 
 			{
@@ -140,20 +135,24 @@ void litews_frame_create_bin_header(_litews_frame * f, unsigned char * header, c
 {
 	const unsigned int size = (unsigned int)data_size;
 
+	// 'is_finished' follows FIN, the send queue tells whole messages apart by it
 	if(flag == litews_frame_start)
 	{
 	    LOGV_LITEWS("litews_frame_start");
     	*header++ = 0x00 | f->opcode;
+    	f->is_finished = litews_false;
 	}
 	else if(flag == litews_frame_continue)
 	{
 	    LOGV_LITEWS("litews_frame_continue");
 	    *header++ = 0x00 | f->opcode;
+	    f->is_finished = litews_false;
 	}
 	else
 	{
 	    LOGV_LITEWS("litews_frame_end");
-	    *header++ = 0x80 | f->opcode;
+	    *header++ = 0x80 | f->opcode; // litews_frame_end or litews_frame_one
+	    f->is_finished = litews_true;
 	}
 	
 	if (size < 126) 
@@ -193,7 +192,7 @@ void litews_frame_create_header(_litews_frame * f, unsigned char * header, const
 {
 	const unsigned int size = (unsigned int)data_size;
 	
-	*header++ = 0x80 | f->opcode;
+	*header++ = 0x80 | (f->is_compressed ? 0x40 : 0) | f->opcode;
 	
 	if (size < 126) 
 	{
@@ -232,8 +231,6 @@ void litews_frame_fill_with_send_bin_data(_litews_frame * f, const void * data,
 {
 	unsigned char header[16];
 	unsigned char * frame = NULL;
-	unsigned char mask[4];
-	size_t index = 0;
 
 	litews_frame_create_bin_header(f, header, data_size, flag);
 	
@@ -257,31 +254,32 @@ void litews_frame_fill_with_send_bin_data(_litews_frame * f, const void * data,
 		
 		if (f->is_masked) 
 		{
-			AG_OS_MEMCPY(mask, &f->mask, 4);
-			for (index = 0; index < data_size; index++) 
-			{
-				*frame = *frame ^ mask[index & 0x3];
-				frame++;
-			}
+			litews_frame_mask_data(frame, data_size, f->mask, 0);
 		}
 	}
-	if(flag == litews_frame_end)
-	{
-    	f->is_finished = litews_true;
-	}
-	else
+}
+
+
+void litews_frame_fill_with_send_bin_buffer(_litews_frame * f, unsigned char * payload, const size_t data_size, int flag) 
+{
+	unsigned char header[16];
+
+	litews_frame_create_bin_header(f, header, data_size, flag);
+
+	f->data = payload - f->header_size;
+	f->data_size = data_size + f->header_size;
+	AG_OS_MEMCPY(f->data, header, f->header_size);
+
+	if (f->is_masked) 
 	{
-	    f->is_finished = litews_false;
+		litews_frame_mask_data(payload, data_size, f->mask, 0);
 	}
 }
 
-
 void litews_frame_fill_with_send_data(_litews_frame * f, const void * data, const size_t data_size) 
 {
 	unsigned char header[16];
 	unsigned char * frame = NULL;
-	unsigned char mask[4];
-	size_t index = 0;
 	
 	litews_frame_create_header(f, header, data_size);
 
@@ -300,12 +298,7 @@ void litews_frame_fill_with_send_data(_litews_frame * f, const void * data, cons
 		
 		if (f->is_masked) 
 		{
-			AG_OS_MEMCPY(mask, &f->mask, 4);
-			for (index = 0; index < data_size; index++) 
-			{
-				*frame = *frame ^ mask[index & 0x3];
-				frame++;
-			}
+			litews_frame_mask_data(frame, data_size, f->mask, 0);
 		}
 	}
 	f->is_finished = litews_true;
@@ -313,42 +306,217 @@ void litews_frame_fill_with_send_data(_litews_frame * f, const void * data, cons
 
 void litews_frame_combine_datas(_litews_frame * to, _litews_frame * from) 
 {
-	unsigned char * comb_data = (unsigned char *)litews_malloc(to->data_size + from->data_size);
-	if (comb_data) 
+	if (!from->data || !from->data_size) 
+	{
+		return;
+	}
+	// capacity grows geometrically, so N fragments cost linear copying
+	if (litews_frame_reserve_data(to, to->data_size + from->data_size, 0)) 
+	{
+		AG_OS_MEMCPY((unsigned char *)to->data + to->data_size, from->data, from->data_size);
+		to->data_size += from->data_size;
+	}
+}
+
+void litews_frame_parser_reset(_litews_frame_parser * p) 
+{
+	AG_OS_MEMSET(p, 0, sizeof(_litews_frame_parser));
+	p->state = litews_frame_parser_state_header;
+	p->bytes_need = 2;
+}
+
+static void litews_frame_parser_next_field(_litews_frame_parser * p) 
+{
+	const unsigned char * b = p->bytes;
+	unsigned int index = 0, payload = 0;
+
+	switch (p->state) 
+	{
+		case litews_frame_parser_state_header:
+			p->opcode = (litews_opcode)(b[0] & 0x0f);
+			p->is_finished = ((b[0] >> 7) & 0x01) ? litews_true : litews_false;
+			p->is_compressed = ((b[0] >> 6) & 0x01) ? litews_true : litews_false;
+			p->is_masked = ((b[1] >> 7) & 0x01) ? litews_true : litews_false;
+			payload = b[1] & 0x7f;
+			if (payload == 126 || payload == 127) 
+			{
+				p->state = litews_frame_parser_state_ext_len;
+				p->bytes_need = (payload == 126) ? 2 : 8;
+				break;
+			}
+			p->payload_size = payload;
+			p->state = p->is_masked ? litews_frame_parser_state_mask : litews_frame_parser_state_payload;
+			p->bytes_need = p->is_masked ? 4 : 0;
+			break;
+
+		case litews_frame_parser_state_ext_len:
+			if (p->bytes_need == 8 && (b[0] & 0x80)) 
+			{
+				// the most significant bit of a 64 bit length MUST be 0
+				p->state = litews_frame_parser_state_error;
+				break;
+			}
+			p->payload_size = 0;
+			for (index = 0; index < p->bytes_need; index++) 
+			{
+				p->payload_size = (p->payload_size << 8) | b[index];
+			}
+			p->state = p->is_masked ? litews_frame_parser_state_mask : litews_frame_parser_state_payload;
+			p->bytes_need = p->is_masked ? 4 : 0;
+			break;
+
+		case litews_frame_parser_state_mask:
+			AG_OS_MEMCPY(p->mask, b, 4);
+			p->state = litews_frame_parser_state_payload;
+			p->bytes_need = 0;
+			break;
+
+		default:
+			break;
+	}
+	p->bytes_len = 0;
+}
+
+size_t litews_frame_parser_feed_header(_litews_frame_parser * p, const unsigned char * data, const size_t len) 
+{
+	size_t used = 0, n = 0;
+
+	while (used < len && p->state < litews_frame_parser_state_payload) 
 	{
-		if (to->data && to->data_size) 
+		n = p->bytes_need - p->bytes_len;
+		if (n > len - used) 
 		{
-			AG_OS_MEMCPY(comb_data, to->data, to->data_size);
+			n = len - used;
 		}
-		comb_data += to->data_size;
-		if (from->data && from->data_size) 
+		AG_OS_MEMCPY(p->bytes + p->bytes_len, data + used, n);
+		p->bytes_len += n;
+		used += n;
+		if (p->bytes_len == p->bytes_need) 
 		{
-			AG_OS_MEMCPY(comb_data, from->data, from->data_size);
+			litews_frame_parser_next_field(p);
 		}
 	}
-	litews_free(to->data);
-	to->data = comb_data;
-	to->data_size += from->data_size;
+	return used;
+}
+
+void litews_frame_mask_data(unsigned char * data, const size_t len, const unsigned char mask[4], const size_t offset) 
+{
+	unsigned char rotated[4];
+	unsigned char * words = NULL;
+	uint32_t mask32 = 0, w0 = 0, w1 = 0, w2 = 0, w3 = 0;
+	size_t index = 0, head = 0, count = 0;
+
+	// unaligned head byte by byte
+	head = (size_t)((4 - ((uintptr_t)data & 0x3)) & 0x3);
+	if (head > len) 
+	{
+		head = len;
+	}
+	for (index = 0; index < head; index++) 
+	{
+		data[index] ^= mask[(offset + index) & 0x3];
+	}
+
+	// mask rotated to the first aligned byte, in memory order so no byte swap is needed
+	for (count = 0; count < 4; count++) 
+	{
+		rotated[count] = mask[(offset + head + count) & 0x3];
+	}
+	AG_OS_MEMCPY(&mask32, rotated, 4);
+
+	// words go through memcpy to stay clear of strict aliasing, compilers turn it into aligned loads
+	words = data + head;
+	count = (len - head) >> 2;
+	for (index = 0; index + 4 <= count; index += 4) 
+	{
+		memcpy(&w0, words + (index << 2), 4);
+		memcpy(&w1, words + (index << 2) + 4, 4);
+		memcpy(&w2, words + (index << 2) + 8, 4);
+		memcpy(&w3, words + (index << 2) + 12, 4);
+		w0 ^= mask32;
+		w1 ^= mask32;
+		w2 ^= mask32;
+		w3 ^= mask32;
+		memcpy(words + (index << 2), &w0, 4);
+		memcpy(words + (index << 2) + 4, &w1, 4);
+		memcpy(words + (index << 2) + 8, &w2, 4);
+		memcpy(words + (index << 2) + 12, &w3, 4);
+	}
+	for (; index < count; index++) 
+	{
+		memcpy(&w0, words + (index << 2), 4);
+		w0 ^= mask32;
+		memcpy(words + (index << 2), &w0, 4);
+	}
+
+	// tail
+	for (index = head + (count << 2); index < len; index++) 
+	{
+		data[index] ^= mask[(offset + index) & 0x3];
+	}
+}
+
+litews_bool litews_frame_reserve_data(_litews_frame * f, const size_t size, const size_t limit) 
+{
+	void * data = NULL;
+	size_t capacity = 0;
+
+	if (size <= f->data_capacity) 
+	{
+		return litews_true;
+	}
+
+	// the first reservation is exact, single frame messages are the common case
+	capacity = f->data_capacity ? f->data_capacity * 2 : f->data_size * 2;
+	if (limit && capacity > limit) 
+	{
+		capacity = limit;
+	}
+	if (capacity < size) 
+	{
+		capacity = size;
+	}
+
+	data = litews_malloc(capacity);
+	if (!data) 
+	{
+		return litews_false;
+	}
+	if (f->data && f->data_size) 
+	{
+		AG_OS_MEMCPY(data, f->data, f->data_size);
+	}
+	litews_free(f->data);
+	f->data = data;
+	f->data_capacity = capacity;
+	return litews_true;
 }
 
 _litews_frame * litews_frame_create(void) 
 {
-	_litews_frame * f = (_litews_frame *)litews_malloc_zero(sizeof(_litews_frame));
+	_litews_frame * f = (_litews_frame *)litews_malloc(sizeof(_litews_frame));
+	litews_frame_init(f);
+	return f;
+}
+
+void litews_frame_init(_litews_frame * f) 
+{
 	union {
 		unsigned int ui;
 		unsigned char b[4];
 	} mask_union;
 	//assert(sizeof(unsigned int) == 4);
 	//	mask_union.ui = 2018915346;
+	AG_OS_MEMSET(f, 0, sizeof(_litews_frame));
 	mask_union.ui = (rand() / (RAND_MAX / 2) + 1) * rand();
 	AG_OS_MEMCPY(f->mask, mask_union.b, 4);
-	return f;
 }
 
 void litews_frame_delete(_litews_frame * f) 
 {
 	if (f) 
 	{
+		litews_frame_delete(f->plain);
 		litews_free(f->data);
 		litews_free(f);
 	}
@@ -363,11 +531,11 @@ void litews_frame_delete_clean(_litews_frame ** f)
     }
 }
 
-size_t litews_check_recv_frame_size(const void * data, const size_t data_size) 
+size_t litews_recv_frame_size_from_header(const void * header, const size_t header_len) 
 {
-	if (data && data_size >= 2) 
+	if (header && header_len >= 2) 
 	{
-		const unsigned char * udata = (const unsigned char *)data;
+		const unsigned char * udata = (const unsigned char *)header;
 		//        const unsigned int is_finshd = (udata[0] >> 7) & 0x01;
 		const unsigned int is_masked = (udata[1] >> 7) & 0x01;
 		const unsigned int payload = udata[1] & 0x7f;
@@ -382,7 +550,7 @@ size_t litews_check_recv_frame_size(const void * data, const size_t data_size)
 			default: break;
 		}
 		
-		if (data_size < header_size) 
+		if (header_len < header_size) 
 		{
 			return 0;
 		}
@@ -409,10 +577,13 @@ size_t litews_check_recv_frame_size(const void * data, const size_t data_size)
 				break;
 		}
 		
-		const unsigned int nPackSize = expected_size + header_size;
-		return (nPackSize <= data_size) ? nPackSize : 0;
+		return expected_size + header_size;
 	}
 	return 0;
 }
 
-
+size_t litews_check_recv_frame_size(const void * data, const size_t data_size) 
+{
+	const size_t nPackSize = litews_recv_frame_size_from_header(data, data_size);
+	return (nPackSize && nPackSize <= data_size) ? nPackSize : 0;
+}
@@ -5,6 +5,8 @@
 #include "litewebsocket.h"
 #include "aligenie_os.h"
 
+#define LITEWS_FRAME_MAX_HEADER_SIZE 14 // 2 + 8 extended length + 4 mask
+
 typedef enum _litews_opcode {
 	litews_opcode_continuation = 0x0, // %x0 denotes a continuation frame
 	litews_opcode_text_frame = 0x1, // %x1 denotes a text frame
@@ -23,22 +25,75 @@ typedef struct _litews_frame_struct
 	litews_bool is_masked;
 	litews_bool is_finished;
 	unsigned char header_size;
+	size_t data_capacity; // allocated size of 'data' while a message is reassembled
+	litews_bool is_borrowed; // frame and 'data' belong to a pooled send buffer of the socket
+	litews_bool is_compressed; // RSV1, payload is permessage-deflate compressed
+	unsigned int queued_ms; // binary frame entered the send queue, see litews_get_time_ms
+	struct _litews_frame_struct * plain; // the text as queued while its compressed copy is in flight
+	struct _litews_frame_struct * next; // send queue link, queuing needs no list node
 } _litews_frame;
 
+typedef enum _litews_frame_parser_state 
+{
+	litews_frame_parser_state_header = 0, // FIN, opcode, MASK and 7 bit payload length
+	litews_frame_parser_state_ext_len, // 16 or 64 bit extended payload length
+	litews_frame_parser_state_mask, // masking key
+	litews_frame_parser_state_payload, // payload bytes, handed out as they arrive
+	litews_frame_parser_state_error // malformed header
+} litews_frame_parser_state;
+
+// incremental parser of received frame headers, the payload is never buffered here
+typedef struct _litews_frame_parser_struct 
+{
+	litews_frame_parser_state state;
+	unsigned char bytes[8]; // collected bytes of the current header field
+	size_t bytes_len;
+	size_t bytes_need;
+	litews_opcode opcode;
+	litews_bool is_finished;
+	litews_bool is_masked;
+	litews_bool is_compressed; // RSV1
+	unsigned char mask[4];
+	unsigned long long payload_size;
+	unsigned long long payload_done; // payload bytes already handed out
+} _litews_frame_parser;
+
+// full frame size described by the header bytes, 0 if 'header_len' is too short to tell
+size_t litews_recv_frame_size_from_header(const void * header, const size_t header_len);
+
 size_t litews_check_recv_frame_size(const void * data, const size_t data_size);
 
 _litews_frame * litews_frame_create_with_recv_data(const void * data, const size_t data_size);
 
+void litews_frame_parser_reset(_litews_frame_parser * p);
+
+// consume header bytes until the payload starts or the header is malformed, returns bytes used
+size_t litews_frame_parser_feed_header(_litews_frame_parser * p, const unsigned char * data, const size_t len);
+
+// xor 'len' bytes with 'mask', 'offset' is the position of 'data' in the masked payload
+void litews_frame_mask_data(unsigned char * data, const size_t len, const unsigned char mask[4], const size_t offset);
+
+// make room for 'size' bytes of 'data' in total, keeping the current content,
+// capacity grows geometrically but not past 'limit' (0 - no limit)
+litews_bool litews_frame_reserve_data(_litews_frame * f, const size_t size, const size_t limit);
+
 // data - should be null, and setted by newly created. 'data' & 'data_size' can be null
 void litews_frame_fill_with_send_data(_litews_frame * f, const void * data, const size_t data_size);
 
 void litews_frame_fill_with_send_bin_data(_litews_frame * f, const void * data, const size_t data_size, int flag) ;
 
+// header is written into the LITEWS_FRAME_MAX_HEADER_SIZE bytes before 'payload' and the payload is masked in place,
+// 'data' points into the caller's buffer afterwards so the frame goes out with a single write
+void litews_frame_fill_with_send_bin_buffer(_litews_frame * f, unsigned char * payload, const size_t data_size, int flag);
+
 // combine datas of 2 frames. combined is 'to'
 void litews_frame_combine_datas(_litews_frame * to, _litews_frame * from);
 
 _litews_frame * litews_frame_create(void);
 
+// zero 'f' and pick a new masking key, for frames that are not allocated by 'litews_frame_create'
+void litews_frame_init(_litews_frame * f);
+
 void litews_frame_delete(_litews_frame * f);
 
 void litews_frame_delete_clean(_litews_frame ** f);
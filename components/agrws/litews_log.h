@@ -7,7 +7,9 @@ extern "C" {
 #endif  
 
 #include "aligenie_os.h"
+#ifndef AG_OS_POSIX
 #include "esp_log.h"
+#endif
 
 
 //#define LITEWS_LOG_LEVEL_DEBUG  3
@@ -22,10 +24,17 @@ extern "C" {
 
 #define LOG_LITEWS(...)     ag_os_log_print(__VA_ARGS__)
 
+#ifdef AG_OS_POSIX
+#define LOGE_LITEWS(...)    ag_os_log_print(LITEWS_LOG_TAG, AG_OS_LOGLEVEL_ERROR, __VA_ARGS__)
+#define LOGW_LITEWS(...)    ag_os_log_print(LITEWS_LOG_TAG, AG_OS_LOGLEVEL_WARN, __VA_ARGS__)
+#define LOGD_LITEWS(...)    ag_os_log_print(LITEWS_LOG_TAG, AG_OS_LOGLEVEL_DEBUG, __VA_ARGS__)
+#define LOGV_LITEWS(...)    ag_os_log_print(LITEWS_LOG_TAG, AG_OS_LOGLEVEL_VERBOSE, __VA_ARGS__)
+#else
 #define LOGE_LITEWS(...)    ESP_LOGE(LITEWS_LOG_TAG, __VA_ARGS__)
 #define LOGW_LITEWS(...)    ESP_LOGW(LITEWS_LOG_TAG, __VA_ARGS__)
 #define LOGD_LITEWS(...)    ESP_LOGW(LITEWS_LOG_TAG, __VA_ARGS__)
 #define LOGV_LITEWS(...)    ESP_LOGV(LITEWS_LOG_TAG, __VA_ARGS__)
+#endif
 
 #define FUNCTION_BEGIN      LOGV_LITEWS("function %s line %d begin", __FUNCTION__, __LINE__);
 #define FUNCTION_END        LOGV_LITEWS("function %s line %d end", __FUNCTION__, __LINE__);
@@ -2,15 +2,100 @@
 #include "aligenie_os.h"
 #include <string.h>
 #include "litews_log.h"
+#include "litews_memory.h"
+
+// frames, list nodes and short payloads are freed soon after allocation,
+// so freed blocks of a few size classes are kept and reused instead of going back to the heap
+static const size_t k_litews_mem_class_size[LITEWS_MEM_POOL_CLASSES] = { 32, 64, 192, 640 };
+// list nodes and frames are plentiful and small, payload classes are kept shallow
+static const unsigned int k_litews_mem_class_depth[LITEWS_MEM_POOL_CLASSES] = { 
+    LITEWS_MEM_POOL_DEPTH * 4, LITEWS_MEM_POOL_DEPTH * 4, LITEWS_MEM_POOL_DEPTH, LITEWS_MEM_POOL_DEPTH / 2 };
+
+// in front of every block
+typedef union _litews_mem_header_union 
+{
+    union _litews_mem_header_union * next; // while cached
+    size_t size_class; // while in use, LITEWS_MEM_POOL_CLASSES for plain heap blocks
+    double align; // keep the user part aligned for any type
+} _litews_mem_header;
+
+static _litews_mem_header * _litews_mem_free_list[LITEWS_MEM_POOL_CLASSES];
+static unsigned int _litews_mem_free_count[LITEWS_MEM_POOL_CLASSES];
+static _litews_mem_stats _litews_mem_stat;
+static AG_MUTEX_T _litews_mem_mutex = NULL;
+static unsigned int _litews_mem_users = 0; // sockets alive, the pool is emptied when the last one goes
+
+static void litews_mem_lock(void) 
+{
+    ag_os_task_mutex_lock(&_litews_mem_mutex);
+}
+
+static void litews_mem_unlock(void) 
+{
+    ag_os_task_mutex_unlock(&_litews_mem_mutex);
+}
+
+static size_t litews_mem_class_of(const size_t size) 
+{
+    size_t index = 0;
+    for (index = 0; index < LITEWS_MEM_POOL_CLASSES; index++) 
+    {
+        if (size <= k_litews_mem_class_size[index]) 
+        {
+            break;
+        }
+    }
+    return index;
+}
 
 void * litews_malloc(const size_t size) 
 {
-    if (size > 0) 
+    _litews_mem_header * block = NULL;
+    size_t size_class = 0;
+
+    if (size == 0) 
+    {
+        return NULL;
+    }
+
+    size_class = litews_mem_class_of(size);
+    if (size_class < LITEWS_MEM_POOL_CLASSES) 
+    {
+        litews_mem_lock();
+        block = _litews_mem_free_list[size_class];
+        if (block) 
+        {
+            _litews_mem_free_list[size_class] = block->next;
+            _litews_mem_free_count[size_class]--;
+            _litews_mem_stat.cached--;
+            _litews_mem_stat.cached_bytes -= k_litews_mem_class_size[size_class];
+            _litews_mem_stat.hits++;
+        } 
+        else 
+        {
+            _litews_mem_stat.misses++;
+        }
+        litews_mem_unlock();
+
+        if (!block) 
+        {
+            block = (_litews_mem_header *)AG_OS_MALLOC(sizeof(_litews_mem_header) + k_litews_mem_class_size[size_class]);
+        }
+    } 
+    else 
+    {
+        block = (_litews_mem_header *)AG_OS_MALLOC(sizeof(_litews_mem_header) + size);
+        litews_mem_lock();
+        _litews_mem_stat.oversize++;
+        litews_mem_unlock();
+    }
+
+    if (!block) 
     {
-        void * mem = AG_OS_MALLOC(size);
-        return mem;
+        return NULL;
     }
-    return NULL;
+    block->size_class = size_class;
+    return block + 1;
 }
 
 void * litews_malloc_zero(const size_t size) 
@@ -29,9 +114,34 @@ void * litews_malloc_zero(const size_t size)
 
 void litews_free(void * mem) 
 {
-    if (mem) 
+    _litews_mem_header * block = NULL;
+    size_t size_class = 0;
+
+    if (!mem) 
+    {
+        return;
+    }
+
+    block = (_litews_mem_header *)mem - 1;
+    size_class = block->size_class;
+    if (size_class < LITEWS_MEM_POOL_CLASSES) 
     {
-        AG_OS_FREE(mem);
+        litews_mem_lock();
+        if (_litews_mem_free_count[size_class] < k_litews_mem_class_depth[size_class]) 
+        {
+            block->next = _litews_mem_free_list[size_class];
+            _litews_mem_free_list[size_class] = block;
+            _litews_mem_free_count[size_class]++;
+            _litews_mem_stat.cached++;
+            _litews_mem_stat.cached_bytes += k_litews_mem_class_size[size_class];
+            block = NULL;
+        }
+        litews_mem_unlock();
+    }
+
+    if (block) 
+    {
+        AG_OS_FREE(block);
     }
 }
 
@@ -44,3 +154,64 @@ void litews_free_clean(void ** mem)
     }
 }
 
+void litews_mem_get_stats(_litews_mem_stats * stats) 
+{
+    if (stats && _litews_mem_mutex) 
+    {
+        litews_mem_lock();
+        *stats = _litews_mem_stat;
+        litews_mem_unlock();
+    }
+}
+
+void litews_mem_init(void) 
+{
+    if (!_litews_mem_mutex) 
+    {
+        ag_os_task_mutex_init(&_litews_mem_mutex);
+    }
+    litews_mem_lock();
+    _litews_mem_users++;
+    litews_mem_unlock();
+}
+
+void litews_mem_release(void) 
+{
+    int is_last = 0;
+
+    litews_mem_lock();
+    if (_litews_mem_users > 0 && --_litews_mem_users == 0) 
+    {
+        is_last = 1;
+    }
+    litews_mem_unlock();
+    if (is_last) 
+    {
+        litews_mem_trim(); // cached blocks are only worth keeping while a connection is alive
+    }
+}
+
+void litews_mem_trim(void) 
+{
+    _litews_mem_header * block = NULL;
+    size_t index = 0;
+
+    if (!_litews_mem_mutex) 
+    {
+        return;
+    }
+    litews_mem_lock();
+    for (index = 0; index < LITEWS_MEM_POOL_CLASSES; index++) 
+    {
+        while (_litews_mem_free_list[index]) 
+        {
+            block = _litews_mem_free_list[index];
+            _litews_mem_free_list[index] = block->next;
+            AG_OS_FREE(block);
+        }
+        _litews_mem_free_count[index] = 0;
+    }
+    _litews_mem_stat.cached = 0;
+    _litews_mem_stat.cached_bytes = 0;
+    litews_mem_unlock();
+}
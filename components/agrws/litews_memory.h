@@ -15,6 +15,31 @@ void litews_free(void * mem);
 
 void litews_free_clean(void ** mem);
 
+#define LITEWS_MEM_POOL_CLASSES 4 // size classes of 32, 64, 192 and 640 bytes, audio chunks use pooled send buffers
+#ifndef LITEWS_MEM_POOL_DEPTH
+#define LITEWS_MEM_POOL_DEPTH 8 // freed payload blocks kept per class, 4x for nodes and frames, the rest goes back to the heap
+#endif
+
+typedef struct _litews_mem_stats_struct 
+{
+	unsigned int hits; // allocations served from a cached block
+	unsigned int misses; // allocations of a pooled class that needed the heap
+	unsigned int oversize; // allocations larger than the biggest class
+	unsigned int cached; // blocks waiting for reuse
+	size_t cached_bytes;
+} _litews_mem_stats;
+
+void litews_mem_get_stats(_litews_mem_stats * stats);
+
+// set up the pool lock and count one more socket, called before the socket's first allocation
+void litews_mem_init(void);
+
+// one socket less, the last one gives the cached blocks back to the heap
+void litews_mem_release(void);
+
+// give all cached blocks back to the heap, litews_mem_release does it for the last socket
+void litews_mem_trim(void);
+
 #endif
 
 
@@ -0,0 +1,72 @@
+
+#include "litews_ring.h"
+
+void litews_ring_init(_litews_ring * ring, void * buffer, const size_t size) 
+{
+	ring->buffer = (unsigned char *)buffer;
+	ring->size = size;
+	litews_ring_reset(ring);
+}
+
+void litews_ring_reset(_litews_ring * ring) 
+{
+	ring->head = 0;
+	ring->len = 0;
+}
+
+size_t litews_ring_free_size(const _litews_ring * ring) 
+{
+	return ring->size - ring->len;
+}
+
+unsigned char * litews_ring_write_ptr(_litews_ring * ring, size_t * avail) 
+{
+	size_t tail = 0;
+
+	if (ring->len == 0) 
+	{
+		// empty, restart at the front to get the largest contiguous region
+		ring->head = 0;
+	}
+
+	tail = ring->head + ring->len;
+	if (tail >= ring->size) 
+	{
+		tail -= ring->size;
+		*avail = ring->head - tail;
+	} 
+	else 
+	{
+		*avail = ring->size - tail;
+	}
+	return ring->buffer + tail;
+}
+
+void litews_ring_commit(_litews_ring * ring, const size_t len) 
+{
+	ring->len += len;
+}
+
+unsigned char * litews_ring_read_ptr(const _litews_ring * ring, size_t * avail) 
+{
+	const size_t to_end = ring->size - ring->head;
+	*avail = (ring->len < to_end) ? ring->len : to_end;
+	return ring->buffer + ring->head;
+}
+
+void litews_ring_consume(_litews_ring * ring, const size_t len) 
+{
+	const size_t n = (len < ring->len) ? len : ring->len;
+
+	ring->head += n;
+	if (ring->head >= ring->size) 
+	{
+		ring->head -= ring->size;
+	}
+	ring->len -= n;
+	if (ring->len == 0) 
+	{
+		ring->head = 0;
+	}
+}
+
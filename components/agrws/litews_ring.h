@@ -0,0 +1,35 @@
+
+#ifndef __LITEWS_RING_H__
+#define __LITEWS_RING_H__ 1
+
+#include <stdio.h>
+
+// circular byte buffer over caller owned storage, single reader and writer
+typedef struct _litews_ring_struct 
+{
+	unsigned char * buffer;
+	size_t size; // capacity of 'buffer'
+	size_t head; // offset of the first stored byte
+	size_t len; // number of stored bytes
+} _litews_ring;
+
+void litews_ring_init(_litews_ring * ring, void * buffer, const size_t size);
+
+void litews_ring_reset(_litews_ring * ring);
+
+size_t litews_ring_free_size(const _litews_ring * ring);
+
+// contiguous free region after the stored bytes, so data can be read straight into the ring
+unsigned char * litews_ring_write_ptr(_litews_ring * ring, size_t * avail);
+
+// mark 'len' bytes written through 'litews_ring_write_ptr' as stored
+void litews_ring_commit(_litews_ring * ring, const size_t len);
+
+// contiguous stored region starting at the head
+unsigned char * litews_ring_read_ptr(const _litews_ring * ring, size_t * avail);
+
+// drop 'len' bytes from the head
+void litews_ring_consume(_litews_ring * ring, const size_t len);
+
+#endif
+
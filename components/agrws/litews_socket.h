@@ -48,6 +48,9 @@
 #include "litews_thread.h"
 #include "litews_frame.h"
 #include "litews_list.h"
+#include "litews_ring.h"
+#include "litews_tls.h"
+#include "litews_deflate.h"
 
 /*
 #ifdef SUPPORT_MBEDTLS
@@ -85,37 +88,104 @@ typedef SOCKET litews_socket_t;
 
 typedef int litews_socket_t;
 #define LITEWS_INVALID_SOCKET -1
+#define LITEWS_SOCK_CLOSE(sock) close(sock)
 
 #endif
 
-#if defined(SUPPORT_MBEDTLS) || defined(SUPPORT_WOLFSSL)
+#ifndef LITEWS_IDLE_WAIT_MS
+#define LITEWS_IDLE_WAIT_MS              1000   //longest block of the work thread when nothing happens
+#endif
+
+#ifndef LITEWS_SEND_TIMEOUT_MS
+#define LITEWS_SEND_TIMEOUT_MS           5000   //blocking sends (handshake, close) give up after this
+#endif
+#define LITEWS_WRITE_WAIT_MS             100    //step of waiting for a writable socket
+
+#ifndef LITEWS_SEND_QUEUE_MAX_BYTES
+#define LITEWS_SEND_QUEUE_MAX_BYTES      (16 * 1024)  //binary sends would block above this many queued bytes
+#endif
+
+#ifndef LITEWS_SEND_BUFFER_COUNT
+#define LITEWS_SEND_BUFFER_COUNT         4      //pooled send buffers, see litews_socket_alloc_send_buffer
+#endif
+#ifndef LITEWS_SEND_BUFFER_SIZE
+#define LITEWS_SEND_BUFFER_SIZE          2048   //payload capacity of one pooled send buffer
+#endif
+
+#ifndef LITEWS_RECV_RETRY_MS
+#define LITEWS_RECV_RETRY_MS             10     //a consumer without room is asked again after this, unless it resumes reading earlier
+#endif
+#ifndef LITEWS_RECV_HOLD_MAX_MS
+#define LITEWS_RECV_HOLD_MAX_MS          30000  //a consumer without room for this long has stalled, the link is closed
+#endif
+
+#ifndef LITEWS_SEND_BATCH_SIZE
+#define LITEWS_SEND_BATCH_SIZE           4096   //queued frames are gathered into one write of up to this size
+#endif
+
+#ifndef LITEWS_KEEPALIVE_IDLE_MS
+#define LITEWS_KEEPALIVE_IDLE_MS         20000  //first ping after this long without received bytes, adapted later
+#endif
+#ifndef LITEWS_KEEPALIVE_MIN_MS
+#define LITEWS_KEEPALIVE_MIN_MS          5000   //adapting doesn't cross these bounds
+#endif
+#ifndef LITEWS_KEEPALIVE_MAX_MS
+#define LITEWS_KEEPALIVE_MAX_MS          120000
+#endif
+#define LITEWS_KEEPALIVE_GROW_AFTER      3      //answered probes before the idle time grows by a quarter
+#ifndef LITEWS_KEEPALIVE_PONG_TIMEOUT_MS
+#define LITEWS_KEEPALIVE_PONG_TIMEOUT_MS 3000   //a probe without any received byte meanwhile is missed
+#endif
+#ifndef LITEWS_KEEPALIVE_MAX_MISSED
+#define LITEWS_KEEPALIVE_MAX_MISSED      2      //missed probes in a row before the link is dead
+#endif
+
+#ifndef LITEWS_PING_TRACK
+#define LITEWS_PING_TRACK                4      //own pings waiting for their pong, the oldest is given up
+#endif
+
 #define SSL_REC_BUFFER_SIZE              6144   //websocket total receive buffer size
 #define SSL_REC_ONCE_SIZE                4096   //once receive buffer
 
+#define LITEWS_MAX_CONTROL_PAYLOAD       125    //control frames can not be fragmented or longer
+#ifndef LITEWS_MAX_TEXT_MESSAGE_SIZE
+#define LITEWS_MAX_TEXT_MESSAGE_SIZE     (64 * 1024)  //reassembled text message limit, binary is streamed
+#endif
+
 #define SSL_WEBSOCKET_SEND_BUF_LEN       512    //handshake send buffer size
 #define SSL_WEBSOCKET_RECV_BUF_LEN       2048    //handshake recive buffer size
 #define SSL_WEBSOCKET_UUID "OTY0OWI0YzktY2FjNy00ZjIwLTljZGEtM2EwNTZkNmUyNTQx"
-#endif
 
 #ifdef SUPPORT_MBEDTLS
 typedef struct _litews_ssl_struct
 {
     mbedtls_ssl_context ssl_ctx;        /* mbedtls ssl context */
     mbedtls_net_context net_ctx;        /* Fill in socket id */
-    mbedtls_ssl_config ssl_conf;        /* SSL configuration */
-    mbedtls_entropy_context entropy;  //zz mark
-    mbedtls_ctr_drbg_context ctr_drbg;  //zz mark
-    mbedtls_x509_crt_profile profile;
-    //mbedtls_x509_crt cacert;
-    mbedtls_x509_crt clicert;
-    //mbedtls_pk_context pkey;
+    _litews_tls_context * tls;          /* shared config, DRBG and CA chain, see litews_tls.c */
 } _litews_ssl;
 #endif
 
+typedef struct _litews_ping_struct
+{
+    unsigned int id; // payload of the ping, 0 - free slot
+    unsigned int sent_ms; // when its last byte was written
+    litews_bool is_sent; // still queued otherwise
+} _litews_ping;
+
+typedef struct _litews_send_buffer_struct
+{
+    _litews_frame frame; // must be first, queued as is so sending allocates nothing
+    litews_bool is_used;
+    unsigned char data[LITEWS_FRAME_MAX_HEADER_SIZE + LITEWS_SEND_BUFFER_SIZE]; // header room + payload
+} _litews_send_buffer;
+
 struct litews_socket_struct 
 {
     int port;
-    litews_socket_t socket;
+    const litews_transport * transport; // see litews_transport.h
+    litews_bool is_open; // transport connected and not closed yet
+    litews_socket_t socket; // waited on by the work thread, invalid for an in-memory transport
+    litews_socket_t wakeup_socket; // see litews_event.c
     char * scheme;
     char * host;
     char * path;
@@ -135,6 +205,31 @@ struct litews_socket_struct
     litews_on_socket on_disconnected;
     litews_on_socket_recvd_text on_recvd_text;
     litews_on_socket_recvd_bin on_recvd_bin;
+    litews_on_socket_bin_room bin_room; // room of the 'on_recvd_bin' consumer, null - no flow control
+    litews_bool recv_held; // the consumer had no room, reading waits for it
+    unsigned int recv_hold_ms; // when the current hold began, 0 - reading isn't held
+    litews_on_socket_state on_state_changed;
+
+    int state; // litews_socket_state_t last reported to 'on_state_changed'
+    litews_bool is_released; // disconnect_and_release was called, a lost link is not reconnected
+    unsigned int reconnect_min_ms; // 0 - auto reconnect is off
+    unsigned int reconnect_max_ms;
+    unsigned int reconnect_delay_ms; // backoff of the next attempt
+    unsigned int reconnect_at_ms; // end of the current wait, see litews_get_time_ms
+    litews_bool reconnect_keep_queue;
+
+    unsigned int keepalive_idle_ms; // ping after this long without received bytes, 0 - off
+    unsigned int keepalive_ceiling_ms; // shortest idle time a link died at, the NAT forgets sooner, 0 - not seen
+    unsigned int keepalive_pong_timeout_ms;
+    unsigned int keepalive_max_missed;
+    unsigned int keepalive_answered; // probes answered at the current idle time
+    unsigned int keepalive_missed;
+    unsigned int keepalive_probe_ms; // when the outstanding probe was queued, 0 - none
+    unsigned int last_recv_ms; // any byte received, see litews_get_time_ms
+
+    int deflate_window_bits; // permessage-deflate offered with this window, 0 - not offered
+    litews_bool deflate_no_context_takeover;
+    _litews_deflate * deflate; // accepted by the server for the current connection
 
 #ifdef SUPPORT_REDUCE_MEM
 #else
@@ -143,9 +238,42 @@ struct litews_socket_struct
     size_t received_len; // length of actualy readed message
 #endif
 
-    _litews_list * send_frames;
+    _litews_frame * send_head; // queued frames linked by 'next'
+    _litews_frame * send_tail;
+    _litews_frame * send_ctrl_head; // ping, pong and close, popped before anything else
+    _litews_frame * send_ctrl_tail;
+    _litews_frame * send_prio_head; // priority text, popped before 'send_head' between its messages
+    _litews_frame * send_prio_tail;
+    litews_bool send_in_message; // the last frame popped from 'send_head' left a fragmented message open
+    litews_bool send_user_in_message; // the last binary frame queued by the user left its message open
+    litews_bool send_cut_message; // that message lost its start with a link, the rest of it is dropped
+    size_t send_count; // frames in the send queue, all lanes
+    size_t send_bytes; // bytes in the send queue, headers included
+    size_t send_bytes_limit;
+    _litews_frame * send_pending; // popped frame not fully written yet, owned by the work thread
+    size_t send_pending_offset; // bytes of 'send_pending' already written
+    unsigned char * send_batch; // copies of small frames written at once, one TLS record instead of one per frame
+    size_t send_batch_size; // configured, 0 - frames are written one by one
+    size_t send_batch_capacity; // allocated size of 'send_batch'
+    size_t send_batch_len;
+    size_t send_batch_offset; // bytes of 'send_batch' already written
+    _litews_frame * send_batch_head; // frames copied into 'send_batch', released once it is written
+    _litews_frame * send_batch_tail;
+    unsigned int pace_rate; // binary payload bytes per second, 0 - not paced
+    unsigned int pace_burst;
+    long long pace_credit; // byte-milliseconds: 'pace_rate' per ms flows in, 1000 per payload byte goes out
+    unsigned int pace_at_ms; // last time credit flowed in
+    litews_bool pace_waiting; // the head of the data lane waits for credit, counted once
+    unsigned long long send_delay_sum_ms;
     _litews_list * recvd_frames;
 
+    litews_socket_stats stats; // see litews_socket_get_stats, under 'send_mutex'
+    unsigned long long rtt_sum_ms;
+    _litews_ping pings[LITEWS_PING_TRACK];
+    unsigned int ping_index; // next slot to fill, the oldest one
+
+    _litews_send_buffer * send_buffers; // LITEWS_SEND_BUFFER_COUNT, allocated on first use
+
     litews_error error;
 
     litews_mutex work_mutex;
@@ -153,28 +281,41 @@ struct litews_socket_struct
 
 #ifdef SUPPORT_WOLFSSL
     char *client_cert;
-    char received_buffer[SSL_REC_BUFFER_SIZE];
-    size_t buffer_size;
-    size_t buffer_len;
+    WOLFSSL_CTX *wolf_ctx; // per connection, several sockets may be connected at once
+    WOLFSSL *wolf_ssl;
 #endif
 
 #ifdef SUPPORT_MBEDTLS
     const char *client_cert;
     _litews_ssl *ssl;
+#endif
 
-    char received_buffer[SSL_REC_BUFFER_SIZE];
-    size_t buffer_size;
-    size_t buffer_len;
+    struct _litews_pipe_struct * pipe; // in-memory transport, see litews_socket_set_pipe_peer
 
+#ifdef SUPPORT_REDUCE_MEM
+    char received_buffer[SSL_REC_BUFFER_SIZE];
+    _litews_ring recv_ring; // received bytes, frames are parsed in place and may wrap
+    size_t recv_head_scanned; // handshake responce bytes already searched for the end of the head
+
+    _litews_frame_parser recv_parser; // header of the frame being received
+    litews_opcode recv_message_opcode; // text or binary while a fragmented message is open
+    litews_bool recv_frame_informed; // binary frame already handed out its first slice
+    _litews_frame * recv_message; // text message being reassembled
+    litews_bool recv_compressed; // RSV1 of the first frame, the message is inflated as it arrives
+    unsigned char recv_control[LITEWS_MAX_CONTROL_PAYLOAD]; // ping, pong or close payload
 #endif
 };
 
-litews_bool litews_socket_process_handshake_responce(litews_socket s);
+// parse the head of the upgrade responce, 'len' bytes up to and including the blank line
+litews_bool litews_socket_process_handshake_responce(litews_socket s, const char * str, const size_t len);
 
-// receive raw data from socket
+// receive raw data from socket, litews_false after the peer closed the link or it failed (socket closed, error set)
 litews_bool litews_socket_recv(litews_socket s);
 
-// send raw data to socket
+// write what the transport takes now: bytes written, 0 when it would block, -1 after an error (socket closed)
+int litews_socket_write(litews_socket s, const void * data, const size_t data_size);
+
+// send raw data to socket, waits while the transport would block
 litews_bool litews_socket_send(litews_socket s, const void * data, const size_t data_size);
 
 _litews_frame * litews_socket_last_unfin_recvd_frame_by_opcode(litews_socket s, const litews_opcode opcode);
@@ -187,22 +328,31 @@ void litews_socket_process_conn_close_frame(litews_socket s, _litews_frame * fra
 
 void litews_socket_process_received_frame(litews_socket s, _litews_frame * frame);
 
+// read from the transport straight into the free space of 'recv_ring'
+int litews_socket_read_to_ring(litews_socket s);
+
+// forget buffered bytes and any partially received frame or message
+void litews_socket_reset_recv_state(litews_socket s);
+
+// bytes read, -1 once the peer closed the link or it failed (socket closed, error set)
 int litews_socket_idle_recv(litews_socket s);
 
+// bytes the transport holds already, e.g. decrypted by TLS, they don't make the socket readable again
+int litews_socket_pending_bytes(litews_socket s);
+
 litews_bool litews_socket_idle_send(litews_socket s);
 
 void litews_socket_wait_handshake_responce(litews_socket s);
 
 unsigned int litews_socket_get_next_message_id(litews_socket s);
 
+// queue a ping, under 'send_mutex'
 void litews_socket_send_ping(litews_socket s);
 
 void litews_socket_send_disconnect(litews_socket s);
 
 void litews_socket_send_handshake(litews_socket s);
 
-struct addrinfo * litews_socket_connect_getaddr_info(litews_socket s);
-
 void litews_socket_connect_to_host(litews_socket s);
 
 litews_bool litews_socket_create_start_work_thread(litews_socket s);
@@ -213,9 +363,33 @@ void litews_socket_resize_received(litews_socket s, const size_t size);
 
 void litews_socket_append_recvd_frames(litews_socket s, _litews_frame * frame);
 
+// queue a frame on its lane, under 'send_mutex'
 void litews_socket_append_send_frames(litews_socket s, _litews_frame * frame);
 
-litews_bool litews_socket_send_text_priv(litews_socket s, const char * text);
+// delete a sent or dropped frame, pooled frames go back to the pool
+void litews_socket_release_send_frame(litews_socket s, _litews_frame * frame);
+
+// next frame to send or null, caller owns it until 'litews_socket_release_send_frame'
+_litews_frame * litews_socket_pop_send_frame(litews_socket s);
+
+// something 'litews_socket_pop_send_frame' would return
+litews_bool litews_socket_has_send_frame(litews_socket s);
+
+// ms until the send pacer lets the next binary frame go, LITEWS_IDLE_WAIT_MS when it holds none back
+unsigned int litews_socket_pace_wait_ms(litews_socket s);
+
+void litews_socket_delete_send_frames(litews_socket s);
+
+// litews_would_block when 'size' more bytes don't fit the budget, an empty queue always takes one frame
+litews_bool litews_socket_check_send_budget(litews_socket s, const size_t size);
+
+unsigned char * litews_socket_alloc_send_buffer_priv(litews_socket s, size_t * capacity);
+
+litews_bool litews_socket_send_binary_buffer_priv(litews_socket s, unsigned char * buffer, size_t length, int flag);
+
+void litews_socket_free_send_buffer_priv(litews_socket s, unsigned char * buffer);
+
+litews_bool litews_socket_send_text_priv(litews_socket s, const char * text, const litews_bool is_priority);
 
 litews_bool litews_socket_send_binary_priv(litews_socket s, const char * data, size_t length, int flag) ;
 
@@ -237,6 +411,7 @@ void litews_socket_delete(litews_socket s);
 #define COMMAND_INFORM_CONNECTED 4
 #define COMMAND_INFORM_DISCONNECTED 5
 #define COMMAND_DISCONNECT 6
+#define COMMAND_WAIT_RECONNECT 7
 
 #define COMMAND_END 9999
 
@@ -4,26 +4,20 @@
 #include "litews_memory.h"
 #include "litews_string.h"
 #include "litews_log.h"
+#include "litews_event.h"
+#include "litews_tls.h"
+#include "litews_transport.h"
 
-#define LITEWS_CONNECT_RETRY_DELAY 200
-#define LITEWS_CONNECT_ATTEMPS 5
+#include <ctype.h>
 
 #ifndef  LITEWS_OS_WINDOWS 
 #define  WSAEWOULDBLOCK  EAGAIN
 #define  WSAEINPROGRESS     EINPROGRESS
 #endif
 
-#ifdef SUPPORT_WOLFSSL
-static WOLFSSL_CTX* xWolfSSL_Context = NULL;
-static WOLFSSL* xWolfSSL_Object = NULL;
-static size_t WS_PING_LOOP = 0; //ping loop 20S no data send, send ping
-#elif defined(SUPPORT_MBEDTLS)
-static size_t WS_PING_LOOP = 0; //ping loop 20S no data send, send ping
-#else
-#endif
-
 static const char * k_litews_socket_min_http_ver = "1.1";
 static const char * k_litews_socket_sec_websocket_accept = "sec-websocket-accept";
+static const char * k_litews_socket_sec_websocket_extensions = "sec-websocket-extensions";
 
 unsigned int litews_socket_get_next_message_id(litews_socket s) 
 {
@@ -40,10 +34,17 @@ void litews_socket_send_ping(litews_socket s)
     char buff[16];
     size_t len = 0;
     _litews_frame * frame = litews_frame_create();
+    const unsigned int id = litews_socket_get_next_message_id(s);
+    _litews_ping * ping = &s->pings[s->ping_index++ % LITEWS_PING_TRACK];
 
-    len = litews_sprintf(buff, 16, "%u", litews_socket_get_next_message_id(s));
+    len = litews_sprintf(buff, 16, "%u", id);
     LOGD_LITEWS("%s, buff: %s", __FUNCTION__, buff);
 
+    // the round trip starts when it is written, see litews_socket_ping_written
+    ping->id = id;
+    ping->sent_ms = 0;
+    ping->is_sent = litews_false;
+
     frame->is_masked = litews_true;
     frame->opcode = litews_opcode_ping;
     litews_frame_fill_with_send_data(frame, buff, len);
@@ -51,9 +52,9 @@ void litews_socket_send_ping(litews_socket s)
 }
 
 #ifdef SUPPORT_REDUCE_MEM
+// only complete text messages are queued, binary payload is handed out by 'litews_socket_idle_recv'
 void litews_socket_inform_recvd_frames(litews_socket s) 
 {
-    litews_bool is_all_finished = litews_true;
     _litews_frame * frame = NULL;
     _litews_node * cur = s->recvd_frames;
 
@@ -63,71 +64,17 @@ void litews_socket_inform_recvd_frames(litews_socket s)
 
         if (frame) 
         {
-            //if (frame->is_finished) //bin file no need frame finished
+            if (frame->opcode == litews_opcode_text_frame && s->on_recvd_text) 
             {
-                switch (frame->opcode) 
-                {
-                    case litews_opcode_text_frame:
-                    {
-                        if(frame->is_finished)  //text data need finished and send
-                        {
-                            if (s->on_recvd_text) 
-                            {
-                            s->on_recvd_text(s, (const char *)frame->data, (unsigned int)frame->data_size);
-#ifdef SUPPORT_REDUCE_MEM
-                            //clear buffer
-                            s->buffer_size = SSL_REC_BUFFER_SIZE;
-#endif
-                            }
-                        }
-                    }
-                    break;
-                    
-                    case litews_opcode_binary_frame:
-                    {
-                        if (s->on_recvd_bin) 
-                        {
-                            LOGD_LITEWS("received bin frame start , lens = %d", frame->data_size);
-                            s->on_recvd_bin(s, frame->data, (unsigned int)frame->data_size, litews_frame_start);
-                            s->buffer_size = SSL_REC_BUFFER_SIZE;
-                        }
-                    }
-                    break;
-                    
-                    case litews_opcode_continuation:
-                    {
-                        if(s->on_recvd_bin)
-                        {
-                            if(frame->data_size == 0)
-                            {
-                                LOGD_LITEWS("received bin frame end, lens = %d", frame->data_size);
-                                s->on_recvd_bin(s, frame->data, (unsigned int)frame->data_size, litews_frame_end);
-                            }
-                            else
-                            {
-                                LOGD_LITEWS("received bin frame continue, lens = %d", frame->data_size);
-                                s->on_recvd_bin(s, frame->data, (unsigned int)frame->data_size, litews_frame_continue);
-                            }
-                            s->buffer_size = SSL_REC_BUFFER_SIZE;
-                        }
-                    }
-                    break;
-                    
-                    default: 
-                        break;
-                    }
-
-                litews_frame_delete(frame);
-                cur->value.object = NULL;
+                s->on_recvd_text(s, (const char *)frame->data, (unsigned int)frame->data_size);
             }
+            litews_frame_delete(frame);
+            cur->value.object = NULL;
         }
         cur = cur->next;
     }
 
-    if (is_all_finished) 
-    {
-        litews_list_delete_clean(&s->recvd_frames);
-    }
+    litews_list_delete_clean(&s->recvd_frames);
 }
 
 #else
@@ -181,186 +128,302 @@ void litews_socket_inform_recvd_frames(litews_socket s)
 }
 #endif
 
-void litews_socket_read_handshake_responce_value(const char * str, char ** value) 
+// length of the responce head up to and including the blank line, 0 while it is incomplete,
+// '*scanned' keeps how far it was searched, so every byte read is looked at once
+static size_t litews_socket_handshake_head_len(const char * str, const size_t len, size_t * scanned) 
 {
-	const char * s = NULL;
-	size_t len = 0;
+    size_t i = (*scanned > 3) ? *scanned - 3 : 0;
 
-	while (*str == ':' || *str == ' ') 
-	{
-		str++;
-	}
-	s = str;
-	while (*s != '\r' && *s != '\n') 
-	{
-		s++;
-		len++;
-	}
-	if (len > 0) 
-	{
-		*value = litews_string_copy_len(str, len);
-	}
+    for (; i + 3 < len; i++) 
+    {
+        if (str[i] == '\r' && str[i + 1] == '\n' && str[i + 2] == '\r' && str[i + 3] == '\n') 
+        {
+            return i + 4;
+        }
+    }
+    *scanned = len;
+    return 0;
 }
 
-litews_bool litews_socket_process_handshake_responce(litews_socket s) 
+// case insensitive match of a header name with a lowercase one
+static litews_bool litews_socket_header_is(const char * str, const size_t len, const char * name) 
 {
-#ifdef SUPPORT_REDUCE_MEM
-    const char * str = s->received_buffer;
-#else
-    const char * str = (const char *)s->received;
-#endif
-    const char * sub = NULL;
-    float http_ver = -1;
-    int http_code = -1;
+    size_t i = 0;
 
-    litews_error_delete_clean(&s->error);
-    sub = strstr(str, "HTTP/");
-    if (!sub) 
+    if (strlen(name) != len) 
     {
-        LOGE_LITEWS("sub error return litews_false");
         return litews_false;
     }
+    for (; i < len; i++) 
+    {
+        if (tolower((unsigned char)str[i]) != name[i]) 
+        {
+            return litews_false;
+        }
+    }
+    return litews_true;
+}
+
+// end of the line starting at 'str', the '\r' of its CRLF or 'end'
+static const char * litews_socket_line_end(const char * str, const char * end) 
+{
+    const char * eol = (const char *)memchr(str, '\n', (size_t)(end - str));
 
-    sub += 5;
-    if (litews_sscanf(sub, "%f %i", &http_ver, &http_code) != 2) 
+    if (!eol) 
     {
-        LOGE_LITEWS("sscanf error, return false");
-        http_ver = -1;
-        http_code = -1;
+        return end;
     }
+    return (eol > str && eol[-1] == '\r') ? eol - 1 : eol;
+}
+
+litews_bool litews_socket_process_handshake_responce(litews_socket s, const char * str, const size_t len) 
+{
+    const char * end = str + len;
+    const char * line = str;
+    const char * eol = NULL;
+    const char * colon = NULL;
+    const char * value = NULL;
+    const char * value_end = NULL;
+    const char * descr = NULL;
+    char * extensions = NULL;
+    litews_bool has_extensions = litews_false;
+    int http_code = -1, digits = 0;
+
+    litews_error_delete_clean(&s->error);
+    litews_string_delete_clean(&s->sec_ws_accept); // left from the previous connection of a reconnecting socket
+    litews_deflate_delete_clean(&s->deflate);
 
-    sub = strstr(str, k_litews_socket_sec_websocket_accept); // "Sec-WebSocket-Accept" //?? sec-websocket-accept
+    // status line, "HTTP/1.1 101 Switching Protocols"
+    eol = litews_socket_line_end(line, end);
+    if (eol - line < 5 || memcmp(line, "HTTP/", 5) != 0) 
+    {
+        LOGE_LITEWS("no HTTP status line");
+        return litews_false;
+    }
+    value = (const char *)memchr(line, ' ', (size_t)(eol - line));
+    if (value) 
+    {
+        http_code = 0;
+        for (value++; value < eol && digits < 3 && *value >= '0' && *value <= '9'; value++, digits++) 
+        {
+            http_code = http_code * 10 + (*value - '0');
+        }
+        if (digits != 3) 
+        {
+            http_code = -1;
+        }
+    }
 
-    if (sub) 
+    // header lines up to the blank one, each looked at within its own bounds
+    for (line = eol; line < end; line = eol) 
     {
-        sub += strlen(k_litews_socket_sec_websocket_accept);
-        litews_socket_read_handshake_responce_value(sub, &s->sec_ws_accept);
+        line += (*line == '\r') ? 2 : 1;
+        if (line >= end) 
+        {
+            break;
+        }
+        eol = litews_socket_line_end(line, end);
+        if (eol == line) 
+        {
+            break;
+        }
+        colon = (const char *)memchr(line, ':', (size_t)(eol - line));
+        if (!colon) 
+        {
+            continue;
+        }
+        value = colon + 1;
+        while (value < eol && (*value == ' ' || *value == '\t')) 
+        {
+            value++;
+        }
+        value_end = eol;
+        while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) 
+        {
+            value_end--;
+        }
+        if (litews_socket_header_is(line, (size_t)(colon - line), k_litews_socket_sec_websocket_accept)) 
+        {
+            if (!s->sec_ws_accept && value_end > value) 
+            {
+                s->sec_ws_accept = litews_string_copy_len(value, (size_t)(value_end - value));
+            }
+        } 
+        else if (litews_socket_header_is(line, (size_t)(colon - line), k_litews_socket_sec_websocket_extensions)) 
+        {
+            if (!has_extensions && value_end > value) 
+            {
+                extensions = litews_string_copy_len(value, (size_t)(value_end - value));
+            }
+            has_extensions = litews_true;
+        }
     }
 
     if (http_code != 101 || !s->sec_ws_accept) 
     {
+        litews_string_delete(extensions);
         s->error = litews_error_new_code_descr(litews_error_code_parse_handshake,
                                                 (http_code != 101) ? "HTPP code not found or non 101" : "Accept key not found");
         return litews_false;
     }
 
+    if (has_extensions) 
+    {
+        if (s->deflate_window_bits > 0) 
+        {
+            s->deflate = litews_deflate_create(extensions ? extensions : "", s->deflate_window_bits,
+                                               s->deflate_no_context_takeover, &descr);
+        } 
+        else 
+        {
+            descr = "Unexpected websocket extension";
+        }
+        litews_string_delete(extensions);
+        if (!s->deflate) 
+        {
+            s->error = litews_error_new_code_descr(litews_error_code_parse_handshake, descr);
+            return litews_false;
+        }
+    }
+
     return litews_true;
 }
 
+int litews_socket_write(litews_socket s, const void * data, const size_t data_size) 
+{
+    int sended = -1;
+
+    if (!s->is_open) 
+    {
+        return -1;
+    }
+
+    sended = s->transport->write(s, (const unsigned char *)data, data_size);
+    if (sended > 0) 
+    {
+        litews_mutex_lock(s->send_mutex);
+        s->stats.stream_bytes_out += (unsigned int)sended;
+        s->stats.stream_writes++;
+        litews_mutex_unlock(s->send_mutex);
+        return sended;
+    }
+    if (sended == 0) 
+    {
+        return 0;
+    }
+
+    LOGE_LITEWS("WebSocket write failed [%d]", sended);
+    if (!s->error) 
+    {
+        s->error = litews_error_new_code_descr(litews_error_code_read_write_socket, "Failed write socket");
+    }
+    litews_socket_close(s);
+    return -1;
+}
+
+int litews_socket_pending_bytes(litews_socket s) 
+{
+    return s->is_open ? s->transport->poll(s) : 0;
+}
+
 // need close socket on error
-#ifdef SUPPORT_REDUCE_MEM
 litews_bool litews_socket_send(litews_socket s, const void * data, const size_t data_size) 
 {
-    int sended = -3, error_number = -1;
+    const unsigned char * bytes = (const unsigned char *)data;
+    size_t offset = 0;
+    unsigned int waited = 0;
+    int sended = 0;
+
     litews_error_delete_clean(&s->error);
 
-#if defined(LITEWS_OS_WINDOWS)
-    sended = send(s->socket, (const char *)data, data_size, 0);
-    error_number = WSAGetLastError();
-#else
+    // blocking flavour for the handshake and close frame, queued frames use 'litews_socket_idle_send'
+    while (offset < data_size) 
+    {
+        sended = litews_socket_write(s, bytes + offset, data_size - offset);
+        if (sended < 0) 
+        {
+            return litews_false;
+        }
+        if (sended == 0) 
+        {
+            if (waited >= LITEWS_SEND_TIMEOUT_MS) 
+            {
+                s->error = litews_error_new_code_descr(litews_error_code_read_write_socket, "Send timeout");
+                litews_socket_close(s);
+                return litews_false;
+            }
+            litews_event_wait_writable(s, LITEWS_WRITE_WAIT_MS);
+            waited += LITEWS_WRITE_WAIT_MS;
+            continue;
+        }
+        offset += (size_t)sended;
+    }
 
-#ifdef SUPPORT_MBEDTLS
-    sended = mbedtls_ssl_write(&s->ssl->ssl_ctx, (const unsigned char *)data, (int)data_size);
-#elif defined(SUPPORT_WOLFSSL)
-    sended = wolfSSL_write(xWolfSSL_Object, data, (int)data_size);
-#else
-    sended = (int)send(s->socket, data, (int)data_size, 0);
-#endif
+    LOGD_LITEWS("WebSocket send wanted [%d], finished [%d]", data_size, offset);
+    return litews_true;
+}
 
-#endif
 
-    LOGD_LITEWS("WebSocket send wanted [%d], finished [%d]", data_size, sended);
+#ifdef SUPPORT_REDUCE_MEM
+// read (and decrypt) up to 'size' bytes into 'buffer', -1 closes a link the peer closed or that failed
+static int litews_socket_read_into(litews_socket s, unsigned char * buffer, const size_t size) 
+{
+    const int len = s->is_open ? s->transport->read(s, buffer, size) : -1;
 
-    if (sended > 0) 
+    if (len > 0) 
     {
-        return litews_true;
+        litews_mutex_lock(s->send_mutex);
+        s->stats.stream_bytes_in += (unsigned int)len;
+        litews_mutex_unlock(s->send_mutex);
     }
-    else
+    else if (len < 0 && s->is_open) 
     {
-        litews_socket_check_write_error(s, error_number);
-        if (s->error) 
+        if (!s->error) 
         {
-            LOGE_LITEWS("socket error : errorcode[%d], description[%s]", s->error->code, s->error->description);
-            litews_socket_close(s);
-            return litews_false;
+            s->error = litews_error_new_code_descr(litews_error_code_read_write_socket, "Failed read socket");
         }
-        LOGE_LITEWS("socket error appended");
-        return litews_false;
+        litews_socket_close(s);
     }
-    //#endif
-
-    return litews_true;
+    return len;
 }
-#else
-litews_bool litews_socket_send(litews_socket s, const void * data, const size_t data_size) 
-{
-    int sended = -1, error_number = -1;
-    litews_error_delete_clean(&s->error);
 
-    //errno = -1;
-#if defined(LITEWS_OS_WINDOWS)
-    sended = send(s->socket, (const char *)data, data_size, 0);
-    error_number = WSAGetLastError();
-#else
-    sended = (int)send(s->socket, data, (int)data_size, 0);
-    //error_number = errno;
-#endif
+int litews_socket_read_to_ring(litews_socket s) 
+{
+    size_t avail = 0;
+    int len = -1;
+    unsigned char * tail = litews_ring_write_ptr(&s->recv_ring, &avail);
 
-    if (sended > 0) 
+    if (avail == 0) 
     {
-        return litews_true;
+        return 0;
     }
 
-    litews_socket_check_write_error(s, error_number);
-    if (s->error) 
+    len = litews_socket_read_into(s, tail, avail);
+    if (len > 0) 
     {
-        litews_socket_close(s);
-        return litews_false;
+        litews_ring_commit(&s->recv_ring, (size_t)len);
     }
-    return litews_true;
+    return len;
 }
-#endif
-
 
-#ifdef SUPPORT_REDUCE_MEM
 litews_bool litews_socket_recv(litews_socket s) 
 {
-    int is_reading = 1;
-    int error_number = 1; 
-    int len = -1;
-    //char * received = NULL;
-    unsigned char buff[SSL_WEBSOCKET_RECV_BUF_LEN];
+    int len = 0;
 
     litews_error_delete_clean(&s->error);
 
-    s->buffer_len = 0;
-
-    while ((is_reading) && (((s->buffer_size) > SSL_WEBSOCKET_RECV_BUF_LEN)))
+    // the responce accumulates in the ring until it is complete, the work thread waits for more in 'select'
+    while (litews_ring_free_size(&s->recv_ring) > 0)
     {
-#ifdef SUPPORT_WOLFSSL
-        len = wolfSSL_read(xWolfSSL_Object, buff, SSL_WEBSOCKET_RECV_BUF_LEN);    //once recieve 2048
-        #elif defined(SUPPORT_MBEDTLS)
-        len = mbedtls_ssl_read(&(s->ssl->ssl_ctx), (unsigned char *)buff, SSL_REC_ONCE_SIZE);
-#endif
-        //LOGV_LITEWS("buffer_size = %d, buffer_len = %d, len = %d", s->buffer_size, s->buffer_len, len);
-
-        if (len > 0)    //received data, put to buffer
-        {
-            AG_OS_MEMCPY((s->received_buffer)+(s->buffer_len), buff, len);
-            s->buffer_len += len;
-            s->buffer_size = SSL_REC_BUFFER_SIZE - s->buffer_len;
-        }
-        else
+        len = litews_socket_read_to_ring(s);
+        if (len <= 0) 
         {
-            is_reading = 0;
+            break;
         }
-        litews_thread_sleep(100);
     }
 
-    if (error_number == 0)  //socket abnormal
+    if (len < 0) // closed by 'litews_socket_read_into'
     {
-        s->error = litews_error_new_code_descr(litews_error_code_read_write_socket, "Failed read/write socket");
-        litews_socket_close(s);
         LOGE_LITEWS("FAILED read/write socket");
         return litews_false;
     }
@@ -370,7 +433,7 @@ litews_bool litews_socket_recv(litews_socket s)
 #else
 litews_bool litews_socket_recv(litews_socket s) 
 {
-	int is_reading = 1, error_number = -1, len = -1;
+	int is_reading = 1, len = -1;
 	char * received = NULL;
 	size_t total_len = 0;
 	char buff[8192];
@@ -379,12 +442,7 @@ litews_bool litews_socket_recv(litews_socket s)
 	
 	while (is_reading) 
 	{
-		len = (int)recv(s->socket, buff, 8192, 0);
-#if defined(LITEWS_OS_WINDOWS)
-		error_number = WSAGetLastError();
-#else
-		//error_number = errno;
-#endif
+		len = s->is_open ? s->transport->read(s, (unsigned char *)buff, 8192) : -1;
 		if (len > 0) 
 		{
 			total_len += len;
@@ -405,8 +463,7 @@ litews_bool litews_socket_recv(litews_socket s)
 			is_reading = 0;
 		}
 	}
-	//if (error_number < 0) return litews_true;
-	if (error_number != WSAEWOULDBLOCK && error_number != WSAEINPROGRESS) 
+	if (len < 0) // closed by the peer or failed, 0 is just nothing to read now
 	{
 		s->error = litews_error_new_code_descr(litews_error_code_read_write_socket, "Failed read/write socket");
 		litews_socket_close(s);
@@ -467,6 +524,80 @@ void litews_socket_process_bin_or_text_frame(litews_socket s, _litews_frame * fr
 	}
 }
 
+static const unsigned int k_litews_rtt_bounds[LITEWS_RTT_BUCKETS - 1] = { 20, 50, 100, 200, 500, 1000, 2000 };
+
+// the oldest queued ping went out, pings keep their order in the queue
+static void litews_socket_ping_written(litews_socket s) 
+{
+    unsigned int i = 0;
+    _litews_ping * ping = NULL;
+
+    for (i = 0; i < LITEWS_PING_TRACK; i++) 
+    {
+        ping = &s->pings[(s->ping_index + i) % LITEWS_PING_TRACK];
+        if (ping->id && !ping->is_sent) 
+        {
+            ping->is_sent = litews_true;
+            ping->sent_ms = litews_get_time_ms();
+            s->stats.pings_sent++;
+            return;
+        }
+    }
+}
+
+// round trip of the ping whose id the pong carries
+static void litews_socket_process_pong_frame(litews_socket s, _litews_frame * frame) 
+{
+    const unsigned char * data = (const unsigned char *)frame->data;
+    unsigned int id = 0, rtt = 0, i = 0;
+    _litews_ping * ping = NULL;
+
+    for (i = 0; i < frame->data_size && data[i] >= '0' && data[i] <= '9'; i++) 
+    {
+        id = id * 10 + (data[i] - '0');
+    }
+
+    litews_mutex_lock(s->send_mutex);
+    for (i = 0; i < LITEWS_PING_TRACK; i++) 
+    {
+        if (s->pings[i].id == id && id && s->pings[i].is_sent) 
+        {
+            ping = &s->pings[i];
+            break;
+        }
+    }
+    if (ping) 
+    {
+        rtt = litews_get_time_ms() - ping->sent_ms;
+        ping->id = 0;
+        i = 0;
+        while (i < LITEWS_RTT_BUCKETS - 1 && rtt > k_litews_rtt_bounds[i]) 
+        {
+            i++;
+        }
+        s->stats.rtt_histogram[i]++;
+        if (!s->stats.pongs_matched || rtt < s->stats.rtt_min_ms) 
+        {
+            s->stats.rtt_min_ms = rtt;
+        }
+        if (rtt > s->stats.rtt_max_ms) 
+        {
+            s->stats.rtt_max_ms = rtt;
+        }
+        s->stats.rtt_last_ms = rtt;
+        s->stats.pongs_matched++;
+        s->rtt_sum_ms += rtt;
+        LOGD_LITEWS("Received Pong frame, rtt %u ms", rtt);
+    } 
+    else 
+    {
+        s->stats.pongs_unmatched++;
+        LOGD_LITEWS("Received Pong frame, no ping of ours");
+    }
+    litews_mutex_unlock(s->send_mutex);
+    litews_frame_delete(frame);
+}
+
 void litews_socket_process_ping_frame(litews_socket s, _litews_frame * frame) 
 {
 	_litews_frame * pong_frame = litews_frame_create();
@@ -474,7 +605,9 @@ void litews_socket_process_ping_frame(litews_socket s, _litews_frame * frame)
 	pong_frame->is_masked = litews_true;
 	litews_frame_fill_with_send_data(pong_frame, frame->data, frame->data_size);
 	litews_frame_delete(frame);
+	litews_mutex_lock(s->send_mutex); // producers append to the same lanes and budget
 	litews_socket_append_send_frames(s, pong_frame);
+	litews_mutex_unlock(s->send_mutex);
 }
 
 void litews_socket_process_conn_close_frame(litews_socket s, _litews_frame * frame) 
@@ -498,9 +631,7 @@ void litews_socket_process_received_frame(litews_socket s, _litews_frame * frame
 
 		case litews_opcode_pong:
 		    {
-		        LOGD_LITEWS("Received Pong frame \r\n");
-		        litews_frame_delete(frame);
-		        //litews_socket_process_ping_frame(s, frame);
+		        litews_socket_process_pong_frame(s, frame);
 		    }
 		    break;
 		case litews_opcode_text_frame:
@@ -541,71 +672,404 @@ void litews_socket_process_received_frame(litews_socket s, _litews_frame * frame
 }
 
 #ifdef SUPPORT_REDUCE_MEM
-int litews_socket_idle_recv(litews_socket s) 
+static void litews_socket_recv_protocol_error(litews_socket s, const char * description) 
 {
-	_litews_frame * frame = NULL;
-	//int is_reading = 1;
-	//int error_number = 1; 
-	int len = -1;
-	//char * received = NULL;
-	unsigned char buff[SSL_REC_ONCE_SIZE];
-	
-	litews_error_delete_clean(&s->error);
-    
-	if((SSL_REC_BUFFER_SIZE - (s->buffer_len)) > SSL_REC_ONCE_SIZE)
-	{
-#ifdef SUPPORT_WOLFSSL
-        len = wolfSSL_read(xWolfSSL_Object, buff, SSL_REC_ONCE_SIZE);    //once recieve
-#elif defined(SUPPORT_MBEDTLS)
-        len = mbedtls_ssl_read(&(s->ssl->ssl_ctx), (unsigned char *)buff, SSL_REC_ONCE_SIZE);
-#endif
-        //LOGV_LITEWS("buffer_size = %d, buffer_len = %d, len = %d", s->buffer_size, s->buffer_len, len);
-    }
+    LOGE_LITEWS("receive frame error: %s", description);
+    litews_error_delete_clean(&s->error);
+    s->error = litews_error_new_code_descr(litews_error_code_connection_closed, description);
+    s->command = COMMAND_INFORM_DISCONNECTED;
+}
+
+void litews_socket_reset_recv_state(litews_socket s) 
+{
+    litews_ring_reset(&s->recv_ring);
+    litews_frame_parser_reset(&s->recv_parser);
+    s->recv_message_opcode = litews_opcode_continuation;
+    s->recv_frame_informed = litews_false;
+    s->recv_compressed = litews_false;
+    s->recv_held = litews_false;
+    s->recv_hold_ms = 0;
+    s->recv_head_scanned = 0;
+    litews_frame_delete_clean(&s->recv_message);
+}
+
+// the current frame carries binary payload
+static litews_bool litews_socket_recv_is_bin(litews_socket s) 
+{
+    const litews_opcode opcode = s->recv_parser.opcode;
+
+    return (opcode == litews_opcode_binary_frame || 
+            (opcode == litews_opcode_continuation && !s->recv_message)) ? litews_true : litews_false;
+}
 
-    if (len > 0)   //received data, put to buffer
+// reading waits for room, the time it began bounds the wait
+static void litews_socket_recv_hold(litews_socket s) 
+{
+    if (!s->recv_held) 
     {
-        AG_OS_MEMCPY((s->received_buffer)+(s->buffer_len), buff, len);
-        s->buffer_len += len;
-        s->buffer_size = SSL_REC_BUFFER_SIZE - s->buffer_len;
+        litews_mutex_lock(s->send_mutex);
+        s->stats.recv_held++;
+        litews_mutex_unlock(s->send_mutex);
     }
-    /*
-    else
+    s->recv_held = litews_true;
+    if (!s->recv_hold_ms) 
     {
-    is_reading = 0;
+        s->recv_hold_ms = litews_get_time_ms();
+        s->recv_hold_ms = s->recv_hold_ms ? s->recv_hold_ms : 1;
     }
-    */
-    //litews_thread_sleep(100);
+}
 
-    const size_t nframe_size = litews_check_recv_frame_size(s->received_buffer, s->buffer_len); //check data
+// held for LITEWS_RECV_HOLD_MAX_MS: the consumer stalled, e.g. a paused player, the link is closed rather than
+// keeping the server and its text and control frames waiting for good
+static litews_bool litews_socket_recv_hold_expired(litews_socket s) 
+{
+    if (!s->recv_hold_ms || litews_get_time_ms() - s->recv_hold_ms < LITEWS_RECV_HOLD_MAX_MS) 
+    {
+        return litews_false;
+    }
+    LOGE_LITEWS("binary consumer had no room for %u ms, closing the link", LITEWS_RECV_HOLD_MAX_MS);
+    litews_error_delete_clean(&s->error);
+    s->error = litews_error_new_code_descr(litews_error_code_read_write_socket, "Binary consumer stalled");
+    litews_socket_close(s);
+    return litews_true;
+}
 
-   /*   check received bin frame
-   if(nframe_size == 2)
-   {
-       LOGN_LITEWS("nframe size = %d", nframe_size);
-   }
-   */
-   
-   if (nframe_size) 
-   {
-       frame = litews_frame_create_with_recv_data(s->received_buffer, nframe_size);
-       //LOGV_LITEWS("frame = %d", frame);
-       if (frame)  
-       {
-           litews_socket_process_received_frame(s, frame);
-       }
+// no more of the current binary frame than the consumer of 'on_recvd_bin' has room for
+static size_t litews_socket_bin_room(litews_socket s, const size_t len) 
+{
+    const unsigned int room = s->bin_room(s);
 
-       if (nframe_size == s->buffer_len) 
-       {
-           s->buffer_len = 0;
-       } 
-       else if (s->buffer_len > nframe_size) 
-       {
-           const size_t nLeftLen = s->buffer_len - nframe_size;
-           memmove(s->received_buffer, s->received_buffer + nframe_size, nLeftLen);
-           s->buffer_len = nLeftLen;
-       }
-   }
-   return len;
+    if (room == 0) 
+    {
+        litews_socket_recv_hold(s);
+        return 0;
+    }
+    s->recv_hold_ms = 0; // the consumer makes progress
+    return (room < len) ? room : len;
+}
+
+static void litews_socket_inform_recvd_bin(litews_socket s, const void * data, const size_t len, int flag) 
+{
+    if (!s->on_recvd_bin && !s->recvd_frames) 
+    {
+        return;
+    }
+
+    // callbacks may block on the audio sink, don't hold the work mutex meanwhile
+    litews_mutex_unlock(s->work_mutex);
+    if (s->recvd_frames) 
+    {
+        litews_socket_inform_recvd_frames(s); // keep text messages in order
+    }
+    if (s->on_recvd_bin) 
+    {
+        s->on_recvd_bin(s, data, (unsigned int)len, flag);
+    }
+    litews_mutex_lock(s->work_mutex);
+}
+
+// header of a received frame is complete
+static litews_bool litews_socket_recv_frame_started(litews_socket s) 
+{
+    _litews_frame_parser * p = &s->recv_parser;
+
+    s->recv_frame_informed = litews_false;
+    litews_mutex_lock(s->send_mutex);
+    s->stats.frames_in[p->opcode & 0x0f]++;
+    s->stats.bytes_in[p->opcode & 0x0f] += p->payload_size;
+    litews_mutex_unlock(s->send_mutex);
+
+    // RSV1 is valid on the first frame of a data message, when permessage-deflate was accepted
+    if (p->is_compressed && (!s->deflate || p->opcode == litews_opcode_continuation || (p->opcode & 0x08))) 
+    {
+        litews_socket_recv_protocol_error(s, "Unexpected RSV1 bit");
+        return litews_false;
+    }
+
+    switch (p->opcode) 
+    {
+        case litews_opcode_ping:
+        case litews_opcode_pong:
+        case litews_opcode_connection_close:
+            if (!p->is_finished || p->payload_size > LITEWS_MAX_CONTROL_PAYLOAD) 
+            {
+                litews_socket_recv_protocol_error(s, "Control frame fragmented or too large");
+                return litews_false;
+            }
+            return litews_true;
+
+        case litews_opcode_text_frame:
+            litews_frame_delete_clean(&s->recv_message);
+            s->recv_message = litews_frame_create();
+            s->recv_message->opcode = litews_opcode_text_frame;
+            s->recv_message_opcode = p->is_finished ? litews_opcode_continuation : litews_opcode_text_frame;
+            s->recv_compressed = p->is_compressed;
+            break;
+
+        case litews_opcode_binary_frame:
+            s->recv_message_opcode = p->is_finished ? litews_opcode_continuation : litews_opcode_binary_frame;
+            s->recv_compressed = p->is_compressed;
+            return litews_true;
+
+        case litews_opcode_continuation:
+            if (s->recv_message_opcode != litews_opcode_text_frame) 
+            {
+                return litews_true; // binary continuation
+            }
+            if (p->is_finished) 
+            {
+                s->recv_message_opcode = litews_opcode_continuation;
+            }
+            break;
+
+        default:
+            litews_socket_recv_protocol_error(s, "Unknown frame opcode");
+            return litews_false;
+    }
+
+    if (s->recv_message && s->recv_compressed) 
+    {
+        return litews_true; // grows while it's inflated
+    }
+
+    // text, reassembled up to a limit
+    if (!s->recv_message || 
+        s->recv_message->data_size + p->payload_size > LITEWS_MAX_TEXT_MESSAGE_SIZE) 
+    {
+        litews_socket_recv_protocol_error(s, "Text message too large");
+        return litews_false;
+    }
+    if (!litews_frame_reserve_data(s->recv_message, s->recv_message->data_size + (size_t)p->payload_size, LITEWS_MAX_TEXT_MESSAGE_SIZE)) 
+    {
+        litews_socket_recv_protocol_error(s, "No memory for text message");
+        return litews_false;
+    }
+    return litews_true;
+}
+
+// inflated slice of the current message
+static litews_bool litews_socket_recv_inflated(void * user, const unsigned char * data, const size_t len) 
+{
+    litews_socket s = (litews_socket)user;
+    _litews_frame * message = s->recv_message;
+
+    if (message) 
+    {
+        if (message->data_size + len > LITEWS_MAX_TEXT_MESSAGE_SIZE || 
+            !litews_frame_reserve_data(message, message->data_size + len, LITEWS_MAX_TEXT_MESSAGE_SIZE)) 
+        {
+            litews_socket_recv_protocol_error(s, "Text message too large");
+            return litews_false;
+        }
+        AG_OS_MEMCPY((unsigned char *)message->data + message->data_size, data, len);
+        message->data_size += len;
+    } 
+    else 
+    {
+        litews_socket_inform_recvd_bin(s, data, len, 
+            (s->recv_parser.opcode == litews_opcode_binary_frame && !s->recv_frame_informed) ? litews_frame_start : litews_frame_continue);
+        s->recv_frame_informed = litews_true;
+    }
+    return litews_true;
+}
+
+static void litews_socket_recv_inflate(litews_socket s, const unsigned char * data, const size_t len, const litews_bool is_last) 
+{
+    if (!litews_inflate_message(s->deflate, data, len, is_last, litews_socket_recv_inflated, s) && 
+        s->command == COMMAND_IDLE) 
+    {
+        litews_socket_recv_protocol_error(s, "Broken compressed message");
+    }
+}
+
+// next unmasked slice of the payload of the current frame
+static void litews_socket_recv_frame_payload(litews_socket s, const unsigned char * data, const size_t len) 
+{
+    _litews_frame_parser * p = &s->recv_parser;
+
+    switch (p->opcode) 
+    {
+        case litews_opcode_ping:
+        case litews_opcode_pong:
+        case litews_opcode_connection_close:
+            AG_OS_MEMCPY(s->recv_control + p->payload_done, data, len);
+            break;
+
+        case litews_opcode_binary_frame:
+            if (s->recv_compressed) 
+            {
+                litews_socket_recv_inflate(s, data, len, litews_false);
+                break;
+            }
+            litews_socket_inform_recvd_bin(s, data, len, s->recv_frame_informed ? litews_frame_continue : litews_frame_start);
+            s->recv_frame_informed = litews_true;
+            break;
+
+        default:
+            if (s->recv_compressed) 
+            {
+                litews_socket_recv_inflate(s, data, len, litews_false);
+            }
+            else if (s->recv_message) 
+            {
+                AG_OS_MEMCPY((unsigned char *)s->recv_message->data + s->recv_message->data_size, data, len);
+                s->recv_message->data_size += len;
+            } 
+            else 
+            {
+                litews_socket_inform_recvd_bin(s, data, len, litews_frame_continue);
+                s->recv_frame_informed = litews_true;
+            }
+            break;
+    }
+}
+
+// payload of the current frame is complete
+static void litews_socket_recv_frame_finished(litews_socket s) 
+{
+    _litews_frame_parser * p = &s->recv_parser;
+    _litews_frame * frame = NULL;
+
+    if (s->recv_compressed && p->is_finished && !(p->opcode & 0x08)) 
+    {
+        // the end of the message flushes the inflater
+        litews_socket_recv_inflate(s, NULL, 0, litews_true);
+        s->recv_compressed = litews_false;
+        if (s->command != COMMAND_IDLE) 
+        {
+            return;
+        }
+    }
+
+    switch (p->opcode) 
+    {
+        case litews_opcode_ping:
+        case litews_opcode_pong:
+        case litews_opcode_connection_close:
+            frame = litews_frame_create();
+            frame->opcode = p->opcode;
+            frame->is_finished = litews_true;
+            if (p->payload_size > 0) 
+            {
+                frame->data = litews_malloc((size_t)p->payload_size);
+                frame->data_size = (size_t)p->payload_size;
+                AG_OS_MEMCPY(frame->data, s->recv_control, frame->data_size);
+            }
+            litews_socket_process_received_frame(s, frame);
+            break;
+
+        case litews_opcode_binary_frame:
+            if (p->payload_size == 0) 
+            {
+                litews_socket_inform_recvd_bin(s, NULL, 0, litews_frame_start);
+            }
+            break;
+
+        default:
+            if (s->recv_message && p->is_finished && s->recv_message_opcode == litews_opcode_continuation) 
+            {
+                frame = s->recv_message;
+                s->recv_message = NULL;
+                frame->is_finished = litews_true;
+                litews_socket_append_recvd_frames(s, frame);
+            } 
+            else if (!s->recv_message && p->payload_size == 0) 
+            {
+                // empty continuation closes the binary stream
+                litews_socket_inform_recvd_bin(s, NULL, 0, litews_frame_end);
+            }
+            break;
+    }
+}
+
+int litews_socket_idle_recv(litews_socket s) 
+{
+    _litews_frame_parser * p = &s->recv_parser;
+    unsigned char * data = NULL;
+    unsigned long long left = 0;
+    size_t avail = 0, used = 0;
+    int len = -1, total = 0, reads = 0;
+
+    litews_error_delete_clean(&s->error);
+
+    // free space may be split at the end of the ring, so fill it with up to two reads,
+    // a held back ring is offered first
+    while (!(s->recv_held && s->recv_ring.len > 0) && reads++ < 2) 
+    {
+        len = litews_socket_read_to_ring(s);
+        if (len <= 0) 
+        {
+            break;
+        }
+        total += len;
+    }
+    s->recv_held = litews_false;
+
+    // payload is handed out in slices, so a frame never has to fit into the ring
+    while (s->command == COMMAND_IDLE) 
+    {
+        if (p->state == litews_frame_parser_state_payload && p->payload_done == p->payload_size) 
+        {
+            litews_socket_recv_frame_finished(s);
+            litews_frame_parser_reset(p);
+            continue;
+        }
+
+        if (s->recv_ring.len == 0) 
+        {
+            break;
+        }
+
+        data = litews_ring_read_ptr(&s->recv_ring, &avail);
+
+        if (p->state != litews_frame_parser_state_payload) 
+        {
+            used = litews_frame_parser_feed_header(p, data, avail);
+            litews_ring_consume(&s->recv_ring, used);
+            if (p->state == litews_frame_parser_state_error) 
+            {
+                litews_socket_recv_protocol_error(s, "Malformed frame header");
+            } 
+            else if (p->state == litews_frame_parser_state_payload) 
+            {
+                litews_socket_recv_frame_started(s);
+            }
+            continue;
+        }
+
+        left = p->payload_size - p->payload_done;
+        used = (left < avail) ? (size_t)left : avail;
+        if (s->bin_room && litews_socket_recv_is_bin(s)) 
+        {
+            used = litews_socket_bin_room(s, used); // the rest waits in the ring
+            if (used == 0) 
+            {
+                break;
+            }
+        }
+        if (p->is_masked) 
+        {
+            litews_frame_mask_data(data, used, p->mask, (size_t)p->payload_done);
+        }
+        litews_socket_recv_frame_payload(s, data, used);
+        p->payload_done += used;
+        litews_ring_consume(&s->recv_ring, used);
+    }
+    if (total > 0) 
+    {
+        // any byte proves the link, pongs included, time spent held doesn't
+        s->last_recv_ms = litews_get_time_ms();
+    }
+    if (!s->recv_held) 
+    {
+        s->recv_hold_ms = 0;
+    }
+    else if (s->is_open) 
+    {
+        litews_socket_recv_hold_expired(s);
+    }
+    // bytes read before the peer closed the link are handled, the loss is reported after them
+    return s->is_open ? total : -1;
 }
 #else
 int litews_socket_idle_recv(litews_socket s) 
@@ -615,11 +1079,7 @@ int litews_socket_idle_recv(litews_socket s)
 	if (!litews_socket_recv(s)) 
 	{
 		// sock already closed
-		if (s->error) 
-		{
-			s->command = COMMAND_INFORM_DISCONNECTED;
-		}
-		return;
+		return -1;
 	}
 
    const size_t nframe_size = litews_check_recv_frame_size(s->received, s->received_len);
@@ -647,51 +1107,271 @@ int litews_socket_idle_recv(litews_socket s)
 }
 #endif
 
+// compress a popped text message for the current link, it stays as is when that doesn't pay off
+static void litews_socket_deflate_frame(litews_socket s, _litews_frame * frame) 
+{
+    unsigned char * payload = (unsigned char *)frame->data + frame->header_size;
+    const size_t len = frame->data_size - frame->header_size;
+    unsigned char * packed = NULL;
+    size_t packed_len = 0;
+    _litews_frame * plain = NULL;
+
+    if (frame->is_masked) 
+    {
+        litews_frame_mask_data(payload, len, frame->mask, 0); // xor again gives the text back
+    }
+    packed = litews_deflate_message(s->deflate, payload, len, &packed_len);
+    if (frame->is_masked) 
+    {
+        litews_frame_mask_data(payload, len, frame->mask, 0);
+    }
+    if (packed) 
+    {
+        // the text is kept until the frame is written, a new link can't inflate this copy
+        plain = litews_frame_create();
+        *plain = *frame;
+        plain->next = NULL;
+        frame->plain = plain;
+        frame->data = NULL;
+        frame->is_compressed = litews_true;
+        litews_frame_fill_with_send_data(frame, packed, packed_len);
+        litews_free(packed);
+    }
+}
+
+// 1 when 'data' is written up to 'len', 0 when the transport would block, -1 on error
+static int litews_socket_write_from(litews_socket s, const unsigned char * data, const size_t len, size_t * offset) 
+{
+    size_t left = 0;
+    int sended = 0;
+
+    while (*offset < len) 
+    {
+        left = len - *offset;
+        sended = litews_socket_write(s, data + *offset, left);
+        if (sended < 0) 
+        {
+            return -1;
+        }
+        if (sended == 0) 
+        {
+            litews_mutex_lock(s->send_mutex);
+            s->stats.write_blocks++;
+            litews_mutex_unlock(s->send_mutex);
+            return 0; // resumed from the same offset once the socket is writable
+        }
+        if ((size_t)sended < left) 
+        {
+            litews_mutex_lock(s->send_mutex);
+            s->stats.partial_writes++;
+            litews_mutex_unlock(s->send_mutex);
+        }
+        *offset += (size_t)sended;
+    }
+    return 1;
+}
+
+// a binary frame fully written, its time in the queue includes any wait for the pacer
+static void litews_socket_count_send_delay(litews_socket s, _litews_frame * frame) 
+{
+    const unsigned int delay = litews_get_time_ms() - frame->queued_ms;
+    unsigned int i = 0;
+
+    while (i < LITEWS_RTT_BUCKETS - 1 && delay > k_litews_rtt_bounds[i]) 
+    {
+        i++;
+    }
+    s->stats.send_delay_histogram[i]++;
+    if (delay > s->stats.send_delay_max_ms) 
+    {
+        s->stats.send_delay_max_ms = delay;
+    }
+    s->stats.send_delay_last_ms = delay;
+    s->send_delay_sum_ms += delay;
+}
+
+// a frame fully on the wire, under 'send_mutex'
+static void litews_socket_frame_written(litews_socket s, _litews_frame * frame) 
+{
+    if (frame->opcode == litews_opcode_binary_frame || frame->opcode == litews_opcode_continuation) 
+    {
+        litews_socket_count_send_delay(s, frame);
+    }
+    s->stats.frames_out[frame->opcode & 0x0f]++;
+    s->stats.bytes_out[frame->opcode & 0x0f] += frame->data_size - frame->header_size;
+    if (frame->opcode == litews_opcode_ping) 
+    {
+        litews_socket_ping_written(s);
+    }
+    litews_socket_release_send_frame(s, frame);
+}
+
+// size for the next batch, a batch larger than a TLS record would be split again
+static void litews_socket_prepare_batch(litews_socket s) 
+{
+    size_t size = s->send_batch_size;
+
+#if defined(SUPPORT_MBEDTLS) && defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    const size_t max_record = s->ssl ? mbedtls_ssl_get_max_frag_len(&s->ssl->ssl_ctx) : 0; // TLS transport only
+    if (max_record > 0 && size > max_record) 
+    {
+        size = max_record;
+    }
+#endif
+    if (size == s->send_batch_capacity) 
+    {
+        return;
+    }
+    litews_free(s->send_batch);
+    s->send_batch = (size > 0) ? (unsigned char *)litews_malloc(size) : NULL;
+    s->send_batch_capacity = s->send_batch ? size : 0;
+}
+
+// 1 when 'send_batch' and then 'send_pending' are fully written, 0 when the transport would block, -1 on error
+static int litews_socket_flush_pending(litews_socket s) 
+{
+    _litews_frame * frame = NULL;
+    int flushed = 1;
+
+    if (s->send_batch_len > 0) 
+    {
+        // the gathered frames were popped before 'send_pending'
+        flushed = litews_socket_write_from(s, s->send_batch, s->send_batch_len, &s->send_batch_offset);
+        if (flushed <= 0) 
+        {
+            return flushed;
+        }
+        frame = s->send_batch_head;
+        s->send_batch_head = NULL;
+        s->send_batch_tail = NULL;
+        s->send_batch_len = 0;
+        s->send_batch_offset = 0;
+        litews_mutex_lock(s->send_mutex);
+        while (frame) 
+        {
+            _litews_frame * next = frame->next;
+            frame->next = NULL;
+            litews_socket_frame_written(s, frame);
+            frame = next;
+        }
+        litews_mutex_unlock(s->send_mutex);
+    }
+
+    if (!s->send_pending) 
+    {
+        return 1;
+    }
+    frame = s->send_pending;
+    flushed = litews_socket_write_from(s, (const unsigned char *)frame->data, frame->data_size, &s->send_pending_offset);
+    if (flushed <= 0) 
+    {
+        return flushed;
+    }
+    s->send_pending = NULL;
+    s->send_pending_offset = 0;
+    litews_mutex_lock(s->send_mutex);
+    litews_socket_frame_written(s, frame);
+    litews_mutex_unlock(s->send_mutex);
+    return 1;
+}
+
 litews_bool litews_socket_idle_send(litews_socket s) 
 {
-    _litews_node * cur = NULL;
-    litews_bool sending = litews_true;
     litews_bool ret = litews_false;
     _litews_frame * frame = NULL;
+    size_t count = 0;
+    int flushed = 1;
 
+    // a partially written batch or frame goes first, nothing may be put into its middle
+    if (s->send_pending || s->send_batch_len > 0) 
+    {
+        flushed = litews_socket_flush_pending(s);
+        ret = litews_true;
+    }
+    if (flushed > 0) 
+    {
+        litews_socket_prepare_batch(s);
+    }
+
+    // frames are popped one by one so senders don't wait for the transport,
+    // frames queued meanwhile are left for the next loop
     litews_mutex_lock(s->send_mutex);
-    cur = s->send_frames;
+    count = s->send_count;
+    litews_mutex_unlock(s->send_mutex);
 
-    if (cur) 
+    while (flushed > 0 && count-- > 0 && s->is_connected) 
     {
-        while (cur && s->is_connected && sending) 
+        litews_mutex_lock(s->send_mutex);
+        frame = litews_socket_pop_send_frame(s);
+        litews_mutex_unlock(s->send_mutex);
+        if (!frame) 
         {
-            frame = (_litews_frame *)cur->value.object;
-            cur->value.object = NULL;
-            if (frame) 
+            break;
+        }
+        ret = litews_true;
+
+        // text goes out as one frame per message, binary is exempt
+        if (s->deflate && frame->opcode == litews_opcode_text_frame && frame->is_finished && !frame->is_compressed) 
+        {
+            litews_socket_deflate_frame(s, frame);
+        }
+
+        if (frame->data_size <= s->send_batch_capacity && frame->data_size > s->send_batch_capacity - s->send_batch_len) 
+        {
+            flushed = litews_socket_flush_pending(s); // full, an empty batch takes the frame
+            if (flushed <= 0) 
             {
-                WS_PING_LOOP = 0;
-                sending = litews_socket_send(s, frame->data, frame->data_size);
-            //printf("frame->data_size = %d\n", frame->data_size);
+                s->send_pending = frame;
+                s->send_pending_offset = 0;
+                break;
             }
-            litews_frame_delete(frame);
-            cur = cur->next;
         }
-        litews_list_delete_clean(&s->send_frames);
-        if ((s->error)||(sending == litews_false) ) 
+        if (frame->data_size <= s->send_batch_capacity - s->send_batch_len) 
         {
-            s->command = COMMAND_INFORM_DISCONNECTED;
+            AG_OS_MEMCPY(s->send_batch + s->send_batch_len, frame->data, frame->data_size);
+            s->send_batch_len += frame->data_size;
+            if (s->send_batch_tail) 
+            {
+                s->send_batch_tail->next = frame;
+            } 
+            else 
+            {
+                s->send_batch_head = frame;
+            }
+            s->send_batch_tail = frame;
+            continue;
         }
-        ret = litews_true;
+
+        s->send_pending = frame;
+        s->send_pending_offset = 0;
+        flushed = litews_socket_flush_pending(s);
+    }
+
+    if (flushed > 0 && s->send_batch_len > 0) 
+    {
+        flushed = litews_socket_flush_pending(s);
+    }
+
+    if (flushed < 0) 
+    {
+        if (s->reconnect_min_ms == 0) // a managed socket sorts its queue out when the link is back
+        {
+            litews_mutex_lock(s->send_mutex);
+            litews_socket_delete_send_frames(s);
+            litews_mutex_unlock(s->send_mutex);
+        }
+        s->command = COMMAND_INFORM_DISCONNECTED;
     }
-    litews_mutex_unlock(s->send_mutex);
     return ret;
 }
 
-#if defined(SUPPORT_MBEDTLS) || defined(SUPPORT_WOLFSSL)
-void ssl_socket_wait_handshake_responce(litews_socket s) 
+#ifdef SUPPORT_REDUCE_MEM
+void litews_socket_wait_handshake_responce(litews_socket s) 
 {
+    size_t head_len = 0;
+
     LOGV_LITEWS("wait hand shake responce!!!");
     
-    #ifdef SUPPORT_REDUCE_MEM
-    s->buffer_size = SSL_REC_BUFFER_SIZE;   //init buffer size
-    #endif
-    
 	if (!litews_socket_recv(s)) 
 	{
 		// sock already closed
@@ -703,25 +1383,35 @@ void ssl_socket_wait_handshake_responce(litews_socket s)
 		return;
 	}
 
-	if (s->buffer_len == 0) 
+	// nothing is consumed before the head is complete, so it lies unwrapped at the start of the ring
+	head_len = litews_socket_handshake_head_len(s->received_buffer, s->recv_ring.len, &s->recv_head_scanned);
+	if (head_len == 0) 
 	{
-		return;
+		if (litews_ring_free_size(&s->recv_ring) == 0) 
+		{
+			litews_socket_close(s);
+			s->error = litews_error_new_code_descr(litews_error_code_parse_handshake, "Handshake responce too large");
+			s->command = COMMAND_INFORM_DISCONNECTED;
+		}
+		return; // not complete yet
 	}
 
-	if (litews_socket_process_handshake_responce(s)) 
+	if (litews_socket_process_handshake_responce(s, s->received_buffer, head_len)) 
 	{
-	    #ifdef SUPPORT_REDUCE_MEM
-	    #else
-        s->received_len = 0;
-        #endif
+		// frames the server pushed right after the upgrade stay in the ring for 'litews_socket_idle_recv'
+		litews_ring_consume(&s->recv_ring, head_len);
 		s->is_connected = litews_true;
 		s->command = COMMAND_INFORM_CONNECTED;
+		litews_mutex_lock(s->send_mutex);
+		if (s->stats.connects++ > 0) 
+		{
+			s->stats.reconnects++;
+		}
+		litews_mutex_unlock(s->send_mutex);
+		s->last_recv_ms = litews_get_time_ms();
+		s->keepalive_probe_ms = 0;
+		s->keepalive_missed = 0;
 		LOGD_LITEWS("handshake OK!");
-		
-		#ifdef SUPPORT_REDUCE_MEM
-        s->buffer_len = 0;
-        s->buffer_size = SSL_REC_BUFFER_SIZE;
-		#endif
 	} 
 	else 
 	{
@@ -733,6 +1423,8 @@ void ssl_socket_wait_handshake_responce(litews_socket s)
 
 #else
 void litews_socket_wait_handshake_responce(litews_socket s) {
+	size_t head_len = 0, scanned = 0;
+
 	if (!litews_socket_recv(s)) {
 		// sock already closed
 		if (s->error) {
@@ -741,11 +1433,13 @@ void litews_socket_wait_handshake_responce(litews_socket s) {
 		return;
 	}
 	
-	if (s->received_len == 0) {
+	scanned = 0;
+	head_len = litews_socket_handshake_head_len((const char *)s->received, s->received_len, &scanned);
+	if (head_len == 0) {
 		return;
 	}
 
-	if (litews_socket_process_handshake_responce(s)) {
+	if (litews_socket_process_handshake_responce(s, (const char *)s->received, head_len)) {
         s->received_len = 0;
 		s->is_connected = litews_true;
 		s->command = COMMAND_INFORM_CONNECTED;
@@ -760,13 +1454,30 @@ void litews_socket_send_disconnect(litews_socket s)
 {
 	char buff[16];
 	size_t len = 0;
-	_litews_frame * frame = litews_frame_create();
+	_litews_frame * frame = NULL;
 
+	if (!s->is_open) 
+	{
+		s->command = COMMAND_END; // the peer closed the link or it failed, nobody hears the close frame
+		return;
+	}
+
+	frame = litews_frame_create();
 	len = litews_sprintf(buff, 16, "%u", litews_socket_get_next_message_id(s));
 
 	frame->is_masked = litews_true;
 	frame->opcode = litews_opcode_connection_close;
 	litews_frame_fill_with_send_data(frame, buff, len);
+	if (s->send_batch_len > s->send_batch_offset) 
+	{
+		litews_socket_send(s, s->send_batch + s->send_batch_offset, s->send_batch_len - s->send_batch_offset);
+	}
+	if (s->send_pending) 
+	{
+		// finish the partially written frame, the close frame can't go into its middle
+		litews_socket_send(s, (const unsigned char *)s->send_pending->data + s->send_pending_offset, 
+			s->send_pending->data_size - s->send_pending_offset);
+	}
 	litews_socket_send(s, frame->data, frame->data_size);
 	litews_frame_delete(frame);
 	
@@ -774,8 +1485,7 @@ void litews_socket_send_disconnect(litews_socket s)
 	litews_thread_sleep(LITEWS_CONNECT_RETRY_DELAY); // little bit wait after send message
 }
 
-#if defined(SUPPORT_WOLFSSL) || defined(SUPPORT_MBEDTLS) 
-void ssl_socket_send_handshake(litews_socket s) 
+void litews_socket_send_handshake(litews_socket s) 
 {
     {
         char buff[SSL_WEBSOCKET_SEND_BUF_LEN];
@@ -797,6 +1507,12 @@ void ssl_socket_send_handshake(litews_socket s)
                               "Connection: Upgrade\r\n"
                               "Origin: %s://%s\r\n",
                               s->scheme, s->host);
+
+        if (s->deflate_window_bits > 0) 
+        {
+            writed += litews_deflate_write_offer(ptr + writed, SSL_WEBSOCKET_SEND_BUF_LEN - writed,
+                                                 s->deflate_window_bits, s->deflate_no_context_takeover);
+        }
     
         writed += litews_sprintf(ptr + writed, SSL_WEBSOCKET_SEND_BUF_LEN - writed,
                               "Sec-WebSocket-Key: %s\r\n"
@@ -826,575 +1542,341 @@ void ssl_socket_send_handshake(litews_socket s)
     }
 }
 
-#else
-void litews_socket_send_handshake(litews_socket s) 
+void litews_socket_connect_to_host(litews_socket s) 
 {
-	char buff[512];
-	char * ptr = buff;
-	size_t writed = 0;
-	writed = litews_sprintf(ptr, 512, "GET %s HTTP/%s\r\n", s->path, k_litews_socket_min_http_ver);
-
-	if (s->port == 80) 
-	{
-		writed += litews_sprintf(ptr + writed, 512 - writed, "Host: %s\r\n", s->host);
-	} 
-	else 
-	{
-		writed += litews_sprintf(ptr + writed, 512 - writed, "Host: %s:%i\r\n", s->host, s->port);
-	}
-
-	writed += litews_sprintf(ptr + writed, 512 - writed,
-						  "Upgrade: websocket\r\n"
-						  "Connection: Upgrade\r\n"
-						  "Origin: %s://%s\r\n",
-						  s->scheme, s->host);
+    LOGD_LITEWS("connect over %s", s->transport->name);
+    if (!s->transport->connect(s)) 
+    {
+        s->error = litews_error_new_code_descr(litews_error_code_connect_to_host, "Failed connect to host");
+        LOGE_LITEWS("%s: code:%d, error:%s", __FUNCTION__, s->error->code, s->error->description);
+        s->command = COMMAND_END; //connect error, no need send disconnect message;
+        return;
+    }
 
-	writed += litews_sprintf(ptr + writed, 512 - writed,
-						  "Sec-WebSocket-Key: %s\r\n"
-						  "Sec-WebSocket-Protocol: chat, superchat\r\n"
-						  "Sec-WebSocket-Version: 13\r\n"
-						  "\r\n",
-						  "dGhlIHNhbXBsZSBub25jZQ==");
+    s->is_open = litews_true;
+#ifdef SUPPORT_REDUCE_MEM
+    litews_socket_reset_recv_state(s);
+#else
+    s->received_len = 0;
+#endif
+    s->command = COMMAND_SEND_HANDSHAKE;
+}
 
-	if (litews_socket_send(s, buff, writed)) 
+static void litews_socket_lane_append(_litews_frame ** head, _litews_frame ** tail, _litews_frame * frame) 
+{
+	frame->next = NULL;
+	if (*tail) 
 	{
-		s->command = COMMAND_WAIT_HANDSHAKE_RESPONCE;
+		(*tail)->next = frame;
 	} 
 	else 
 	{
-		if (s->error) 
-		{
-			s->error->code = litews_error_code_send_handshake;
-		} 
-		else 
-		{
-			s->error = litews_error_new_code_descr(litews_error_code_send_handshake, "Send handshake");
-		}
-		litews_socket_close(s);
-		s->command = COMMAND_INFORM_DISCONNECTED;
+		*head = frame;
 	}
+	*tail = frame;
 }
-#endif
 
-struct addrinfo * litews_socket_connect_getaddr_info(litews_socket s) {
-	struct addrinfo hints;
-	char portstr[16];
-	struct addrinfo * result = NULL;
-	int ret = 0, retry_number = 0;
-#if defined(LITEWS_OS_RTOS)
-#else
-	int last_ret = 0;
-#endif
-
-#if defined(LITEWS_OS_WINDOWS)
-	WSADATA wsa;
-#endif
-
-	litews_error_delete_clean(&s->error);
-
-#if defined(LITEWS_OS_WINDOWS)
-	AG_OS_MEMSET(&wsa, 0, sizeof(WSADATA));
-	if (WSAStartup(MAKEWORD(2,2), &wsa) != 0) {
-		s->error = litews_error_new_code_descr(litews_error_code_connect_to_host, "Failed initialise winsock");
-		s->command = COMMAND_INFORM_DISCONNECTED;
-		return NULL;
-	}
-#endif
-
-	litews_sprintf(portstr, 16, "%i", s->port);
-	while (++retry_number < LITEWS_CONNECT_ATTEMPS) {
-		result = NULL;
-		AG_OS_MEMSET(&hints, 0, sizeof(hints));
-		hints.ai_family = AF_UNSPEC;
-		hints.ai_socktype = SOCK_STREAM;
+static _litews_frame * litews_socket_lane_pop(_litews_frame ** head, _litews_frame ** tail) 
+{
+	_litews_frame * frame = *head;
 
-		ret = getaddrinfo(s->host, portstr, &hints, &result);
-		if (ret == 0 && result) {
-			return result;
-		}
-		
-#if defined(LITEWS_OS_RTOS)
-#else
-		if (ret != 0) 
+	if (frame) 
+	{
+		*head = frame->next;
+		if (!*head) 
 		{
-			last_ret = ret;
+			*tail = NULL;
 		}
-#endif
-		if (result) {
-			freeaddrinfo(result);
-		}
-		
-		litews_thread_sleep(LITEWS_CONNECT_RETRY_DELAY);
+		frame->next = NULL;
 	}
-
-#if defined(LITEWS_OS_WINDOWS)
-	WSACleanup();
-#endif
-
-#if defined(LITEWS_OS_RTOS)
-	s->error = litews_error_new_code_descr(litews_error_code_connect_to_host, "Failed connect to host");
-#else
-	s->error = litews_error_new_code_descr(litews_error_code_connect_to_host,
-										(last_ret > 0) ? gai_strerror(last_ret) : "Failed connect to host");
-#endif										
-	s->command = COMMAND_INFORM_DISCONNECTED;
-	return NULL;
+	return frame;
 }
 
-
-#ifdef SUPPORT_WOLFSSL
-void wolfssl_socket_connect_to_host(litews_socket s)
+static void litews_socket_count_send_frame(litews_socket s, _litews_frame * frame) 
 {
-	struct addrinfo * result = NULL;
-	struct addrinfo * p = NULL;
-	litews_socket_t sock = LITEWS_INVALID_SOCKET;
-	int retry_number = 0;
-	int ret = 0 ;
-
-	result = litews_socket_connect_getaddr_info(s);
-
-	if (!result) 
+	// the work thread drains the whole queue once woken, except what the pacer holds back,
+	// it may sleep on the pacer then and a frame passing the held binary mustn't wait for it
+	if (s->send_count == 0 ||
+		(s->pace_rate && frame->opcode != litews_opcode_binary_frame && frame->opcode != litews_opcode_continuation))
 	{
-	    LOGE_LITEWS("litews socket connect get address error!!");
-		return;
+		litews_event_wakeup(s);
 	}
-
-	while ((++retry_number < LITEWS_CONNECT_ATTEMPS) && (sock == LITEWS_INVALID_SOCKET)) 
+	s->send_count++;
+	s->send_bytes += frame->data_size;
+	if (s->send_count > s->stats.send_queue_peak_frames) 
 	{
-		for (p = result; p != NULL; p = p->ai_next) 
-		{
-			sock = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-			if (sock != LITEWS_INVALID_SOCKET) 
-			{
-				litews_socket_set_option(sock, SO_ERROR, 1); // 
-				litews_socket_set_option(sock, SO_KEEPALIVE, 1); //
-
-				if (connect(sock, p->ai_addr, p->ai_addrlen) == 0) 
-				{
-				    #ifdef SUPPORT_REDUCE_MEM
-				    #else
-                    s->received_len = 0;
-                    #endif
-                    
-					s->socket = sock;
-					fcntl(s->socket, F_SETFL, O_NONBLOCK);
-
-                    ret = wolfSSL_Init(); //init wolfssl
-                    if(ret != WOLFSSL_SUCCESS)
-                    {
-                        LOGE_LITEWS("wolfSSL_Init failed!");
-                        goto failed1;
-                    }
-                    xWolfSSL_Context = wolfSSL_CTX_new(wolfTLSv1_2_client_method());
-                    if(xWolfSSL_Context != NULL)
-                    {   
-                        #if 1
-                        LOGV_LITEWS("cert lens = %s", (s->client_cert));
-                        ret = wolfSSL_CTX_load_verify_buffer(xWolfSSL_Context, (unsigned char*)s->client_cert, strlen(s->client_cert), SSL_FILETYPE_PEM);
-                        if (WOLFSSL_SUCCESS != ret) 
-                        {
-                			LOGE_LITEWS("Loading the CA root certificate failed...");
-                			goto failed2;
-                		}
-                        wolfSSL_CTX_set_verify(xWolfSSL_Context, WOLFSSL_VERIFY_PEER, NULL);
-                        #else
-                        wolfSSL_CTX_set_verify(xWolfSSL_Context, WOLFSSL_VERIFY_NONE, NULL);
-                        #endif
-                    }
-                    else
-                    {
-                        LOGE_LITEWS("wolfssl context creat failed!");
-                        goto failed2;
-                    }
-                    xWolfSSL_Object = wolfSSL_new(xWolfSSL_Context);
-
-                    if(xWolfSSL_Object != NULL)
-                    {
-                        wolfSSL_set_fd(xWolfSSL_Object, sock);
-                        ret = 0;
-                        while((ret != WOLFSSL_SUCCESS))
-                        {
-                            ret = wolfSSL_connect(xWolfSSL_Object);
-                            litews_thread_sleep(100);
-                        }
-                    }
-                    else
-                    {
-                        LOGE_LITEWS("wolfssl object creat failed");
-                        goto failed3;
-                    }
-                    
-					LOGD_LITEWS("SOCKET CONNECT");
-					break;
-
-					//wolfssl failed
-            		failed3: wolfSSL_free(xWolfSSL_Object);
-            		failed2: wolfSSL_CTX_free(xWolfSSL_Context);
-            		failed1: wolfSSL_Cleanup();
-
-            		close(sock);
-                    s->socket = LITEWS_INVALID_SOCKET;
-					//
-				}
-				else
-				{
-				    //socket connect fail close
-				    LOGE_LITEWS("socket connect failed, close socket");
-				    close(sock);
-				}
-			}
-		}
-		if (sock == LITEWS_INVALID_SOCKET) 
-		{
-			litews_thread_sleep(LITEWS_CONNECT_RETRY_DELAY);
-		}
+		s->stats.send_queue_peak_frames = (unsigned int)s->send_count;
 	}
-
-	freeaddrinfo(result);
-
-	if (s->socket == LITEWS_INVALID_SOCKET) 
+	if (s->send_bytes > s->stats.send_queue_peak_bytes) 
 	{
-		s->error = litews_error_new_code_descr(litews_error_code_connect_to_host, "Failed connect to host");
-		s->command = COMMAND_END;   //connect error, no need send disconnect message;
-		LOGE_LITEWS("SOCKET ERROR -> LITEWS_INVALID_SOCKET");
-	} 
-	else 
-	{
-		s->command = COMMAND_SEND_HANDSHAKE;
+		s->stats.send_queue_peak_bytes = (unsigned int)s->send_bytes;
 	}
-	
 }
 
-#elif defined(SUPPORT_MBEDTLS)
-static void litews_debug( void *ctx, int level,
-                                const char *file, int line,
-                                const char *str )
+// frames queued when the link was lost: the partly written one starts over, compressed text goes back
+// uncompressed, control frames and the rest of a message begun on the old link can't go to the new one,
+// priority text keeps its own lane
+static void litews_socket_requeue_send_frames(litews_socket s) 
 {
-    ((void) level);
-    fprintf( (FILE *) ctx, "%s:%04d: %s", file, line, str );
-    fflush(  (FILE *) ctx  );
-}
-
-
-void mbedtls_socket_connect_to_host(litews_socket s) 
-{
-    int authmode = MBEDTLS_SSL_VERIFY_NONE;
-    const char *pers = "https";
-    int value, ret = 0;
-    uint32_t flags;
-    _litews_ssl *ssl = NULL;
-    char portstr[16] = {0};
-
-    int retry_number = 0;
-    //char portbuf[100];
-
-    //FUNCTION_BEGIN
+    _litews_frame * frame = NULL;
+    _litews_frame * plain = NULL;
+    _litews_frame * list = s->send_head;
+    _litews_frame * prio = s->send_prio_head;
+    litews_bool is_orphan = litews_true; // leading continuation frames belong to a message begun on the old link
 
-    s->ssl = litews_malloc_zero(sizeof(_litews_ssl));
-    if(!s->ssl)
+    if (!s->reconnect_keep_queue) 
     {
-        LOGE_LITEWS("mbedtls Memory malloc error");
-        ret = -1;
-        goto exit;
+        litews_socket_delete_send_frames(s);
+        s->send_cut_message = s->send_user_in_message;
+        return;
     }
-    ssl = s->ssl;
-    
-    if(s->client_cert)
+
+    // priority texts keep their lane: spliced into the data list they could land between
+    // a message begun in the batch and its continuations queued behind
+    s->send_prio_head = NULL;
+    s->send_prio_tail = NULL;
+    if (s->send_ctrl_head) 
     {
-        authmode = MBEDTLS_SSL_VERIFY_REQUIRED;
+        s->send_ctrl_tail->next = list; // released below
+        list = s->send_ctrl_head;
+        s->send_ctrl_head = NULL;
+        s->send_ctrl_tail = NULL;
     }
-    
-    //mbedtls_debug_set_threshold(1); //enable mbedtls debug; set debug level = 3; 
-    
-    mbedtls_net_init(&ssl->net_ctx);
-    mbedtls_ssl_init(&ssl->ssl_ctx);
-    mbedtls_ssl_config_init(&ssl->ssl_conf);
-    //mbedtls_x509_crt_init(&ssl->cacert);
-    mbedtls_x509_crt_init(&ssl->clicert);
-    //mbedtls_pk_init(&ssl->pkey);
-    mbedtls_ctr_drbg_init(&ssl->ctr_drbg);  //zz mark
-
-    /* 
-        0. Initialize the RNG and the session data
-    */
-    
-    //zz mark
-    
-    mbedtls_entropy_init(&ssl->entropy);
-    if((value = mbedtls_ctr_drbg_seed(&ssl->ctr_drbg, mbedtls_entropy_func, &ssl->entropy,(const unsigned char*)pers, strlen(pers))) != 0)
+    if (s->send_pending) 
     {
-        LOGE_LITEWS("mbedtls_ctr_drbg_seed() failed, value:-0x%x.", -value);
-        ret = -1;
-        goto exit;
+        s->send_pending->next = list;
+        list = s->send_pending;
+        s->send_pending = NULL;
+        s->send_pending_offset = 0;
     }
-    
-    /* 
-        1. Load the client certificate
-    */
-    //LOGD_LITEWS("== client_cert ==");
-    //LOGD_LITEWS("%s", s->client_cert);
-    if(s->client_cert)
-    {
-        ret = mbedtls_x509_crt_parse(&ssl->clicert, (const unsigned char *)s->client_cert, strlen(s->client_cert)+1);
-        if(ret < 0)
-        {
-            LOGE_LITEWS("mbedtls_x509_crt_parse returned -0x%x\n\n", -ret);
-            goto exit;
-        }
+    if (s->send_batch_head) 
+    {
+        // the batch holds copies, its frames go back in front of the rest
+        s->send_batch_tail->next = list;
+        list = s->send_batch_head;
+        s->send_batch_head = NULL;
+        s->send_batch_tail = NULL;
+        s->send_batch_len = 0;
+        s->send_batch_offset = 0;
     }
+    s->send_head = NULL;
+    s->send_tail = NULL;
+    s->send_in_message = litews_false;
+    s->send_count = 0;
+    s->send_bytes = 0;
 
-     /* 
-         2. Start the connection
-     */
-
-    litews_sprintf(portstr, 16, "%i", s->port);
-    LOGD_LITEWS("Connecting to %s:%s...", s->host, portstr);
-
-    ret = -1;    //reset flag retry conncet 5 times
-    while ((++retry_number < LITEWS_CONNECT_ATTEMPS) && (ret != 0))
+    while (list) 
     {
-        if ((ret = mbedtls_net_connect(&ssl->net_ctx, s->host, portstr, MBEDTLS_NET_PROTO_TCP)) != 0)
+        frame = list;
+        list = frame->next;
+        if (frame->plain) 
         {
-            LOGE_LITEWS("mbedtls_net_connect failed -%x", -ret);
+            // compressed against the dictionary of the old link, the text goes again as queued
+            plain = frame->plain;
+            frame->plain = NULL;
+            litews_socket_release_send_frame(s, frame);
+            frame = plain;
         }
-        if(retry_number >= LITEWS_CONNECT_ATTEMPS)
+        if (frame->opcode & 0x08) 
         {
-            goto exit;
+            litews_socket_release_send_frame(s, frame);
+        }
+        else if (frame->opcode == litews_opcode_continuation && is_orphan) 
+        {
+            is_orphan = frame->is_finished ? litews_false : litews_true;
+            litews_socket_release_send_frame(s, frame);
+        }
+        else 
+        {
+            if (!frame->is_finished) 
+            {
+                is_orphan = litews_false; // a message starts here, its continuations follow
+            }
+            litews_socket_append_send_frames(s, frame);
         }
-        litews_thread_sleep(LITEWS_CONNECT_RETRY_DELAY);
     }
+    // the user is still sending a message none of which is left for the new link
+    s->send_cut_message = (s->send_user_in_message && (!s->send_tail || s->send_tail->is_finished)) ? litews_true : litews_false;
 
-    LOGD_LITEWS("Socket Connected.");
-
-    s->buffer_len = 0;
-    s->socket = ssl->net_ctx.fd;
-
-
-    /* 
-         3. Setup stuff
-    */  
-
-     if((value = mbedtls_ssl_config_defaults(&ssl->ssl_conf,
-                                           MBEDTLS_SSL_IS_CLIENT,
-                                           MBEDTLS_SSL_TRANSPORT_STREAM,
-                                           MBEDTLS_SSL_PRESET_DEFAULT)) != 0)
-     {
-         LOGE_LITEWS("mbedtls_ssl_config_defaults failed value: -0x%x", -value);
-         ret = -1;
-         goto exit;
-     }
-
-    /*
-    memcpy(&ssl->profile, ssl->ssl_conf.cert_profile, sizeof(mbedtls_x509_crt_profile));
-    ssl->profile.allowed_mds = ssl->profile.allowed_mds | MBEDTLS_X509_ID_FLAG(MBEDTLS_MD_MD5);
-    mbedtls_ssl_conf_cert_profile(&ssl->ssl_conf, &ssl->profile);
-    */
-    
-    mbedtls_ssl_conf_authmode(&ssl->ssl_conf, authmode);
-    mbedtls_ssl_conf_ca_chain(&ssl->ssl_conf, &ssl->clicert, NULL);
-
-    /*  
-    if (s->client_cert && (ret = mbedtls_ssl_conf_own_cert(&ssl->ssl_conf, &ssl->clicert, &ssl->pkey)) != 0) 
+    while (prio) 
     {
-         DBG("[SSL]failed! mbedtls_ssl_conf_own_cert returned %d.", ret );
-         goto exit;
+        frame = prio;
+        prio = frame->next;
+        frame->next = NULL;
+        litews_socket_lane_append(&s->send_prio_head, &s->send_prio_tail, frame);
+        litews_socket_count_send_frame(s, frame);
     }
-    */
+}
 
-    mbedtls_ssl_conf_rng(&ssl->ssl_conf, mbedtls_ctr_drbg_random, &ssl->ctr_drbg);    //zz mark
-    mbedtls_ssl_conf_dbg(&ssl->ssl_conf, litews_debug, stdout);
+// the link ended without the user asking for it: close what is left and wait for the next attempt
+static void litews_socket_schedule_reconnect(litews_socket s) 
+{
+    const unsigned int delay = s->reconnect_delay_ms;
 
+    litews_socket_close(s);
+#ifdef SUPPORT_REDUCE_MEM
+    litews_socket_reset_recv_state(s);
+#endif
 
-    if ((value = mbedtls_ssl_setup(&ssl->ssl_ctx, &ssl->ssl_conf)) != 0) 
-    {
-        LOGE_LITEWS("mbedtls_ssl_setup() failed, value:-0x%x.", -value);
-        ret = -1;
-        goto exit;
-    }
+    litews_mutex_lock(s->send_mutex);
+    litews_socket_requeue_send_frames(s);
+    litews_mutex_unlock(s->send_mutex);
+
+    // half of the delay is random, devices that lost the link together don't come back together
+    s->reconnect_at_ms = litews_get_time_ms() + delay / 2 + (unsigned int)rand() % (delay / 2 + 1);
+    s->reconnect_delay_ms = (delay * 2 < s->reconnect_max_ms) ? delay * 2 : s->reconnect_max_ms;
+    s->command = COMMAND_WAIT_RECONNECT;
+    LOGD_LITEWS("link lost, reconnect in %u ms", s->reconnect_at_ms - litews_get_time_ms());
+}
+
+static void litews_socket_update_state(litews_socket s) 
+{
+    int state = litews_state_disconnected;
 
-    if((ret = mbedtls_ssl_set_hostname(&ssl->ssl_ctx, s->host)) != 0)
+    switch (s->command) 
     {
-        LOGE_LITEWS( "failed\n  ! mbedtls_ssl_set_hostname returned %d\n\n", ret );
-        goto exit;
+        case COMMAND_NONE:
+        case COMMAND_CONNECT_TO_HOST:
+        case COMMAND_SEND_HANDSHAKE:
+        case COMMAND_WAIT_HANDSHAKE_RESPONCE:
+            state = litews_state_connecting;
+            break;
 
-    }
+        case COMMAND_IDLE:
+            state = litews_state_connected;
+            break;
 
-    mbedtls_ssl_set_bio(&ssl->ssl_ctx, &ssl->net_ctx, mbedtls_net_send, mbedtls_net_recv, NULL);
+        case COMMAND_WAIT_RECONNECT:
+            state = litews_state_waiting_reconnect;
+            break;
 
-    /* 
-         4. handshake
-    */
-    LOGD_LITEWS("Performing the SSL/TLS handshake...");
+        default: 
+            break;
+    }
 
-    while ((ret = mbedtls_ssl_handshake(&ssl->ssl_ctx)) != 0)
+    if (state != s->state) 
     {
-        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+        s->state = state;
+        if (s->on_state_changed) 
         {
-            LOGE_LITEWS("[SSL]mbedtls_ssl_handshake() failed, ret:-0x%x.", -ret);
-            goto exit;
+            s->on_state_changed(s, state);
         }
-        litews_thread_sleep(100);
     }
+}
 
-    mbedtls_net_set_nonblock(&ssl->net_ctx);
+// ping an idle link, the idle time adapts to how long the NAT on the way keeps it
+static void litews_socket_keepalive(litews_socket s) 
+{
+    const unsigned int now = litews_get_time_ms();
+    unsigned int idle = s->keepalive_idle_ms;
 
-    /* 
-         4. Verify the server certificate
-    */
-    LOGD_LITEWS("Verifying peer X.509 certificate...");
-    if ((flags = mbedtls_ssl_get_verify_result(&ssl->ssl_ctx)) != 0)
-    {
-        /* In real life, we probably want to close connection if ret != 0 */
-        LOGE_LITEWS("Failed to verify peer certificate!");
-        char verfy_buff[512];
-        mbedtls_x509_crt_verify_info(verfy_buff, sizeof(verfy_buff), "  ! ", flags);
-        LOGE_LITEWS("[SSL] %s", verfy_buff);
-    }
-    else 
+    if (!idle || s->recv_held) 
     {
-        LOGD_LITEWS("Certificate verified OK");
+        return; // a pong would wait behind the held payload, LITEWS_RECV_HOLD_MAX_MS bounds the hold instead
     }
 
-exit:
-    if(ret != 0) 
+    if (s->keepalive_probe_ms) 
     {
-        /*
-        #ifdef MBEDTLS_ERROR_C
-        char error_buf[100];
-        mbedtls_strerror( ret, error_buf, 100 );
-        LOGE_LITEWS("[SSL]Last error was: %d - %s\n\n", ret, error_buf);
-        #endif
-        */
-        LOGE_LITEWS("[SSL]ret=0x%x.", ret);
-        s->error = litews_error_new_code_descr(litews_error_code_connect_to_host, "Failed connect to host");
-        LOGE_LITEWS("[SSL]%s: code:%d, error:%s", __FUNCTION__, s->error->code, s->error->description);
-        s->command = COMMAND_END;
-
-        if (s->ssl)
+        if ((int)(s->last_recv_ms - s->keepalive_probe_ms) >= 0) 
+        {
+            // answered, a longer idle time costs less radio time
+            s->keepalive_probe_ms = 0;
+            s->keepalive_missed = 0;
+            if (++s->keepalive_answered >= LITEWS_KEEPALIVE_GROW_AFTER) 
+            {
+                s->keepalive_answered = 0;
+                idle += idle / 4;
+                if (s->keepalive_ceiling_ms && idle > s->keepalive_ceiling_ms - s->keepalive_ceiling_ms / 4) 
+                {
+                    idle = s->keepalive_ceiling_ms - s->keepalive_ceiling_ms / 4;
+                }
+                if (idle > LITEWS_KEEPALIVE_MAX_MS) 
+                {
+                    idle = (s->keepalive_idle_ms < LITEWS_KEEPALIVE_MAX_MS) ? LITEWS_KEEPALIVE_MAX_MS : s->keepalive_idle_ms;
+                }
+                s->keepalive_idle_ms = idle;
+            }
+            return;
+        }
+        if (now - s->keepalive_probe_ms < s->keepalive_pong_timeout_ms) 
         {
-            mbedtls_net_free(&s->ssl->net_ctx);
-            //mbedtls_x509_crt_free(&s->ssl->cacert);
-            mbedtls_x509_crt_free(&s->ssl->clicert);
-            //mbedtls_pk_free(&s->ssl->pkey);
-            mbedtls_ssl_free(&s->ssl->ssl_ctx);
-            mbedtls_ssl_config_free(&s->ssl->ssl_conf);
-            mbedtls_ctr_drbg_free(&s->ssl->ctr_drbg);  //zz mark
-            mbedtls_entropy_free(&s->ssl->entropy);  //zz mark
-
-            litews_free(s->ssl);
-            s->ssl = NULL;
+            return;
         }
-        s->socket = LITEWS_INVALID_SOCKET;
-    }
-    else
+        if (++s->keepalive_missed >= s->keepalive_max_missed) 
+        {
+            // died while idle: the NAT may forget sooner than this idle time
+            if (!s->keepalive_ceiling_ms || idle < s->keepalive_ceiling_ms) 
+            {
+                s->keepalive_ceiling_ms = idle;
+            }
+            idle -= idle / 4;
+            if (idle < LITEWS_KEEPALIVE_MIN_MS) 
+            {
+                idle = (s->keepalive_idle_ms > LITEWS_KEEPALIVE_MIN_MS) ? LITEWS_KEEPALIVE_MIN_MS : s->keepalive_idle_ms;
+            }
+            s->keepalive_idle_ms = idle;
+            s->keepalive_answered = 0;
+            s->keepalive_probe_ms = 0;
+            LOGE_LITEWS("keep-alive: %u probes missed, link is dead, next idle time %u ms", 
+                        s->keepalive_missed, s->keepalive_idle_ms);
+            litews_error_delete_clean(&s->error);
+            s->error = litews_error_new_code_descr(litews_error_code_read_write_socket, "Keep-alive timeout");
+            litews_socket_close(s);
+            s->command = COMMAND_INFORM_DISCONNECTED;
+            return;
+        }
+    } 
+    else if (now - s->last_recv_ms < idle) 
     {
-        s->command = COMMAND_SEND_HANDSHAKE;
+        return;
     }
 
-    return;
-
+    litews_mutex_lock(s->send_mutex);
+    litews_socket_send_ping(s);
+    litews_mutex_unlock(s->send_mutex);
+    s->keepalive_probe_ms = now ? now : 1;
 }
 
-#else
-
-void litews_socket_connect_to_host(litews_socket s) 
+// how long the work thread may wait before litews_socket_keepalive has something to do
+static unsigned int litews_socket_keepalive_wait_ms(litews_socket s) 
 {
-	struct addrinfo * result = NULL;
-	struct addrinfo * p = NULL;
-	litews_socket_t sock = LITEWS_INVALID_SOCKET;
-	int retry_number = 0;
-#if defined(LITEWS_OS_WINDOWS)
-	unsigned long iMode = 0;
-#endif
-
-	result = litews_socket_connect_getaddr_info(s);
-	if (!result) {
-		return;
-	}
-
-	while ((++retry_number < LITEWS_CONNECT_ATTEMPS) && (sock == LITEWS_INVALID_SOCKET)) {
-		for (p = result; p != NULL; p = p->ai_next) {
-			sock = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-			if (sock != LITEWS_INVALID_SOCKET) {
-				litews_socket_set_option(sock, SO_ERROR, 1); // When an error occurs on a socket, set error variable so_error and notify process
-				litews_socket_set_option(sock, SO_KEEPALIVE, 1); // Periodically test if connection is alive
-
-				if (connect(sock, p->ai_addr, p->ai_addrlen) == 0) {
-                    s->received_len = 0;
-					s->socket = sock;
-#if defined(LITEWS_OS_WINDOWS)
-					// If iMode != 0, non-blocking mode is enabled.
-					iMode = 1;
-					ioctlsocket(s->socket, FIONBIO, &iMode);
-#else
-					fcntl(s->socket, F_SETFL, O_NONBLOCK);
-#endif
-					break;
-				}
-				//LITEWS_SOCK_CLOSE(sock);
-				litews_socket_close(s);
-			}
-		}
-		if (sock == LITEWS_INVALID_SOCKET) {
-			litews_thread_sleep(LITEWS_CONNECT_RETRY_DELAY);
-		}
-	}
+    unsigned int due = 0;
+    int left = 0;
 
-	freeaddrinfo(result);
-
-	if (s->socket == LITEWS_INVALID_SOCKET) {
-#if defined(LITEWS_OS_WINDOWS)
-		WSACleanup();
-#endif
-		s->error = litews_error_new_code_descr(litews_error_code_connect_to_host, "Failed connect to host");
-		s->command = COMMAND_INFORM_DISCONNECTED;
-	} else {
-		s->command = COMMAND_SEND_HANDSHAKE;
-	}
+    if (!s->keepalive_idle_ms || !s->is_connected) 
+    {
+        return LITEWS_IDLE_WAIT_MS;
+    }
+    due = s->keepalive_probe_ms ? s->keepalive_probe_ms + s->keepalive_pong_timeout_ms : s->last_recv_ms + s->keepalive_idle_ms;
+    left = (int)(due - litews_get_time_ms());
+    if (left <= 0) 
+    {
+        return 1;
+    }
+    return ((unsigned int)left < LITEWS_IDLE_WAIT_MS) ? (unsigned int)left : LITEWS_IDLE_WAIT_MS;
 }
 
-#endif
-
-#define WAIT_TIME_MAX               100  // 80 ms
-#define WAIT_TIME_MIN               5  // 5 ms
-
 static void litews_socket_work_th_func(void * user_object) 
 {
     litews_socket s = (litews_socket)user_object;
-    //size_t loop_number = 0;
-    int wait_time = WAIT_TIME_MIN;
+    int wait_ms = 0;
+    unsigned int idle_ms = 0, pace_ms = 0;
 
     while (s->command < COMMAND_END) 
     {
-        WS_PING_LOOP++;
-
         litews_mutex_lock(s->work_mutex);
         switch (s->command) 
         {
             case COMMAND_CONNECT_TO_HOST: 
-#ifdef SUPPORT_MBEDTLS
-                mbedtls_socket_connect_to_host(s);
-#elif defined(SUPPORT_WOLFSSL)
-                wolfssl_socket_connect_to_host(s);
-#else
                 litews_socket_connect_to_host(s); 
-#endif
                 break;
 
             case COMMAND_SEND_HANDSHAKE: 
-#if defined(SUPPORT_MBEDTLS) || defined(SUPPORT_WOLFSSL)
-                ssl_socket_send_handshake(s);
-#else
                 litews_socket_send_handshake(s); 
-#endif
                 break;
 
             case COMMAND_WAIT_HANDSHAKE_RESPONCE: 
-#if defined(SUPPORT_MBEDTLS) || defined(SUPPORT_WOLFSSL)
-                ssl_socket_wait_handshake_responce(s);
-#else
                 litews_socket_wait_handshake_responce(s); 
-#endif
                 break;
 
             case COMMAND_DISCONNECT: 
@@ -1406,47 +1888,47 @@ static void litews_socket_work_th_func(void * user_object)
                 break;
 
 
-            case COMMAND_IDLE:
-                if (0) 
+            case COMMAND_WAIT_RECONNECT:
+                if ((int)(litews_get_time_ms() - s->reconnect_at_ms) >= 0) 
                 {
-                    WS_PING_LOOP = 0;
-
-                    if (s->is_connected) 
-                    {
-                        LOGD_LITEWS("====websocket send ping====");
-                        litews_socket_send_ping(s);
-                    }
-                    else
+                    if (!s->reconnect_keep_queue) 
                     {
-                        LOGD_LITEWS("====websocket flag is false====");
+                        litews_mutex_lock(s->send_mutex);
+                        litews_socket_delete_send_frames(s);
+                        litews_mutex_unlock(s->send_mutex);
                     }
+                    litews_error_delete_clean(&s->error);
+                    s->command = COMMAND_CONNECT_TO_HOST;
                 }
+                break;
 
+            case COMMAND_IDLE:
                 if (s->is_connected) 
                 {   
-                    litews_bool sRet= litews_socket_idle_send(s);
-                    if (sRet == litews_true)
-                        wait_time = WAIT_TIME_MIN;
-                    else {
-                        wait_time = wait_time << 1;
-                        if (wait_time > WAIT_TIME_MAX) {
-                            wait_time = WAIT_TIME_MAX;
-                        }
-                    }
+                    litews_socket_idle_send(s);
                 }
 
-                if (s->is_connected) 
+                if (s->is_connected && litews_socket_idle_recv(s) < 0) 
+                {
+                    s->command = COMMAND_INFORM_DISCONNECTED; // the peer closed the link or it failed
+                }
+
+                if (s->is_connected && s->command == COMMAND_IDLE) 
                 {
-                    int ret = litews_socket_idle_recv(s);
-                    if (ret > 0) {
-                        wait_time = WAIT_TIME_MIN;
-                    } 
+                    litews_socket_keepalive(s);
                 }
                 break;
                 
             default: 
                 break;
         }
+
+        // a failed connect ends the socket, a lost link informs and ends it, unless it is managed
+        if (s->reconnect_min_ms > 0 && !s->is_released && 
+            (s->command == COMMAND_INFORM_DISCONNECTED || s->command == COMMAND_END)) 
+        {
+            litews_socket_schedule_reconnect(s);
+        }
         
         litews_mutex_unlock(s->work_mutex);
 
@@ -1456,6 +1938,13 @@ static void litews_socket_work_th_func(void * user_object)
             {
                 LOGD_LITEWS("websocket connect OK !!");
                 s->command = COMMAND_IDLE;
+                s->reconnect_delay_ms = s->reconnect_min_ms;
+#ifdef SUPPORT_REDUCE_MEM
+                if (s->recv_ring.len > 0) 
+                {
+                    litews_event_wakeup(s); // frames that came with the upgrade, don't wait for more
+                }
+#endif
                 if (s->on_connected) 
                 {
                     s->on_connected(s);
@@ -1485,12 +1974,41 @@ static void litews_socket_work_th_func(void * user_object)
             default: 
             break;
         }
+
+        litews_socket_update_state(s);
         
-        litews_thread_sleep(10);
-        
+        // sleep only where progress needs the peer or another thread, other commands run at once
+        switch (s->command) 
+        {
+            case COMMAND_NONE:
+            case COMMAND_WAIT_HANDSHAKE_RESPONCE:
+                litews_event_wait(s, LITEWS_IDLE_WAIT_MS);
+                break;
+
+            case COMMAND_IDLE:
+                idle_ms = litews_socket_keepalive_wait_ms(s);
+                pace_ms = litews_socket_pace_wait_ms(s); // until the pacer lets the next binary frame go
+                litews_event_wait(s, (pace_ms < idle_ms) ? pace_ms : idle_ms);
+                break;
+
+            case COMMAND_WAIT_RECONNECT:
+                wait_ms = (int)(s->reconnect_at_ms - litews_get_time_ms());
+                if (wait_ms > 0) 
+                {
+                    litews_event_wait(s, (unsigned int)wait_ms);
+                }
+                break;
+
+            default: 
+            break;
+        }
     }
     
     LOGE_LITEWS("END SOCKET LOOP!");
+    litews_socket_update_state(s);
+    // a woken disconnect_and_release may still be inside the work mutex
+    litews_mutex_lock(s->work_mutex);
+    litews_mutex_unlock(s->work_mutex);
     litews_socket_close(s);
     
     s->work_thread = NULL;
@@ -1501,10 +2019,12 @@ litews_bool litews_socket_create_start_work_thread(litews_socket s)
 {
     litews_error_delete_clean(&s->error);
     s->command = COMMAND_NONE;
+    litews_event_open(s); // without it the work thread falls back to sleeping
     s->work_thread = litews_thread_create(&litews_socket_work_th_func, s);
     if (s->work_thread) 
     {
         s->command = COMMAND_CONNECT_TO_HOST;
+        litews_event_wakeup(s);
         return litews_true;
     }
     return litews_false;
@@ -1536,50 +2056,6 @@ void litews_socket_resize_received(litews_socket s, const size_t size)
 }
 #endif
 
-#ifdef SUPPORT_WOLFSSL
-void LITEWS_SOCK_CLOSE(litews_socket s)
-{
-    //wolfSSL_shutdown(xWolfSSL_Object);
-    wolfSSL_free(xWolfSSL_Object);
-    wolfSSL_CTX_free(xWolfSSL_Context);
-    wolfSSL_Cleanup();
-    close(s->socket);
-}
-
-#elif defined(SUPPORT_MBEDTLS)
-void LITEWS_SOCK_CLOSE(litews_socket s)
-{
-    _litews_ssl *ssl = s->ssl;
-
-    if(!ssl)
-    {
-        //return -1;
-        return;
-    }
-    
-	mbedtls_ssl_close_notify(&ssl->ssl_ctx);
-    mbedtls_net_free(&ssl->net_ctx);
-    //mbedtls_x509_crt_free(&ssl->cacert);
-    mbedtls_x509_crt_free(&ssl->clicert);
-    //mbedtls_pk_free(&ssl->pkey);
-    mbedtls_ssl_free(&ssl->ssl_ctx);
-    mbedtls_ssl_config_free(&ssl->ssl_conf);
-    mbedtls_ctr_drbg_free(&ssl->ctr_drbg);  //zz mark
-    mbedtls_entropy_free(&ssl->entropy);  //zz mark
-
-    litews_free(ssl);
-    s->ssl = NULL;
-
-    //return 0;
-    return;
-}
-#else
-void LITEWS_SOCK_CLOSE(litews_socket s)
-{
-    close(s->socket);
-}
-#endif
-
 void litews_socket_close(litews_socket s) 
 {
 #ifdef SUPPORT_REDUCE_MEM
@@ -1587,15 +2063,12 @@ void litews_socket_close(litews_socket s)
     s->received_len = 0;
 #endif
     
-    if (s->socket != LITEWS_INVALID_SOCKET) 
+    if (s->is_open) 
     {
-#if defined(SUPPORT_MBEDTLS)||defined(SUPPORT_WOLFSSL)
-        LITEWS_SOCK_CLOSE(s);
-#else
-        LITEWS_SOCK_CLOSE(s->socket);
-#endif
-        s->socket = LITEWS_INVALID_SOCKET;
+        s->transport->close(s);
+        s->is_open = litews_false;
     }
+    s->socket = LITEWS_INVALID_SOCKET;
     s->is_connected = litews_false;
 }
 
@@ -1614,22 +2087,160 @@ void litews_socket_append_recvd_frames(litews_socket s, _litews_frame * frame)
 	}
 }
 
+// control frames may go between the fragments of a message, so they get a lane of their own
 void litews_socket_append_send_frames(litews_socket s, _litews_frame * frame) 
 {
-	_litews_node_value frame_list_var;
-	frame_list_var.object = frame;
-	if (s->send_frames) 
+	if (frame->opcode & 0x08) 
+	{
+		litews_socket_lane_append(&s->send_ctrl_head, &s->send_ctrl_tail, frame);
+	} 
+	else 
+	{
+		litews_socket_lane_append(&s->send_head, &s->send_tail, frame);
+	}
+	litews_socket_count_send_frame(s, frame);
+}
+
+// credit flowed in since the last call, capped by the burst
+static void litews_socket_pace_refill(litews_socket s) 
+{
+	const unsigned int now = litews_get_time_ms();
+	const long long cap = (long long)s->pace_burst * 1000;
+
+	s->pace_credit += (long long)(now - s->pace_at_ms) * s->pace_rate;
+	if (s->pace_credit > cap) 
+	{
+		s->pace_credit = cap;
+	}
+	s->pace_at_ms = now;
+}
+
+// binary payload goes while there is credit, a frame larger than it leaves a debt the next one waits for
+static litews_bool litews_socket_pace_allows(litews_socket s, const _litews_frame * frame) 
+{
+	if (!s->pace_rate || (frame->opcode != litews_opcode_binary_frame && frame->opcode != litews_opcode_continuation)) 
+	{
+		return litews_true;
+	}
+	litews_socket_pace_refill(s);
+	if (s->pace_credit >= 0) 
+	{
+		return litews_true;
+	}
+	if (!s->pace_waiting) 
+	{
+		s->pace_waiting = litews_true;
+		s->stats.pace_waits++;
+	}
+	return litews_false;
+}
+
+unsigned int litews_socket_pace_wait_ms(litews_socket s) 
+{
+	unsigned int wait_ms = LITEWS_IDLE_WAIT_MS;
+
+	litews_mutex_lock(s->send_mutex);
+	if (s->send_head && !litews_socket_pace_allows(s, s->send_head)) 
+	{
+		wait_ms = (unsigned int)((-s->pace_credit + s->pace_rate - 1) / s->pace_rate);
+	}
+	litews_mutex_unlock(s->send_mutex);
+	return wait_ms;
+}
+
+litews_bool litews_socket_has_send_frame(litews_socket s) 
+{
+	return (s->send_ctrl_head || (s->send_head && litews_socket_pace_allows(s, s->send_head)) || 
+		(s->send_prio_head && !s->send_in_message)) ? litews_true : litews_false;
+}
+
+_litews_frame * litews_socket_pop_send_frame(litews_socket s) 
+{
+	_litews_frame * frame = litews_socket_lane_pop(&s->send_ctrl_head, &s->send_ctrl_tail);
+
+	if (!frame && !s->send_in_message) 
+	{
+		frame = litews_socket_lane_pop(&s->send_prio_head, &s->send_prio_tail);
+	}
+	if (!frame && s->send_head && litews_socket_pace_allows(s, s->send_head)) 
+	{
+		frame = litews_socket_lane_pop(&s->send_head, &s->send_tail);
+		s->send_in_message = frame->is_finished ? litews_false : litews_true;
+		if (s->pace_rate && (frame->opcode == litews_opcode_binary_frame || frame->opcode == litews_opcode_continuation)) 
+		{
+			s->pace_credit -= (long long)(frame->data_size - frame->header_size) * 1000;
+			s->pace_waiting = litews_false;
+		}
+	}
+	if (frame) 
+	{
+		s->send_count--;
+		s->send_bytes -= frame->data_size;
+	}
+	return frame;
+}
+
+litews_bool litews_socket_check_send_budget(litews_socket s, const size_t size) 
+{
+	if (s->send_head && s->send_bytes + size > s->send_bytes_limit) 
+	{
+		return litews_would_block;
+	}
+	return litews_true;
+}
+
+void litews_socket_release_send_frame(litews_socket s, _litews_frame * frame) 
+{
+	if (frame && frame->is_borrowed) 
 	{
-		litews_list_append(s->send_frames, frame_list_var);
+		((_litews_send_buffer *)frame)->is_used = litews_false;
 	} 
 	else 
 	{
-		s->send_frames = litews_list_create();
-		s->send_frames->value = frame_list_var;
+		litews_frame_delete(frame);
+	}
+}
+
+void litews_socket_delete_send_frames(litews_socket s) 
+{
+	_litews_frame * frame = s->send_head;
+	_litews_frame * next = NULL;
+
+	litews_socket_release_send_frame(s, s->send_pending);
+	s->send_pending = NULL;
+	s->send_pending_offset = 0;
+	while (s->send_batch_head) 
+	{
+		next = s->send_batch_head->next;
+		litews_socket_release_send_frame(s, s->send_batch_head);
+		s->send_batch_head = next;
+	}
+	s->send_batch_tail = NULL;
+	s->send_batch_len = 0;
+	s->send_batch_offset = 0;
+
+	while (frame) 
+	{
+		next = frame->next;
+		litews_socket_release_send_frame(s, frame);
+		frame = next;
+	}
+	while ((frame = litews_socket_lane_pop(&s->send_ctrl_head, &s->send_ctrl_tail)) != NULL) 
+	{
+		litews_socket_release_send_frame(s, frame);
 	}
+	while ((frame = litews_socket_lane_pop(&s->send_prio_head, &s->send_prio_tail)) != NULL) 
+	{
+		litews_socket_release_send_frame(s, frame);
+	}
+	s->send_head = NULL;
+	s->send_tail = NULL;
+	s->send_in_message = litews_false;
+	s->send_count = 0;
+	s->send_bytes = 0;
 }
 
-litews_bool litews_socket_send_text_priv(litews_socket s, const char * text) 
+litews_bool litews_socket_send_text_priv(litews_socket s, const char * text, const litews_bool is_priority) 
 {
 	size_t len = text ? strlen(text) : 0;
 	_litews_frame * frame = NULL;
@@ -1643,37 +2254,145 @@ litews_bool litews_socket_send_text_priv(litews_socket s, const char * text)
 	frame->is_masked = litews_true;
 	frame->opcode = litews_opcode_text_frame;
 	litews_frame_fill_with_send_data(frame, text, len);
-	litews_socket_append_send_frames(s, frame);
+	if (is_priority) 
+	{
+		litews_socket_lane_append(&s->send_prio_head, &s->send_prio_tail, frame);
+		litews_socket_count_send_frame(s, frame);
+	} 
+	else 
+	{
+		litews_socket_append_send_frames(s, frame);
+	}
 
 	return litews_true;
 }
 
+static litews_opcode litews_socket_bin_opcode(int flag) 
+{
+	return (flag == litews_frame_start || flag == litews_frame_one) ? litews_opcode_binary_frame : litews_opcode_continuation;
+}
+
+// the rest of a message cut by a reconnect goes nowhere, the new link never saw its start
+static litews_bool litews_socket_drop_cut_message(litews_socket s, int flag) 
+{
+	const litews_bool is_cut = (s->send_cut_message && litews_socket_bin_opcode(flag) == litews_opcode_continuation) ? litews_true : litews_false;
+
+	s->send_user_in_message = (flag == litews_frame_start || flag == litews_frame_continue) ? litews_true : litews_false;
+	if (flag != litews_frame_continue) 
+	{
+		s->send_cut_message = litews_false; // ended, or a new message begins
+	}
+	return is_cut;
+}
+
 litews_bool litews_socket_send_binary_priv(litews_socket s, const char * data, size_t length, int flag) 
 {
 	_litews_frame * frame = NULL;
-   
+
+	if (litews_socket_check_send_budget(s, length + LITEWS_FRAME_MAX_HEADER_SIZE) != litews_true) 
+	{
+		return litews_would_block;
+	}
+	if (litews_socket_drop_cut_message(s, flag)) 
+	{
+		return litews_true;
+	}
+
 	frame = litews_frame_create();
 	frame->is_masked = litews_true;
+	frame->opcode = litews_socket_bin_opcode(flag);
+	
+	litews_frame_fill_with_send_bin_data(frame, data, length, flag);
+	frame->queued_ms = litews_get_time_ms();
+	litews_socket_append_send_frames(s, frame);
+
+	return litews_true;
+}
+
+static _litews_send_buffer * litews_socket_send_buffer_by_data(litews_socket s, unsigned char * buffer) 
+{
+	int index = 0;
+
+	for (index = 0; s->send_buffers && index < LITEWS_SEND_BUFFER_COUNT; index++) 
+	{
+		if (s->send_buffers[index].data + LITEWS_FRAME_MAX_HEADER_SIZE == buffer) 
+		{
+			return &s->send_buffers[index];
+		}
+	}
+	return NULL;
+}
+
+unsigned char * litews_socket_alloc_send_buffer_priv(litews_socket s, size_t * capacity) 
+{
+	int index = 0;
+
+	if (!s->send_buffers) 
+	{
+		s->send_buffers = (_litews_send_buffer *)litews_malloc_zero(sizeof(_litews_send_buffer) * LITEWS_SEND_BUFFER_COUNT);
+		if (!s->send_buffers) 
+		{
+			return NULL;
+		}
+	}
+
+	for (index = 0; index < LITEWS_SEND_BUFFER_COUNT; index++) 
+	{
+		if (!s->send_buffers[index].is_used) 
+		{
+			s->send_buffers[index].is_used = litews_true;
+			if (capacity) 
+			{
+				*capacity = LITEWS_SEND_BUFFER_SIZE;
+			}
+			return s->send_buffers[index].data + LITEWS_FRAME_MAX_HEADER_SIZE;
+		}
+	}
+	return NULL; // all buffers are queued, caller falls back to 'litews_socket_send_binary'
+}
+
+litews_bool litews_socket_send_binary_buffer_priv(litews_socket s, unsigned char * buffer, size_t length, int flag) 
+{
+	_litews_send_buffer * send_buffer = litews_socket_send_buffer_by_data(s, buffer);
+	_litews_frame * frame = NULL;
 
-	if(flag == litews_frame_start)
+	if (!send_buffer || !send_buffer->is_used || length > LITEWS_SEND_BUFFER_SIZE) 
 	{
-        frame->opcode = litews_opcode_binary_frame;
+		return litews_false;
 	}
-	else if(flag == litews_frame_continue)
+	if (litews_socket_check_send_budget(s, length + LITEWS_FRAME_MAX_HEADER_SIZE) != litews_true) 
 	{
-	    frame->opcode = litews_opcode_continuation;
+		return litews_would_block;
 	}
-	else if(flag == litews_frame_end)
+	if (litews_socket_drop_cut_message(s, flag)) 
 	{
-	    frame->opcode = litews_opcode_continuation;
+		send_buffer->is_used = litews_false;
+		return litews_true;
 	}
-	
-	litews_frame_fill_with_send_bin_data(frame, data, length, flag);
+
+	frame = &send_buffer->frame;
+	litews_frame_init(frame);
+	frame->is_borrowed = litews_true;
+	frame->is_masked = litews_true;
+	frame->opcode = litews_socket_bin_opcode(flag);
+
+	litews_frame_fill_with_send_bin_buffer(frame, buffer, length, flag);
+	frame->queued_ms = litews_get_time_ms();
 	litews_socket_append_send_frames(s, frame);
 
 	return litews_true;
 }
 
+void litews_socket_free_send_buffer_priv(litews_socket s, unsigned char * buffer) 
+{
+	_litews_send_buffer * send_buffer = litews_socket_send_buffer_by_data(s, buffer);
+
+	if (send_buffer) 
+	{
+		send_buffer->is_used = litews_false;
+	}
+}
+
 void litews_socket_delete_all_frames_in_list(_litews_list * list_with_frames) 
 {
     _litews_frame * frame = NULL;
@@ -1,6 +1,9 @@
 
 #include "litewebsocket.h"
 #include "litews_socket.h"
+#include "litews_event.h"
+#include "litews_dns.h"
+#include "litews_transport.h"
 #include "litews_memory.h"
 #include "litews_string.h"
 #include <assert.h>
@@ -63,17 +66,26 @@ void litews_socket_disconnect_and_release(litews_socket socket) {
 	}
 	
 	litews_mutex_lock(socket->work_mutex);
+	socket->is_released = litews_true;
 
-	litews_socket_delete_all_frames_in_list(socket->send_frames);
-	litews_list_delete_clean(&socket->send_frames);
+	litews_mutex_lock(socket->send_mutex);
+	litews_socket_delete_send_frames(socket);
+	litews_mutex_unlock(socket->send_mutex);
 
 	if (socket->is_connected) { // connected in loop
 		LOGD_LITEWS("send socket command COMMAND DISCONNECT");
 		socket->command = COMMAND_DISCONNECT;
+		litews_event_wakeup(socket);
+		litews_mutex_unlock(socket->work_mutex);
+	} else if (socket->work_thread && socket->reconnect_min_ms > 0 && socket->stats.connects > 0) { // between reconnect attempts
+		LOGD_LITEWS("send socket command COMMAND INFORM DISCONNECTED");
+		socket->command = COMMAND_INFORM_DISCONNECTED; // on_connected was called, so on_disconnected is too
+		litews_event_wakeup(socket);
 		litews_mutex_unlock(socket->work_mutex);
 	} else if (socket->work_thread) { // disconnected in loop
 		LOGD_LITEWS("send socket command COMMAND END");
 		socket->command = COMMAND_END;
+		litews_event_wakeup(socket);
 		litews_mutex_unlock(socket->work_mutex);
 	} else if (socket->command != COMMAND_END) {
 		// not in loop
@@ -89,7 +101,19 @@ litews_bool litews_socket_send_text(litews_socket socket, const char * text)
 	if (socket) 
 	{
 		litews_mutex_lock(socket->send_mutex);
-		r = litews_socket_send_text_priv(socket, text);
+		r = litews_socket_send_text_priv(socket, text, litews_false);
+		litews_mutex_unlock(socket->send_mutex);
+	}
+	return r;
+}
+
+litews_bool litews_socket_send_text_priority(litews_socket socket, const char * text) 
+{
+	litews_bool r = litews_false;
+	if (socket) 
+	{
+		litews_mutex_lock(socket->send_mutex);
+		r = litews_socket_send_text_priv(socket, text, litews_true);
 		litews_mutex_unlock(socket->send_mutex);
 	}
 	return r;
@@ -107,6 +131,80 @@ litews_bool litews_socket_send_binary(litews_socket socket, const unsigned char
 	return r;
 }
 
+void litews_socket_set_send_queue_limit(litews_socket socket, int max_bytes) 
+{
+	if (socket && max_bytes > 0) 
+	{
+		litews_mutex_lock(socket->send_mutex);
+		socket->send_bytes_limit = (size_t)max_bytes;
+		litews_mutex_unlock(socket->send_mutex);
+	}
+}
+
+void litews_socket_set_send_batch(litews_socket socket, int max_bytes) 
+{
+	if (socket) 
+	{
+		litews_mutex_lock(socket->work_mutex);
+		socket->send_batch_size = max_bytes > 0 ? (size_t)max_bytes : 0; // takes effect with the next empty batch
+		litews_mutex_unlock(socket->work_mutex);
+	}
+}
+
+void litews_socket_set_send_pacing(litews_socket socket, int bytes_per_sec, int burst_bytes) 
+{
+	if (socket) 
+	{
+		litews_mutex_lock(socket->send_mutex);
+		socket->pace_rate = bytes_per_sec > 0 ? (unsigned int)bytes_per_sec : 0;
+		socket->pace_burst = burst_bytes > 0 ? (unsigned int)burst_bytes : 0;
+		socket->pace_credit = (long long)socket->pace_burst * 1000; // starts with a full bucket
+		socket->pace_at_ms = litews_get_time_ms();
+		socket->pace_waiting = litews_false;
+		litews_mutex_unlock(socket->send_mutex);
+		litews_event_wakeup(socket); // frames held back may go now
+	}
+}
+
+unsigned char * litews_socket_alloc_send_buffer(litews_socket socket, int * capacity) 
+{
+	unsigned char * buffer = NULL;
+	size_t size = 0;
+	if (socket) 
+	{
+		litews_mutex_lock(socket->send_mutex);
+		buffer = litews_socket_alloc_send_buffer_priv(socket, &size);
+		litews_mutex_unlock(socket->send_mutex);
+	}
+	if (capacity) 
+	{
+		*capacity = buffer ? (int)size : 0;
+	}
+	return buffer;
+}
+
+litews_bool litews_socket_send_binary_buffer(litews_socket socket, unsigned char * buffer, int length, int flag) 
+{
+	litews_bool r = litews_false;
+	if (socket && buffer && length >= 0) 
+	{
+		litews_mutex_lock(socket->send_mutex);
+		r = litews_socket_send_binary_buffer_priv(socket, buffer, (size_t)length, flag);
+		litews_mutex_unlock(socket->send_mutex);
+	}
+	return r;
+}
+
+void litews_socket_free_send_buffer(litews_socket socket, unsigned char * buffer) 
+{
+	if (socket && buffer) 
+	{
+		litews_mutex_lock(socket->send_mutex);
+		litews_socket_free_send_buffer_priv(socket, buffer);
+		litews_mutex_unlock(socket->send_mutex);
+	}
+}
+
 #if !defined(LITEWS_OS_WINDOWS)
 void litews_socket_handle_sigpipe(int signal_number) {
 	printf("\nliblitews handle sigpipe %i", signal_number);
@@ -125,9 +223,14 @@ void litews_socket_check_info(const char * info) {
 
 litews_socket litews_socket_create(void) 
 {
-	litews_socket s = (litews_socket)litews_malloc_zero(sizeof(struct litews_socket_struct));
+	litews_socket s = NULL;
+
+	// process wide caches, set up here on the caller's thread rather than by the first work thread
+	litews_mem_init();
+	s = (litews_socket)litews_malloc_zero(sizeof(struct litews_socket_struct));
 	if (!s) 
 	{
+		litews_mem_release();
 		return NULL;
 	}
 	
@@ -142,10 +245,25 @@ litews_socket litews_socket_create(void)
 #endif
 
 	s->port = -1;
+	s->transport = litews_transport_default();
 	s->socket = LITEWS_INVALID_SOCKET;
+	s->wakeup_socket = LITEWS_INVALID_SOCKET;
+	s->send_bytes_limit = LITEWS_SEND_QUEUE_MAX_BYTES;
+	s->send_batch_size = LITEWS_SEND_BATCH_SIZE;
+	s->keepalive_idle_ms = LITEWS_KEEPALIVE_IDLE_MS;
+	s->keepalive_pong_timeout_ms = LITEWS_KEEPALIVE_PONG_TIMEOUT_MS;
+	s->keepalive_max_missed = LITEWS_KEEPALIVE_MAX_MISSED;
 	s->command = COMMAND_NONE;
 	s->work_mutex = litews_mutex_create_recursive();
 	s->send_mutex = litews_mutex_create_recursive();
+	litews_dns_init();
+#ifdef SUPPORT_MBEDTLS
+	litews_tls_init();
+#endif
+#ifdef SUPPORT_REDUCE_MEM
+	litews_ring_init(&s->recv_ring, s->received_buffer, SSL_REC_BUFFER_SIZE);
+	litews_frame_parser_reset(&s->recv_parser);
+#endif
 	static const char * info = "liblitews ver: " TO_STRING(LITEWS_VERSION_MAJOR) "." TO_STRING(LITEWS_VERSION_MINOR) "." TO_STRING(LITEWS_VERSION_PATCH) "\n";
 	litews_socket_check_info(info);
 	return s;
@@ -154,8 +272,10 @@ litews_socket litews_socket_create(void)
 void litews_socket_delete(litews_socket s) 
 {
 	litews_socket_close(s);
+	litews_event_close(s);
 
 	litews_string_delete_clean(&s->sec_ws_accept);
+	litews_deflate_delete_clean(&s->deflate);
 
     #ifdef SUPPORT_REDUCE_MEM
     #else
@@ -164,15 +284,20 @@ void litews_socket_delete(litews_socket s)
 	s->received_len = 0;
 	#endif
 
-	litews_socket_delete_all_frames_in_list(s->send_frames);
-	litews_list_delete_clean(&s->send_frames);
+	litews_socket_delete_send_frames(s);
 	litews_socket_delete_all_frames_in_list(s->recvd_frames);
 	litews_list_delete_clean(&s->recvd_frames);
+#ifdef SUPPORT_REDUCE_MEM
+	litews_frame_delete_clean(&s->recv_message);
+#endif
+	litews_transport_pipe_delete(s);
 
 	litews_string_delete_clean(&s->scheme);
 	litews_string_delete_clean(&s->host);
 	litews_string_delete_clean(&s->path);
+#if defined(SUPPORT_MBEDTLS) || defined(SUPPORT_WOLFSSL) 
     litews_string_delete_clean(&s->client_cert);
+#endif
 
 	litews_string_delete_clean(&s->sec_ws_accept);
 
@@ -183,8 +308,11 @@ void litews_socket_delete(litews_socket s)
 	litews_free_clean(&s->received);
 	#endif
 	
-	litews_socket_delete_all_frames_in_list(s->send_frames);
-	litews_list_delete_clean(&s->send_frames);
+	litews_socket_delete_send_frames(s);
+	litews_free(s->send_buffers);
+	s->send_buffers = NULL;
+	litews_free(s->send_batch);
+	s->send_batch = NULL;
 	litews_socket_delete_all_frames_in_list(s->recvd_frames);
 	litews_list_delete_clean(&s->recvd_frames);
 
@@ -193,6 +321,8 @@ void litews_socket_delete(litews_socket s)
 
 	litews_free(s);
     s = NULL;
+
+	litews_mem_release(); // the last socket gives the cached blocks back
 }
 
 void litews_socket_set_url(litews_socket socket,
@@ -336,6 +466,121 @@ void litews_socket_set_on_received_bin(litews_socket socket, litews_on_socket_re
 	}
 }
 
+void litews_socket_set_recv_flow_control(litews_socket socket, litews_on_socket_bin_room room) {
+	if (socket) {
+		litews_mutex_lock(socket->work_mutex);
+		socket->bin_room = room;
+		litews_mutex_unlock(socket->work_mutex);
+		litews_event_wakeup(socket); // a dropped consumer no longer holds reading back
+	}
+}
+
+void litews_socket_recv_resume(litews_socket socket) {
+	if (socket) {
+		litews_event_wakeup(socket);
+	}
+}
+
+void litews_socket_set_transport(litews_socket socket, const litews_transport * transport) {
+	if (socket) {
+		litews_mutex_lock(socket->work_mutex);
+		if (socket->work_thread) {
+			LOGE_LITEWS("transport can't change once connecting");
+		} else {
+			socket->transport = transport ? transport : litews_transport_default();
+		}
+		litews_mutex_unlock(socket->work_mutex);
+	}
+}
+
+void litews_socket_set_pipe_peer(litews_socket socket, litews_on_pipe_written peer) {
+	if (socket) {
+		litews_mutex_lock(socket->work_mutex);
+		litews_transport_pipe_set_peer(socket, peer);
+		litews_mutex_unlock(socket->work_mutex);
+	}
+}
+
+litews_bool litews_socket_pipe_put(litews_socket socket, const void * data, const unsigned int length) {
+	return (socket && (data || length == 0)) ? litews_transport_pipe_put(socket, data, length) : litews_false;
+}
+
+void litews_socket_set_on_state_changed(litews_socket socket, litews_on_socket_state callback) {
+	if (socket) {
+		socket->on_state_changed = callback;
+	}
+}
+
+void litews_socket_set_auto_reconnect(litews_socket socket, int min_delay_ms, int max_delay_ms, litews_bool keep_queue) 
+{
+	if (socket) 
+	{
+		litews_mutex_lock(socket->work_mutex);
+		socket->reconnect_min_ms = min_delay_ms > 0 ? (unsigned int)min_delay_ms : 0;
+		socket->reconnect_max_ms = max_delay_ms > min_delay_ms ? (unsigned int)max_delay_ms : socket->reconnect_min_ms;
+		socket->reconnect_delay_ms = socket->reconnect_min_ms;
+		socket->reconnect_keep_queue = keep_queue;
+		litews_mutex_unlock(socket->work_mutex);
+	}
+}
+
+void litews_socket_set_deflate(litews_socket socket, int window_bits, litews_bool no_context_takeover) 
+{
+	if (socket) 
+	{
+		if (window_bits > 0 && window_bits < LITEWS_DEFLATE_MIN_WINDOW_BITS) 
+		{
+			window_bits = LITEWS_DEFLATE_MIN_WINDOW_BITS;
+		}
+		if (window_bits > LITEWS_DEFLATE_MAX_WINDOW_BITS) 
+		{
+			window_bits = LITEWS_DEFLATE_MAX_WINDOW_BITS;
+		}
+		litews_mutex_lock(socket->work_mutex);
+		socket->deflate_window_bits = window_bits > 0 ? window_bits : 0;
+		socket->deflate_no_context_takeover = no_context_takeover;
+		litews_mutex_unlock(socket->work_mutex);
+	}
+}
+
+void litews_socket_set_keepalive(litews_socket socket, int idle_ms, int pong_timeout_ms, int max_missed) 
+{
+	if (socket) 
+	{
+		litews_mutex_lock(socket->work_mutex);
+		socket->keepalive_idle_ms = idle_ms > 0 ? (unsigned int)idle_ms : 0;
+		socket->keepalive_pong_timeout_ms = pong_timeout_ms > 0 ? (unsigned int)pong_timeout_ms : LITEWS_KEEPALIVE_PONG_TIMEOUT_MS;
+		socket->keepalive_max_missed = max_missed > 0 ? (unsigned int)max_missed : LITEWS_KEEPALIVE_MAX_MISSED;
+		socket->keepalive_ceiling_ms = 0;
+		socket->keepalive_answered = 0;
+		litews_mutex_unlock(socket->work_mutex);
+	}
+}
+
+litews_bool litews_socket_get_stats(litews_socket socket, litews_socket_stats * stats) 
+{
+	unsigned long long delayed = 0;
+	int i = 0;
+
+	if (!socket || !stats) 
+	{
+		return litews_false;
+	}
+	// every counter is taken under 'send_mutex', a connect or TLS handshake in progress doesn't block this
+	litews_mutex_lock(socket->send_mutex);
+	AG_OS_MEMCPY(stats, &socket->stats, sizeof(litews_socket_stats));
+	stats->send_queue_frames = (unsigned int)socket->send_count;
+	stats->send_queue_bytes = (unsigned int)socket->send_bytes;
+	stats->rtt_avg_ms = stats->pongs_matched ? (unsigned int)(socket->rtt_sum_ms / stats->pongs_matched) : 0;
+	for (i = 0; i < LITEWS_RTT_BUCKETS; i++) 
+	{
+		delayed += stats->send_delay_histogram[i];
+	}
+	stats->send_delay_avg_ms = delayed ? (unsigned int)(socket->send_delay_sum_ms / delayed) : 0;
+	litews_mutex_unlock(socket->send_mutex);
+	return litews_true;
+}
+
 litews_bool litews_socket_is_connected(litews_socket socket) {
 	litews_bool r = litews_false;
 	if (socket) 
@@ -4,6 +4,8 @@
 
 #include <stdio.h>
 
+// monotonic milliseconds since boot, wraps around: compare differences only
+unsigned int litews_get_time_ms(void);
 
 #endif
 
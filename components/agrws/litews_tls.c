@@ -0,0 +1,610 @@
+
+#include "litewebsocket.h"
+#include "litews_tls.h"
+#include "litews_socket.h"
+#include "litews_transport.h"
+#include "litews_memory.h"
+#include "litews_string.h"
+#include "litews_log.h"
+
+#ifdef SUPPORT_MBEDTLS
+
+// one session is enough, every socket of the process talks to the same gateway,
+// lives in RAM only: a ticket and its master secret don't fit the 64 byte flash values
+static mbedtls_ssl_session _litews_tls_session;
+static char * _litews_tls_session_host = NULL; // null while no session is kept
+static int _litews_tls_session_port = 0;
+static AG_MUTEX_T _litews_tls_mutex = NULL;
+
+void litews_tls_init(void) 
+{
+    if (!_litews_tls_mutex) 
+    {
+        ag_os_task_mutex_init(&_litews_tls_mutex);
+    }
+}
+
+static void litews_tls_lock(void) 
+{
+    ag_os_task_mutex_lock(&_litews_tls_mutex);
+}
+
+static void litews_tls_unlock(void) 
+{
+    ag_os_task_mutex_unlock(&_litews_tls_mutex);
+}
+
+static _litews_tls_context * _litews_tls_contexts = NULL;
+
+static void litews_tls_debug(void * ctx, int level, const char * file, int line, const char * str) 
+{
+    ((void) level);
+    fprintf((FILE *) ctx, "%s:%04d: %s", file, line, str);
+    fflush((FILE *) ctx);
+}
+
+static int litews_tls_random(void * p_rng, unsigned char * output, size_t output_len) 
+{
+    _litews_tls_context * ctx = (_litews_tls_context *)p_rng;
+    int ret = 0;
+
+    litews_mutex_lock(ctx->rng_mutex);
+    ret = mbedtls_ctr_drbg_random(&ctx->ctr_drbg, output, output_len);
+    litews_mutex_unlock(ctx->rng_mutex);
+    return ret;
+}
+
+static void litews_tls_context_delete(_litews_tls_context * ctx) 
+{
+    mbedtls_ssl_config_free(&ctx->ssl_conf);
+    mbedtls_x509_crt_free(&ctx->cacert);
+    mbedtls_ctr_drbg_free(&ctx->ctr_drbg);
+    mbedtls_entropy_free(&ctx->entropy);
+    litews_mutex_delete(ctx->rng_mutex);
+    litews_string_delete(ctx->ca_pem);
+    litews_free(ctx);
+}
+
+static _litews_tls_context * litews_tls_context_create(const char * ca_pem) 
+{
+    const char * pers = "https";
+    int ret = 0;
+    _litews_tls_context * ctx = (_litews_tls_context *)litews_malloc_zero(sizeof(_litews_tls_context));
+
+    if (!ctx) 
+    {
+        LOGE_LITEWS("tls context malloc error");
+        return NULL;
+    }
+    mbedtls_ssl_config_init(&ctx->ssl_conf);
+    mbedtls_entropy_init(&ctx->entropy);
+    mbedtls_ctr_drbg_init(&ctx->ctr_drbg);
+    mbedtls_x509_crt_init(&ctx->cacert);
+    ctx->rng_mutex = litews_mutex_create_recursive();
+
+    if ((ret = mbedtls_ctr_drbg_seed(&ctx->ctr_drbg, mbedtls_entropy_func, &ctx->entropy, (const unsigned char *)pers, strlen(pers))) != 0) 
+    {
+        LOGE_LITEWS("mbedtls_ctr_drbg_seed() failed, value:-0x%x.", -ret);
+        goto error;
+    }
+
+    if (ca_pem) 
+    {
+        if ((ret = mbedtls_x509_crt_parse(&ctx->cacert, (const unsigned char *)ca_pem, strlen(ca_pem) + 1)) < 0) 
+        {
+            LOGE_LITEWS("mbedtls_x509_crt_parse returned -0x%x", -ret);
+            goto error;
+        }
+        ctx->ca_pem = litews_string_copy(ca_pem);
+        if (!ctx->ca_pem) 
+        {
+            goto error;
+        }
+    }
+
+    if ((ret = mbedtls_ssl_config_defaults(&ctx->ssl_conf, 
+                                           MBEDTLS_SSL_IS_CLIENT, 
+                                           MBEDTLS_SSL_TRANSPORT_STREAM, 
+                                           MBEDTLS_SSL_PRESET_DEFAULT)) != 0) 
+    {
+        LOGE_LITEWS("mbedtls_ssl_config_defaults failed value: -0x%x", -ret);
+        goto error;
+    }
+    mbedtls_ssl_conf_authmode(&ctx->ssl_conf, ca_pem ? MBEDTLS_SSL_VERIFY_REQUIRED : MBEDTLS_SSL_VERIFY_NONE);
+    mbedtls_ssl_conf_ca_chain(&ctx->ssl_conf, &ctx->cacert, NULL);
+    mbedtls_ssl_conf_rng(&ctx->ssl_conf, litews_tls_random, ctx);
+    mbedtls_ssl_conf_dbg(&ctx->ssl_conf, litews_tls_debug, stdout);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    mbedtls_ssl_conf_session_tickets(&ctx->ssl_conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+    return ctx;
+
+error:
+    litews_tls_context_delete(ctx);
+    return NULL;
+}
+
+static void litews_tls_context_trim_priv(void) 
+{
+    _litews_tls_context ** link = &_litews_tls_contexts;
+
+    while (*link) 
+    {
+        _litews_tls_context * ctx = *link;
+        if (ctx->refs == 0) 
+        {
+            *link = ctx->next;
+            litews_tls_context_delete(ctx);
+        }
+        else 
+        {
+            link = &ctx->next;
+        }
+    }
+}
+
+_litews_tls_context * litews_tls_context_acquire(const char * ca_pem) 
+{
+    _litews_tls_context * ctx = NULL;
+
+    litews_tls_lock();
+    for (ctx = _litews_tls_contexts; ctx; ctx = ctx->next) 
+    {
+        if ((!ctx->ca_pem && !ca_pem) || 
+            (ctx->ca_pem && ca_pem && strcmp(ctx->ca_pem, ca_pem) == 0)) 
+        {
+            break;
+        }
+    }
+    if (!ctx) 
+    {
+        litews_tls_context_trim_priv(); // a different CA, the old unused one goes
+        ctx = litews_tls_context_create(ca_pem);
+        if (ctx) 
+        {
+            ctx->next = _litews_tls_contexts;
+            _litews_tls_contexts = ctx;
+        }
+    }
+    if (ctx) 
+    {
+        ctx->refs++;
+    }
+    litews_tls_unlock();
+    return ctx;
+}
+
+void litews_tls_context_release(_litews_tls_context * ctx) 
+{
+    if (!ctx) 
+    {
+        return;
+    }
+    litews_tls_lock();
+    if (ctx->refs > 0) 
+    {
+        ctx->refs--;
+    }
+    litews_tls_unlock();
+}
+
+void litews_tls_context_trim(void) 
+{
+    litews_tls_lock();
+    litews_tls_context_trim_priv();
+    litews_tls_unlock();
+}
+
+static litews_bool litews_tls_session_match(const char * host, const int port) 
+{
+    return (_litews_tls_session_host && host && 
+            _litews_tls_session_port == port && 
+            strcmp(_litews_tls_session_host, host) == 0) ? litews_true : litews_false;
+}
+
+static void litews_tls_session_forget(void) 
+{
+    if (_litews_tls_session_host) 
+    {
+        mbedtls_ssl_session_free(&_litews_tls_session);
+        litews_string_delete_clean(&_litews_tls_session_host);
+        _litews_tls_session_port = 0;
+    }
+}
+
+litews_bool litews_tls_session_load(mbedtls_ssl_context * ssl_ctx, const char * host, const int port) 
+{
+    litews_bool offered = litews_false;
+    int ret = 0;
+
+    litews_tls_lock();
+    if (litews_tls_session_match(host, port)) 
+    {
+        ret = mbedtls_ssl_set_session(ssl_ctx, &_litews_tls_session);
+        if (ret == 0) 
+        {
+            offered = litews_true;
+        }
+        else 
+        {
+            LOGE_LITEWS("mbedtls_ssl_set_session failed -0x%x", -ret);
+            litews_tls_session_forget();
+        }
+    }
+    litews_tls_unlock();
+    return offered;
+}
+
+litews_bool litews_tls_session_save(const mbedtls_ssl_context * ssl_ctx, const char * host, const int port) 
+{
+    litews_bool resumed = litews_false;
+    mbedtls_ssl_session session;
+    int ret = 0;
+
+    if (!host) 
+    {
+        return litews_false;
+    }
+
+    mbedtls_ssl_session_init(&session);
+    ret = mbedtls_ssl_get_session(ssl_ctx, &session);
+    if (ret != 0) 
+    {
+        LOGE_LITEWS("mbedtls_ssl_get_session failed -0x%x", -ret);
+        mbedtls_ssl_session_free(&session);
+        return litews_false;
+    }
+
+    litews_tls_lock();
+    // only a resumed handshake ends with the master secret of the kept session,
+    // the session id alone doesn't tell as clients offering a ticket send a random one
+    if (litews_tls_session_match(host, port) && 
+        memcmp(session.master, _litews_tls_session.master, sizeof(session.master)) == 0) 
+    {
+        resumed = litews_true;
+    }
+    litews_tls_session_forget();
+    _litews_tls_session_host = litews_string_copy(host);
+    if (_litews_tls_session_host) 
+    {
+        _litews_tls_session = session; // ownership of the ticket and peer cert moves here
+        _litews_tls_session_port = port;
+    }
+    else 
+    {
+        mbedtls_ssl_session_free(&session);
+    }
+    litews_tls_unlock();
+    return resumed;
+}
+
+void litews_tls_session_clear(void) 
+{
+    litews_tls_lock();
+    litews_tls_session_forget();
+    litews_tls_unlock();
+}
+
+static void litews_tls_free(litews_socket s) 
+{
+    mbedtls_net_free(&s->ssl->net_ctx);
+    mbedtls_ssl_free(&s->ssl->ssl_ctx);
+    litews_tls_context_release(s->ssl->tls); // stays set up for the next connect
+
+    litews_free(s->ssl);
+    s->ssl = NULL;
+}
+
+static litews_bool litews_tls_connect(litews_socket s) 
+{
+    int ret = 0;
+    uint32_t flags;
+    litews_bool session_offered = litews_false;
+    _litews_ssl *ssl = NULL;
+
+    s->ssl = litews_malloc_zero(sizeof(_litews_ssl));
+    if(!s->ssl)
+    {
+        LOGE_LITEWS("mbedtls Memory malloc error");
+        return litews_false;
+    }
+    ssl = s->ssl;
+    
+    //mbedtls_debug_set_threshold(1); //enable mbedtls debug; set debug level = 3; 
+    
+    mbedtls_net_init(&ssl->net_ctx);
+    mbedtls_ssl_init(&ssl->ssl_ctx);
+
+    /* 
+        0. RNG, config and CA chain, seeded and parsed by the first connect only
+    */
+    ssl->tls = litews_tls_context_acquire(s->client_cert);
+    if (!ssl->tls)
+    {
+        ret = -1;
+        goto exit;
+    }
+
+     /* 
+         2. Start the connection
+     */
+    ssl->net_ctx.fd = litews_transport_tcp_open(s);
+    if (ssl->net_ctx.fd == LITEWS_INVALID_SOCKET)
+    {
+        ret = -1;
+        goto exit;
+    }
+
+    LOGD_LITEWS("Socket Connected.");
+
+    s->socket = ssl->net_ctx.fd;
+
+    /* 
+         3. Setup stuff
+    */  
+
+    if ((ret = mbedtls_ssl_setup(&ssl->ssl_ctx, &ssl->tls->ssl_conf)) != 0) 
+    {
+        LOGE_LITEWS("mbedtls_ssl_setup() failed, value:-0x%x.", -ret);
+        goto exit;
+    }
+
+    if((ret = mbedtls_ssl_set_hostname(&ssl->ssl_ctx, s->host)) != 0)
+    {
+        LOGE_LITEWS( "failed\n  ! mbedtls_ssl_set_hostname returned %d\n\n", ret );
+        goto exit;
+
+    }
+
+    mbedtls_ssl_set_bio(&ssl->ssl_ctx, &ssl->net_ctx, mbedtls_net_send, mbedtls_net_recv, NULL);
+
+    // a reconnect resumes the previous session: no certificate chain check and one round trip less
+    session_offered = litews_tls_session_load(&ssl->ssl_ctx, s->host, s->port);
+
+    /* 
+         4. handshake
+    */
+    LOGD_LITEWS("Performing the SSL/TLS handshake...");
+
+    while ((ret = mbedtls_ssl_handshake(&ssl->ssl_ctx)) != 0)
+    {
+        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+        {
+            LOGE_LITEWS("[SSL]mbedtls_ssl_handshake() failed, ret:-0x%x.", -ret);
+            if (session_offered) 
+            {
+                litews_tls_session_clear(); // the next attempt does a full handshake
+            }
+            goto exit;
+        }
+        litews_thread_sleep(100);
+    }
+
+    mbedtls_net_set_nonblock(&ssl->net_ctx);
+
+    /* 
+         4. Verify the server certificate
+    */
+    LOGD_LITEWS("Verifying peer X.509 certificate...");
+    if ((flags = mbedtls_ssl_get_verify_result(&ssl->ssl_ctx)) != 0)
+    {
+        /* In real life, we probably want to close connection if ret != 0 */
+        LOGE_LITEWS("Failed to verify peer certificate!");
+        char verfy_buff[512];
+        mbedtls_x509_crt_verify_info(verfy_buff, sizeof(verfy_buff), "  ! ", flags);
+        LOGE_LITEWS("[SSL] %s", verfy_buff);
+        // resuming would skip the certificate check, so a session of an unverified peer is not kept
+        litews_tls_session_clear();
+    }
+    else 
+    {
+        LOGD_LITEWS("Certificate verified OK");
+        if (litews_tls_session_save(&ssl->ssl_ctx, s->host, s->port)) 
+        {
+            LOGD_LITEWS("TLS session resumed");
+        }
+    }
+
+exit:
+    if(ret != 0) 
+    {
+        LOGE_LITEWS("[SSL]ret=0x%x.", ret);
+        litews_tls_free(s);
+        s->socket = LITEWS_INVALID_SOCKET;
+        return litews_false;
+    }
+    return litews_true;
+}
+
+static int litews_tls_read(litews_socket s, unsigned char * buffer, const size_t size) 
+{
+    const int len = mbedtls_ssl_read(&s->ssl->ssl_ctx, buffer, size);
+
+    if (len > 0) 
+    {
+        return len;
+    }
+    if (len == MBEDTLS_ERR_SSL_WANT_READ || len == MBEDTLS_ERR_SSL_WANT_WRITE) 
+    {
+        return 0;
+    }
+    // 0 and close_notify are the peer closing the link, anything else broke it
+    LOGE_LITEWS("[SSL]read ret=-0x%x", -len);
+    return -1;
+}
+
+static int litews_tls_write(litews_socket s, const unsigned char * data, const size_t size) 
+{
+    const int sended = mbedtls_ssl_write(&s->ssl->ssl_ctx, data, size);
+
+    if (sended == MBEDTLS_ERR_SSL_WANT_WRITE || sended == MBEDTLS_ERR_SSL_WANT_READ) 
+    {
+        return 0; // same bytes have to be offered again
+    }
+    if (sended > 0) 
+    {
+        return sended;
+    }
+    litews_socket_check_write_error(s, -1);
+    return -1;
+}
+
+static int litews_tls_poll(litews_socket s) 
+{
+    return (int)mbedtls_ssl_get_bytes_avail(&s->ssl->ssl_ctx);
+}
+
+static void litews_tls_close(litews_socket s) 
+{
+    mbedtls_ssl_close_notify(&s->ssl->ssl_ctx);
+    litews_tls_free(s); // closes the socket
+}
+
+static const litews_transport k_litews_transport_tls = 
+{
+    "mbedtls",
+    litews_tls_connect,
+    litews_tls_read,
+    litews_tls_write,
+    litews_tls_poll,
+    litews_tls_close
+};
+
+#elif defined(SUPPORT_WOLFSSL)
+
+static litews_bool litews_tls_connect(litews_socket s) 
+{
+    int ret = 0;
+    const litews_socket_t sock = litews_transport_tcp_open(s);
+
+    if (sock == LITEWS_INVALID_SOCKET) 
+    {
+        return litews_false;
+    }
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+
+    ret = wolfSSL_Init(); //init wolfssl
+    if(ret != WOLFSSL_SUCCESS)
+    {
+        LOGE_LITEWS("wolfSSL_Init failed!");
+        goto failed1;
+    }
+    s->wolf_ctx = wolfSSL_CTX_new(wolfTLSv1_2_client_method());
+    if(s->wolf_ctx != NULL)
+    {   
+        LOGV_LITEWS("cert lens = %s", (s->client_cert));
+        ret = wolfSSL_CTX_load_verify_buffer(s->wolf_ctx, (unsigned char*)s->client_cert, strlen(s->client_cert), SSL_FILETYPE_PEM);
+        if (WOLFSSL_SUCCESS != ret) 
+        {
+            LOGE_LITEWS("Loading the CA root certificate failed...");
+            goto failed2;
+        }
+        wolfSSL_CTX_set_verify(s->wolf_ctx, WOLFSSL_VERIFY_PEER, NULL);
+    }
+    else
+    {
+        LOGE_LITEWS("wolfssl context creat failed!");
+        goto failed2;
+    }
+    s->wolf_ssl = wolfSSL_new(s->wolf_ctx);
+
+    if(s->wolf_ssl != NULL)
+    {
+        wolfSSL_set_fd(s->wolf_ssl, sock);
+        ret = 0;
+        while((ret != WOLFSSL_SUCCESS))
+        {
+            ret = wolfSSL_connect(s->wolf_ssl);
+            litews_thread_sleep(100);
+        }
+    }
+    else
+    {
+        LOGE_LITEWS("wolfssl object creat failed");
+        goto failed2;
+    }
+    
+    LOGD_LITEWS("SOCKET CONNECT");
+    s->socket = sock;
+    return litews_true;
+
+    //wolfssl failed
+failed2: wolfSSL_CTX_free(s->wolf_ctx);
+    s->wolf_ctx = NULL;
+failed1: wolfSSL_Cleanup();
+    close(sock);
+    return litews_false;
+}
+
+static int litews_tls_read(litews_socket s, unsigned char * buffer, const size_t size) 
+{
+    const int len = wolfSSL_read(s->wolf_ssl, buffer, (int)size);
+    int error_number = 0;
+
+    if (len > 0) 
+    {
+        return len;
+    }
+    error_number = wolfSSL_get_error(s->wolf_ssl, len);
+    if (error_number == SSL_ERROR_WANT_READ || error_number == SSL_ERROR_WANT_WRITE) 
+    {
+        return 0;
+    }
+    LOGE_LITEWS("[SSL]read error=%d", error_number);
+    return -1;
+}
+
+static int litews_tls_write(litews_socket s, const unsigned char * data, const size_t size) 
+{
+    const int sended = wolfSSL_write(s->wolf_ssl, data, (int)size);
+    int error_number = 0;
+
+    if (sended > 0) 
+    {
+        return sended;
+    }
+    error_number = wolfSSL_get_error(s->wolf_ssl, sended);
+    if (error_number == SSL_ERROR_WANT_WRITE || error_number == SSL_ERROR_WANT_READ) 
+    {
+        return 0;
+    }
+    litews_socket_check_write_error(s, -1);
+    return -1;
+}
+
+static int litews_tls_poll(litews_socket s) 
+{
+    return wolfSSL_pending(s->wolf_ssl);
+}
+
+static void litews_tls_close(litews_socket s) 
+{
+    //wolfSSL_shutdown(s->wolf_ssl);
+    wolfSSL_free(s->wolf_ssl);
+    s->wolf_ssl = NULL;
+    wolfSSL_CTX_free(s->wolf_ctx);
+    s->wolf_ctx = NULL;
+    wolfSSL_Cleanup(); // counted, pairs with the wolfSSL_Init of this connection
+    close(s->socket);
+}
+
+static const litews_transport k_litews_transport_tls = 
+{
+    "wolfssl",
+    litews_tls_connect,
+    litews_tls_read,
+    litews_tls_write,
+    litews_tls_poll,
+    litews_tls_close
+};
+
+#endif
+
+const litews_transport * litews_transport_tls(void) 
+{
+#if defined(SUPPORT_MBEDTLS) || defined(SUPPORT_WOLFSSL)
+    return &k_litews_transport_tls;
+#else
+    return NULL;
+#endif
+}
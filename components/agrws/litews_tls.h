@@ -0,0 +1,47 @@
+#ifndef __LITEWS_TLS_H__
+#define __LITEWS_TLS_H__ 1
+
+#include "litewebsocket.h"
+#include "aligenie_libs.h"
+
+#ifdef SUPPORT_MBEDTLS
+
+// client config, DRBG and parsed CA chain, set up once and shared by every connection
+// with the same CA, only the mbedtls_ssl_context is per connection
+typedef struct _litews_tls_context_struct 
+{
+    mbedtls_ssl_config ssl_conf;
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context ctr_drbg;
+    litews_mutex rng_mutex; // handshakes of several sockets draw from one DRBG
+    mbedtls_x509_crt cacert;
+    char * ca_pem; // CA chain the context was made for, null - peer is not verified
+    unsigned int refs; // connections using it, an unused context is kept for the next connect
+    struct _litews_tls_context_struct * next;
+} _litews_tls_context;
+
+// set up the lock of the shared contexts and session, called by litews_socket_create
+void litews_tls_init(void);
+
+// shared context for 'ca_pem' (may be null), created on first use, null on error
+_litews_tls_context * litews_tls_context_acquire(const char * ca_pem);
+
+void litews_tls_context_release(_litews_tls_context * ctx);
+
+// free the contexts no connection uses
+void litews_tls_context_trim(void);
+
+// offer the session kept from the last connection to 'host':'port' before the handshake,
+// returns litews_true if one was offered
+litews_bool litews_tls_session_load(mbedtls_ssl_context * ssl_ctx, const char * host, const int port);
+
+// keep the session of a finished handshake for the next connect,
+// returns litews_true if the handshake resumed the kept session
+litews_bool litews_tls_session_save(const mbedtls_ssl_context * ssl_ctx, const char * host, const int port);
+
+// forget the kept session, e.g. after a handshake that offered it failed
+void litews_tls_session_clear(void);
+
+#endif
+
+#endif
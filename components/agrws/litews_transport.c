@@ -0,0 +1,318 @@
+#include "litewebsocket.h"
+#include "litews_socket.h"
+#include "litews_transport.h"
+#include "litews_event.h"
+#include "litews_dns.h"
+#include "litews_memory.h"
+#include "litews_log.h"
+
+#include <errno.h>
+
+#define LITEWS_PIPE_MIN_SIZE 4096
+
+// bytes the peer put for the socket to read, the peer gets what the socket writes at once
+typedef struct _litews_pipe_struct
+{
+    litews_mutex mutex; // 'litews_socket_pipe_put' may run on any thread
+    litews_on_pipe_written peer;
+    unsigned char * data;
+    size_t size; // capacity of 'data'
+    size_t head; // offset of the first unread byte
+    size_t len;
+    litews_bool is_open; // between connect and close, puts are dropped otherwise
+} _litews_pipe;
+
+litews_socket_t litews_transport_tcp_open(litews_socket s)
+{
+    litews_socket_t fd = LITEWS_INVALID_SOCKET;
+    int retry_number = 0;
+
+    LOGD_LITEWS("Connecting to %s:%d...", s->host, s->port);
+
+    // a cached name and racing its addresses, a reconnect waits for the fastest address only
+    while (++retry_number < LITEWS_CONNECT_ATTEMPS)
+    {
+        _litews_dns_addr addrs[LITEWS_DNS_MAX_ADDRS];
+        const int count = litews_dns_resolve(s->host, s->port, addrs, LITEWS_DNS_MAX_ADDRS);
+
+        if (count > 0)
+        {
+            fd = litews_dns_connect(addrs, count, LITEWS_CONNECT_TIMEOUT_MS);
+            if (fd != LITEWS_INVALID_SOCKET)
+            {
+                int nodelay = 1;
+
+                litews_socket_set_option(fd, SO_KEEPALIVE, 1); // Periodically test if connection is alive
+                // writes are batched already, Nagle would only hold a pong or a priority text
+                // behind the unacknowledged segment before it, a delayed ACK away
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char *)&nodelay, sizeof(nodelay));
+                return fd;
+            }
+            LOGE_LITEWS("no address of %s answered", s->host);
+            litews_dns_forget(s->host, s->port); // may have moved, resolve again
+        }
+        litews_thread_sleep(LITEWS_CONNECT_RETRY_DELAY);
+    }
+    return LITEWS_INVALID_SOCKET;
+}
+
+static litews_bool litews_transport_tcp_connect(litews_socket s)
+{
+#if defined(LITEWS_OS_WINDOWS)
+    unsigned long iMode = 1; // If iMode != 0, non-blocking mode is enabled.
+#endif
+    const litews_socket_t fd = litews_transport_tcp_open(s);
+
+    if (fd == LITEWS_INVALID_SOCKET)
+    {
+        return litews_false;
+    }
+#if defined(LITEWS_OS_WINDOWS)
+    ioctlsocket(fd, FIONBIO, &iMode);
+#else
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+#endif
+    s->socket = fd;
+    return litews_true;
+}
+
+static int litews_transport_tcp_read(litews_socket s, unsigned char * buffer, const size_t size)
+{
+    const int len = (int)recv(s->socket, (char *)buffer, (int)size, 0);
+    int error_number = -1;
+
+    if (len > 0)
+    {
+        return len;
+    }
+    if (len == 0)
+    {
+        LOGE_LITEWS("connection closed by peer");
+        return -1; // a closed socket stays readable, it must not look like an empty one
+    }
+#if defined(LITEWS_OS_WINDOWS)
+    error_number = WSAGetLastError();
+    if (error_number == WSAEWOULDBLOCK)
+    {
+        return 0;
+    }
+#else
+    error_number = errno;
+    if (error_number == EAGAIN || error_number == EWOULDBLOCK || error_number == EINTR)
+    {
+        return 0;
+    }
+#endif
+    LOGE_LITEWS("recv failed [%d]", error_number);
+    return -1;
+}
+
+static int litews_transport_tcp_write(litews_socket s, const unsigned char * data, const size_t size)
+{
+    int sended = -1, error_number = -1;
+
+#if defined(LITEWS_OS_WINDOWS)
+    sended = send(s->socket, (const char *)data, size, 0);
+    error_number = WSAGetLastError();
+    if (sended < 0 && error_number == WSAEWOULDBLOCK)
+    {
+        return 0;
+    }
+#else
+    sended = (int)send(s->socket, data, (int)size, 0);
+    if (sended < 0)
+    {
+        error_number = errno;
+        if (error_number == EAGAIN || error_number == EWOULDBLOCK)
+        {
+            return 0;
+        }
+    }
+#endif
+    if (sended > 0)
+    {
+        return sended;
+    }
+    litews_socket_check_write_error(s, error_number);
+    return -1;
+}
+
+static int litews_transport_tcp_poll(litews_socket s)
+{
+    return 0; // nothing is buffered above the socket
+}
+
+static void litews_transport_tcp_close(litews_socket s)
+{
+    LITEWS_SOCK_CLOSE(s->socket);
+}
+
+static const litews_transport k_litews_transport_tcp =
+{
+    "tcp",
+    litews_transport_tcp_connect,
+    litews_transport_tcp_read,
+    litews_transport_tcp_write,
+    litews_transport_tcp_poll,
+    litews_transport_tcp_close
+};
+
+const litews_transport * litews_transport_tcp(void)
+{
+    return &k_litews_transport_tcp;
+}
+
+const litews_transport * litews_transport_default(void)
+{
+    const litews_transport * tls = litews_transport_tls();
+
+    return tls ? tls : &k_litews_transport_tcp;
+}
+
+// in-memory pipe, nothing but the websocket protocol itself runs: no name lookup, TCP, TLS or 'select'
+static litews_bool litews_transport_pipe_connect(litews_socket s)
+{
+    _litews_pipe * pipe = s->pipe;
+
+    if (!pipe || !pipe->peer)
+    {
+        LOGE_LITEWS("pipe transport without a peer");
+        return litews_false;
+    }
+    litews_mutex_lock(pipe->mutex);
+    pipe->head = 0;
+    pipe->len = 0; // left from the last link
+    pipe->is_open = litews_true;
+    litews_mutex_unlock(pipe->mutex);
+    return litews_true;
+}
+
+static int litews_transport_pipe_read(litews_socket s, unsigned char * buffer, const size_t size)
+{
+    _litews_pipe * pipe = s->pipe;
+    size_t len = 0;
+
+    litews_mutex_lock(pipe->mutex);
+    len = (pipe->len < size) ? pipe->len : size;
+    if (len > 0)
+    {
+        AG_OS_MEMCPY(buffer, pipe->data + pipe->head, len);
+        pipe->head += len;
+        pipe->len -= len;
+    }
+    litews_mutex_unlock(pipe->mutex);
+    return (int)len;
+}
+
+static int litews_transport_pipe_write(litews_socket s, const unsigned char * data, const size_t size)
+{
+    s->pipe->peer(s, data, (unsigned int)size); // may put the answer right away
+    return (int)size;
+}
+
+static int litews_transport_pipe_poll(litews_socket s)
+{
+    _litews_pipe * pipe = s->pipe;
+    int len = 0;
+
+    litews_mutex_lock(pipe->mutex);
+    len = (int)pipe->len;
+    litews_mutex_unlock(pipe->mutex);
+    return len;
+}
+
+static void litews_transport_pipe_close(litews_socket s)
+{
+    _litews_pipe * pipe = s->pipe;
+
+    litews_mutex_lock(pipe->mutex);
+    pipe->is_open = litews_false;
+    pipe->head = 0;
+    pipe->len = 0;
+    litews_mutex_unlock(pipe->mutex);
+}
+
+static const litews_transport k_litews_transport_pipe =
+{
+    "pipe",
+    litews_transport_pipe_connect,
+    litews_transport_pipe_read,
+    litews_transport_pipe_write,
+    litews_transport_pipe_poll,
+    litews_transport_pipe_close
+};
+
+const litews_transport * litews_transport_pipe(void)
+{
+    return &k_litews_transport_pipe;
+}
+
+void litews_transport_pipe_set_peer(litews_socket s, litews_on_pipe_written peer)
+{
+    if (!s->pipe)
+    {
+        s->pipe = (_litews_pipe *)litews_malloc_zero(sizeof(_litews_pipe));
+        s->pipe->mutex = litews_mutex_create_recursive();
+    }
+    s->pipe->peer = peer;
+}
+
+litews_bool litews_transport_pipe_put(litews_socket s, const void * data, const size_t len)
+{
+    _litews_pipe * pipe = s->pipe;
+    unsigned char * grown = NULL;
+    size_t size = 0;
+
+    if (!pipe)
+    {
+        return litews_false;
+    }
+
+    litews_mutex_lock(pipe->mutex);
+    if (!pipe->is_open)
+    {
+        litews_mutex_unlock(pipe->mutex);
+        return litews_false;
+    }
+    if (pipe->head + pipe->len + len > pipe->size)
+    {
+        if (pipe->len + len <= pipe->size)
+        {
+            memmove(pipe->data, pipe->data + pipe->head, pipe->len); // read bytes make room
+        }
+        else
+        {
+            size = (pipe->size > LITEWS_PIPE_MIN_SIZE) ? pipe->size : LITEWS_PIPE_MIN_SIZE;
+            while (size < pipe->len + len)
+            {
+                size *= 2;
+            }
+            grown = (unsigned char *)litews_malloc(size);
+            if (pipe->len > 0)
+            {
+                AG_OS_MEMCPY(grown, pipe->data + pipe->head, pipe->len);
+            }
+            litews_free(pipe->data);
+            pipe->data = grown;
+            pipe->size = size;
+        }
+        pipe->head = 0;
+    }
+    AG_OS_MEMCPY(pipe->data + pipe->head + pipe->len, data, len);
+    pipe->len += len;
+    litews_mutex_unlock(pipe->mutex);
+
+    litews_event_wakeup(s); // the work thread waits on its wakeup socket only
+    return litews_true;
+}
+
+void litews_transport_pipe_delete(litews_socket s)
+{
+    if (s->pipe)
+    {
+        litews_mutex_delete(s->pipe->mutex);
+        litews_free(s->pipe->data);
+        litews_free(s->pipe);
+        s->pipe = NULL;
+    }
+}
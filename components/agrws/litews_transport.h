@@ -0,0 +1,47 @@
+#ifndef __LITEWS_TRANSPORT_H__
+#define __LITEWS_TRANSPORT_H__ 1
+
+#include "litews_socket.h"
+
+#define LITEWS_CONNECT_RETRY_DELAY 200
+#define LITEWS_CONNECT_ATTEMPS 5
+
+// byte stream under the websocket protocol, chosen per socket by litews_socket_set_transport,
+// all but 'litews_socket_pipe_put' run on the work thread with the socket locked
+struct litews_transport_struct
+{
+    const char * name;
+
+    // open a link to 's->host':'s->port', set 's->socket' to what the work thread waits on,
+    // an in-memory link leaves it invalid; nothing is left open on failure
+    litews_bool (*connect)(litews_socket s);
+
+    // bytes read into 'buffer', 0 when there are none now, -1 when the peer closed the link or it failed
+    int (*read)(litews_socket s, unsigned char * buffer, const size_t size);
+
+    // bytes taken, 0 when it would block and the same bytes are offered again, -1 on error
+    int (*write)(litews_socket s, const unsigned char * data, const size_t size);
+
+    // bytes 'read' returns at once that don't make 's->socket' readable, e.g. decrypted or queued in memory
+    int (*poll)(litews_socket s);
+
+    // free the link, called once per successful connect
+    void (*close)(litews_socket s);
+};
+
+// TCP connection to 's->host':'s->port' over the cached and raced addresses, blocking mode,
+// LITEWS_INVALID_SOCKET if no address answered
+litews_socket_t litews_transport_tcp_open(litews_socket s);
+
+// TLS of the library built in, plain TCP without one
+const litews_transport * litews_transport_default(void);
+
+// in-memory pipe of 's', created by the first peer set, see litews_socket_set_pipe_peer
+void litews_transport_pipe_set_peer(litews_socket s, litews_on_pipe_written peer);
+
+// queue bytes for the socket to read and wake its work thread, litews_false while the pipe isn't connected
+litews_bool litews_transport_pipe_put(litews_socket s, const void * data, const size_t len);
+
+void litews_transport_pipe_delete(litews_socket s);
+
+#endif
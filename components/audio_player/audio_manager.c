@@ -220,6 +220,10 @@ esp_err_t audio_manager_ws_put_data(char *buffer, int buf_size) {
     return audio_player_ws_put_data(s_audio_manager_handle->tts_player_handle, buffer, buf_size);
 }
 
+esp_err_t audio_manager_ws_get_room(int *room) {
+    return audio_player_ws_get_room(s_audio_manager_handle->tts_player_handle, room);
+}
+
 esp_err_t audio_manager_ws_put_done() {
     return audio_palyer_ws_put_done(s_audio_manager_handle->tts_player_handle);
 }
@@ -815,6 +815,23 @@ esp_err_t audio_player_ws_put_data(audio_player_handle_t player_handle, char *bu
     return raw_stream_write(player_handle->source, buffer, buf_size);
 }
 
+esp_err_t audio_player_ws_get_room(audio_player_handle_t player_handle, int *room) {
+    ringbuf_handle_t rb = NULL;
+
+    *room = 0;
+    if(player_handle->src_type != ADUIO_SRC_WEBSOCKET) {
+        return ESP_FAIL;
+    }
+
+    rb = audio_element_get_output_ringbuf(player_handle->source);
+    if(rb == NULL) {
+        return ESP_FAIL;
+    }
+
+    *room = rb_bytes_available(rb);
+    return ESP_OK;
+}
+
 esp_err_t audio_palyer_ws_put_done(audio_player_handle_t player_handle) {
     if(player_handle->src_type != ADUIO_SRC_WEBSOCKET) {
         return ESP_FAIL;
@@ -37,6 +37,7 @@ esp_err_t audio_manager_wait_for_finish(audio_player_type_t type, TickType_t tic
 
 esp_err_t audio_manager_ws_put_data(char *buffer, int buf_size);
 esp_err_t audio_manager_ws_put_done();
+esp_err_t audio_manager_ws_get_room(int *room);
 
 void audio_manager_register_state_callback(audio_manager_state_callback state_callback);
 
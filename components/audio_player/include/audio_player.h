@@ -40,6 +40,7 @@ esp_err_t audio_player_pause(audio_player_handle_t player_handle);
 esp_err_t audio_player_wait_for_finish(audio_player_handle_t player_handle, TickType_t ticks_to_wait);
 
 esp_err_t audio_player_ws_put_data(audio_player_handle_t player_handle, char *buffer, int buf_size);
+esp_err_t audio_player_ws_get_room(audio_player_handle_t player_handle, int *room);
 esp_err_t audio_palyer_ws_put_done(audio_player_handle_t player_handle);
 
 #endif